@@ -0,0 +1,323 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "anonymizer.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "glog/logging.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+namespace coral {
+
+namespace {
+
+// sums[i] += row[i] for `n` bytes.
+void add_row(const uint8_t* row, int n, uint16_t* sums) {
+  int i = 0;
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= n; i += 16) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+    __m128i* s = reinterpret_cast<__m128i*>(sums + i);
+    _mm_storeu_si128(s, _mm_add_epi16(_mm_loadu_si128(s), _mm_unpacklo_epi8(v, zero)));
+    _mm_storeu_si128(s + 1, _mm_add_epi16(_mm_loadu_si128(s + 1), _mm_unpackhi_epi8(v, zero)));
+  }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  for (; i + 16 <= n; i += 16) {
+    const uint8x16_t v = vld1q_u8(row + i);
+    vst1q_u16(sums + i, vaddw_u8(vld1q_u16(sums + i), vget_low_u8(v)));
+    vst1q_u16(sums + i + 8, vaddw_u8(vld1q_u16(sums + i + 8), vget_high_u8(v)));
+  }
+#endif
+  for (; i < n; ++i) sums[i] += row[i];
+}
+
+// Adds up the RGBA sums of `count` pixels, channel by channel.
+void sum_pixels(const uint16_t* sums, int count, uint32_t total[4]) {
+  int i = 0;
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  __m128i acc = zero;
+  for (; i + 2 <= count; i += 2) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sums + i * 4));
+    acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+    acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+  }
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(total), acc);
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  uint32x4_t acc = vdupq_n_u32(0);
+  for (; i + 2 <= count; i += 2) {
+    const uint16x8_t v = vld1q_u16(sums + i * 4);
+    acc = vaddw_u16(vaddw_u16(acc, vget_low_u16(v)), vget_high_u16(v));
+  }
+  vst1q_u32(total, acc);
+#else
+  std::fill(total, total + 4, 0);
+#endif
+  for (; i < count; ++i) {
+    for (int c = 0; c < 4; ++c) total[c] += sums[i * 4 + c];
+  }
+}
+
+// Writes to out[r][4 * x] the RGBA sums of the pixels of rows[r] from
+// x - radius to x + radius, the first and last pixel repeated past the ends,
+// for two rows at once. The sums slide along the rows, one pixel in and one
+// out, the two rows sharing a vector so their chains of additions overlap.
+// They fit 16 bits, which wrap around in between.
+void sum_windows(
+    const uint8_t* const rows[2], int width, int radius, uint16_t* const out[2]) {
+  const auto at = [&](int r, int x) {
+    uint32_t pixel;
+    std::memcpy(&pixel, rows[r] + std::min(std::max(x, 0), width - 1) * 4, 4);
+    return pixel;
+  };
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  const auto load = [&](int x) {
+    const __m128i pixels = _mm_unpacklo_epi32(
+        _mm_cvtsi32_si128(static_cast<int>(at(0, x))),
+        _mm_cvtsi32_si128(static_cast<int>(at(1, x))));
+    return _mm_unpacklo_epi8(pixels, zero);
+  };
+  __m128i acc = zero;
+  for (int k = -radius; k <= radius; ++k) acc = _mm_add_epi16(acc, load(k));
+  for (int x = 0; x < width; ++x) {
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out[0] + x * 4), acc);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out[1] + x * 4), _mm_unpackhi_epi64(acc, acc));
+    acc = _mm_sub_epi16(_mm_add_epi16(acc, load(x + radius + 1)), load(x - radius));
+  }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  const auto load = [&](int x) {
+    const uint64_t pixels = static_cast<uint64_t>(at(1, x)) << 32 | at(0, x);
+    return vmovl_u8(vreinterpret_u8_u64(vcreate_u64(pixels)));
+  };
+  uint16x8_t acc = vdupq_n_u16(0);
+  for (int k = -radius; k <= radius; ++k) acc = vaddq_u16(acc, load(k));
+  for (int x = 0; x < width; ++x) {
+    vst1_u16(out[0] + x * 4, vget_low_u16(acc));
+    vst1_u16(out[1] + x * 4, vget_high_u16(acc));
+    acc = vsubq_u16(vaddq_u16(acc, load(x + radius + 1)), load(x - radius));
+  }
+#else
+  for (int r = 0; r < 2; ++r) {
+    uint16_t acc[4] = {0, 0, 0, 0};
+    const auto add = [&](int x, int sign) {
+      const uint32_t pixel = at(r, x);
+      for (int c = 0; c < 4; ++c) {
+        acc[c] += sign * static_cast<int>((pixel >> (8 * c)) & 0xff);
+      }
+    };
+    for (int k = -radius; k <= radius; ++k) add(k, 1);
+    for (int x = 0; x < width; ++x) {
+      std::memcpy(out[r] + x * 4, acc, sizeof(acc));
+      add(x + radius + 1, 1);
+      add(x - radius, -1);
+    }
+  }
+#endif
+}
+
+// sums[i] += in[i] - out[i] for `n` values, `out` may be null.
+void slide_sums(const uint16_t* in, const uint16_t* out, int n, uint32_t* sums) {
+  int i = 0;
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 8 <= n; i += 8) {
+    __m128i* s = reinterpret_cast<__m128i*>(sums + i);
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    __m128i lo = _mm_add_epi32(_mm_loadu_si128(s), _mm_unpacklo_epi16(a, zero));
+    __m128i hi = _mm_add_epi32(_mm_loadu_si128(s + 1), _mm_unpackhi_epi16(a, zero));
+    if (out) {
+      const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(out + i));
+      lo = _mm_sub_epi32(lo, _mm_unpacklo_epi16(b, zero));
+      hi = _mm_sub_epi32(hi, _mm_unpackhi_epi16(b, zero));
+    }
+    _mm_storeu_si128(s, lo);
+    _mm_storeu_si128(s + 1, hi);
+  }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  for (; i + 8 <= n; i += 8) {
+    const uint16x8_t a = vld1q_u16(in + i);
+    uint32x4_t lo = vaddw_u16(vld1q_u32(sums + i), vget_low_u16(a));
+    uint32x4_t hi = vaddw_u16(vld1q_u32(sums + i + 4), vget_high_u16(a));
+    if (out) {
+      const uint16x8_t b = vld1q_u16(out + i);
+      lo = vsubw_u16(lo, vget_low_u16(b));
+      hi = vsubw_u16(hi, vget_high_u16(b));
+    }
+    vst1q_u32(sums + i, lo);
+    vst1q_u32(sums + i + 4, hi);
+  }
+#endif
+  for (; i < n; ++i) sums[i] += in[i] - (out ? out[i] : 0);
+}
+
+// out[i] = round(sums[i] * scale) for `n` values.
+void write_scaled(const uint32_t* sums, int n, float scale, uint8_t* out) {
+  int i = 0;
+#if defined(__SSE2__)
+  const __m128 s = _mm_set1_ps(scale);
+  const __m128 half = _mm_set1_ps(0.5f);
+  const auto scaled = [&](int j) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sums + j));
+    return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(v), s), half));
+  };
+  for (; i + 16 <= n; i += 16) {
+    const __m128i lo = _mm_packs_epi32(scaled(i), scaled(i + 4));
+    const __m128i hi = _mm_packs_epi32(scaled(i + 8), scaled(i + 12));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(lo, hi));
+  }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  const float32x4_t half = vdupq_n_f32(0.5f);
+  const auto scaled = [&](int j) {
+    return vqmovn_u32(
+        vcvtq_u32_f32(vaddq_f32(vmulq_n_f32(vcvtq_f32_u32(vld1q_u32(sums + j)), scale), half)));
+  };
+  for (; i + 16 <= n; i += 16) {
+    const uint16x8_t lo = vcombine_u16(scaled(i), scaled(i + 4));
+    const uint16x8_t hi = vcombine_u16(scaled(i + 8), scaled(i + 12));
+    vst1q_u8(out + i, vcombine_u8(vqmovn_u16(lo), vqmovn_u16(hi)));
+  }
+#endif
+  for (; i < n; ++i) out[i] = static_cast<uint8_t>(sums[i] * scale + 0.5f);
+}
+
+}  // namespace
+
+bool parse_anonymize_method(const std::string& name, AnonymizeMethod* method) {
+  if (name == "fill") {
+    *method = AnonymizeMethod::kFill;
+  } else if (name == "pixelate") {
+    *method = AnonymizeMethod::kPixelate;
+  } else if (name == "blur") {
+    *method = AnonymizeMethod::kBlur;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void pixelate_region(
+    uint8_t* rgba, int stride, const BoundingBox& region, int block, AnonymizeScratch* scratch) {
+  if (region.width <= 0 || region.height <= 0) return;
+  block = std::min(std::max(block, 1), 255);
+  const int n = region.width * 4;
+  auto& sums = scratch->sums16;
+  sums.resize(n);
+  uint8_t* origin = rgba + region.ymin * stride + region.xmin * 4;
+  for (int y = 0; y < region.height; y += block) {
+    const int rows = std::min(block, region.height - y);
+    uint8_t* first = origin + y * stride;
+    // Column sums of the block row, at most 255 * 255.
+    std::fill(sums.begin(), sums.end(), 0);
+    for (int k = 0; k < rows; ++k) add_row(first + k * stride, n, sums.data());
+    for (int x = 0; x < region.width; x += block) {
+      const int cols = std::min(block, region.width - x);
+      uint32_t total[4];
+      sum_pixels(sums.data() + x * 4, cols, total);
+      const uint32_t count = rows * cols;
+      uint8_t color[4];
+      for (int c = 0; c < 4; ++c) color[c] = (total[c] + count / 2) / count;
+      for (int i = 0; i < cols; ++i) std::memcpy(first + (x + i) * 4, color, 4);
+    }
+    // The other rows of the block row are the same.
+    for (int k = 1; k < rows; ++k) std::memcpy(first + k * stride, first, n);
+  }
+}
+
+void blur_region(
+    uint8_t* rgba, int stride, const BoundingBox& region, int radius, AnonymizeScratch* scratch) {
+  if (region.width <= 0 || region.height <= 0) return;
+  radius = std::min(std::max(radius, 1), 127);
+  const int n = region.width * 4;
+  const int last = region.height - 1;
+  auto& rows = scratch->sums16;
+  auto& columns = scratch->sums32;
+  rows.resize(static_cast<size_t>(n) * region.height);
+  columns.assign(n, 0);
+  uint8_t* origin = rgba + region.ymin * stride + region.xmin * 4;
+  const auto row_sums = [&](int y) {
+    return &rows[static_cast<size_t>(std::min(std::max(y, 0), last)) * n];
+  };
+  // Sums along the rows first, then sums of those down the columns, which
+  // slide a row at a time and are written out as the average.
+  for (int y = 0; y < region.height; y += 2) {
+    // An odd last row is summed twice.
+    const int next = std::min(y + 1, last);
+    const uint8_t* const pair[2] = {origin + y * stride, origin + next * stride};
+    uint16_t* const sums[2] = {row_sums(y), row_sums(next)};
+    sum_windows(pair, region.width, radius, sums);
+  }
+  for (int k = -radius; k <= radius; ++k) slide_sums(row_sums(k), nullptr, n, columns.data());
+  const int side = 2 * radius + 1;
+  const float scale = 1.0f / (side * side);
+  for (int y = 0; y < region.height; ++y) {
+    write_scaled(columns.data(), n, scale, origin + y * stride);
+    slide_sums(row_sums(y + radius + 1), row_sums(y - radius), n, columns.data());
+  }
+}
+
+Anonymizer::Anonymizer(int num_streams, const AnonymizeOptions& options) : options_(options) {
+  CHECK(options_.method != AnonymizeMethod::kFill) << "The overlay fills the boxes";
+  CHECK_GT(options_.width, 0);
+  CHECK_GT(options_.height, 0);
+  CHECK_GT(options_.blocks, 0);
+  for (int i = 0; i < num_streams; ++i) streams_.emplace_back(new StreamState);
+}
+
+void Anonymizer::set_regions(int stream, const std::vector<BoundingBox>& regions) {
+  auto& state = *streams_[stream];
+  absl::MutexLock l(&state.lock);
+  state.regions = regions;
+}
+
+void Anonymizer::apply(int stream, uint8_t* rgba, int stride) {
+  // Kept per thread, like the rows of a resize, so the steady state doesn't
+  // allocate.
+  static thread_local std::vector<BoundingBox> applied;
+  static thread_local AnonymizeScratch scratch;
+  auto& state = *streams_[stream];
+  {
+    absl::MutexLock l(&state.lock);
+    applied = state.regions;
+  }
+  for (const auto& box : applied) {
+    const int dx = box.width * options_.margin;
+    const int dy = box.height * options_.margin;
+    const int x1 = std::max(box.xmin - dx, 0);
+    const int y1 = std::max(box.ymin - dy, 0);
+    const int x2 = std::min(box.xmax + dx, options_.width);
+    const int y2 = std::min(box.ymax + dy, options_.height);
+    if (x2 <= x1 || y2 <= y1) continue;
+    const BoundingBox region(y1, x1, y2, x2);
+    // Blocks scale with the region, so near and far workers are as hard to
+    // recognize.
+    const int block =
+        std::min(std::max(std::min(region.width, region.height) / options_.blocks, 2), 255);
+    if (options_.method == AnonymizeMethod::kPixelate) {
+      pixelate_region(rgba, stride, region, block, &scratch);
+    } else {
+      blur_region(rgba, stride, region, block / 2, &scratch);
+    }
+  }
+}
+
+}  // namespace coral
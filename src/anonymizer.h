@@ -0,0 +1,111 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MANUFACTURING_DEMO_ANONYMIZER_H_
+#define MANUFACTURING_DEMO_ANONYMIZER_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "image_utils.h"
+
+namespace coral {
+
+// How detected workers are hidden.
+enum class AnonymizeMethod {
+  // Opaque boxes drawn by the overlay, over the mixed video with the SVG one.
+  kFill,
+  // Each region is replaced by blocks of its average color.
+  kPixelate,
+  // Each region is box blurred.
+  kBlur,
+};
+
+// Parses "fill", "pixelate" or "blur" into `method`. Returns false on an
+// unknown name.
+bool parse_anonymize_method(const std::string& name, AnonymizeMethod* method);
+
+// Rows of running sums kept between regions, so the steady state doesn't
+// allocate.
+struct AnonymizeScratch {
+  std::vector<uint16_t> sums16;
+  std::vector<uint32_t> sums32;
+};
+
+// Both kernels work on a `region` of packed RGBA pixels, rows `stride` bytes
+// apart, in place. They are separable, summing columns and rows in separate
+// passes, and keep running sums, so a pixel costs the same whatever the size
+// of the blocks or the blur. Sums are taken on 16 byte vectors with SSE2 or
+// NEON.
+
+// Replaces every `block` x `block` square of `region`, from its top left
+// corner, with its average color. `block` is at most 255.
+void pixelate_region(
+    uint8_t* rgba, int stride, const BoundingBox& region, int block, AnonymizeScratch* scratch);
+// Replaces every pixel of `region` with the average of the square of side
+// 2 * `radius` + 1 around it, the edges of the region repeated outwards.
+// `radius` is at most 127.
+void blur_region(
+    uint8_t* rgba, int stride, const BoundingBox& region, int radius, AnonymizeScratch* scratch);
+
+struct AnonymizeOptions {
+  AnonymizeMethod method = AnonymizeMethod::kPixelate;
+  // Size of the frames of every stream.
+  int width = 0;
+  int height = 0;
+  // Regions are cut into about this many blocks across their shorter side,
+  // a blur averages over squares as wide as one.
+  int blocks = 8;
+  // Regions grow by this fraction of their size on every side, covering
+  // workers that moved since they were detected.
+  float margin = 0.1f;
+};
+
+// Hides the regions last detected in each stream in every frame it
+// displays or records, before the frames are mixed or encoded, so no
+// consumer of the video sees them. Each stream has a lock of its own, held
+// only while its regions are replaced or copied out.
+class Anonymizer {
+public:
+  Anonymizer(int num_streams, const AnonymizeOptions& options);
+  Anonymizer(const Anonymizer&) = delete;
+  Anonymizer& operator=(const Anonymizer&) = delete;
+
+  // Replaces the regions hidden in the frames of `stream`, in frame pixels.
+  // Thread safe.
+  void set_regions(int stream, const std::vector<BoundingBox>& regions);
+  // Hides the regions of `stream` in a packed RGBA frame of the configured
+  // size. Thread safe, each branch of a stream calls it from its own thread.
+  void apply(int stream, uint8_t* rgba, int stride);
+  int get_width() const { return options_.width; }
+  int get_height() const { return options_.height; }
+
+private:
+  struct StreamState {
+    absl::Mutex lock;
+    std::vector<BoundingBox> regions GUARDED_BY(lock);
+  };
+
+  const AnonymizeOptions options_;
+  std::vector<std::unique_ptr<StreamState>> streams_;
+};
+
+}  // namespace coral
+
+#endif  // MANUFACTURING_DEMO_ANONYMIZER_H_
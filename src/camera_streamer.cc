@@ -14,6 +14,8 @@
 
 #include "camera_streamer.h"
 
+#include <chrono>
+
 #include "absl/strings/str_format.h"
 #include "absl/strings/substitute.h"
 #include "glog/logging.h"
@@ -22,27 +24,69 @@ namespace coral {
 
 namespace {
 
-GstFlowReturn on_new_sample(GstElement* sink, void* data) {
-  GstSample* sample;
-  GstFlowReturn retval = GST_FLOW_OK;
+constexpr guint kStatsIntervalSeconds = 10;
+// A burst of drops longer than this is recorded in pieces of this length.
+constexpr int64_t kDropRecordIntervalNs = 1000000000;
 
-  g_signal_emit_by_name(sink, "pull-sample", &sample);
-  if (sample) {
-    GstMapInfo info;
-    auto buf = gst_sample_get_buffer(sample);
-    if (gst_buffer_map(buf, &info, GST_MAP_READ) == TRUE) {
-      auto cb_data = reinterpret_cast<CameraStreamer::CallbackData*>(data);
-      // Pass the frame to the user callback
-      cb_data->cb(cb_data->svg_gen, info.data, info.size);
-    } else {
-      LOG(ERROR) << "Couldn't get buffer info";
-      retval = GST_FLOW_ERROR;
-    }
+// Asks upstream elements to allocate frames with the alignment the
+// interpreter needs to use them as input tensors without a copy.
+GstPadProbeReturn on_appsink_query(GstPad* pad, GstPadProbeInfo* info, gpointer data) {
+  GstQuery* query = GST_PAD_PROBE_INFO_QUERY(info);
+  if (GST_QUERY_TYPE(query) == GST_QUERY_ALLOCATION) {
+    GstAllocationParams params;
+    gst_allocation_params_init(&params);
+    params.align = kInputAlignment - 1;
+    gst_query_add_allocation_param(query, nullptr, &params);
+  }
+  return GST_PAD_PROBE_OK;
+}
 
-    gst_buffer_unmap(buf, &info);
-    gst_sample_unref(sample);
+// Describes the mapped planes of `frame`. Returns false on a format the
+// converter doesn't take.
+bool get_yuv_image(GstVideoFrame* frame, YuvImage* image) {
+  switch (GST_VIDEO_FRAME_FORMAT(frame)) {
+    case GST_VIDEO_FORMAT_NV12:
+      image->format = PixelFormat::kNv12;
+      break;
+    case GST_VIDEO_FORMAT_I420:
+      image->format = PixelFormat::kI420;
+      break;
+    case GST_VIDEO_FORMAT_YUY2:
+      image->format = PixelFormat::kYuy2;
+      break;
+    default:
+      return false;
   }
-  return retval;
+  image->matrix = GST_VIDEO_INFO_COLORIMETRY(&frame->info).matrix == GST_VIDEO_COLOR_MATRIX_BT709
+                      ? YuvMatrix::kBt709
+                      : YuvMatrix::kBt601;
+  image->width = GST_VIDEO_FRAME_WIDTH(frame);
+  image->height = GST_VIDEO_FRAME_HEIGHT(frame);
+  const int planes = image->format == PixelFormat::kI420   ? 3
+                     : image->format == PixelFormat::kNv12 ? 2
+                                                           : 1;
+  for (int i = 0; i < 3; ++i) {
+    image->planes[i] =
+        i < planes ? static_cast<const uint8_t*>(GST_VIDEO_FRAME_PLANE_DATA(frame, i)) : nullptr;
+    image->strides[i] = i < planes ? GST_VIDEO_FRAME_PLANE_STRIDE(frame, i) : 0;
+  }
+  return true;
+}
+
+// Records how long after its capture timestamp `sample` reached `sink`, in
+// running time. Only live sources stamp buffers at capture, files are
+// decoded ahead of their timestamps and record nothing.
+void record_capture_latency(GstElement* sink, GstSample* sample, LatencyHistogram* histogram) {
+  GstBuffer* buffer = gst_sample_get_buffer(sample);
+  GstSegment* segment = gst_sample_get_segment(sample);
+  if (!buffer || !segment || !GST_CLOCK_TIME_IS_VALID(GST_BUFFER_PTS(buffer))) return;
+  GstClock* clock = gst_element_get_clock(sink);
+  if (!clock) return;
+  const GstClockTime now = gst_clock_get_time(clock) - gst_element_get_base_time(sink);
+  gst_object_unref(clock);
+  const GstClockTime captured =
+      gst_segment_to_running_time(segment, GST_FORMAT_TIME, GST_BUFFER_PTS(buffer));
+  if (GST_CLOCK_TIME_IS_VALID(captured) && now >= captured) histogram->record(now - captured);
 }
 
 gboolean on_bus_message(GstBus* bus, GstMessage* msg, gpointer data) {
@@ -78,50 +122,319 @@ gboolean on_bus_message(GstBus* bus, GstMessage* msg, gpointer data) {
 
 }  // namespace
 
-void CameraStreamer::prepare_appsink(
-    GstElement* pipeline, const std::string name, CallbackData* callback_data) {
+void CameraStreamer::prepare_appsink(GstElement* pipeline, Stream* stream) {
   // Set up an appsink to pass frames to a user callback
   auto appsink = gst_bin_get_by_name(
-      reinterpret_cast<GstBin*>(pipeline), absl::StrCat("appsink_", name).c_str());
+      reinterpret_cast<GstBin*>(pipeline), absl::StrCat("appsink_", stream->name).c_str());
   CHECK_NOTNULL(appsink);
 
   g_object_set(appsink, "emit-signals", true, nullptr);
-  g_signal_connect(
-      appsink, "new-sample", reinterpret_cast<GCallback>(on_new_sample), callback_data);
+  g_signal_connect(appsink, "new-sample", reinterpret_cast<GCallback>(on_new_sample), stream);
+
+  auto sink_pad = gst_element_get_static_pad(appsink, "sink");
+  CHECK_NOTNULL(sink_pad);
+  gst_pad_add_probe(
+      sink_pad, GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM, on_appsink_query, nullptr, nullptr);
+  gst_object_unref(sink_pad);
+  gst_object_unref(appsink);
+}
+
+void CameraStreamer::prepare_display(GstElement* pipeline, Stream* stream) {
+  // Draws the overlay into every frame of the stream on its way to display.
+  auto element = gst_bin_get_by_name(
+      reinterpret_cast<GstBin*>(pipeline), absl::StrCat("overlay_", stream->name).c_str());
+  CHECK_NOTNULL(element);
+  auto src_pad = gst_element_get_static_pad(element, "src");
+  CHECK_NOTNULL(src_pad);
+  gst_pad_add_probe(src_pad, GST_PAD_PROBE_TYPE_BUFFER, on_display_buffer, stream, nullptr);
+  gst_object_unref(src_pad);
+  gst_object_unref(element);
 }
 
-void CameraStreamer::run_pipeline(
-    const gchar* pipeline_string, CallbackData safety_callback_data,
-    CallbackData inspection_callback_data) {
+GstFlowReturn CameraStreamer::on_new_sample(GstElement* sink, void* data) {
+  auto stream = reinterpret_cast<Stream*>(data);
+  GstSample* sample;
+  g_signal_emit_by_name(sink, "pull-sample", &sample);
+  if (!sample) return GST_FLOW_OK;
+  stream->stats.captured->add();
+  record_capture_latency(sink, sample, stream->stats.capture);
+
+  // Only hand the sample over, the callback runs on the stream worker.
+  QueuedSample queued{sample, now_ns()};
+  bool dropped = false;
+  switch (stream->policy) {
+    case DropPolicy::kDropNewest:
+      if (!stream->ring->try_push(queued)) {
+        gst_sample_unref(sample);
+        record_drop(stream, queued.queued_ns);
+        dropped = true;
+      }
+      break;
+    case DropPolicy::kDropOldest:
+      while (!stream->ring->try_push(queued)) {
+        QueuedSample oldest;
+        if (stream->ring->try_pop(&oldest)) {
+          gst_sample_unref(oldest.sample);
+          record_drop(stream, queued.queued_ns);
+          dropped = true;
+        }
+      }
+      break;
+    case DropPolicy::kBlock:
+      if (!stream->ring->push(queued)) {
+        gst_sample_unref(sample);
+        return GST_FLOW_FLUSHING;
+      }
+      break;
+  }
+  // A frame queued without a drop ends the burst.
+  if (!dropped) flush_drops(stream);
+  return GST_FLOW_OK;
+}
+
+void CameraStreamer::record_drop(Stream* stream, int64_t now) {
+  stream->stats.dropped->add();
+  if (!stream->events) return;
+  if (stream->pending_drops++ == 0) stream->pending_since_ns = now;
+  if (now - stream->pending_since_ns >= kDropRecordIntervalNs) flush_drops(stream);
+}
+
+void CameraStreamer::flush_drops(Stream* stream) {
+  if (stream->pending_drops == 0) return;
+  Event event{EventType::kFrameDropped, stream->index};
+  event.frame = stream->stats.captured->value();
+  event.id = static_cast<int>(stream->pending_drops);
+  stream->events->record(event);
+  stream->pending_drops = 0;
+}
+
+GstPadProbeReturn CameraStreamer::on_display_buffer(
+    GstPad* pad, GstPadProbeInfo* info, gpointer data) {
+  auto stream = reinterpret_cast<Stream*>(data);
+  // Copies the buffer only if another branch still reads it.
+  GstBuffer* buffer = gst_buffer_make_writable(GST_PAD_PROBE_INFO_BUFFER(info));
+  GST_PAD_PROBE_INFO_DATA(info) = buffer;
+  GstMapInfo map;
+  if (!gst_buffer_map(buffer, &map, GST_MAP_WRITE)) {
+    LOG(ERROR) << "Couldn't map " << stream->name << " frame for the overlay";
+    return GST_PAD_PROBE_OK;
+  }
+  // Rows of packed RGBA are never padded.
+  const int width = stream->native_overlay->get_width();
+  stream->native_overlay->draw(stream->index, map.data, width * 4);
+  gst_buffer_unmap(buffer, &map);
+  return GST_PAD_PROBE_OK;
+}
+
+void CameraStreamer::prepare_anonymize(GstElement* pipeline, Stream* stream) {
+  // The display branch and the clip branch each have their own element.
+  // Streams with nothing to hide have neither.
+  for (const char* prefix : {"anon_", "anon_clip_"}) {
+    auto element = gst_bin_get_by_name(
+        reinterpret_cast<GstBin*>(pipeline), absl::StrCat(prefix, stream->name).c_str());
+    if (!element) continue;
+    stream->anonymizer = anonymizer_;
+    auto src_pad = gst_element_get_static_pad(element, "src");
+    CHECK_NOTNULL(src_pad);
+    gst_pad_add_probe(src_pad, GST_PAD_PROBE_TYPE_BUFFER, on_anonymize_buffer, stream, nullptr);
+    gst_object_unref(src_pad);
+    gst_object_unref(element);
+  }
+}
+
+GstPadProbeReturn CameraStreamer::on_anonymize_buffer(
+    GstPad* pad, GstPadProbeInfo* info, gpointer data) {
+  auto stream = reinterpret_cast<Stream*>(data);
+  GstBuffer* buffer = gst_buffer_make_writable(GST_PAD_PROBE_INFO_BUFFER(info));
+  GST_PAD_PROBE_INFO_DATA(info) = buffer;
+  GstMapInfo map;
+  if (!gst_buffer_map(buffer, &map, GST_MAP_WRITE)) {
+    LOG(ERROR) << "Couldn't map " << stream->name << " frame to anonymize";
+    return GST_PAD_PROBE_OK;
+  }
+  // Rows of packed RGBA are never padded.
+  stream->anonymizer->apply(stream->index, map.data, stream->anonymizer->get_width() * 4);
+  gst_buffer_unmap(buffer, &map);
+  return GST_PAD_PROBE_OK;
+}
+
+Frame CameraStreamer::convert_sample(
+    Stream* stream, const IngestOptions& ingest_options, GstSample* sample, uint64_t seq) {
+  ScopedLatency latency(stream->stats.convert);
+  Frame frame;
+  GstCaps* caps = gst_sample_get_caps(sample);
+  GstBuffer* buffer = gst_sample_get_buffer(sample);
+  if (caps && caps != stream->caps) {
+    // Caps only change on renegotiation, parsing them every frame would be a waste.
+    if (stream->caps) gst_caps_unref(stream->caps);
+    stream->caps = nullptr;
+    if (gst_video_info_from_caps(&stream->video_info, caps)) stream->caps = gst_caps_ref(caps);
+  }
+  GstVideoFrame video;
+  if (buffer && stream->caps &&
+      gst_video_frame_map(&video, &stream->video_info, buffer, GST_MAP_READ)) {
+    YuvImage image;
+    uint8_t* pixels = nullptr;
+    if (!get_yuv_image(&video, &image)) {
+      LOG_FIRST_N(ERROR, 1) << stream->name << ": can't convert frames of format "
+                            << GST_VIDEO_FRAME_FORMAT(&video);
+    } else if ((pixels = stream->pool->acquire()) != nullptr) {
+      yuv_to_rgb_resize(image, ingest_options.dims, pixels, ingest_options.letterbox);
+      frame = Frame(stream->pool, pixels, seq);
+      if (ingest_options.letterbox) {
+        const auto box = get_letterbox(image.width, image.height, ingest_options.dims);
+        ContentRect content;
+        content.xmin = static_cast<float>(box.x) / ingest_options.dims[1];
+        content.ymin = static_cast<float>(box.y) / ingest_options.dims[0];
+        content.xmax = static_cast<float>(box.x + box.width) / ingest_options.dims[1];
+        content.ymax = static_cast<float>(box.y + box.height) / ingest_options.dims[0];
+        frame.set_content(content);
+      }
+    }
+    gst_video_frame_unmap(&video);
+  }
+  gst_sample_unref(sample);
+  return frame;
+}
+
+void CameraStreamer::run_worker(Stream* stream, const IngestOptions* ingest_options) {
+  QueuedSample queued;
+  while (stream->ring->pop(&queued)) {
+    stream->stats.queue_wait->record(now_ns() - queued.queued_ns);
+    const uint64_t seq = stream->next_seq++;
+    Frame frame = stream->pool ? convert_sample(stream, *ingest_options, queued.sample, seq)
+                               : Frame(queued.sample, seq);
+    if (!frame.valid()) {
+      LOG(ERROR) << "Couldn't get buffer info";
+      continue;
+    }
+    // Pass the frame to the user callback
+    stream->callback_data->cb(stream->callback_data->overlay, std::move(frame));
+    stream->stats.processed->add();
+  }
+}
+
+gboolean CameraStreamer::log_stats(gpointer data) {
+  auto streamer = reinterpret_cast<CameraStreamer*>(data);
+  for (const auto& stream : streamer->streams_) {
+    LOG(INFO) << stream->name << ": captured " << stream->stats.captured->value()
+              << ", dropped " << stream->stats.dropped->value() << ", processed "
+              << stream->stats.processed->value()
+              << ", queued " << stream->ring->size() << "/" << stream->ring->capacity();
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+CameraStreamer::~CameraStreamer() {
+  if (pipeline_) gst_object_unref(pipeline_);
+}
+
+void CameraStreamer::parse_pipeline(const gchar* pipeline_string) {
   gst_init(nullptr, nullptr);
+  if (pipeline_) gst_object_unref(pipeline_);
   // Set up a pipeline based on the pipeline string
+  pipeline_ = gst_parse_launch(pipeline_string, nullptr);
+  CHECK_NOTNULL(pipeline_);
+}
+
+void CameraStreamer::run_pipeline(std::vector<CallbackData> callback_data) {
+  CHECK(pipeline_) << "parse_pipeline() must come first";
+  GstElement* pipeline = pipeline_;
+  pipeline_ = nullptr;
   auto loop = g_main_loop_new(nullptr, FALSE);
   CHECK_NOTNULL(loop);
-  auto pipeline = gst_parse_launch(pipeline_string, nullptr);
-  CHECK_NOTNULL(pipeline);
-
-  GstElement* rsvg = gst_bin_get_by_name(GST_BIN(pipeline), "rsvg");
-  CHECK_NOTNULL(rsvg);
-  SvgGenerator svg_gen(rsvg);
-  safety_callback_data.svg_gen = &svg_gen;
-  inspection_callback_data.svg_gen = &svg_gen;
 
+  std::unique_ptr<Overlay> overlay;
+  NativeOverlay* native_overlay = nullptr;
+  GstElement* rsvg = nullptr;
+  switch (overlay_options_.type) {
+    case OverlayType::kSvg:
+      rsvg = gst_bin_get_by_name(GST_BIN(pipeline), "rsvg");
+      CHECK_NOTNULL(rsvg);
+      overlay.reset(new SvgGenerator(rsvg, overlay_options_));
+      break;
+    case OverlayType::kNative:
+      native_overlay = new NativeOverlay(overlay_options_);
+      overlay.reset(native_overlay);
+      break;
+    case OverlayType::kNone:
+      overlay.reset(new NullOverlay);
+      break;
+  }
   // Prepare each appsink, ensuring the right frames reach their callback.
-  prepare_appsink(pipeline, coral::kWorkerSafety, &safety_callback_data);
-  prepare_appsink(pipeline, coral::kVisualInspection, &inspection_callback_data);
+  for (auto& data : callback_data) {
+    data.overlay = overlay.get();
+    std::unique_ptr<Stream> stream(new Stream);
+    stream->name = data.name;
+    stream->index = streams_.size();
+    stream->callback_data = &data;
+    stream->policy = queue_options_.policy;
+    stream->events = events_;
+    stream->ring.reset(new FrameRing<QueuedSample>(queue_options_.capacity));
+    const std::string labels = absl::StrFormat("stream=\"%s\"", stream->name);
+    stream->stats.captured = metrics_->get_counter(
+        "coral_frames_captured_total", "Frames that reached the appsink of a stream.", labels);
+    stream->stats.dropped = metrics_->get_counter(
+        "coral_frames_dropped_total", "Frames dropped from a full stream queue.", labels);
+    stream->stats.processed = metrics_->get_counter(
+        "coral_frames_processed_total", "Frames the callback of a stream has finished.", labels);
+    stream->stats.capture = metrics_->get_stage_latency(stream->name, "capture");
+    stream->stats.queue_wait = metrics_->get_stage_latency(stream->name, "queue_wait");
+    stream->stats.convert = metrics_->get_stage_latency(stream->name, "convert");
+    if (ingest_options_.convert) {
+      const auto& dims = ingest_options_.dims;
+      stream->pool = std::make_shared<FrameBufferPool>(
+          static_cast<size_t>(dims[0]) * dims[1] * dims[2], kInputAlignment);
+    }
+    prepare_appsink(pipeline, stream.get());
+    if (anonymizer_) prepare_anonymize(pipeline, stream.get());
+    if (native_overlay) {
+      stream->native_overlay = native_overlay;
+      prepare_display(pipeline, stream.get());
+    }
+    stream->worker = std::thread(&CameraStreamer::run_worker, stream.get(), &ingest_options_);
+    streams_.push_back(std::move(stream));
+  }
+  if (clips_) clips_->attach(pipeline);
 
   // Add a bus watcher. It's safe to unref the bus immediately after
   auto bus = gst_element_get_bus(pipeline);
   CHECK_NOTNULL(bus);
   gst_bus_add_watch(bus, on_bus_message, loop);
   gst_object_unref(bus);
+  // Periodically shows whether the streams keep up with their inputs.
+  g_timeout_add_seconds(kStatsIntervalSeconds, log_stats, this);
 
   // Start the pipeline, runs until interrupted, EOS or error
-  gst_element_set_state(pipeline, GST_STATE_PLAYING);
+  const auto start = std::chrono::steady_clock::now();
+  if (gst_element_set_state(pipeline, GST_STATE_PLAYING) != GST_STATE_CHANGE_FAILURE &&
+      on_playing_) {
+    on_playing_();
+  }
   g_main_loop_run(loop);
 
-  // Cleanup
+  // Cleanup. Closing the rings first releases appsinks blocked on a full
+  // queue, otherwise the state change would wait for them forever.
+  for (auto& stream : streams_) stream->ring->close();
   gst_element_set_state(pipeline, GST_STATE_NULL);
+  for (auto& stream : streams_) {
+    flush_drops(stream.get());
+    stream->worker.join();
+    if (stream->callback_data->on_stop) stream->callback_data->on_stop();
+    QueuedSample queued;
+    while (stream->ring->try_pop(&queued)) gst_sample_unref(queued.sample);
+    if (stream->caps) gst_caps_unref(stream->caps);
+  }
+  log_stats(this);
+  // Without a display to pace them, this is how fast the streams are processed.
+  const double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  for (const auto& stream : streams_) {
+    LOG(INFO) << stream->name << ": " << stream->stats.processed->value() / seconds
+              << " frames/s processed over " << seconds << " s";
+  }
+  streams_.clear();
+  if (rsvg) gst_object_unref(rsvg);
   gst_object_unref(pipeline);
 }
 
@@ -19,37 +19,176 @@
 
 #include <glib.h>
 #include <gst/gst.h>
+#include <gst/video/video.h>
 
+#include <atomic>
 #include <functional>
 #include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
+#include "anonymizer.h"
+#include "clip_recorder.h"
+#include "event_log.h"
+#include "frame.h"
+#include "frame_ring.h"
+#include "image_utils.h"
 #include "inference_wrapper.h"
 #include "keepout_shape.h"
+#include "metrics.h"
+#include "overlay.h"
 #include "svg_generator.h"
 
 namespace coral {
 
-const std::string kVisualInspection = "inspection";
-const std::string kWorkerSafety = "safety";
+// Bounds the frames queued between an appsink and its callback.
+struct FrameQueueOptions {
+  size_t capacity = 2;
+  DropPolicy policy = DropPolicy::kDropOldest;
+};
+
+// How frames get from the appsinks to the callbacks.
+struct IngestOptions {
+  // If set, appsinks take NV12, I420 or YUY2 frames at any size and the
+  // stream workers convert and resize them to RGB `dims` in one pass,
+  // instead of the pipeline scaling and converting them to RGB.
+  bool convert = false;
+  ImageDims dims{};
+  // Keeps the aspect ratio of converted frames, the borders are black.
+  bool letterbox = false;
+};
 
 class CameraStreamer {
 public:
   CameraStreamer() = default;
-  virtual ~CameraStreamer() = default;
+  // Stream metrics go to `metrics` if set, which must outlive the streamer.
+  explicit CameraStreamer(
+      const FrameQueueOptions& queue_options, const OverlayOptions& overlay_options = {},
+      MetricsRegistry* metrics = nullptr, const IngestOptions& ingest_options = {})
+      : queue_options_(queue_options),
+        overlay_options_(overlay_options),
+        ingest_options_(ingest_options),
+        owned_metrics_(metrics ? nullptr : new MetricsRegistry),
+        metrics_(metrics ? metrics : owned_metrics_.get()) {}
+  virtual ~CameraStreamer();
   CameraStreamer(const CameraStreamer&) = delete;
   CameraStreamer& operator=(const CameraStreamer&) = delete;
-  // handle to gstreamer rsvgoverlay module, used by callbacks
+  // The overlay is set up by run_pipeline() and handed to the callbacks.
   struct CallbackData {
-    SvgGenerator* svg_gen;
-    std::function<void(SvgGenerator*, uint8_t*, int)> cb;
+    // Frames come from the appsink named "appsink_<name>".
+    std::string name;
+    Overlay* overlay;
+    std::function<void(Overlay*, Frame)> cb;
+    // Called once the worker of the stream has stopped, while the overlay is
+    // still alive, to finish work `cb` handed to threads of its own.
+    std::function<void()> on_stop;
+  };
+  // Records the frames dropped from a stream queue into `events`, an event
+  // per burst of drops with their number, or per second of a longer burst.
+  // `events` must outlive the streamer. Only before run_pipeline().
+  void set_event_log(EventLog* events) { events_ = events; }
+  // Feeds the "clip_<name>" appsinks of the pipeline into `clips`, which must
+  // outlive the pipeline. Only before run_pipeline().
+  void set_clip_recorder(ClipRecorder* clips) { clips_ = clips; }
+  // Hides regions with `anonymizer` in the RGBA frames passing the elements
+  // "anon_<name>" and "anon_clip_<name>" of each stream that has them, on
+  // their way to display and to the clip encoder.
+  // `anonymizer` must outlive the streamer. Only before run_pipeline().
+  void set_anonymizer(Anonymizer* anonymizer) { anonymizer_ = anonymizer; }
+  // Called by run_pipeline() once setting the pipeline to playing returns,
+  // before the main loop runs. A pipeline that prerolls asynchronously may
+  // still be completing the change. Only before run_pipeline().
+  void set_on_playing(std::function<void()> on_playing) { on_playing_ = std::move(on_playing); }
+  // Parses `pipeline_string` into the pipeline run_pipeline() plays. This
+  // loads the plugins and builds every element, which is worth overlapping
+  // with building the interpreters.
+  void parse_pipeline(const gchar* pipeline_string);
+  // Run the parsed pipeline with a callback per stream, the index of a stream
+  // in `callback_data` being its overlay stream id. Each callback runs on a
+  // worker thread of its own, fed from a bounded frame queue, so slow
+  // inference never stalls the GStreamer streaming threads. The SVG overlay
+  // needs an rsvgoverlay named "rsvg", the native one an element named
+  // "overlay_<stream name>" passing the RGBA frames of each stream to display.
+  void run_pipeline(std::vector<CallbackData> callback_data);
+  // Parses and runs `pipeline_string`.
+  void run_pipeline(const gchar* pipeline_string, std::vector<CallbackData> callback_data) {
+    parse_pipeline(pipeline_string);
+    run_pipeline(std::move(callback_data));
+  }
+
+  // Frame counters and latencies of a stream, updated without locks.
+  struct StreamStats {
+    Counter* captured;
+    Counter* dropped;
+    Counter* processed;
+    // From the capture timestamp of a frame to its arrival in the appsink,
+    // for live sources.
+    LatencyHistogram* capture;
+    // From the appsink to the start of the callback.
+    LatencyHistogram* queue_wait;
+    // Converting a YUV frame to the RGB callback input, if the streamer does.
+    LatencyHistogram* convert;
   };
-  // Run pipeline with userdata and a callback function.
-  void run_pipeline(
-      const gchar* pipeline_string, CallbackData safety_callback_data,
-      CallbackData inspection_callback_data);
 
 private:
-  void prepare_appsink(GstElement* pipeline, const std::string name, CallbackData* callback_data);
+  // A sample waiting for the stream worker.
+  struct QueuedSample {
+    GstSample* sample;
+    int64_t queued_ns;
+  };
+  // An appsink, its frame queue and the worker running its callback.
+  struct Stream {
+    std::string name;
+    // Overlay stream id.
+    int index;
+    CallbackData* callback_data;
+    NativeOverlay* native_overlay = nullptr;
+    Anonymizer* anonymizer = nullptr;
+    DropPolicy policy;
+    EventLog* events = nullptr;
+    // Drops of the current burst not recorded yet, and when the first of
+    // them happened. Touched by the appsink thread only.
+    uint32_t pending_drops = 0;
+    int64_t pending_since_ns = 0;
+    std::unique_ptr<FrameRing<QueuedSample>> ring;
+    // Buffers of converted frames and the layout of the last caps converted
+    // from, only when the streamer converts.
+    std::shared_ptr<FrameBufferPool> pool;
+    GstCaps* caps = nullptr;
+    GstVideoInfo video_info;
+    StreamStats stats;
+    std::atomic<uint64_t> next_seq{0};
+    std::thread worker;
+  };
+
+  void prepare_appsink(GstElement* pipeline, Stream* stream);
+  void prepare_display(GstElement* pipeline, Stream* stream);
+  void prepare_anonymize(GstElement* pipeline, Stream* stream);
+  static GstFlowReturn on_new_sample(GstElement* sink, void* data);
+  static void record_drop(Stream* stream, int64_t now);
+  static void flush_drops(Stream* stream);
+  static GstPadProbeReturn on_display_buffer(GstPad* pad, GstPadProbeInfo* info, gpointer data);
+  static GstPadProbeReturn on_anonymize_buffer(
+      GstPad* pad, GstPadProbeInfo* info, gpointer data);
+  static void run_worker(Stream* stream, const IngestOptions* ingest_options);
+  static Frame convert_sample(
+      Stream* stream, const IngestOptions& ingest_options, GstSample* sample, uint64_t seq);
+  static gboolean log_stats(gpointer data);
+
+  FrameQueueOptions queue_options_;
+  OverlayOptions overlay_options_;
+  IngestOptions ingest_options_;
+  std::unique_ptr<MetricsRegistry> owned_metrics_;
+  MetricsRegistry* metrics_;
+  EventLog* events_ = nullptr;
+  ClipRecorder* clips_ = nullptr;
+  Anonymizer* anonymizer_ = nullptr;
+  std::function<void()> on_playing_;
+  std::vector<std::unique_ptr<Stream>> streams_;
+  // Set by parse_pipeline(), released once run.
+  GstElement* pipeline_ = nullptr;
 };
 
 }  // namespace coral
@@ -0,0 +1,416 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "clip_recorder.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/time/time.h"
+#include "glog/logging.h"
+
+namespace coral {
+
+namespace {
+
+constexpr int64_t kNanosPerSecond = 1000000000;
+
+int64_t steady_now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+int64_t wall_now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+// Moves `time` back by `base`, leaving unset times unset.
+uint64_t rebase(uint64_t time, uint64_t base) {
+  return GST_CLOCK_TIME_IS_VALID(time) ? time - std::min(time, base) : time;
+}
+
+double megabytes(size_t bytes) { return bytes / (1024.0 * 1024.0); }
+
+}  // namespace
+
+ClipBuffer::ClipBuffer(std::string name, const ClipOptions& options, ClipHandler handler)
+    : name_(std::move(name)), options_(options), handler_(std::move(handler)) {}
+
+void ClipBuffer::push(
+    const uint8_t* data, size_t size, bool keyframe, uint64_t pts, uint64_t dts,
+    uint64_t duration, int64_t now_ns) {
+  take_trigger(now_ns);
+  if (keyframe) {
+    if (current_) seal(now_ns);
+    current_.reset(new Gop);
+    current_->index = next_index_++;
+    current_->start_ns = now_ns;
+    // GOPs of a stream are about the same size, a little slack spares most
+    // of them a reallocation.
+    current_->data.reserve(last_gop_bytes_ + last_gop_bytes_ / 4);
+    current_->frames.reserve(last_gop_frames_ + 1);
+  }
+  if (!current_) return;
+  current_->frames.push_back({current_->data.size(), size, pts, dts, duration});
+  current_->data.insert(current_->data.end(), data, data + size);
+  current_->end_ns = now_ns;
+  evict(now_ns);
+  update_stats();
+}
+
+void ClipBuffer::trigger(int64_t now_ns) {
+  last_trigger_ns_.store(now_ns, std::memory_order_relaxed);
+}
+
+void ClipBuffer::finish() {
+  if (current_ && !current_->frames.empty()) seal(current_->end_ns);
+  current_.reset();
+  if (clip_active_) hand_over();
+  update_stats();
+}
+
+void ClipBuffer::take_trigger(int64_t now_ns) {
+  const int64_t trigger_ns = last_trigger_ns_.load(std::memory_order_relaxed);
+  if (trigger_ns <= taken_trigger_ns_) return;
+  taken_trigger_ns_ = trigger_ns;
+  if (!clip_active_) {
+    // The pre-roll starts with the GOP holding the frame from that long ago,
+    // and never repeats GOPs of the clip before.
+    const int64_t from_ns = trigger_ns - options_.pre_roll_seconds * kNanosPerSecond;
+    clip_active_ = true;
+    clip_.stream = name_;
+    clip_.trigger_time_ns = wall_now_ns() - (now_ns - trigger_ns);
+    clip_.gops.clear();
+    clip_bytes_ = 0;
+    clip_only_bytes_ = 0;
+    for (const auto& gop : ring_) {
+      if (gop->index >= next_unclipped_ && gop->end_ns >= from_ns) {
+        clip_.gops.push_back(gop);
+        clip_bytes_ += gop->data.size();
+      }
+    }
+    clip_first_trigger_ns_ = trigger_ns;
+    clip_end_ns_ = 0;
+  }
+  // Each trigger pushes the end out, up to the longest clip allowed.
+  clip_end_ns_ = std::max(
+      clip_end_ns_, std::min(
+                        trigger_ns + options_.post_roll_seconds * kNanosPerSecond,
+                        clip_first_trigger_ns_ + options_.max_clip_seconds * kNanosPerSecond));
+}
+
+void ClipBuffer::seal(int64_t now_ns) {
+  last_gop_bytes_ = current_->data.size();
+  last_gop_frames_ = current_->frames.size();
+  std::shared_ptr<const Gop> gop(std::move(current_));
+  ring_bytes_ += gop->data.size();
+  ring_.push_back(gop);
+  if (clip_active_) {
+    clip_.gops.push_back(gop);
+    clip_bytes_ += gop->data.size();
+    if (now_ns >= clip_end_ns_) hand_over();
+  }
+}
+
+void ClipBuffer::evict(int64_t now_ns) {
+  const int64_t keep_from_ns = now_ns - options_.pre_roll_seconds * kNanosPerSecond;
+  while (!ring_.empty() && (held_bytes() > options_.max_ring_bytes ||
+                            (ring_.size() > 1 && ring_[1]->start_ns <= keep_from_ns))) {
+    const auto& gop = ring_.front();
+    ring_bytes_ -= gop->data.size();
+    // A clip holding the GOP keeps it alive until handed over, on the
+    // stream's account until then.
+    if (clip_active_ && !clip_.gops.empty() && gop->index >= clip_.gops.front()->index) {
+      clip_only_bytes_ += gop->data.size();
+    }
+    ring_.pop_front();
+  }
+  if (clip_active_ && held_bytes() > options_.max_ring_bytes) {
+    LOG(WARNING) << name_ << ": clip cut at " << megabytes(clip_bytes_)
+                 << " MB, the most a stream holds";
+    hand_over();
+  }
+}
+
+size_t ClipBuffer::held_bytes() const {
+  return ring_bytes_ + (current_ ? current_->data.size() : 0) + clip_only_bytes_;
+}
+
+void ClipBuffer::hand_over() {
+  clip_active_ = false;
+  clip_bytes_ = 0;
+  clip_only_bytes_ = 0;
+  if (clip_.gops.empty()) return;
+  next_unclipped_ = clip_.gops.back()->index + 1;
+  Clip clip;
+  std::swap(clip, clip_);
+  handler_(std::move(clip));
+}
+
+void ClipBuffer::update_stats() {
+  const size_t bytes = held_bytes();
+  bytes_.store(bytes, std::memory_order_relaxed);
+  clip_bytes_stat_.store(clip_bytes_, std::memory_order_relaxed);
+  if (bytes > peak_bytes_.load(std::memory_order_relaxed)) {
+    peak_bytes_.store(bytes, std::memory_order_relaxed);
+  }
+  gops_.store(ring_.size(), std::memory_order_relaxed);
+  span_ns_.store(
+      ring_.empty() ? 0 : ring_.back()->end_ns - ring_.front()->start_ns,
+      std::memory_order_relaxed);
+}
+
+ClipRecorder::ClipRecorder(const std::vector<std::string>& streams, const ClipOptions& options)
+    : options_(options) {
+  CHECK(!options_.directory.empty());
+  CHECK_GT(options_.report_interval_seconds, 0);
+  if (mkdir(options_.directory.c_str(), 0755) != 0 && errno != EEXIST) {
+    LOG(ERROR) << "Unable to create clip directory " << options_.directory << ": "
+               << strerror(errno);
+  }
+  for (const auto& name : streams) {
+    std::unique_ptr<Stream> stream(new Stream);
+    stream->buffer.reset(
+        new ClipBuffer(name, options_, [this](Clip clip) { enqueue(std::move(clip)); }));
+    streams_.push_back(std::move(stream));
+  }
+  writer_ = std::thread(&ClipRecorder::run_writer, this);
+}
+
+ClipRecorder::~ClipRecorder() {
+  for (auto& stream : streams_) stream->buffer->finish();
+  {
+    absl::MutexLock l(&lock_);
+    stopped_ = true;
+  }
+  writer_.join();
+}
+
+void ClipRecorder::attach(GstElement* pipeline) {
+  for (auto& stream : streams_) {
+    auto appsink = gst_bin_get_by_name(
+        GST_BIN(pipeline), absl::StrCat("clip_", stream->buffer->get_name()).c_str());
+    CHECK_NOTNULL(appsink);
+    g_object_set(appsink, "emit-signals", true, nullptr);
+    g_signal_connect(
+        appsink, "new-sample", reinterpret_cast<GCallback>(on_new_sample), stream.get());
+    gst_object_unref(appsink);
+  }
+}
+
+void ClipRecorder::trigger(int stream) { streams_[stream]->buffer->trigger(steady_now_ns()); }
+
+GstFlowReturn ClipRecorder::on_new_sample(GstElement* sink, void* data) {
+  auto stream = reinterpret_cast<Stream*>(data);
+  // The thread pulling the samples is the one running the encoder, see
+  // ClipRecorder::report().
+  if (!stream->has_clock.load(std::memory_order_relaxed) &&
+      pthread_getcpuclockid(pthread_self(), &stream->clock) == 0) {
+    stream->has_clock.store(true, std::memory_order_release);
+  }
+  GstSample* sample;
+  g_signal_emit_by_name(sink, "pull-sample", &sample);
+  if (!sample) return GST_FLOW_OK;
+  GstBuffer* buffer = gst_sample_get_buffer(sample);
+  GstMapInfo map;
+  if (buffer && gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+    stream->buffer->push(
+        map.data, map.size, !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT),
+        GST_BUFFER_PTS(buffer), GST_BUFFER_DTS(buffer), GST_BUFFER_DURATION(buffer),
+        steady_now_ns());
+    gst_buffer_unmap(buffer, &map);
+  }
+  gst_sample_unref(sample);
+  return GST_FLOW_OK;
+}
+
+size_t ClipRecorder::get_bytes(const Clip& clip) {
+  size_t bytes = 0;
+  for (const auto& gop : clip.gops) bytes += gop->data.size();
+  return bytes;
+}
+
+void ClipRecorder::enqueue(Clip clip) {
+  const size_t bytes = get_bytes(clip);
+  absl::MutexLock l(&lock_);
+  if (static_cast<int>(pending_.size()) >= options_.max_pending_clips ||
+      pending_bytes_ + bytes > options_.max_pending_bytes) {
+    LOG(ERROR) << clip.stream << ": " << pending_.size() << " clips of "
+               << megabytes(pending_bytes_) << " MB are waiting to be written, dropping another";
+    return;
+  }
+  pending_bytes_ += bytes;
+  pending_.push_back(std::move(clip));
+}
+
+bool ClipRecorder::has_work() const { return stopped_ || !pending_.empty(); }
+
+void ClipRecorder::run_writer() {
+  const absl::Duration interval = absl::Seconds(options_.report_interval_seconds);
+  auto last_report = std::chrono::steady_clock::now();
+  while (true) {
+    Clip clip;
+    {
+      absl::MutexLock l(&lock_);
+      lock_.AwaitWithTimeout(absl::Condition(this, &ClipRecorder::has_work), interval);
+      if (!pending_.empty()) {
+        clip = std::move(pending_.front());
+        pending_.pop_front();
+      } else if (stopped_) {
+        return;  // Stopped and drained.
+      }
+    }
+    if (!clip.gops.empty()) {
+      write(clip);
+      const size_t bytes = get_bytes(clip);
+      // Frees the GOPs no ring holds any more before they are no longer
+      // counted.
+      clip = Clip();
+      absl::MutexLock l(&lock_);
+      pending_bytes_ -= bytes;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    const double seconds = std::chrono::duration<double>(now - last_report).count();
+    if (seconds >= options_.report_interval_seconds) {
+      report(seconds);
+      last_report = now;
+    }
+  }
+}
+
+bool ClipRecorder::write(const Clip& clip) const {
+  const std::string path = absl::StrFormat(
+      "%s/%s_%s.mp4", options_.directory, clip.stream,
+      absl::FormatTime(
+          "%Y%m%d-%H%M%S", absl::FromUnixNanos(clip.trigger_time_ns), absl::LocalTimeZone()));
+  // Each GOP begins with a keyframe carrying the stream headers, so the
+  // clip can be muxed as is.
+  const std::string pipeline_string = absl::StrFormat(
+      "appsrc name=src format=time block=true "
+      "caps=video/x-h264,stream-format=byte-stream,alignment=au ! "
+      "h264parse ! mp4mux ! filesink location=\"%s\"",
+      path);
+  GError* error = nullptr;
+  auto pipeline = gst_parse_launch(pipeline_string.c_str(), &error);
+  if (error) {
+    LOG(ERROR) << "Unable to write " << path << ": " << error->message;
+    g_error_free(error);
+    if (pipeline) gst_object_unref(pipeline);
+    return false;
+  }
+  auto src = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+  CHECK_NOTNULL(src);
+  gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+  // The file starts at time zero.
+  const auto& first = clip.gops.front()->frames.front();
+  const uint64_t base = std::min(first.pts, first.dts);
+  GstFlowReturn ret = GST_FLOW_OK;
+  size_t bytes = 0;
+  for (const auto& gop : clip.gops) {
+    for (size_t i = 0; i < gop->frames.size() && ret == GST_FLOW_OK; ++i) {
+      const auto& frame = gop->frames[i];
+      GstBuffer* buffer = gst_buffer_new_allocate(nullptr, frame.size, nullptr);
+      gst_buffer_fill(buffer, 0, gop->data.data() + frame.offset, frame.size);
+      GST_BUFFER_PTS(buffer) = rebase(frame.pts, base);
+      GST_BUFFER_DTS(buffer) = rebase(frame.dts, base);
+      GST_BUFFER_DURATION(buffer) = frame.duration;
+      if (i > 0) GST_BUFFER_FLAG_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+      // Takes a reference of its own.
+      g_signal_emit_by_name(src, "push-buffer", buffer, &ret);
+      gst_buffer_unref(buffer);
+      bytes += frame.size;
+    }
+  }
+  g_signal_emit_by_name(src, "end-of-stream", &ret);
+  gst_object_unref(src);
+
+  // The muxer writes the index on EOS.
+  auto bus = gst_element_get_bus(pipeline);
+  CHECK_NOTNULL(bus);
+  auto msg =
+      gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  bool ok = true;
+  if (msg && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+    GError* error;
+    gst_message_parse_error(msg, &error, nullptr);
+    LOG(ERROR) << "Unable to write " << path << ": " << error->message;
+    g_error_free(error);
+    ok = false;
+  }
+  if (msg) gst_message_unref(msg);
+  gst_object_unref(bus);
+  gst_element_set_state(pipeline, GST_STATE_NULL);
+  gst_object_unref(pipeline);
+  if (ok) {
+    const auto& last = clip.gops.back();
+    LOG(INFO) << "Wrote " << path << ": "
+              << (last->end_ns - clip.gops.front()->start_ns) / 1e9 << " s in "
+              << clip.gops.size() << " GOPs, " << megabytes(bytes) << " MB";
+  }
+  return ok;
+}
+
+void ClipRecorder::report(double seconds) {
+  size_t total_bytes = 0;
+  for (auto& stream : streams_) {
+    const auto& buffer = *stream->buffer;
+    total_bytes += buffer.get_bytes();
+    std::string cpu;
+    timespec ts;
+    if (stream->has_clock.load(std::memory_order_acquire) &&
+        clock_gettime(stream->clock, &ts) == 0) {
+      // Scaling, converting and encoding the clip branch, as x264enc with
+      // threads=1 encodes on the thread feeding it.
+      const int64_t cpu_ns = ts.tv_sec * kNanosPerSecond + ts.tv_nsec;
+      // The first report only takes the time spent so far, over an unknown
+      // span.
+      if (stream->reported_cpu_ns > 0) {
+        absl::StrAppendFormat(
+            &cpu, ", clip branch %.1f%% of a core",
+            100.0 * (cpu_ns - stream->reported_cpu_ns) / (seconds * kNanosPerSecond));
+      }
+      stream->reported_cpu_ns = cpu_ns;
+    }
+    LOG(INFO) << absl::StrFormat(
+        "%s: clip ring holds %.1f MB in %d GOPs over %.1f s, clip being taken %.1f MB, "
+        "peak %.1f MB%s",
+        buffer.get_name(), megabytes(buffer.get_bytes()), buffer.get_gops(),
+        buffer.get_span_ns() / 1e9, megabytes(buffer.get_clip_bytes()),
+        megabytes(buffer.get_peak_bytes()), cpu);
+  }
+  size_t pending_bytes;
+  size_t pending_clips;
+  {
+    absl::MutexLock l(&lock_);
+    pending_bytes = pending_bytes_;
+    pending_clips = pending_.size();
+  }
+  // GOPs still in a ring are shared with the clips, so these overlap.
+  LOG(INFO) << absl::StrFormat(
+      "Clip rings hold %.1f MB in all, clips to write %.1f MB with %d queued",
+      megabytes(total_bytes), megabytes(pending_bytes), pending_clips);
+}
+
+}  // namespace coral
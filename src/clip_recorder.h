@@ -0,0 +1,221 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MANUFACTURING_DEMO_CLIP_RECORDER_H_
+#define MANUFACTURING_DEMO_CLIP_RECORDER_H_
+
+#include <gst/gst.h>
+#include <time.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+
+namespace coral {
+
+struct ClipOptions {
+  // Directory the clips are written to, as <stream>_<time>.mp4.
+  std::string directory;
+  // Video kept from before and after a trigger, rounded out to whole GOPs.
+  int pre_roll_seconds = 10;
+  int post_roll_seconds = 10;
+  // A clip still triggered after this long is cut, the next trigger begins
+  // another one.
+  int max_clip_seconds = 60;
+  // Encoded bytes a stream holds at most, its current GOP and the GOPs of
+  // the clip it is taking included. The oldest GOPs go first when it would
+  // hold more, shortening the pre-roll, and a clip holding that much alone is
+  // handed over early.
+  size_t max_ring_bytes = 32 << 20;
+  // Clips waiting for the writer at most, and the encoded bytes they hold at
+  // most across streams, later ones are dropped.
+  int max_pending_clips = 4;
+  size_t max_pending_bytes = 64 << 20;
+  // Seconds between reports of the memory and CPU the rings and clips take.
+  int report_interval_seconds = 30;
+};
+
+// An encoded frame within a GOP. Times are those of its buffer.
+struct EncodedFrame {
+  size_t offset;
+  size_t size;
+  uint64_t pts;
+  uint64_t dts;
+  uint64_t duration;
+};
+
+// A group of pictures: a keyframe and the frames predicted from it, encoded
+// back to back in one allocation. Immutable once sealed, so clips share it
+// with the ring.
+struct Gop {
+  // Counts the GOPs of a stream.
+  uint64_t index = 0;
+  // Arrival of the first and the last frame, steady clock.
+  int64_t start_ns = 0;
+  int64_t end_ns = 0;
+  std::vector<uint8_t> data;
+  std::vector<EncodedFrame> frames;
+};
+
+// GOPs around a trigger, in order, each starting with a keyframe.
+struct Clip {
+  std::string stream;
+  // Wall clock time of the first trigger, in nanoseconds since the Unix epoch.
+  int64_t trigger_time_ns = 0;
+  std::vector<std::shared_ptr<const Gop>> gops;
+};
+
+// The encoded video of a stream over the last pre-roll seconds, cut at
+// keyframes. A trigger starts a clip from the GOPs in the ring, which then
+// takes every GOP sealed until the post-roll is over and is handed to
+// `handler`. Frames are copied once into the GOP they belong to, whose
+// storage is reserved from the size of the one before, so the ring
+// allocates about once per GOP.
+class ClipBuffer {
+public:
+  using ClipHandler = std::function<void(Clip)>;
+
+  ClipBuffer(std::string name, const ClipOptions& options, ClipHandler handler);
+  ClipBuffer(const ClipBuffer&) = delete;
+  ClipBuffer& operator=(const ClipBuffer&) = delete;
+
+  // Appends an encoded frame that arrived at `now_ns`, a keyframe sealing
+  // the current GOP and beginning the next. Frames before the first keyframe
+  // are dropped. From one thread at a time.
+  void push(
+      const uint8_t* data, size_t size, bool keyframe, uint64_t pts, uint64_t dts,
+      uint64_t duration, int64_t now_ns);
+  // Asks for the video around `now_ns`, from any thread. Cheap enough to call
+  // on every frame a trigger holds: a store, picked up by the next push().
+  void trigger(int64_t now_ns);
+  // Hands over the clip being taken, if any, with the frames pushed so far.
+  // Only once push() isn't called anymore.
+  void finish();
+
+  const std::string& get_name() const { return name_; }
+  // Bytes held, current GOP and clip being taken included, and the most
+  // ever held.
+  size_t get_bytes() const { return bytes_.load(std::memory_order_relaxed); }
+  size_t get_peak_bytes() const { return peak_bytes_.load(std::memory_order_relaxed); }
+  // Bytes of the clip being taken, whether still in the ring or not.
+  size_t get_clip_bytes() const { return clip_bytes_stat_.load(std::memory_order_relaxed); }
+  // Sealed GOPs held and the time they span.
+  int get_gops() const { return gops_.load(std::memory_order_relaxed); }
+  int64_t get_span_ns() const { return span_ns_.load(std::memory_order_relaxed); }
+
+private:
+  // Takes the trigger raised since the last push(), if any.
+  void take_trigger(int64_t now_ns);
+  // Moves the current GOP into the ring, and into the clip being taken.
+  void seal(int64_t now_ns);
+  // Drops the GOPs older than the pre-roll, and the oldest beyond the bytes
+  // allowed, then hands over a clip too large to keep on its own.
+  void evict(int64_t now_ns);
+  // Bytes of the ring, the current GOP and the clip GOPs evicted from the ring.
+  size_t held_bytes() const;
+  void hand_over();
+  void update_stats();
+
+  const std::string name_;
+  const ClipOptions options_;
+  const ClipHandler handler_;
+  std::atomic<int64_t> last_trigger_ns_{0};
+
+  // Touched by push() only.
+  std::deque<std::shared_ptr<const Gop>> ring_;
+  std::unique_ptr<Gop> current_;
+  size_t ring_bytes_ = 0;
+  size_t last_gop_bytes_ = 0;
+  size_t last_gop_frames_ = 0;
+  uint64_t next_index_ = 0;
+  int64_t taken_trigger_ns_ = 0;
+  // The clip being taken, when `clip_active_`, and when it ends. GOPs from
+  // `next_unclipped_` on aren't in a clip yet.
+  bool clip_active_ = false;
+  Clip clip_;
+  // Bytes of all GOPs of the clip, and of those it alone keeps alive.
+  size_t clip_bytes_ = 0;
+  size_t clip_only_bytes_ = 0;
+  int64_t clip_first_trigger_ns_ = 0;
+  int64_t clip_end_ns_ = 0;
+  uint64_t next_unclipped_ = 0;
+
+  std::atomic<size_t> bytes_{0};
+  std::atomic<size_t> peak_bytes_{0};
+  std::atomic<size_t> clip_bytes_stat_{0};
+  std::atomic<int> gops_{0};
+  std::atomic<int64_t> span_ns_{0};
+};
+
+// Keeps a ClipBuffer per stream, fed by the appsink "clip_<stream>" taking
+// H.264 byte-stream access units, and writes the clips to MP4 files from a
+// thread of its own, so a trigger never waits for the disk. Periodically
+// logs the memory the rings and the clips hold and the CPU time spent
+// encoding into the rings.
+class ClipRecorder {
+public:
+  ClipRecorder(const std::vector<std::string>& streams, const ClipOptions& options);
+  // Writes the clips still being taken and those queued, so only once the
+  // pipeline stopped.
+  ~ClipRecorder();
+  ClipRecorder(const ClipRecorder&) = delete;
+  ClipRecorder& operator=(const ClipRecorder&) = delete;
+
+  // Feeds each buffer from the appsink of its stream in `pipeline`.
+  void attach(GstElement* pipeline);
+  // Asks for a clip of stream `stream`, by index in `streams`, around now.
+  void trigger(int stream);
+
+private:
+  struct Stream {
+    std::unique_ptr<ClipBuffer> buffer;
+    // CPU clock of the streaming thread feeding the appsink, which also
+    // scales, converts and encodes the frames of the clip branch.
+    std::atomic<bool> has_clock{false};
+    clockid_t clock;
+    // Last reported CPU time of that thread.
+    int64_t reported_cpu_ns = 0;
+  };
+
+  static GstFlowReturn on_new_sample(GstElement* sink, void* data);
+  static size_t get_bytes(const Clip& clip);
+  void enqueue(Clip clip) LOCKS_EXCLUDED(lock_);
+  bool has_work() const EXCLUSIVE_LOCKS_REQUIRED(lock_);
+  void run_writer() LOCKS_EXCLUDED(lock_);
+  bool write(const Clip& clip) const;
+  void report(double seconds);
+
+  const ClipOptions options_;
+  std::vector<std::unique_ptr<Stream>> streams_;
+  absl::Mutex lock_;
+  std::deque<Clip> pending_ GUARDED_BY(lock_);
+  // Bytes of the clips queued and of the one being written.
+  size_t pending_bytes_ GUARDED_BY(lock_) = 0;
+  bool stopped_ GUARDED_BY(lock_) = false;
+  std::thread writer_;
+};
+
+}  // namespace coral
+
+#endif  // MANUFACTURING_DEMO_CLIP_RECORDER_H_
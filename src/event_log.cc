@@ -0,0 +1,227 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "event_log.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "absl/strings/str_cat.h"
+#include "glog/logging.h"
+
+namespace coral {
+
+namespace {
+
+// Copies `text` into a fixed size field, NUL padded.
+void copy_name(absl::string_view text, char* field, size_t size) {
+  const size_t length = std::min(text.size(), size);
+  std::memcpy(field, text.data(), length);
+  std::memset(field + length, 0, size - length);
+}
+
+size_t log_bytes(uint64_t capacity) {
+  return kEventLogHeaderBytes + capacity * sizeof(EventRecord);
+}
+
+bool is_event_log(const EventLogHeader& header) {
+  return std::memcmp(header.magic, kEventLogMagic, sizeof(header.magic)) == 0 &&
+         header.version == kEventLogVersion && header.record_bytes == sizeof(EventRecord) &&
+         header.capacity > 0;
+}
+
+}  // namespace
+
+const char* event_type_name(EventType type) {
+  switch (type) {
+    case EventType::kKeepoutEnter:
+      return "keepout_enter";
+    case EventType::kKeepoutExit:
+      return "keepout_exit";
+    case EventType::kInspectionReject:
+      return "inspection_reject";
+    case EventType::kFrameDropped:
+      return "frame_dropped";
+  }
+  return "unknown";
+}
+
+EventLog::~EventLog() {
+  if (!mapping_) return;
+  msync(mapping_, mapping_bytes_, MS_SYNC);
+  munmap(mapping_, mapping_bytes_);
+}
+
+bool EventLog::open(
+    const std::string& path, uint64_t capacity, const std::vector<std::string>& streams) {
+  CHECK(!mapping_) << "Event log already open";
+  CHECK_GT(capacity, 0u);
+  if (streams.size() > kMaxEventStreams) {
+    LOG(ERROR) << "An event log names at most " << kMaxEventStreams << " streams";
+    return false;
+  }
+  const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    LOG(ERROR) << "Unable to open event log " << path;
+    return false;
+  }
+  struct stat st;
+  EventLogHeader header;
+  const bool resume = fstat(fd, &st) == 0 && st.st_size > 0;
+  if (resume) {
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || !is_event_log(header)) {
+      LOG(ERROR) << path << " is not an event log";
+      ::close(fd);
+      return false;
+    }
+    if (header.capacity != capacity) {
+      LOG(ERROR) << path << " holds " << header.capacity << " records, not " << capacity;
+      ::close(fd);
+      return false;
+    }
+  }
+  const size_t bytes = log_bytes(capacity);
+  // A full disk fails here rather than as a SIGBUS while recording.
+  const int error = posix_fallocate(fd, 0, bytes);
+  if (error != 0) {
+    LOG(ERROR) << "Unable to allocate event log " << path << ": " << strerror(error);
+    ::close(fd);
+    return false;
+  }
+  void* mapping =
+      mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+  // The mapping keeps the file open.
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    LOG(ERROR) << "Unable to map event log " << path;
+    return false;
+  }
+  mapping_ = mapping;
+  mapping_bytes_ = bytes;
+  header_ = reinterpret_cast<EventLogHeader*>(mapping_);
+  records_ = reinterpret_cast<EventRecord*>(
+      reinterpret_cast<uint8_t*>(mapping_) + kEventLogHeaderBytes);
+  capacity_ = capacity;
+  if (!resume) {
+    std::memset(header_, 0, kEventLogHeaderBytes);
+    std::memcpy(header_->magic, kEventLogMagic, sizeof(header_->magic));
+    header_->version = kEventLogVersion;
+    header_->record_bytes = sizeof(EventRecord);
+    header_->capacity = capacity;
+  }
+  header_->num_streams = streams.size();
+  for (int i = 0; i < kMaxEventStreams; ++i) {
+    copy_name(
+        i < static_cast<int>(streams.size()) ? streams[i] : "", header_->streams[i],
+        kEventStreamNameBytes);
+  }
+  LOG(INFO) << (resume ? "Appending to event log " : "Recording events to ") << path << ", "
+            << get_written() << " events so far";
+  return true;
+}
+
+void EventLog::record(const Event& event) {
+  if (!header_) return;
+  const uint64_t position = __atomic_fetch_add(&header_->next, 1, __ATOMIC_RELAXED);
+  EventRecord& record = records_[position % capacity_];
+  // Readers skip the slot from here until its sequence is set again, last.
+  __atomic_store_n(&record.sequence, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  record.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::system_clock::now().time_since_epoch())
+                       .count();
+  record.frame = event.frame;
+  record.type = static_cast<uint16_t>(event.type);
+  record.stream = event.stream;
+  record.id = event.id;
+  record.score = event.score;
+  record.x1 = event.x1;
+  record.y1 = event.y1;
+  record.x2 = event.x2;
+  record.y2 = event.y2;
+  copy_name(event.label, record.label, kEventLabelBytes);
+  __atomic_store_n(&record.sequence, position + 1, __ATOMIC_RELEASE);
+}
+
+uint64_t EventLog::get_written() const {
+  return header_ ? __atomic_load_n(&header_->next, __ATOMIC_RELAXED) : 0;
+}
+
+EventLogReader::~EventLogReader() {
+  if (mapping_) munmap(mapping_, mapping_bytes_);
+}
+
+bool EventLogReader::open(const std::string& path) {
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    LOG(ERROR) << "Unable to open event log " << path;
+    return false;
+  }
+  struct stat st;
+  EventLogHeader header;
+  if (fstat(fd, &st) != 0 || pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+      !is_event_log(header) || static_cast<size_t>(st.st_size) < log_bytes(header.capacity)) {
+    LOG(ERROR) << path << " is not an event log";
+    ::close(fd);
+    return false;
+  }
+  const size_t bytes = log_bytes(header.capacity);
+  // Shared, so records written meanwhile are seen.
+  void* mapping = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    LOG(ERROR) << "Unable to map event log " << path;
+    return false;
+  }
+  mapping_ = mapping;
+  mapping_bytes_ = bytes;
+  header_ = reinterpret_cast<const EventLogHeader*>(mapping_);
+  records_ = reinterpret_cast<const EventRecord*>(
+      reinterpret_cast<const uint8_t*>(mapping_) + kEventLogHeaderBytes);
+  capacity_ = header.capacity;
+  return true;
+}
+
+void EventLogReader::read(std::vector<EventRecord>* records) const {
+  const uint64_t next = __atomic_load_n(&header_->next, __ATOMIC_ACQUIRE);
+  const uint64_t first = next > capacity_ ? next - capacity_ : 0;
+  for (uint64_t position = first; position < next; ++position) {
+    const EventRecord& record = records_[position % capacity_];
+    const uint64_t sequence = __atomic_load_n(&record.sequence, __ATOMIC_ACQUIRE);
+    if (sequence != position + 1) continue;
+    EventRecord copy;
+    std::memcpy(&copy, &record, sizeof(copy));
+    // Left out if a writer claimed the slot while it was copied.
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&record.sequence, __ATOMIC_RELAXED) != sequence) continue;
+    copy.sequence = sequence;
+    records->push_back(copy);
+  }
+}
+
+std::string EventLogReader::get_stream_name(int stream) const {
+  if (stream < 0 || stream >= kMaxEventStreams || !header_->streams[stream][0]) {
+    return absl::StrCat(stream);
+  }
+  const char* name = header_->streams[stream];
+  return std::string(name, strnlen(name, kEventStreamNameBytes));
+}
+
+}  // namespace coral
@@ -0,0 +1,165 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MANUFACTURING_DEMO_EVENT_LOG_H_
+#define MANUFACTURING_DEMO_EVENT_LOG_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+namespace coral {
+
+enum class EventType : uint16_t {
+  // A keepout zone holds a detected person since this frame.
+  kKeepoutEnter = 1,
+  // The last person in a keepout zone left it.
+  kKeepoutExit = 2,
+  // An inspected object was classified as defective, on the first frame it
+  // is seen in.
+  kInspectionReject = 3,
+  // Frames were dropped from a full stream queue, one event per burst or per
+  // second of a longer one.
+  kFrameDropped = 4,
+};
+
+// Returns "keepout_enter", "keepout_exit", "inspection_reject",
+// "frame_dropped" or "unknown".
+const char* event_type_name(EventType type);
+
+// Bytes of the label of a record, NUL padded but not terminated when full.
+constexpr size_t kEventLabelBytes = 16;
+
+// An event as stored, one cache line.
+struct EventRecord {
+  // Position of the record in the log plus one, written last. A record whose
+  // sequence doesn't match its position is being written.
+  uint64_t sequence;
+  // Wall clock time, in nanoseconds since the Unix epoch.
+  int64_t time_ns;
+  // Frame of the stream the event happened on, or for a drop the number of
+  // frames the stream captured.
+  uint32_t frame;
+  uint16_t type;
+  uint16_t stream;
+  // Keepout zone id, for a drop the number of frames dropped, -1 when there
+  // is none.
+  int32_t id;
+  float score;
+  // Box of the object, in the coordinates of the displayed frames.
+  float x1, y1, x2, y2;
+  // Keepout zone name or class label.
+  char label[kEventLabelBytes];
+};
+static_assert(sizeof(EventRecord) == 64, "Records must stay one cache line");
+
+// An event to record, see EventRecord.
+struct Event {
+  EventType type;
+  int stream = 0;
+  uint64_t frame = 0;
+  int id = -1;
+  float score = 0;
+  float x1 = 0, y1 = 0, x2 = 0, y2 = 0;
+  absl::string_view label;
+};
+
+// Streams named in the header of an event log, and the bytes of a name.
+constexpr int kMaxEventStreams = 64;
+constexpr size_t kEventStreamNameBytes = 32;
+
+// An event log is an EventLogHeader padded to kEventLogHeaderBytes followed
+// by a ring of `capacity` records, the newest overwriting the oldest.
+struct EventLogHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t record_bytes;
+  uint32_t num_streams;
+  uint64_t capacity;
+  // Records ever written, the next one goes to slot next % capacity.
+  // Updated atomically by the writers.
+  uint64_t next;
+  // Names of the streams by id, as of the last time the log was opened.
+  char streams[kMaxEventStreams][kEventStreamNameBytes];
+};
+constexpr char kEventLogMagic[4] = {'C', 'E', 'V', 'L'};
+constexpr uint32_t kEventLogVersion = 1;
+constexpr size_t kEventLogHeaderBytes = 4096;
+static_assert(sizeof(EventLogHeader) <= kEventLogHeaderBytes, "Header too large");
+
+// Records events into a memory mapped event log. Recording takes no lock
+// and makes no system call, any number of threads can record at once: a
+// slot is claimed with an atomic add and its sequence is written last, so
+// readers, even in another process, skip records still being written. The
+// records reach the file through the page cache, a crash of the demo loses
+// none of them.
+class EventLog {
+public:
+  EventLog() = default;
+  // Flushes the log to disk.
+  ~EventLog();
+  EventLog(const EventLog&) = delete;
+  EventLog& operator=(const EventLog&) = delete;
+
+  // Opens the log at `path` for `streams`, appending to it if it exists.
+  // The whole file is allocated and paged in here, recording never waits on
+  // the disk. Returns false if it can't be written or holds another number
+  // of records.
+  bool open(const std::string& path, uint64_t capacity, const std::vector<std::string>& streams);
+  bool is_open() const { return header_ != nullptr; }
+  // Records `event`, does nothing unless the log is open.
+  void record(const Event& event);
+  // Records ever written to the log.
+  uint64_t get_written() const;
+
+private:
+  void* mapping_ = nullptr;
+  size_t mapping_bytes_ = 0;
+  EventLogHeader* header_ = nullptr;
+  EventRecord* records_ = nullptr;
+  uint64_t capacity_ = 0;
+};
+
+// An event log mapped read only, possibly while it is written.
+class EventLogReader {
+public:
+  EventLogReader() = default;
+  ~EventLogReader();
+  EventLogReader(const EventLogReader&) = delete;
+  EventLogReader& operator=(const EventLogReader&) = delete;
+
+  // Maps the log at `path`. Returns false if it is missing or malformed.
+  bool open(const std::string& path);
+  // Appends the records still in the log, oldest first. Records being
+  // written or overwritten meanwhile are left out.
+  void read(std::vector<EventRecord>* records) const;
+  // Name of stream `stream`, its id as a string if it has none.
+  std::string get_stream_name(int stream) const;
+
+private:
+  void* mapping_ = nullptr;
+  size_t mapping_bytes_ = 0;
+  const EventLogHeader* header_ = nullptr;
+  const EventRecord* records_ = nullptr;
+  uint64_t capacity_ = 0;
+};
+
+}  // namespace coral
+
+#endif  // MANUFACTURING_DEMO_EVENT_LOG_H_
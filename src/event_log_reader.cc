@@ -0,0 +1,112 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Converts an event log written with --event_log to CSV or JSON on stdout:
+//
+//   event_log_reader --format=csv events.log > events.csv
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/time/time.h"
+#include "event_log.h"
+#include "glog/logging.h"
+
+ABSL_FLAG(std::string, format, "csv", "Output format: csv or json.");
+
+namespace {
+
+std::string format_time(int64_t time_ns) {
+  return absl::FormatTime(
+      "%Y-%m-%dT%H:%M:%E3SZ", absl::FromUnixNanos(time_ns), absl::UTCTimeZone());
+}
+
+std::string get_label(const coral::EventRecord& record) {
+  return std::string(record.label, strnlen(record.label, coral::kEventLabelBytes));
+}
+
+// Quotes a CSV field if it needs to be.
+std::string csv_field(const std::string& text) {
+  if (text.find_first_of(",\"\n") == std::string::npos) return text;
+  std::string quoted = "\"";
+  for (char c : text) {
+    if (c == '"') quoted += '"';
+    quoted += c;
+  }
+  return quoted + "\"";
+}
+
+std::string json_string(const std::string& text) {
+  std::string quoted = "\"";
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      absl::StrAppend(&quoted, "\\", std::string(1, c));
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      absl::StrAppendFormat(&quoted, "\\u%04x", c);
+    } else {
+      quoted += c;
+    }
+  }
+  return quoted + "\"";
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  google::InitGoogleLogging(argv[0]);
+  const std::vector<char*> args = absl::ParseCommandLine(argc, argv);
+  const std::string format = absl::GetFlag(FLAGS_format);
+  if (args.size() != 2 || (format != "csv" && format != "json")) {
+    fprintf(stderr, "Usage: %s [--format=csv|json] <event log>\n", args[0]);
+    return EXIT_FAILURE;
+  }
+  coral::EventLogReader reader;
+  if (!reader.open(args[1])) return EXIT_FAILURE;
+  std::vector<coral::EventRecord> records;
+  reader.read(&records);
+
+  const bool json = format == "json";
+  printf(json ? "[\n" : "sequence,time,stream,type,frame,id,label,score,x1,y1,x2,y2\n");
+  for (size_t i = 0; i < records.size(); ++i) {
+    const auto& record = records[i];
+    const std::string stream = reader.get_stream_name(record.stream);
+    const char* type = coral::event_type_name(static_cast<coral::EventType>(record.type));
+    const std::string label = get_label(record);
+    const std::string time = format_time(record.time_ns);
+    if (json) {
+      printf(
+          "  {\"sequence\": %llu, \"time\": \"%s\", \"time_ns\": %lld, \"stream\": %s, "
+          "\"type\": \"%s\", \"frame\": %u, \"id\": %d, \"label\": %s, \"score\": %g, "
+          "\"box\": [%g, %g, %g, %g]}%s\n",
+          static_cast<unsigned long long>(record.sequence), time.c_str(),
+          static_cast<long long>(record.time_ns), json_string(stream).c_str(), type,
+          record.frame, record.id, json_string(label).c_str(), record.score, record.x1,
+          record.y1, record.x2, record.y2, i + 1 < records.size() ? "," : "");
+    } else {
+      printf(
+          "%llu,%s,%s,%s,%u,%d,%s,%g,%g,%g,%g,%g\n",
+          static_cast<unsigned long long>(record.sequence), time.c_str(),
+          csv_field(stream).c_str(), type, record.frame, record.id, csv_field(label).c_str(),
+          record.score, record.x1, record.y1, record.x2, record.y2);
+    }
+  }
+  if (json) printf("]\n");
+  return EXIT_SUCCESS;
+}
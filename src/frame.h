@@ -0,0 +1,162 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MANUFACTURING_DEMO_FRAME_H_
+#define MANUFACTURING_DEMO_FRAME_H_
+
+#include <gst/gst.h>
+#include <stdlib.h>
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+
+namespace coral {
+
+// Recycles the pixel buffers of frames converted on the CPU, so the steady
+// state doesn't allocate. A buffer is only allocated when every other one is
+// still held by a frame, which bounds them by the frames in flight.
+class FrameBufferPool {
+public:
+  // Buffers of `bytes`, aligned to `alignment` so they can be bound as input
+  // tensors without a copy.
+  FrameBufferPool(size_t bytes, size_t alignment) : bytes_(bytes), alignment_(alignment) {}
+  ~FrameBufferPool() {
+    for (uint8_t* buffer : buffers_) free(buffer);
+  }
+  FrameBufferPool(const FrameBufferPool&) = delete;
+  FrameBufferPool& operator=(const FrameBufferPool&) = delete;
+
+  uint8_t* acquire() LOCKS_EXCLUDED(lock_) {
+    absl::MutexLock l(&lock_);
+    if (!free_.empty()) {
+      uint8_t* buffer = free_.back();
+      free_.pop_back();
+      return buffer;
+    }
+    void* buffer = nullptr;
+    if (posix_memalign(&buffer, alignment_, bytes_) != 0) return nullptr;
+    buffers_.push_back(static_cast<uint8_t*>(buffer));
+    free_.reserve(buffers_.size());
+    return buffers_.back();
+  }
+  void release(uint8_t* buffer) LOCKS_EXCLUDED(lock_) {
+    absl::MutexLock l(&lock_);
+    free_.push_back(buffer);
+  }
+  size_t get_buffer_bytes() const { return bytes_; }
+
+private:
+  const size_t bytes_;
+  const size_t alignment_;
+  absl::Mutex lock_;
+  std::vector<uint8_t*> buffers_ GUARDED_BY(lock_);
+  std::vector<uint8_t*> free_ GUARDED_BY(lock_);
+};
+
+// Part of a frame holding the picture, as fractions of its width and height.
+// Letterboxed frames have black borders around it.
+struct ContentRect {
+  float xmin = 0, ymin = 0, xmax = 1, ymax = 1;
+};
+
+// A video frame handed to a stream callback. It owns a reference to the
+// GstSample it came from and keeps the buffer mapped until destroyed, so it
+// can be moved between threads without copying pixels. It can also hold a
+// buffer of a FrameBufferPool, returned when destroyed, or just point at
+// pixels owned by someone else, such as a replayed frame dump.
+class Frame {
+public:
+  Frame() = default;
+  // Doesn't own `data`, which must outlive the frame.
+  Frame(const uint8_t* data, size_t size, uint64_t seq) : data_(data), size_(size), seq_(seq) {}
+  // Takes `buffer`, acquired from `pool`.
+  Frame(std::shared_ptr<FrameBufferPool> pool, uint8_t* buffer, uint64_t seq)
+      : pool_(std::move(pool)),
+        pool_buffer_(buffer),
+        data_(buffer),
+        size_(pool_->get_buffer_bytes()),
+        seq_(seq) {}
+  // Takes ownership of the `sample` reference. `seq` numbers the frames of a
+  // stream in capture order.
+  Frame(GstSample* sample, uint64_t seq) : sample_(sample), seq_(seq) {
+    GstBuffer* buffer = gst_sample_get_buffer(sample_);
+    if (buffer && gst_buffer_map(buffer, &map_, GST_MAP_READ)) {
+      buffer_ = buffer;
+      data_ = map_.data;
+      size_ = map_.size;
+    }
+  }
+  ~Frame() { reset(); }
+  Frame(Frame&& other) { *this = std::move(other); }
+  Frame& operator=(Frame&& other) {
+    if (this != &other) {
+      reset();
+      std::swap(sample_, other.sample_);
+      std::swap(buffer_, other.buffer_);
+      std::swap(map_, other.map_);
+      std::swap(pool_, other.pool_);
+      std::swap(pool_buffer_, other.pool_buffer_);
+      std::swap(content_, other.content_);
+      std::swap(data_, other.data_);
+      std::swap(size_, other.size_);
+      std::swap(seq_, other.seq_);
+    }
+    return *this;
+  }
+  Frame(const Frame&) = delete;
+  Frame& operator=(const Frame&) = delete;
+
+  // True if the frame holds mapped pixels.
+  bool valid() const { return data_ != nullptr; }
+  const uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+  uint64_t seq() const { return seq_; }
+  // Where the picture is within the pixels, all of them unless letterboxed.
+  const ContentRect& get_content() const { return content_; }
+  void set_content(const ContentRect& content) { content_ = content; }
+
+private:
+  void reset() {
+    if (buffer_) gst_buffer_unmap(buffer_, &map_);
+    if (sample_) gst_sample_unref(sample_);
+    if (pool_buffer_) pool_->release(pool_buffer_);
+    sample_ = nullptr;
+    buffer_ = nullptr;
+    pool_.reset();
+    pool_buffer_ = nullptr;
+    content_ = ContentRect();
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  GstSample* sample_ = nullptr;
+  GstBuffer* buffer_ = nullptr;
+  GstMapInfo map_ = GST_MAP_INFO_INIT;
+  std::shared_ptr<FrameBufferPool> pool_;
+  uint8_t* pool_buffer_ = nullptr;
+  ContentRect content_;
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+  uint64_t seq_ = 0;
+};
+
+}  // namespace coral
+
+#endif  // MANUFACTURING_DEMO_FRAME_H_
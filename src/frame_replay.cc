@@ -0,0 +1,251 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "frame_replay.h"
+
+#include <fcntl.h>
+#include <gst/gst.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+#include "absl/strings/str_format.h"
+#include "glog/logging.h"
+
+namespace coral {
+
+namespace {
+
+// An appsink and the dump its frames go to.
+struct DumpSink {
+  std::string name;
+  FrameDumpWriter writer;
+  bool failed = false;
+};
+
+GstFlowReturn on_dump_sample(GstElement* sink, void* data) {
+  auto dump = reinterpret_cast<DumpSink*>(data);
+  GstSample* sample;
+  g_signal_emit_by_name(sink, "pull-sample", &sample);
+  if (!sample) return GST_FLOW_OK;
+  GstBuffer* buffer = gst_sample_get_buffer(sample);
+  GstMapInfo map;
+  if (buffer && gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+    if (!dump->writer.write(map.data, map.size)) {
+      LOG(ERROR) << "Couldn't dump a " << map.size << " byte frame of " << dump->name
+                 << ", expected " << dump->writer.get_frame_bytes();
+      dump->failed = true;
+    }
+    gst_buffer_unmap(buffer, &map);
+  }
+  gst_sample_unref(sample);
+  return dump->failed ? GST_FLOW_ERROR : GST_FLOW_OK;
+}
+
+}  // namespace
+
+double percentile(const std::vector<double>& values, double q) {
+  if (values.empty()) return 0;
+  const size_t rank = std::ceil(q * values.size());
+  return values[std::max<size_t>(rank, 1) - 1];
+}
+
+bool FrameDumpWriter::open(const std::string& path, const ImageDims& dims) {
+  close();
+  file_ = fopen(path.c_str(), "wb");
+  if (!file_) return false;
+  FrameDumpHeader header{};
+  std::memcpy(header.magic, kFrameDumpMagic, sizeof(header.magic));
+  header.version = kFrameDumpVersion;
+  header.height = dims[0];
+  header.width = dims[1];
+  header.channels = dims[2];
+  frame_bytes_ = static_cast<size_t>(dims[0]) * dims[1] * dims[2];
+  frame_count_ = 0;
+  return fwrite(&header, sizeof(header), 1, file_) == 1;
+}
+
+bool FrameDumpWriter::write(const uint8_t* data, size_t size) {
+  if (!file_ || size != frame_bytes_) return false;
+  if (fwrite(data, 1, size, file_) != size) return false;
+  frame_count_++;
+  return true;
+}
+
+void FrameDumpWriter::close() {
+  if (file_) fclose(file_);
+  file_ = nullptr;
+}
+
+FrameDump::~FrameDump() {
+  if (mapping_) munmap(mapping_, mapping_bytes_);
+}
+
+bool FrameDump::open(const std::string& path) {
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG(ERROR) << "Unable to open frame dump " << path;
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(FrameDumpHeader)) {
+    LOG(ERROR) << path << " is too short for a frame dump";
+    ::close(fd);
+    return false;
+  }
+  void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping keeps the file open.
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    LOG(ERROR) << "Unable to map frame dump " << path;
+    return false;
+  }
+  mapping_ = mapping;
+  mapping_bytes_ = st.st_size;
+  FrameDumpHeader header;
+  std::memcpy(&header, mapping_, sizeof(header));
+  if (std::memcmp(header.magic, kFrameDumpMagic, sizeof(header.magic)) != 0 ||
+      header.version != kFrameDumpVersion) {
+    LOG(ERROR) << path << " is not a frame dump";
+    return false;
+  }
+  dims_ = {static_cast<int>(header.height), static_cast<int>(header.width),
+           static_cast<int>(header.channels)};
+  frame_bytes_ = static_cast<size_t>(header.height) * header.width * header.channels;
+  if (frame_bytes_ == 0) {
+    LOG(ERROR) << path << " has empty frames";
+    return false;
+  }
+  frames_ = reinterpret_cast<const uint8_t*>(mapping_) + sizeof(header);
+  frame_count_ = (mapping_bytes_ - sizeof(header)) / frame_bytes_;
+  // Frames are read front to back, once.
+  madvise(mapping_, mapping_bytes_, MADV_SEQUENTIAL);
+  return true;
+}
+
+bool dump_frames(
+    const std::string& pipeline_string,
+    const std::vector<std::pair<std::string, std::string>>& sinks, const ImageDims& dims) {
+  gst_init(nullptr, nullptr);
+  auto pipeline = gst_parse_launch(pipeline_string.c_str(), nullptr);
+  CHECK_NOTNULL(pipeline);
+  std::vector<std::unique_ptr<DumpSink>> dumps;
+  for (const auto& entry : sinks) {
+    std::unique_ptr<DumpSink> dump(new DumpSink);
+    dump->name = entry.first;
+    if (!dump->writer.open(entry.second, dims)) {
+      LOG(ERROR) << "Unable to create frame dump " << entry.second;
+      gst_object_unref(pipeline);
+      return false;
+    }
+    auto appsink = gst_bin_get_by_name(GST_BIN(pipeline), entry.first.c_str());
+    CHECK_NOTNULL(appsink);
+    g_object_set(appsink, "emit-signals", true, "sync", false, nullptr);
+    g_signal_connect(
+        appsink, "new-sample", reinterpret_cast<GCallback>(on_dump_sample), dump.get());
+    gst_object_unref(appsink);
+    dumps.push_back(std::move(dump));
+  }
+
+  // Decodes as fast as possible, there's nothing to pace the frames.
+  gst_element_set_state(pipeline, GST_STATE_PLAYING);
+  auto bus = gst_element_get_bus(pipeline);
+  CHECK_NOTNULL(bus);
+  auto msg = gst_bus_timed_pop_filtered(
+      bus, GST_CLOCK_TIME_NONE, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  bool ok = true;
+  if (msg && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+    GError* error;
+    gst_message_parse_error(msg, &error, nullptr);
+    LOG(ERROR) << error->message;
+    g_error_free(error);
+    ok = false;
+  }
+  if (msg) gst_message_unref(msg);
+  gst_object_unref(bus);
+  gst_element_set_state(pipeline, GST_STATE_NULL);
+  gst_object_unref(pipeline);
+  for (const auto& dump : dumps) {
+    LOG(INFO) << dump->name << ": dumped " << dump->writer.get_frame_count() << " frames";
+    ok = ok && !dump->failed;
+  }
+  return ok;
+}
+
+ReplayStats replay_frames(
+    const FrameDump& dump, const ReplayOptions& options, const std::function<void(Frame)>& cb) {
+  std::vector<double> latencies;
+  latencies.reserve(dump.size());
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < dump.size(); ++i) {
+    if (options.fps > 0) {
+      // Frames are due on a fixed schedule, a late frame doesn't delay the next ones.
+      std::this_thread::sleep_until(
+          start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                      std::chrono::duration<double>(i / options.fps)));
+    }
+    const auto begin = std::chrono::steady_clock::now();
+    cb(Frame(dump.frame(i), dump.get_frame_bytes(), i));
+    latencies.push_back(
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin)
+            .count());
+  }
+  ReplayStats stats;
+  stats.frames = dump.size();
+  stats.seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::sort(latencies.begin(), latencies.end());
+  stats.p50_ms = percentile(latencies, 0.50);
+  stats.p95_ms = percentile(latencies, 0.95);
+  stats.p99_ms = percentile(latencies, 0.99);
+  return stats;
+}
+
+SceneRecorder::SceneRecorder(int num_streams) {
+  for (int i = 0; i < num_streams; ++i) streams_.emplace_back(new StreamLog);
+}
+
+void SceneRecorder::set_scene(int stream, const OverlayScene& scene) {
+  auto& log = *streams_[stream];
+  absl::MutexLock l(&log.lock);
+  absl::StrAppendFormat(&log.text, "stream %d scene %d\n", stream, log.scenes++);
+  for (const auto& box : scene.get_boxes()) {
+    absl::StrAppendFormat(
+        &log.text, "  box %.1f %.1f %d %d rgb(%d,%d,%d)%s\n", box.x, box.y, box.w, box.h,
+        box.color.r, box.color.g, box.color.b, box.filled ? " filled" : "");
+  }
+  for (const auto& label : scene.get_labels()) {
+    absl::StrAppendFormat(
+        &log.text, "  label %.1f %.1f rgb(%d,%d,%d) %s\n", label.x, label.y, label.color.r,
+        label.color.g, label.color.b, label.text);
+  }
+}
+
+bool SceneRecorder::write(const std::string& path) const {
+  std::ofstream file(path);
+  for (const auto& log : streams_) {
+    absl::MutexLock l(&log->lock);
+    file << log->text;
+  }
+  return file.good();
+}
+
+}  // namespace coral
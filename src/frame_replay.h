@@ -0,0 +1,151 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MANUFACTURING_DEMO_FRAME_REPLAY_H_
+#define MANUFACTURING_DEMO_FRAME_REPLAY_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "frame.h"
+#include "image_utils.h"
+#include "overlay.h"
+
+namespace coral {
+
+// A frame dump is a FrameDumpHeader followed by raw frames of the size it
+// describes, back to back. The frame count follows from the file size, so a
+// dump cut short by an interrupt is still valid.
+struct FrameDumpHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t height, width, channels;
+  uint32_t reserved;
+};
+constexpr char kFrameDumpMagic[4] = {'C', 'F', 'D', 'P'};
+constexpr uint32_t kFrameDumpVersion = 1;
+
+// Appends frames of one size to a new frame dump.
+class FrameDumpWriter {
+public:
+  FrameDumpWriter() = default;
+  ~FrameDumpWriter() { close(); }
+  FrameDumpWriter(const FrameDumpWriter&) = delete;
+  FrameDumpWriter& operator=(const FrameDumpWriter&) = delete;
+
+  // Creates `path` for frames of `dims`. Returns false if it can't be written.
+  bool open(const std::string& path, const ImageDims& dims);
+  // Appends a frame, which must be exactly get_frame_bytes() long. Returns
+  // false on a size mismatch or a write error.
+  bool write(const uint8_t* data, size_t size);
+  void close();
+  size_t get_frame_bytes() const { return frame_bytes_; }
+  uint64_t get_frame_count() const { return frame_count_; }
+
+private:
+  FILE* file_ = nullptr;
+  size_t frame_bytes_ = 0;
+  uint64_t frame_count_ = 0;
+};
+
+// A frame dump mapped read only. Frames are paged in from the file as they
+// are read, without copies.
+class FrameDump {
+public:
+  FrameDump() = default;
+  ~FrameDump();
+  FrameDump(const FrameDump&) = delete;
+  FrameDump& operator=(const FrameDump&) = delete;
+
+  // Maps the dump at `path`. Returns false if it is missing or malformed.
+  bool open(const std::string& path);
+  size_t size() const { return frame_count_; }
+  const ImageDims& get_dims() const { return dims_; }
+  size_t get_frame_bytes() const { return frame_bytes_; }
+  // Returns the pixels of frame `index`.
+  const uint8_t* frame(size_t index) const { return frames_ + index * frame_bytes_; }
+
+private:
+  void* mapping_ = nullptr;
+  size_t mapping_bytes_ = 0;
+  const uint8_t* frames_ = nullptr;
+  ImageDims dims_{};
+  size_t frame_bytes_ = 0;
+  size_t frame_count_ = 0;
+};
+
+// Runs `pipeline_string` until end of stream and writes every frame reaching
+// its appsinks to a frame dump, `sinks` pairing the name of each appsink with
+// the path of its dump. Frames must be of `dims`. Returns false on a
+// pipeline error.
+bool dump_frames(
+    const std::string& pipeline_string,
+    const std::vector<std::pair<std::string, std::string>>& sinks, const ImageDims& dims);
+
+struct ReplayOptions {
+  // Frames fed per second, 0 to feed the next frame as soon as the callback
+  // returns.
+  double fps = 0;
+};
+
+// How a replay went. Latencies are the time the callback took per frame.
+struct ReplayStats {
+  uint64_t frames = 0;
+  double seconds = 0;
+  double p50_ms = 0;
+  double p95_ms = 0;
+  double p99_ms = 0;
+};
+
+// Nearest rank `q` quantile of sorted `values`, 0 when empty.
+double percentile(const std::vector<double>& values, double q);
+
+// Feeds every frame of `dump` to `cb` in order, on the calling thread, as
+// Frames pointing into the mapping.
+ReplayStats replay_frames(
+    const FrameDump& dump, const ReplayOptions& options, const std::function<void(Frame)>& cb);
+
+// Keeps every scene as text, a line per box and label, so the results of two
+// runs over the same frames can be diffed.
+class SceneRecorder : public Overlay {
+public:
+  explicit SceneRecorder(int num_streams);
+  SceneRecorder(const SceneRecorder&) = delete;
+  SceneRecorder& operator=(const SceneRecorder&) = delete;
+
+  void set_scene(int stream, const OverlayScene& scene) override;
+  // Writes the scenes of every stream to `path`, stream after stream, each in
+  // the order it was set. Returns false if the file can't be written.
+  bool write(const std::string& path) const;
+
+private:
+  struct StreamLog {
+    absl::Mutex lock;
+    std::string text GUARDED_BY(lock);
+    uint64_t scenes GUARDED_BY(lock) = 0;
+  };
+  std::vector<std::unique_ptr<StreamLog>> streams_;
+};
+
+}  // namespace coral
+
+#endif  // MANUFACTURING_DEMO_FRAME_REPLAY_H_
@@ -0,0 +1,193 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MANUFACTURING_DEMO_FRAME_RING_H_
+#define MANUFACTURING_DEMO_FRAME_RING_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "absl/synchronization/mutex.h"
+
+namespace coral {
+
+// What a full FrameRing does with a new frame.
+enum class DropPolicy {
+  // Evict the oldest queued frame to make room, keeps latency lowest.
+  kDropOldest,
+  // Discard the new frame.
+  kDropNewest,
+  // Wait for the consumer, back pressure reaches the GStreamer pipeline.
+  kBlock,
+};
+
+// Parses "drop_oldest", "drop_newest" or "block" into `policy`. Returns false
+// on an unknown name.
+inline bool parse_drop_policy(const std::string& name, DropPolicy* policy) {
+  if (name == "drop_oldest") {
+    *policy = DropPolicy::kDropOldest;
+  } else if (name == "drop_newest") {
+    *policy = DropPolicy::kDropNewest;
+  } else if (name == "block") {
+    *policy = DropPolicy::kBlock;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Bounded lock-free ring for handing frames from a capture thread to a
+// worker. There is a single producer. Pops may come from the consumer and
+// from the producer itself when it evicts the oldest frame, so slots are
+// claimed with per-slot sequence numbers (Vyukov's bounded queue) rather
+// than plain head/tail indices. Blocking waits only take a mutex when
+// somebody is actually waiting.
+template <typename T>
+class FrameRing {
+public:
+  explicit FrameRing(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) size *= 2;
+    mask_ = size - 1;
+    cells_.reset(new Cell[size]);
+    for (size_t i = 0; i < size; ++i) cells_[i].seq.store(i, std::memory_order_relaxed);
+  }
+  FrameRing(const FrameRing&) = delete;
+  FrameRing& operator=(const FrameRing&) = delete;
+
+  // Queues `item`, returns false if the ring is full.
+  bool try_push(T item) {
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+      cell = &cells_[pos & mask_];
+      const size_t seq = cell->seq.load(std::memory_order_acquire);
+      const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    cell->value = item;
+    cell->seq.store(pos + 1, std::memory_order_release);
+    wake();
+    return true;
+  }
+
+  // Takes the oldest item, returns false if the ring is empty.
+  bool try_pop(T* item) {
+    size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+      cell = &cells_[pos & mask_];
+      const size_t seq = cell->seq.load(std::memory_order_acquire);
+      const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+      if (diff == 0) {
+        if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    *item = cell->value;
+    cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+    wake();
+    return true;
+  }
+
+  // Blocks until an item is available and takes it. Returns false once the
+  // ring has been closed and drained.
+  bool pop(T* item) {
+    while (!try_pop(item)) {
+      if (closed_.load(std::memory_order_acquire)) return try_pop(item);
+      wait([this] { return size() > 0 || closed_.load(std::memory_order_acquire); });
+    }
+    return true;
+  }
+
+  // Blocks until there is room and queues `item`. Returns false if the ring
+  // was closed first, `item` is left to the caller.
+  bool push(T item) {
+    while (!try_push(item)) {
+      if (closed_.load(std::memory_order_acquire)) return false;
+      wait([this] { return size() <= mask_ || closed_.load(std::memory_order_acquire); });
+    }
+    return true;
+  }
+
+  // Wakes every blocked push and pop, which then stop waiting.
+  void close() {
+    closed_.store(true, std::memory_order_release);
+    absl::MutexLock l(&lock_);
+    cond_.SignalAll();
+  }
+
+  // Number of queued items, approximate while other threads are active.
+  size_t size() const {
+    const size_t enqueued = enqueue_pos_.load(std::memory_order_acquire);
+    const size_t dequeued = dequeue_pos_.load(std::memory_order_acquire);
+    return enqueued > dequeued ? enqueued - dequeued : 0;
+  }
+  size_t capacity() const { return mask_ + 1; }
+
+private:
+  struct Cell {
+    std::atomic<size_t> seq;
+    T value;
+  };
+
+  template <typename Predicate>
+  void wait(Predicate ready) {
+    waiters_.fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    {
+      absl::MutexLock l(&lock_);
+      while (!ready()) cond_.Wait(&lock_);
+    }
+    waiters_.fetch_sub(1);
+  }
+
+  void wake() {
+    // Pairs with the fetch_add in wait(): either the waiter sees the new
+    // state when it checks under the lock, or we see the waiter here.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters_.load() > 0) {
+      absl::MutexLock l(&lock_);
+      cond_.SignalAll();
+    }
+  }
+
+  std::unique_ptr<Cell[]> cells_;
+  size_t mask_;
+  // Kept on separate cache lines so producer and consumer don't false share.
+  alignas(64) std::atomic<size_t> enqueue_pos_{0};
+  alignas(64) std::atomic<size_t> dequeue_pos_{0};
+  alignas(64) std::atomic<int> waiters_{0};
+  std::atomic<bool> closed_{false};
+  absl::Mutex lock_;
+  absl::CondVar cond_;
+};
+
+}  // namespace coral
+
+#endif  // MANUFACTURING_DEMO_FRAME_RING_H_
@@ -14,16 +14,446 @@
 
 #include "image_utils.h"
 
-#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 
 #include "glog/logging.h"
-#include "tensorflow/lite/builtin_op_data.h"
-#include "tensorflow/lite/interpreter.h"
-#include "tensorflow/lite/kernels/register.h"
-#include "tensorflow/lite/model.h"
+
+// IMAGE_UTILS_SCALAR builds only the plain C++ paths, which the tests
+// compare with the vector ones.
+#if defined(IMAGE_UTILS_SCALAR)
+#elif defined(__SSE2__)
+#define IMAGE_UTILS_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define IMAGE_UTILS_NEON
+#include <arm_neon.h>
+#endif
 
 namespace coral {
 
+namespace {
+
+// Source pixels contributing to one output row or column.
+struct ResizeTap {
+  int first;    // First source index.
+  int count;    // Number of consecutive source indices.
+  int weights;  // Offset of the first weight in ResizeTable::weights.
+};
+
+// Separable resize weights along one axis.
+struct ResizeTable {
+  std::vector<ResizeTap> taps;
+  std::vector<float> weights;
+  int max_count;
+};
+
+
+// Same sampling as TFLite RESIZE_BILINEAR without align_corners or
+// half_pixel_centers, including its float scale computation.
+void build_bilinear_table(int in_size, int out_size, ResizeTable* table) {
+  const float scale = static_cast<float>(in_size) / out_size;
+  table->taps.resize(out_size);
+  table->weights.resize(2 * out_size);
+  table->max_count = 2;
+  for (int o = 0; o < out_size; ++o) {
+    const float src = o * scale;
+    const int i0 = std::min(static_cast<int>(std::floor(src)), in_size - 1);
+    const float frac = src - i0;
+    auto& tap = table->taps[o];
+    tap.first = i0;
+    tap.weights = 2 * o;
+    if (i0 + 1 < in_size) {
+      tap.count = 2;
+      table->weights[2 * o] = 1.0f - frac;
+      table->weights[2 * o + 1] = frac;
+    } else {
+      tap.count = 1;
+      table->weights[2 * o] = 1.0f;
+    }
+  }
+}
+
+// Every source pixel is weighted by how much of it the output pixel covers.
+void build_area_table(int in_size, int out_size, ResizeTable* table) {
+  const double scale = static_cast<double>(in_size) / out_size;
+  table->taps.resize(out_size);
+  table->weights.clear();
+  table->max_count = 0;
+  for (int o = 0; o < out_size; ++o) {
+    const double start = o * scale;
+    const double end = std::min((o + 1) * scale, static_cast<double>(in_size));
+    const int first = std::min(static_cast<int>(start), in_size - 1);
+    const int last = std::max(first, std::min(static_cast<int>(std::ceil(end)), in_size) - 1);
+    auto& tap = table->taps[o];
+    tap.first = first;
+    tap.count = last - first + 1;
+    tap.weights = table->weights.size();
+    for (int i = first; i <= last; ++i) {
+      const double covered = std::min(end, i + 1.0) - std::max(start, static_cast<double>(i));
+      table->weights.push_back(static_cast<float>(covered / (end - start)));
+    }
+    table->max_count = std::max(table->max_count, tap.count);
+  }
+}
+
+void build_table(ResizeMethod method, int in_size, int out_size, ResizeTable* table) {
+  if (method == ResizeMethod::kArea) {
+    build_area_table(in_size, out_size, table);
+  } else {
+    build_bilinear_table(in_size, out_size, table);
+  }
+}
+
+// Resizes one source row horizontally into floats. Source pixels are `step`
+// bytes apart, and `channels` values are read from each, at `offsets` if set
+// or else from the first bytes of the pixel.
+void resize_row(
+    const uint8_t* src, int step, int channels, const int* offsets, const ResizeTable& table,
+    float* dst) {
+  if (offsets) {
+    for (const auto& tap : table.taps) {
+      const float* w = &table.weights[tap.weights];
+      for (int c = 0; c < channels; ++c) {
+        const uint8_t* p = src + tap.first * step + offsets[c];
+        float v = 0;
+        for (int k = 0; k < tap.count; ++k, p += step) {
+          v += w[k] * *p;
+        }
+        *dst++ = v;
+      }
+    }
+    return;
+  }
+  if (channels == 3 && step == 3) {
+    for (const auto& tap : table.taps) {
+      const float* w = &table.weights[tap.weights];
+      const uint8_t* p = src + tap.first * 3;
+      float r = 0, g = 0, b = 0;
+      for (int k = 0; k < tap.count; ++k, p += 3) {
+        r += w[k] * p[0];
+        g += w[k] * p[1];
+        b += w[k] * p[2];
+      }
+      dst[0] = r;
+      dst[1] = g;
+      dst[2] = b;
+      dst += 3;
+    }
+    return;
+  }
+  for (const auto& tap : table.taps) {
+    const float* w = &table.weights[tap.weights];
+    for (int c = 0; c < channels; ++c) {
+      const uint8_t* p = src + tap.first * step + c;
+      float v = 0;
+      for (int k = 0; k < tap.count; ++k, p += step) {
+        v += w[k] * *p;
+      }
+      *dst++ = v;
+    }
+  }
+}
+
+// out[i] = saturate(truncate(bias + sum_k weights[k] * rows[k][i])).
+void blend_rows(
+    const float* const* rows, const float* weights, int count, int n, float bias, uint8_t* out) {
+  int i = 0;
+#if defined(IMAGE_UTILS_SSE2)
+  for (; i + 16 <= n; i += 16) {
+    __m128 a0 = _mm_set1_ps(bias), a1 = a0, a2 = a0, a3 = a0;
+    for (int k = 0; k < count; ++k) {
+      const __m128 w = _mm_set1_ps(weights[k]);
+      const float* r = rows[k] + i;
+      a0 = _mm_add_ps(a0, _mm_mul_ps(w, _mm_loadu_ps(r)));
+      a1 = _mm_add_ps(a1, _mm_mul_ps(w, _mm_loadu_ps(r + 4)));
+      a2 = _mm_add_ps(a2, _mm_mul_ps(w, _mm_loadu_ps(r + 8)));
+      a3 = _mm_add_ps(a3, _mm_mul_ps(w, _mm_loadu_ps(r + 12)));
+    }
+    const __m128i lo = _mm_packs_epi32(_mm_cvttps_epi32(a0), _mm_cvttps_epi32(a1));
+    const __m128i hi = _mm_packs_epi32(_mm_cvttps_epi32(a2), _mm_cvttps_epi32(a3));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(lo, hi));
+  }
+#elif defined(IMAGE_UTILS_NEON)
+  for (; i + 16 <= n; i += 16) {
+    float32x4_t a0 = vdupq_n_f32(bias), a1 = a0, a2 = a0, a3 = a0;
+    for (int k = 0; k < count; ++k) {
+      const float w = weights[k];
+      const float* r = rows[k] + i;
+      a0 = vaddq_f32(a0, vmulq_n_f32(vld1q_f32(r), w));
+      a1 = vaddq_f32(a1, vmulq_n_f32(vld1q_f32(r + 4), w));
+      a2 = vaddq_f32(a2, vmulq_n_f32(vld1q_f32(r + 8), w));
+      a3 = vaddq_f32(a3, vmulq_n_f32(vld1q_f32(r + 12), w));
+    }
+    const int16x8_t lo =
+        vcombine_s16(vqmovn_s32(vcvtq_s32_f32(a0)), vqmovn_s32(vcvtq_s32_f32(a1)));
+    const int16x8_t hi =
+        vcombine_s16(vqmovn_s32(vcvtq_s32_f32(a2)), vqmovn_s32(vcvtq_s32_f32(a3)));
+    vst1q_u8(out + i, vcombine_u8(vqmovun_s16(lo), vqmovun_s16(hi)));
+  }
+#endif
+  for (; i < n; ++i) {
+    float v = bias;
+    for (int k = 0; k < count; ++k) {
+      v += weights[k] * rows[k][i];
+    }
+    out[i] = static_cast<uint8_t>(std::min(std::max(static_cast<int>(v), 0), 255));
+  }
+}
+
+// Resizes one plane of an image an output row at a time. Output rows walk
+// the source top to bottom, so a ring of max_count rows computes every
+// source row horizontally at most once. Kept per thread so the steady state
+// of a resize doesn't allocate.
+class PlaneResizer {
+public:
+  // Sets up resizing `in`, of pixels `step` bytes apart, to `out_height` rows
+  // of `out_width` pixels. See resize_row() for `channels` and `offsets`.
+  void init(
+      const uint8_t* in, int in_height, int in_width, int in_stride, int step, int channels,
+      const int* offsets, int out_height, int out_width, ResizeMethod method) {
+    in_ = in;
+    in_stride_ = in_stride;
+    step_ = step;
+    channels_ = channels;
+    offsets_ = offsets;
+    build_table(method, in_width, out_width, &x_table_);
+    build_table(method, in_height, out_height, &y_table_);
+    row_size_ = out_width * channels;
+    const int cached_rows = y_table_.max_count;
+    rows_.resize(static_cast<size_t>(cached_rows) * row_size_);
+    row_tags_.assign(cached_rows, -1);
+    row_ptrs_.resize(cached_rows);
+    // Bilinear truncates like the float TFLite kernel followed by a uint8
+    // cast, area rounds to nearest.
+    bias_ = method == ResizeMethod::kArea ? 0.5f : 0.0f;
+  }
+
+  // Writes output row `y`, row_size() bytes.
+  void resize_row_to(int y, uint8_t* out) {
+    const auto& tap = y_table_.taps[y];
+    const int cached_rows = row_tags_.size();
+    for (int k = 0; k < tap.count; ++k) {
+      const int src_y = tap.first + k;
+      const int slot = src_y % cached_rows;
+      float* row = &rows_[static_cast<size_t>(slot) * row_size_];
+      if (row_tags_[slot] != src_y) {
+        resize_row(
+            in_ + static_cast<size_t>(src_y) * in_stride_, step_, channels_, offsets_, x_table_,
+            row);
+        row_tags_[slot] = src_y;
+      }
+      row_ptrs_[k] = row;
+    }
+    blend_rows(
+        row_ptrs_.data(), &y_table_.weights[tap.weights], tap.count, row_size_, bias_, out);
+  }
+
+  int row_size() const { return row_size_; }
+
+private:
+  const uint8_t* in_ = nullptr;
+  int in_stride_ = 0;
+  int step_ = 0;
+  int channels_ = 0;
+  const int* offsets_ = nullptr;
+  ResizeTable x_table_, y_table_;
+  int row_size_ = 0;
+  float bias_ = 0;
+  // Horizontally resized source rows, cached by source row index.
+  std::vector<float> rows_;
+  std::vector<int> row_tags_;
+  std::vector<const float*> row_ptrs_;
+};
+
+void resize_impl(
+    const uint8_t* in, int in_height, int in_width, int channels, int in_stride, int out_height,
+    int out_width, uint8_t* out, ResizeMethod method) {
+  static thread_local PlaneResizer resizer;
+  resizer.init(
+      in, in_height, in_width, in_stride, /*step=*/channels, channels, /*offsets=*/nullptr,
+      out_height, out_width, method);
+  for (int y = 0; y < out_height; ++y) {
+    resizer.resize_row_to(y, out + static_cast<size_t>(y) * resizer.row_size());
+  }
+}
+
+// Fixed point YUV to RGB coefficients, scaled by 64 so every product fits 16
+// bits.
+struct YuvCoefficients {
+  int16_t y, rv, gu, gv, bu;
+};
+constexpr YuvCoefficients kBt601{74, 102, -25, -52, 129};
+constexpr YuvCoefficients kBt709{74, 115, -14, -34, 135};
+
+// Converts `n` pixels of limited range YUV to packed RGB. U and V are read
+// `uv_step` bytes apart, 2 when they are interleaved.
+void yuv_row_to_rgb(
+    const uint8_t* y, const uint8_t* u, const uint8_t* v, int uv_step, int n,
+    const YuvCoefficients& k, uint8_t* rgb) {
+  int i = 0;
+#if defined(IMAGE_UTILS_SSE2)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i y_offset = _mm_set1_epi16(16);
+  const __m128i uv_offset = _mm_set1_epi16(128);
+  const __m128i round = _mm_set1_epi16(32);
+  const __m128i low_bytes = _mm_set1_epi16(0xff);
+  const __m128i ky = _mm_set1_epi16(k.y);
+  const __m128i krv = _mm_set1_epi16(k.rv);
+  const __m128i kgu = _mm_set1_epi16(k.gu);
+  const __m128i kgv = _mm_set1_epi16(k.gv);
+  const __m128i kbu = _mm_set1_epi16(k.bu);
+  alignas(16) uint8_t r8[16], g8[16], b8[16];
+  for (; i + 8 <= n; i += 8) {
+    __m128i yy = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(y + i)), zero);
+    __m128i uu, vv;
+    if (uv_step == 2) {
+      const __m128i uv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(u + 2 * i));
+      uu = _mm_and_si128(uv, low_bytes);
+      vv = _mm_srli_epi16(uv, 8);
+    } else {
+      uu = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(u + i)), zero);
+      vv = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(v + i)), zero);
+    }
+    // Sums past 16 bits saturate, which only happens above 255 anyway.
+    yy = _mm_adds_epi16(_mm_mullo_epi16(_mm_sub_epi16(yy, y_offset), ky), round);
+    uu = _mm_sub_epi16(uu, uv_offset);
+    vv = _mm_sub_epi16(vv, uv_offset);
+    const __m128i r = _mm_srai_epi16(_mm_adds_epi16(yy, _mm_mullo_epi16(vv, krv)), 6);
+    const __m128i g = _mm_srai_epi16(
+        _mm_adds_epi16(_mm_adds_epi16(yy, _mm_mullo_epi16(uu, kgu)), _mm_mullo_epi16(vv, kgv)), 6);
+    const __m128i b = _mm_srai_epi16(_mm_adds_epi16(yy, _mm_mullo_epi16(uu, kbu)), 6);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(r8), _mm_packus_epi16(r, r));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(g8), _mm_packus_epi16(g, g));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(b8), _mm_packus_epi16(b, b));
+    // SSE2 has no byte shuffle to interleave with.
+    for (int j = 0; j < 8; ++j, rgb += 3) {
+      rgb[0] = r8[j];
+      rgb[1] = g8[j];
+      rgb[2] = b8[j];
+    }
+  }
+#elif defined(IMAGE_UTILS_NEON)
+  for (; i + 8 <= n; i += 8) {
+    uint8x8_t u8, v8;
+    if (uv_step == 2) {
+      const uint8x8x2_t uv = vld2_u8(u + 2 * i);
+      u8 = uv.val[0];
+      v8 = uv.val[1];
+    } else {
+      u8 = vld1_u8(u + i);
+      v8 = vld1_u8(v + i);
+    }
+    int16x8_t yy = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(y + i)));
+    const int16x8_t uu = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(u8)), vdupq_n_s16(128));
+    const int16x8_t vv = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(v8)), vdupq_n_s16(128));
+    // Sums past 16 bits saturate, which only happens above 255 anyway.
+    yy = vqaddq_s16(vmulq_n_s16(vsubq_s16(yy, vdupq_n_s16(16)), k.y), vdupq_n_s16(32));
+    const int16x8_t r = vshrq_n_s16(vqaddq_s16(yy, vmulq_n_s16(vv, k.rv)), 6);
+    const int16x8_t g =
+        vshrq_n_s16(vqaddq_s16(vqaddq_s16(yy, vmulq_n_s16(uu, k.gu)), vmulq_n_s16(vv, k.gv)), 6);
+    const int16x8_t b = vshrq_n_s16(vqaddq_s16(yy, vmulq_n_s16(uu, k.bu)), 6);
+    uint8x8x3_t pixels;
+    pixels.val[0] = vqmovun_s16(r);
+    pixels.val[1] = vqmovun_s16(g);
+    pixels.val[2] = vqmovun_s16(b);
+    vst3_u8(rgb, pixels);
+    rgb += 24;
+  }
+#endif
+  for (; i < n; ++i, rgb += 3) {
+    const int yy = (y[i] - 16) * k.y + 32;
+    const int uu = u[i * uv_step] - 128;
+    const int vv = v[i * uv_step] - 128;
+    rgb[0] = std::min(std::max((yy + k.rv * vv) >> 6, 0), 255);
+    rgb[1] = std::min(std::max((yy + k.gu * uu + k.gv * vv) >> 6, 0), 255);
+    rgb[2] = std::min(std::max((yy + k.bu * uu) >> 6, 0), 255);
+  }
+}
+
+}  // namespace
+
+Letterbox get_letterbox(int in_width, int in_height, const ImageDims& out_dims) {
+  const double scale = std::min(
+      static_cast<double>(out_dims[1]) / in_width, static_cast<double>(out_dims[0]) / in_height);
+  Letterbox box;
+  box.width = std::min(std::max(static_cast<int>(std::lround(in_width * scale)), 1), out_dims[1]);
+  box.height =
+      std::min(std::max(static_cast<int>(std::lround(in_height * scale)), 1), out_dims[0]);
+  box.x = (out_dims[1] - box.width) / 2;
+  box.y = (out_dims[0] - box.height) / 2;
+  return box;
+}
+
+void yuv_to_rgb_resize(
+    const YuvImage& in, const ImageDims& out_dims, uint8_t* out, bool letterbox,
+    ResizeMethod method) {
+  CHECK_EQ(out_dims[2], 3);
+  CHECK_GT(in.width, 0);
+  CHECK_GT(in.height, 0);
+  const int out_stride = out_dims[1] * 3;
+  Letterbox box{0, 0, out_dims[1], out_dims[0]};
+  if (letterbox) {
+    box = get_letterbox(in.width, in.height, out_dims);
+    std::memset(out, 0, static_cast<size_t>(out_dims[0]) * out_stride);
+  }
+  // Chroma is resized straight to the output size, which upsamples it on
+  // the way.
+  static thread_local PlaneResizer luma, chroma, chroma_v;
+  static thread_local std::vector<uint8_t> rows;
+  static constexpr int kYuy2Luma[] = {0};
+  static constexpr int kYuy2Chroma[] = {1, 3};
+  const int chroma_width = (in.width + 1) / 2;
+  const int chroma_height = (in.height + 1) / 2;
+  switch (in.format) {
+    case PixelFormat::kNv12:
+      luma.init(
+          in.planes[0], in.height, in.width, in.strides[0], /*step=*/1, /*channels=*/1, nullptr,
+          box.height, box.width, method);
+      chroma.init(
+          in.planes[1], chroma_height, chroma_width, in.strides[1], /*step=*/2, /*channels=*/2,
+          nullptr, box.height, box.width, method);
+      break;
+    case PixelFormat::kI420:
+      luma.init(
+          in.planes[0], in.height, in.width, in.strides[0], /*step=*/1, /*channels=*/1, nullptr,
+          box.height, box.width, method);
+      chroma.init(
+          in.planes[1], chroma_height, chroma_width, in.strides[1], /*step=*/1, /*channels=*/1,
+          nullptr, box.height, box.width, method);
+      chroma_v.init(
+          in.planes[2], chroma_height, chroma_width, in.strides[2], /*step=*/1, /*channels=*/1,
+          nullptr, box.height, box.width, method);
+      break;
+    case PixelFormat::kYuy2:
+      // Chroma has the full height, every pair of pixels shares a U and a V.
+      luma.init(
+          in.planes[0], in.height, in.width, in.strides[0], /*step=*/2, /*channels=*/1,
+          kYuy2Luma, box.height, box.width, method);
+      chroma.init(
+          in.planes[0], in.height, chroma_width, in.strides[0], /*step=*/4, /*channels=*/2,
+          kYuy2Chroma, box.height, box.width, method);
+      break;
+    case PixelFormat::kRgb:
+      LOG(FATAL) << "RGB input is resized with resize_image()";
+  }
+  const bool planar = in.format == PixelFormat::kI420;
+  rows.resize(4 * box.width);
+  uint8_t* y_row = rows.data();
+  uint8_t* u_row = y_row + box.width;
+  uint8_t* v_row = planar ? u_row + box.width : u_row + 1;
+  const auto& coefficients = in.matrix == YuvMatrix::kBt709 ? kBt709 : kBt601;
+  for (int y = 0; y < box.height; ++y) {
+    luma.resize_row_to(y, y_row);
+    chroma.resize_row_to(y, u_row);
+    if (planar) chroma_v.resize_row_to(y, v_row);
+    yuv_row_to_rgb(
+        y_row, u_row, v_row, planar ? 1 : 2, box.width, coefficients,
+        out + static_cast<size_t>(y + box.y) * out_stride + box.x * 3);
+  }
+}
+
 std::vector<uint8_t> crop_image(
     uint8_t* pixels, const ImageDims& image_dim, const BoundingBox& crop_area) {
   std::vector<uint8_t> cropped_image;
@@ -43,55 +473,65 @@ std::vector<uint8_t> crop_image(
 
 std::vector<uint8_t> resize_image(
     const uint8_t* in, const ImageDims& in_dims, const ImageDims& out_dims) {
-  const int image_height = in_dims[0];
-  const int image_width = in_dims[1];
-  const int image_channels = in_dims[2];
-  const int wanted_height = out_dims[0];
-  const int wanted_width = out_dims[1];
-  const int wanted_channels = out_dims[2];
-  const int number_of_pixels = image_height * image_width * image_channels;
-  std::unique_ptr<tflite::Interpreter> interpreter(new tflite::Interpreter);
-  int base_index = 0;
-  // two inputs: input and new_sizes
-  interpreter->AddTensors(2, &base_index);
-  // one output
-  interpreter->AddTensors(1, &base_index);
-  // set input and output tensors
-  interpreter->SetInputs({0, 1});
-  interpreter->SetOutputs({2});
-  // set parameters of tensors
-  TfLiteQuantizationParams quant;
-  interpreter->SetTensorParametersReadWrite(
-      0, kTfLiteFloat32, "input", {1, image_height, image_width, image_channels}, quant);
-  interpreter->SetTensorParametersReadWrite(1, kTfLiteInt32, "new_size", {2}, quant);
-  interpreter->SetTensorParametersReadWrite(
-      2, kTfLiteFloat32, "output", {1, wanted_height, wanted_width, wanted_channels}, quant);
-  tflite::ops::builtin::BuiltinOpResolver resolver;
-  const TfLiteRegistration* resize_op = resolver.FindOp(tflite::BuiltinOperator_RESIZE_BILINEAR, 1);
-  auto* params =
-      reinterpret_cast<TfLiteResizeBilinearParams*>(malloc(sizeof(TfLiteResizeBilinearParams)));
-  params->align_corners = false;
-  interpreter->AddNodeWithParameters({0, 1}, {2}, nullptr, 0, params, resize_op, nullptr);
-  interpreter->AllocateTensors();
-  // fill input image
-  // in[] are integers, cannot do memcpy() directly
-  auto input = interpreter->typed_tensor<float>(0);
-  for (int i = 0; i < number_of_pixels; i++) {
-    input[i] = in[i];
-  }
-  // fill new_sizes
-  interpreter->typed_tensor<int>(1)[0] = wanted_height;
-  interpreter->typed_tensor<int>(1)[1] = wanted_width;
-  interpreter->Invoke();
-
   std::vector<uint8_t> out;
   out.resize(out_dims[0] * out_dims[1] * out_dims[2]);
-  auto output = interpreter->typed_tensor<float>(2);
-  auto output_number_of_pixels = wanted_height * wanted_height * wanted_channels;
-  for (int i = 0; i < output_number_of_pixels; i++) {
-    out[i] = static_cast<uint8_t>(output[i]);
-  }
+  resize_image(in, in_dims, /*in_stride=*/0, out_dims, out.data());
   return out;
 }
 
-}  // namespace coral
\ No newline at end of file
+void resize_image(
+    const uint8_t* in, const ImageDims& in_dims, int in_stride, const ImageDims& out_dims,
+    uint8_t* out, ResizeMethod method) {
+  CHECK_EQ(in_dims[2], out_dims[2]) << "Channel conversion is not supported";
+  CHECK_GT(in_dims[0], 0);
+  CHECK_GT(in_dims[1], 0);
+  if (in_stride == 0) in_stride = in_dims[1] * in_dims[2];
+  resize_impl(
+      in, in_dims[0], in_dims[1], in_dims[2], in_stride, out_dims[0], out_dims[1], out, method);
+}
+
+bool crop_and_resize(
+    const uint8_t* in, const ImageDims& in_dims, int in_stride, const BoundingBox& crop_area,
+    const ImageDims& out_dims, uint8_t* out, ResizeMethod method) {
+  CHECK_EQ(in_dims[2], out_dims[2]) << "Channel conversion is not supported";
+  const int ymin = std::max(crop_area.ymin, 0);
+  const int xmin = std::max(crop_area.xmin, 0);
+  const int ymax = std::min(crop_area.ymax, in_dims[0]);
+  const int xmax = std::min(crop_area.xmax, in_dims[1]);
+  if (ymax <= ymin || xmax <= xmin) return false;
+  if (in_stride == 0) in_stride = in_dims[1] * in_dims[2];
+  const uint8_t* origin = in + static_cast<size_t>(ymin) * in_stride + xmin * in_dims[2];
+  resize_impl(
+      origin, ymax - ymin, xmax - xmin, in_dims[2], in_stride, out_dims[0], out_dims[1], out,
+      method);
+  return true;
+}
+
+uint32_t sum_abs_diff(const uint8_t* a, const uint8_t* b, size_t n) {
+  uint32_t sum = 0;
+  size_t i = 0;
+#if defined(IMAGE_UTILS_SSE2)
+  __m128i acc = _mm_setzero_si128();
+  for (; i + 16 <= n; i += 16) {
+    const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+    const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+    // Two 16 bit sums in the low words of each 64 bit half.
+    acc = _mm_add_epi32(acc, _mm_sad_epu8(va, vb));
+  }
+  sum = _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+#elif defined(IMAGE_UTILS_NEON)
+  uint32x4_t acc = vdupq_n_u32(0);
+  for (; i + 16 <= n; i += 16) {
+    const uint8x16_t diff = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+    acc = vpadalq_u16(acc, vpaddlq_u8(diff));
+  }
+  const uint64x2_t pairs = vpaddlq_u32(acc);
+  sum = vgetq_lane_u64(pairs, 0) + vgetq_lane_u64(pairs, 1);
+#endif
+  for (; i < n; ++i) {
+    sum += a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+  }
+  return sum;
+}
+
+}  // namespace coral
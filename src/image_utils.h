@@ -18,11 +18,10 @@
 #define MANUFACTURING_DEMO_IMAGE_UTILS_H_
 
 #include <array>
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 
-#include "tensorflow/lite/interpreter.h"
-
 namespace coral {
 // Defines dimension of an image
 using ImageDims = std::array<int, 3>;
@@ -35,6 +34,64 @@ struct BoundingBox {
   int height, width;
 };
 
+// Interpolation used when resizing.
+enum class ResizeMethod {
+  // Matches TFLite RESIZE_BILINEAR with align_corners and half_pixel_centers
+  // off, to within one level per channel.
+  kBilinear,
+  // Averages every source pixel covered by an output pixel, for downscaling.
+  kArea,
+};
+
+// Layouts of the frames a stream can take from its decoder or camera.
+enum class PixelFormat {
+  // Packed 8 bit RGB.
+  kRgb,
+  // A Y plane, then a half size plane of interleaved U and V.
+  kNv12,
+  // A Y plane, then half size U and V planes.
+  kI420,
+  // Packed Y0 U Y1 V, two pixels every four bytes.
+  kYuy2,
+};
+
+// Matrix of limited range YUV, BT.601 for SD and BT.709 for HD video.
+enum class YuvMatrix {
+  kBt601,
+  kBt709,
+};
+
+// A YUV image as GStreamer maps it, each plane with its own stride. YUY2
+// only uses the first plane.
+struct YuvImage {
+  PixelFormat format;
+  YuvMatrix matrix;
+  int width;
+  int height;
+  const uint8_t* planes[3];
+  int strides[3];
+};
+
+// Where an image letterboxed into an output goes, in output pixels.
+struct Letterbox {
+  int x, y;
+  int width, height;
+};
+
+// Largest centred area of `out_dims` with the aspect ratio of an
+// `in_width` x `in_height` image.
+Letterbox get_letterbox(int in_width, int in_height, const ImageDims& out_dims);
+
+// Converts `in` to RGB and resizes it to `out_dims` in one pass, which reads
+// only the source rows the resize samples and never makes a full size RGB
+// copy: luma and chroma are resized separately, a row at a time, and each
+// output row is converted right away. With `letterbox` the aspect ratio is
+// kept and the borders are black, otherwise the image is stretched. `out` is
+// written tightly packed.
+void yuv_to_rgb_resize(
+    const YuvImage& in, const ImageDims& out_dims, uint8_t* out, bool letterbox = false,
+    ResizeMethod method = ResizeMethod::kBilinear);
+
 // Crop an image
 std::vector<uint8_t> crop_image(
     uint8_t* pixels, const ImageDims& image_dim, const BoundingBox& crop_area);
@@ -43,6 +100,23 @@ std::vector<uint8_t> crop_image(
 std::vector<uint8_t> resize_image(
     const uint8_t* in, const ImageDims& in_dim, const ImageDims& out_dims);
 
+// Resize an image from in_dims to out_dims into the caller-owned `out`, which
+// is written tightly packed. `in_stride` is the distance in bytes between
+// input rows, 0 if they are tightly packed.
+void resize_image(
+    const uint8_t* in, const ImageDims& in_dims, int in_stride, const ImageDims& out_dims,
+    uint8_t* out, ResizeMethod method = ResizeMethod::kBilinear);
+
+// Crops `crop_area` out of `in` and resizes it to `out_dims` in a single pass
+// that reads straight from the source rows, so `out` can be e.g. an input
+// tensor. The crop is clamped to the image. Returns false if it is empty.
+bool crop_and_resize(
+    const uint8_t* in, const ImageDims& in_dims, int in_stride, const BoundingBox& crop_area,
+    const ImageDims& out_dims, uint8_t* out, ResizeMethod method = ResizeMethod::kBilinear);
+
+// Sum of absolute differences between the `n` bytes at `a` and `b`.
+uint32_t sum_abs_diff(const uint8_t* a, const uint8_t* b, size_t n);
+
 }  // namespace coral
 
-#endif  // MANUFACTURING_DEMO_IMAGE_UTILS_H
\ No newline at end of file
+#endif  // MANUFACTURING_DEMO_IMAGE_UTILS_H
@@ -0,0 +1,158 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Built twice, against the SSE2 or NEON kernels of image_utils and against
+// its plain C++ ones.
+
+#include "image_utils.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "tensorflow/lite/builtin_op_data.h"
+#include "tensorflow/lite/interpreter.h"
+#include "tensorflow/lite/kernels/register.h"
+#include "tensorflow/lite/model.h"
+
+namespace coral {
+namespace {
+
+// The resize image_utils used to run: a TFLite interpreter with a single
+// float RESIZE_BILINEAR op, its output cast back to uint8.
+std::vector<uint8_t> tflite_resize_bilinear(
+    const uint8_t* in, const ImageDims& in_dims, const ImageDims& out_dims) {
+  std::unique_ptr<tflite::Interpreter> interpreter(new tflite::Interpreter);
+  int base_index = 0;
+  interpreter->AddTensors(3, &base_index);
+  interpreter->SetInputs({0, 1});
+  interpreter->SetOutputs({2});
+  TfLiteQuantizationParams quant;
+  interpreter->SetTensorParametersReadWrite(
+      0, kTfLiteFloat32, "input", {1, in_dims[0], in_dims[1], in_dims[2]}, quant);
+  interpreter->SetTensorParametersReadWrite(1, kTfLiteInt32, "new_size", {2}, quant);
+  interpreter->SetTensorParametersReadWrite(
+      2, kTfLiteFloat32, "output", {1, out_dims[0], out_dims[1], out_dims[2]}, quant);
+  tflite::ops::builtin::BuiltinOpResolver resolver;
+  const TfLiteRegistration* resize_op = resolver.FindOp(tflite::BuiltinOperator_RESIZE_BILINEAR, 1);
+  auto* params =
+      reinterpret_cast<TfLiteResizeBilinearParams*>(calloc(1, sizeof(TfLiteResizeBilinearParams)));
+  params->align_corners = false;
+  params->half_pixel_centers = false;
+  interpreter->AddNodeWithParameters({0, 1}, {2}, nullptr, 0, params, resize_op, nullptr);
+  EXPECT_EQ(interpreter->AllocateTensors(), kTfLiteOk);
+  std::copy(
+      in, in + in_dims[0] * in_dims[1] * in_dims[2], interpreter->typed_tensor<float>(0));
+  interpreter->typed_tensor<int>(1)[0] = out_dims[0];
+  interpreter->typed_tensor<int>(1)[1] = out_dims[1];
+  EXPECT_EQ(interpreter->Invoke(), kTfLiteOk);
+  const float* output = interpreter->typed_tensor<float>(2);
+  std::vector<uint8_t> out(out_dims[0] * out_dims[1] * out_dims[2]);
+  for (size_t i = 0; i < out.size(); ++i) out[i] = static_cast<uint8_t>(output[i]);
+  return out;
+}
+
+std::vector<uint8_t> random_pixels(size_t size, std::mt19937* rng) {
+  std::uniform_int_distribution<int> value(0, 255);
+  std::vector<uint8_t> pixels(size);
+  for (auto& pixel : pixels) pixel = value(*rng);
+  return pixels;
+}
+
+int max_abs_diff(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b) {
+  int diff = 0;
+  for (size_t i = 0; i < a.size(); ++i) diff = std::max(diff, std::abs(a[i] - b[i]));
+  return diff;
+}
+
+// Both resizes truncate a float sum, which the order of the additions moves
+// by one level at most.
+constexpr int kTolerance = 1;
+
+TEST(ResizeImageTest, MatchesTfliteOnRandomSizesAndStrides) {
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<int> size(1, 80);
+  std::uniform_int_distribution<int> padding(0, 9);
+  const int channels[] = {1, 3, 4};
+  for (int run = 0; run < 200; ++run) {
+    const ImageDims in_dims{size(rng), size(rng), channels[run % 3]};
+    const ImageDims out_dims{size(rng), size(rng), in_dims[2]};
+    const int stride = in_dims[1] * in_dims[2] + padding(rng);
+    const auto padded = random_pixels(in_dims[0] * stride, &rng);
+    std::vector<uint8_t> packed;
+    for (int y = 0; y < in_dims[0]; ++y) {
+      packed.insert(
+          packed.end(), padded.begin() + y * stride,
+          padded.begin() + y * stride + in_dims[1] * in_dims[2]);
+    }
+    std::vector<uint8_t> out(out_dims[0] * out_dims[1] * out_dims[2]);
+    resize_image(padded.data(), in_dims, stride, out_dims, out.data());
+    const auto expected = tflite_resize_bilinear(packed.data(), in_dims, out_dims);
+    EXPECT_LE(max_abs_diff(out, expected), kTolerance)
+        << in_dims[0] << "x" << in_dims[1] << "x" << in_dims[2] << " stride " << stride << " to "
+        << out_dims[0] << "x" << out_dims[1];
+  }
+}
+
+TEST(CropAndResizeTest, MatchesCropThenTflite) {
+  std::mt19937 rng(2);
+  const ImageDims in_dims{90, 120, 3};
+  auto image = random_pixels(in_dims[0] * in_dims[1] * in_dims[2], &rng);
+  std::uniform_int_distribution<int> y(-10, in_dims[0] + 10);
+  std::uniform_int_distribution<int> x(-10, in_dims[1] + 10);
+  std::uniform_int_distribution<int> size(1, 64);
+  int compared = 0;
+  for (int run = 0; run < 300; ++run) {
+    const int y1 = y(rng), y2 = y(rng), x1 = x(rng), x2 = x(rng);
+    const BoundingBox crop(std::min(y1, y2), std::min(x1, x2), std::max(y1, y2), std::max(x1, x2));
+    const ImageDims out_dims{size(rng), size(rng), 3};
+    std::vector<uint8_t> out(out_dims[0] * out_dims[1] * out_dims[2]);
+    // Crops are clamped to the image first.
+    const BoundingBox clamped(
+        std::max(crop.ymin, 0), std::max(crop.xmin, 0), std::min(crop.ymax, in_dims[0]),
+        std::min(crop.xmax, in_dims[1]));
+    const bool empty = clamped.height <= 0 || clamped.width <= 0;
+    ASSERT_EQ(
+        crop_and_resize(image.data(), in_dims, /*in_stride=*/0, crop, out_dims, out.data()),
+        !empty);
+    if (empty) continue;
+    const auto cropped = crop_image(image.data(), in_dims, clamped);
+    const ImageDims crop_dims{clamped.height, clamped.width, 3};
+    const auto expected = tflite_resize_bilinear(cropped.data(), crop_dims, out_dims);
+    EXPECT_LE(max_abs_diff(out, expected), kTolerance)
+        << "crop " << clamped.ymin << "," << clamped.xmin << " " << clamped.height << "x"
+        << clamped.width << " to " << out_dims[0] << "x" << out_dims[1];
+    ++compared;
+  }
+  EXPECT_GT(compared, 100);
+}
+
+// The TFLite resize only read back wanted_height * wanted_height pixels,
+// which left the bottom of outputs wider than tall black.
+TEST(ResizeImageTest, FillsWholeNonSquareOutput) {
+  const ImageDims in_dims{12, 20, 3};
+  const std::vector<uint8_t> in(in_dims[0] * in_dims[1] * in_dims[2], 200);
+  for (const ImageDims& out_dims : {ImageDims{4, 30, 3}, ImageDims{30, 4, 3}}) {
+    const auto out = resize_image(in.data(), in_dims, out_dims);
+    ASSERT_EQ(out.size(), static_cast<size_t>(out_dims[0] * out_dims[1] * out_dims[2]));
+    EXPECT_TRUE(std::all_of(out.begin(), out.end(), [](uint8_t v) { return v == 200; }))
+        << out_dims[0] << "x" << out_dims[1];
+  }
+}
+
+}  // namespace
+}  // namespace coral
@@ -0,0 +1,132 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "inference_backend.h"
+
+#include <algorithm>
+#include <thread>
+
+#include "glog/logging.h"
+#include "tensorflow/lite/delegates/xnnpack/xnnpack_delegate.h"
+
+namespace coral {
+
+namespace {
+
+class EdgeTpuBackend : public InferenceBackend {
+public:
+  explicit EdgeTpuBackend(int device_index) {
+    auto* manager = edgetpu::EdgeTpuManager::GetSingleton();
+    if (device_index < 0) {
+      tpu_context_ = manager->OpenDevice();
+    } else {
+      const auto devices = manager->EnumerateEdgeTpu();
+      CHECK(!devices.empty()) << "No Edge TPU attached";
+      const auto& device = devices[device_index % devices.size()];
+      tpu_context_ = manager->OpenDevice(device.type, device.path);
+    }
+    CHECK(tpu_context_) << "Failed to open an Edge TPU";
+  }
+
+  BackendType type() const override { return BackendType::kEdgeTpu; }
+
+  void register_ops(tflite::ops::builtin::BuiltinOpResolver* resolver) const override {
+    resolver->AddCustom(edgetpu::kCustomOp, edgetpu::RegisterCustomOp());
+  }
+
+  void configure(tflite::Interpreter* interpreter) override {
+    interpreter->SetExternalContext(kTfLiteEdgeTpuContext, tpu_context_.get());
+    // The Edge TPU does the heavy lifting, the remaining CPU ops are tiny.
+    interpreter->SetNumThreads(1);
+  }
+
+private:
+  std::shared_ptr<edgetpu::EdgeTpuContext> tpu_context_;
+};
+
+class CpuBackend : public InferenceBackend {
+public:
+  explicit CpuBackend(int num_threads)
+      : num_threads_(num_threads > 0 ? num_threads : cpu_threads_per_interpreter(1)),
+        delegate_(nullptr, TfLiteXNNPackDelegateDelete) {
+    auto options = TfLiteXNNPackDelegateOptionsDefault();
+    options.num_threads = num_threads_;
+    delegate_.reset(TfLiteXNNPackDelegateCreate(&options));
+  }
+
+  BackendType type() const override { return BackendType::kCpu; }
+
+  void register_ops(tflite::ops::builtin::BuiltinOpResolver* resolver) const override {}
+
+  void configure(tflite::Interpreter* interpreter) override {
+    // Ops XNNPACK can't take stay on the builtin kernels, which share the
+    // same thread count.
+    interpreter->SetNumThreads(num_threads_);
+    if (interpreter->ModifyGraphWithDelegate(delegate_.get()) != kTfLiteOk) {
+      LOG(WARNING) << "XNNPACK delegate rejected the graph, using builtin CPU kernels";
+    }
+  }
+
+private:
+  const int num_threads_;
+  std::unique_ptr<TfLiteDelegate, void (*)(TfLiteDelegate*)> delegate_;
+};
+
+}  // namespace
+
+bool parse_backend_type(const std::string& name, BackendType* type) {
+  if (name == "auto") {
+    *type = BackendType::kAuto;
+  } else if (name == "edgetpu") {
+    *type = BackendType::kEdgeTpu;
+  } else if (name == "cpu") {
+    *type = BackendType::kCpu;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+const char* backend_name(BackendType type) {
+  switch (type) {
+    case BackendType::kAuto:
+      return "auto";
+    case BackendType::kEdgeTpu:
+      return "edgetpu";
+    case BackendType::kCpu:
+      return "cpu";
+  }
+  return "unknown";
+}
+
+BackendType resolve_backend_type(BackendType type) {
+  if (type != BackendType::kAuto) return type;
+  return edgetpu::EdgeTpuManager::GetSingleton()->EnumerateEdgeTpu().empty()
+             ? BackendType::kCpu
+             : BackendType::kEdgeTpu;
+}
+
+int cpu_threads_per_interpreter(int interpreters) {
+  const int n = std::thread::hardware_concurrency();
+  return std::max(n / std::max(interpreters, 1), 1);
+}
+
+std::unique_ptr<InferenceBackend> create_backend(const BackendOptions& options) {
+  if (resolve_backend_type(options.type) == BackendType::kEdgeTpu) {
+    return std::unique_ptr<InferenceBackend>(new EdgeTpuBackend(options.device_index));
+  }
+  return std::unique_ptr<InferenceBackend>(new CpuBackend(options.num_threads));
+}
+
+}  // namespace coral
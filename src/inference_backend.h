@@ -0,0 +1,72 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MANUFACTURING_DEMO_INFERENCE_BACKEND_H_
+#define MANUFACTURING_DEMO_INFERENCE_BACKEND_H_
+
+#include <memory>
+#include <string>
+
+#include "tensorflow/lite/interpreter.h"
+#include "tensorflow/lite/kernels/register.h"
+#include "tflite/public/edgetpu.h"
+
+namespace coral {
+
+// Hardware an interpreter can be run on.
+enum class BackendType { kAuto, kEdgeTpu, kCpu };
+
+// Parses "auto", "edgetpu" or "cpu" into `type`. Returns false on an unknown name.
+bool parse_backend_type(const std::string& name, BackendType* type);
+// Returns the flag spelling of `type`.
+const char* backend_name(BackendType type);
+// Resolves kAuto to kEdgeTpu if an Edge TPU is attached, kCpu otherwise.
+BackendType resolve_backend_type(BackendType type);
+// CPU threads each of `interpreters` CPU interpreters running at once gets
+// so together they use every hardware thread once, at least 1.
+int cpu_threads_per_interpreter(int interpreters);
+
+struct BackendOptions {
+  BackendType type = BackendType::kAuto;
+  // Number of CPU threads used by the CPU backend. 0 uses every hardware thread.
+  int num_threads = 0;
+  // Edge TPU to open, wrapping around the attached devices. -1 opens the
+  // default device shared by every interpreter.
+  int device_index = -1;
+  // Replaces the TFLite SSD postprocess op with one that does nothing, for
+  // detectors whose raw outputs are decoded by an SsdDecoder instead.
+  bool skip_detection_postprocess = false;
+};
+
+// Sets up a tflite::Interpreter to run on a specific piece of hardware.
+class InferenceBackend {
+public:
+  virtual ~InferenceBackend() = default;
+  // The resolved backend type, never kAuto.
+  virtual BackendType type() const = 0;
+  // Registers any custom ops the backend needs before the interpreter is built.
+  virtual void register_ops(tflite::ops::builtin::BuiltinOpResolver* resolver) const = 0;
+  // Attaches the backend to a freshly built interpreter, before AllocateTensors.
+  virtual void configure(tflite::Interpreter* interpreter) = 0;
+};
+
+// Creates the backend described by `options`, auto-detecting the hardware if
+// requested. The backend must outlive every interpreter it configures.
+std::unique_ptr<InferenceBackend> create_backend(const BackendOptions& options);
+
+}  // namespace coral
+
+#endif  // MANUFACTURING_DEMO_INFERENCE_BACKEND_H_
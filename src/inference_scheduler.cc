@@ -0,0 +1,159 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "inference_scheduler.h"
+
+#include <chrono>
+
+#include "glog/logging.h"
+
+namespace coral {
+
+bool parse_scheduling_policy(const std::string& name, SchedulingPolicy* policy) {
+  if (name == "fair") {
+    *policy = SchedulingPolicy::kFair;
+  } else if (name == "priority") {
+    *policy = SchedulingPolicy::kPriority;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+InferenceScheduler::InferenceScheduler(
+    const std::string& model_path, const std::string& label_path,
+    const BackendOptions& backend_options, const SchedulerOptions& options)
+    : InferenceScheduler(
+          InferenceWrapper::load_model(model_path), InferenceWrapper::load_labels(label_path),
+          backend_options, options) {}
+
+InferenceScheduler::InferenceScheduler(
+    std::shared_ptr<const tflite::FlatBufferModel> model,
+    std::shared_ptr<const LabelTable> labels, const BackendOptions& backend_options,
+    const SchedulerOptions& options)
+    : policy_(options.policy) {
+  CHECK_GT(options.pool_size, 0);
+  // One model and label table shared by the whole pool. Building an
+  // interpreter is mostly waiting on the delegate or the Edge TPU, so they
+  // are all built at once.
+  interpreters_.resize(options.pool_size);
+  std::vector<std::thread> builders;
+  for (int i = 0; i < options.pool_size; ++i) {
+    builders.emplace_back([&, i] {
+      BackendOptions interpreter_options = backend_options;
+      // Spread the pool over every attached Edge TPU.
+      if (options.pool_size > 1) interpreter_options.device_index = i;
+      const auto start = std::chrono::steady_clock::now();
+      interpreters_[i].reset(new InferenceWrapper(model, labels, interpreter_options));
+      const std::chrono::duration<double, std::milli> build =
+          std::chrono::steady_clock::now() - start;
+      const double warm_up_ms = options.warm_up ? interpreters_[i]->measure_invoke_latency(1) : 0;
+      LOG(INFO) << options.name << " interpreter " << i << ": built in " << build.count()
+                << " ms, warm-up invoke " << warm_up_ms << " ms";
+    });
+  }
+  for (auto& builder : builders) builder.join();
+  for (auto& interpreter : interpreters_) {
+    workers_.emplace_back(&InferenceScheduler::worker_loop, this, interpreter.get());
+  }
+}
+
+InferenceScheduler::~InferenceScheduler() {
+  {
+    absl::MutexLock l(&lock_);
+    stopped_ = true;
+  }
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+int InferenceScheduler::add_stream(const std::string& name, int priority) {
+  absl::MutexLock l(&lock_);
+  streams_.emplace_back();
+  streams_.back().name = name;
+  streams_.back().priority = priority;
+  return streams_.size() - 1;
+}
+
+void InferenceScheduler::run(int stream, const Task& task) {
+  // The request lives on this stack frame, we don't return before it's done.
+  Request request;
+  request.task = &task;
+  {
+    absl::MutexLock l(&lock_);
+    CHECK(!stopped_);
+    streams_[stream].pending.push_back(&request);
+    pending_++;
+  }
+  request.done.WaitForNotification();
+}
+
+uint64_t InferenceScheduler::get_zero_copy_inputs() const {
+  uint64_t total = 0;
+  for (const auto& interpreter : interpreters_) total += interpreter->get_zero_copy_inputs();
+  return total;
+}
+
+uint64_t InferenceScheduler::get_copied_inputs() const {
+  uint64_t total = 0;
+  for (const auto& interpreter : interpreters_) total += interpreter->get_copied_inputs();
+  return total;
+}
+
+uint64_t InferenceScheduler::get_served(int stream) const {
+  absl::MutexLock l(&lock_);
+  return streams_[stream].served;
+}
+
+bool InferenceScheduler::has_work_or_stopped() const { return pending_ > 0 || stopped_; }
+
+InferenceScheduler::Request* InferenceScheduler::pop_next() {
+  const size_t num_streams = streams_.size();
+  size_t chosen = num_streams;
+  for (size_t i = 0; i < num_streams; ++i) {
+    const size_t candidate = (next_stream_ + i) % num_streams;
+    if (streams_[candidate].pending.empty()) continue;
+    if (chosen == num_streams) {
+      chosen = candidate;
+      if (policy_ == SchedulingPolicy::kFair) break;
+    } else if (streams_[candidate].priority > streams_[chosen].priority) {
+      chosen = candidate;
+    }
+  }
+  CHECK_LT(chosen, num_streams);
+  auto& queue = streams_[chosen];
+  Request* request = queue.pending.front();
+  queue.pending.pop_front();
+  queue.served++;
+  pending_--;
+  next_stream_ = (chosen + 1) % num_streams;
+  return request;
+}
+
+void InferenceScheduler::worker_loop(InferenceWrapper* interpreter) {
+  while (true) {
+    Request* request;
+    {
+      absl::MutexLock l(&lock_);
+      lock_.Await(absl::Condition(this, &InferenceScheduler::has_work_or_stopped));
+      if (pending_ == 0) return;  // Stopped and drained.
+      request = pop_next();
+    }
+    (*request->task)(*interpreter);
+    request->done.Notify();
+  }
+}
+
+}  // namespace coral
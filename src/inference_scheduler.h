@@ -0,0 +1,122 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MANUFACTURING_DEMO_INFERENCE_SCHEDULER_H_
+#define MANUFACTURING_DEMO_INFERENCE_SCHEDULER_H_
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "absl/synchronization/notification.h"
+#include "inference_wrapper.h"
+
+namespace coral {
+
+// Order in which queued requests of different streams are served.
+enum class SchedulingPolicy {
+  // Round robin over the streams with pending requests.
+  kFair,
+  // Highest priority stream first, round robin between equal priorities.
+  kPriority,
+};
+
+// Parses "fair" or "priority" into `policy`. Returns false on an unknown name.
+bool parse_scheduling_policy(const std::string& name, SchedulingPolicy* policy);
+
+struct SchedulerOptions {
+  // Number of interpreters, each driven by its own worker thread.
+  int pool_size = 1;
+  SchedulingPolicy policy = SchedulingPolicy::kFair;
+  // Invokes every interpreter once when it is built, so the lazy allocations
+  // and, on the Edge TPU, the model upload don't delay the first request.
+  bool warm_up = true;
+  // Names the pool in the logs.
+  std::string name = "model";
+};
+
+// Owns a pool of interpreters built from one shared model and hands requests
+// from any number of streams out to them. Every interpreter is only ever
+// touched by its own worker thread, so requests never race on Invoke().
+// The interpreters of the pool are built concurrently.
+class InferenceScheduler {
+public:
+  using Task = std::function<void(InferenceWrapper&)>;
+
+  InferenceScheduler(
+      const std::string& model_path, const std::string& label_path,
+      const BackendOptions& backend_options, const SchedulerOptions& options);
+  // Builds the pool from an already loaded model and labels.
+  InferenceScheduler(
+      std::shared_ptr<const tflite::FlatBufferModel> model,
+      std::shared_ptr<const LabelTable> labels, const BackendOptions& backend_options,
+      const SchedulerOptions& options);
+  ~InferenceScheduler();
+  InferenceScheduler(const InferenceScheduler&) = delete;
+  InferenceScheduler& operator=(const InferenceScheduler&) = delete;
+
+  // Registers a request queue and returns its id. Higher `priority` streams
+  // are served first under SchedulingPolicy::kPriority.
+  int add_stream(const std::string& name, int priority = 0) LOCKS_EXCLUDED(lock_);
+  // Runs `task` on the next free interpreter, queued behind the earlier
+  // requests of `stream`, and blocks until it has finished.
+  void run(int stream, const Task& task) LOCKS_EXCLUDED(lock_);
+
+  // Number of interpreters in the pool.
+  int get_pool_size() const { return interpreters_.size(); }
+  // Direct access to an interpreter of the pool, only for setup before the
+  // first request is submitted.
+  InferenceWrapper& get_interpreter(int index) { return *interpreters_[index]; }
+  // Sum of the zero-copy and copied inputs of every interpreter.
+  uint64_t get_zero_copy_inputs() const;
+  uint64_t get_copied_inputs() const;
+  // Number of requests served for `stream`.
+  uint64_t get_served(int stream) const LOCKS_EXCLUDED(lock_);
+
+private:
+  struct Request {
+    const Task* task;
+    absl::Notification done;
+  };
+  struct StreamQueue {
+    std::string name;
+    int priority;
+    std::deque<Request*> pending;
+    uint64_t served = 0;
+  };
+
+  void worker_loop(InferenceWrapper* interpreter) LOCKS_EXCLUDED(lock_);
+  bool has_work_or_stopped() const EXCLUSIVE_LOCKS_REQUIRED(lock_);
+  Request* pop_next() EXCLUSIVE_LOCKS_REQUIRED(lock_);
+
+  const SchedulingPolicy policy_;
+  std::vector<std::unique_ptr<InferenceWrapper>> interpreters_;
+  std::vector<std::thread> workers_;
+  mutable absl::Mutex lock_;
+  std::vector<StreamQueue> streams_ GUARDED_BY(lock_);
+  // Stream the round robin resumes from.
+  size_t next_stream_ GUARDED_BY(lock_) = 0;
+  size_t pending_ GUARDED_BY(lock_) = 0;
+  bool stopped_ GUARDED_BY(lock_) = false;
+};
+
+}  // namespace coral
+
+#endif  // MANUFACTURING_DEMO_INFERENCE_SCHEDULER_H_
@@ -14,47 +14,141 @@
 
 #include "inference_wrapper.h"
 
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <memory>
-#include <regex>
 #include <string>
 
+#include "flatbuffers/flexbuffers.h"
 #include "glog/logging.h"
 #include "tensorflow/lite/builtin_op_data.h"
 #include "tensorflow/lite/kernels/register.h"
 #include "tensorflow/lite/model.h"
+#include "tensorflow/lite/schema/schema_utils.h"
+#include "tensorflow/lite/util.h"
 
 namespace coral {
 
 namespace {
 
-void read_labels(std::map<int, std::string>& labels, const std::string& label_path) {
-  std::ifstream label_file(label_path);
-  if (!label_file.good()) {
-    LOG(ERROR) << "Unable to open file " << label_path;
-    exit(EXIT_FAILURE);
+int64_t elapsed_ns(std::chrono::steady_clock::time_point since) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - since)
+      .count();
+}
+
+TfLiteStatus skip_node(TfLiteContext* context, TfLiteNode* node) { return kTfLiteOk; }
+
+// Stands in for the SSD postprocess op when an SsdDecoder reads its inputs.
+TfLiteRegistration* get_skipped_postprocess() {
+  static TfLiteRegistration registration = {nullptr, nullptr, nullptr, skip_node};
+  return &registration;
+}
+
+// Returns the SSD postprocess op of `model`, or nullptr if it has none.
+const tflite::Operator* find_postprocess_op(const tflite::Model& model) {
+  for (const auto* op : *model.subgraphs()->Get(0)->operators()) {
+    const auto* code = model.operator_codes()->Get(op->opcode_index());
+    if (tflite::GetBuiltinCode(code) == tflite::BuiltinOperator_CUSTOM && code->custom_code() &&
+        code->custom_code()->str() == kSsdPostprocessOp) {
+      return op;
+    }
   }
-  for (std::string line; getline(label_file, line);) {
-    std::istringstream ss(line);
-    int id;
-    ss >> id;
-    // Trim the id and the space from the line to get label.
-    line = std::regex_replace(line, std::regex("^[0-9]+ +"), "");
-    labels.emplace(id, line);
+  return nullptr;
+}
+
+// Whether tensor `index` of `model` is the output of a sigmoid.
+bool is_logistic_output(const tflite::Model& model, int index) {
+  for (const auto* op : *model.subgraphs()->Get(0)->operators()) {
+    for (const int output : *op->outputs()) {
+      if (output != index) continue;
+      const auto* code = model.operator_codes()->Get(op->opcode_index());
+      return tflite::GetBuiltinCode(code) == tflite::BuiltinOperator_LOGISTIC;
+    }
   }
+  return false;
+}
+
+int get_last_dim(const TfLiteTensor* tensor) {
+  CHECK_GT(tensor->dims->size, 0) << tensor->name << " is a scalar";
+  return tensor->dims->data[tensor->dims->size - 1];
 }
+
+RawTensor get_raw_tensor(const TfLiteTensor* tensor) {
+  RawTensor raw;
+  raw.data = tensor->data.raw_const;
+  if (tensor->type == kTfLiteUInt8) {
+    raw.quantized = true;
+    raw.scale = tensor->params.scale;
+    raw.zero_point = tensor->params.zero_point;
+  } else {
+    CHECK_EQ(tensor->type, kTfLiteFloat32)
+        << "Unsupported raw output type, Tensor Name: " << tensor->name;
+  }
+  return raw;
+}
+
 }  // namespace
-InferenceWrapper::InferenceWrapper(const std::string& model_path, const std::string& label_path) {
-  tpu_context_ = edgetpu::EdgeTpuManager::GetSingleton()->OpenDevice();
-  model_ = tflite::FlatBufferModel::BuildFromFile(model_path.c_str());
-  CHECK_NOTNULL(model_);
+
+static_assert(
+    kInputAlignment == tflite::kDefaultTensorAlignment,
+    "Frames must satisfy the TFLite custom allocation alignment");
+
+std::shared_ptr<const tflite::FlatBufferModel> InferenceWrapper::load_model(
+    const std::string& model_path) {
+  std::shared_ptr<const tflite::FlatBufferModel> model =
+      tflite::FlatBufferModel::BuildFromFile(model_path.c_str());
+  CHECK(model) << "Failed to load model " << model_path;
+  // The file is mapped rather than read. Reading it ahead in the background
+  // spares building the interpreters a page fault per weight page.
+  const tflite::Allocation* allocation = model->allocation();
+  if (allocation && allocation->base()) {
+    const uintptr_t page = sysconf(_SC_PAGESIZE);
+    const uintptr_t base = reinterpret_cast<uintptr_t>(allocation->base());
+    const uintptr_t start = base & ~(page - 1);
+    madvise(reinterpret_cast<void*>(start), base + allocation->bytes() - start, MADV_WILLNEED);
+  }
+  return model;
+}
+
+ImageDims InferenceWrapper::get_input_dims(const tflite::FlatBufferModel& model) {
+  const auto* subgraph = model.GetModel()->subgraphs()->Get(0);
+  const auto* shape = subgraph->tensors()->Get(subgraph->inputs()->Get(0))->shape();
+  CHECK(shape && shape->size() == 4) << "Expected a [batch, height, width, channels] input";
+  return {shape->Get(1), shape->Get(2), shape->Get(3)};
+}
+
+std::shared_ptr<const LabelTable> InferenceWrapper::load_labels(const std::string& label_path) {
+  auto labels = std::make_shared<LabelTable>();
+  labels->load(label_path);
+  return labels;
+}
+
+InferenceWrapper::InferenceWrapper(
+    const std::string& model_path, const std::string& label_path,
+    const BackendOptions& backend_options)
+    : InferenceWrapper(load_model(model_path), load_labels(label_path), backend_options) {}
+
+InferenceWrapper::InferenceWrapper(
+    std::shared_ptr<const tflite::FlatBufferModel> model,
+    std::shared_ptr<const LabelTable> labels, const BackendOptions& backend_options)
+    : model_(std::move(model)),
+      labels_(std::move(labels)),
+      backend_(create_backend(backend_options)) {
   tflite::ops::builtin::BuiltinOpResolver resolver;
-  resolver.AddCustom(edgetpu::kCustomOp, edgetpu::RegisterCustomOp());
+  backend_->register_ops(&resolver);
+  if (backend_options.skip_detection_postprocess) {
+    resolver.AddCustom(kSsdPostprocessOp, get_skipped_postprocess());
+  }
   CHECK_EQ(tflite::InterpreterBuilder(*model_, resolver)(&interpreter_), kTfLiteOk)
-      << "Failed to build Interpreter";
-  interpreter_->SetExternalContext(kTfLiteEdgeTpuContext, tpu_context_.get());
-  interpreter_->SetNumThreads(1);
+      << "Failed to build Interpreter on " << backend_name(backend_->type());
+  backend_->configure(interpreter_.get());
   CHECK_EQ(interpreter_->AllocateTensors(), kTfLiteOk) << "AllocateTensors failed";
 
   // sets output tensor shape.
@@ -67,17 +161,188 @@ InferenceWrapper::InferenceWrapper(const std::string& model_path, const std::str
   }
   // Gets input size from interpeter, assumes square.
   input_size_ = interpreter_->input_tensor(0)->dims->data[1];
-  read_labels(labels_, label_path);
+  model_batch_size_ = interpreter_->input_tensor(0)->dims->data[0];
+  input_image_bytes_ = interpreter_->input_tensor(0)->bytes / model_batch_size_;
+  batch_size_ = model_batch_size_;
+}
+
+double InferenceWrapper::measure_invoke_latency(int runs) {
+  CHECK_GT(runs, 0);
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < runs; ++i) {
+    CHECK_EQ(interpreter_->Invoke(), kTfLiteOk);
+  }
+  const std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / runs;
+}
+
+bool InferenceWrapper::set_input(const uint8_t* input_data, const size_t input_size) {
+  const int tensor_index = interpreter_->inputs()[0];
+  const size_t tensor_bytes = interpreter_->tensor(tensor_index)->bytes;
+  const bool aligned = reinterpret_cast<uintptr_t>(input_data) % kInputAlignment == 0;
+  if (aligned && input_size == tensor_bytes) {
+    // The runtime only reads inputs, so handing it the read-only mapping is
+    // fine. release_input() takes it back before the caller unmaps it.
+    const TfLiteCustomAllocation allocation{const_cast<uint8_t*>(input_data), input_size};
+    if (interpreter_->SetCustomAllocationForTensor(tensor_index, allocation) == kTfLiteOk) {
+      // Only checks the allocation once the tensors are planned, the arena is
+      // left as it is.
+      CHECK_EQ(interpreter_->AllocateTensors(), kTfLiteOk) << "AllocateTensors failed";
+      bound_input_ = input_data;
+      zero_copy_inputs_++;
+      return true;
+    }
+  }
+  std::memcpy(mutable_input(), input_data, std::min(input_size, tensor_bytes));
+  copied_inputs_++;
+  return false;
+}
+
+void InferenceWrapper::release_input() {
+  if (bound_input_ != nullptr && bound_input_ != staging_input_.get()) {
+    // The tensor points at a caller's frame that is unmapped or recycled once
+    // the call returns, or is read-only, move it to memory we own.
+    bind_staging_input();
+  }
+}
+
+uint8_t* InferenceWrapper::mutable_input() {
+  release_input();
+  return interpreter_->typed_input_tensor<uint8_t>(0);
+}
+
+void InferenceWrapper::bind_staging_input() {
+  // The arena slot can't be restored once replaced.
+  const int tensor_index = interpreter_->inputs()[0];
+  const size_t tensor_bytes = interpreter_->tensor(tensor_index)->bytes;
+  if (staging_bytes_ < tensor_bytes) {
+    void* staging = nullptr;
+    CHECK_EQ(posix_memalign(&staging, kInputAlignment, tensor_bytes), 0);
+    staging_input_.reset(static_cast<uint8_t*>(staging));
+    staging_bytes_ = tensor_bytes;
+  }
+  const TfLiteCustomAllocation allocation{staging_input_.get(), staging_bytes_};
+  CHECK_EQ(interpreter_->SetCustomAllocationForTensor(tensor_index, allocation), kTfLiteOk);
+  CHECK_EQ(interpreter_->AllocateTensors(), kTfLiteOk) << "AllocateTensors failed";
+  bound_input_ = staging_input_.get();
 }
 
 ClassificationResult InferenceWrapper::get_classification_result(
     const uint8_t* input_data, const int input_size) {
-  std::vector<float> output_data;
-  uint8_t* input = interpreter_->typed_input_tensor<uint8_t>(0);
-  std::memcpy(input, input_data, input_size);
+  const auto start = std::chrono::steady_clock::now();
+  set_input(input_data, input_size);
+  const int64_t preprocess_ns = elapsed_ns(start);
+  const auto result = get_classification_result();
+  release_input();
+  last_timings_.preprocess_ns = preprocess_ns;
+  return result;
+}
 
+ClassificationResult InferenceWrapper::get_classification_result() {
+  last_timings_ = InferenceTimings();
+  auto start = std::chrono::steady_clock::now();
   CHECK_EQ(interpreter_->Invoke(), kTfLiteOk);
+  last_timings_.invoke_ns = elapsed_ns(start);
+  start = std::chrono::steady_clock::now();
+  const auto result = parse_classification_output(/*batch_index=*/0, batch_size_);
+  last_timings_.postprocess_ns = elapsed_ns(start);
+  return result;
+}
+
+void InferenceWrapper::set_max_batch_size(int batch_size) {
+  CHECK_GT(batch_size, 0);
+  max_batch_size_ = batch_size;
+}
+
+int InferenceWrapper::get_max_batch_size() const {
+  // Models with a baked in batch dimension, and the Edge TPU which only runs
+  // compiled shapes, invoke with a fixed batch.
+  if (model_batch_size_ > 1 || backend_->type() == BackendType::kEdgeTpu) {
+    return model_batch_size_;
+  }
+  return max_batch_size_;
+}
+
+void InferenceWrapper::resize_batch(int batch_size) {
+  if (batch_size == batch_size_) return;
+  const int tensor_index = interpreter_->inputs()[0];
+  const TfLiteIntArray* dims = interpreter_->tensor(tensor_index)->dims;
+  std::vector<int> new_dims(dims->data, dims->data + dims->size);
+  new_dims[0] = batch_size;
+  CHECK_EQ(interpreter_->ResizeInputTensor(tensor_index, new_dims), kTfLiteOk);
+  if (bound_input_ != nullptr) {
+    // A frame bound through set_input() no longer matches the tensor, and the
+    // staging buffer may be too small for it now.
+    bind_staging_input();
+  }
+  CHECK_EQ(interpreter_->AllocateTensors(), kTfLiteOk) << "AllocateTensors failed";
+  batch_size_ = batch_size;
+}
+
+void InferenceWrapper::get_classification_results(
+    const uint8_t* frame, const ImageDims& frame_dims, absl::Span<const BoundingBox> crops,
+    std::vector<ClassificationResult>* results) {
+  const ImageDims crop_dims{
+      static_cast<int>(input_size_), static_cast<int>(input_size_), frame_dims[2]};
+  classify_batches(
+      crops.size(),
+      [&](int index, uint8_t* slot) {
+        if (!crop_and_resize(
+                frame, frame_dims, /*in_stride=*/0, crops[index], crop_dims, slot)) {
+          // Empty crops still take their slot so results stay index aligned.
+          std::memset(slot, 0, input_image_bytes_);
+        }
+      },
+      results);
+}
+
+void InferenceWrapper::get_classification_results(
+    absl::Span<const uint8_t> inputs, std::vector<ClassificationResult>* results) {
+  CHECK_EQ(inputs.size() % input_image_bytes_, 0);
+  classify_batches(
+      inputs.size() / input_image_bytes_,
+      [&](int index, uint8_t* slot) {
+        std::memcpy(slot, inputs.data() + index * input_image_bytes_, input_image_bytes_);
+      },
+      results);
+}
+
+void InferenceWrapper::classify_batches(
+    int count, const std::function<void(int index, uint8_t* slot)>& fill,
+    std::vector<ClassificationResult>* results) {
+  results->clear();
+  last_timings_ = InferenceTimings();
+  const int max_batch = get_max_batch_size();
+  for (int first = 0; first < count; first += max_batch) {
+    const int n = std::min(max_batch, count - first);
+    auto start = std::chrono::steady_clock::now();
+    if (model_batch_size_ == 1 && max_batch > 1) {
+      // Round up to a power of two so changing object counts only ever
+      // produce a handful of shapes to reallocate for.
+      int batch = 1;
+      while (batch < n) batch *= 2;
+      resize_batch(std::min(batch, max_batch));
+    }
+    // Never the tensor memory directly, it may still be a caller's frame.
+    uint8_t* input = mutable_input();
+    for (int i = 0; i < n; ++i) {
+      fill(first + i, input + i * input_image_bytes_);
+    }
+    last_timings_.preprocess_ns += elapsed_ns(start);
+    start = std::chrono::steady_clock::now();
+    CHECK_EQ(interpreter_->Invoke(), kTfLiteOk);
+    last_timings_.invoke_ns += elapsed_ns(start);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; ++i) {
+      results->push_back(parse_classification_output(i, batch_size_));
+    }
+    last_timings_.postprocess_ns += elapsed_ns(start);
+  }
+}
 
+ClassificationResult InferenceWrapper::parse_classification_output(
+    int batch_index, int batch_size) const {
   const auto& output_indices = interpreter_->outputs();
   const auto* out_tensor = interpreter_->tensor(output_indices[0]);
 
@@ -85,78 +350,155 @@ ClassificationResult InferenceWrapper::get_classification_result(
   int max_index;
   // Handles only uint8 or float outputs.
   if (out_tensor->type == kTfLiteUInt8) {
-    const uint8_t* output = interpreter_->typed_output_tensor<uint8_t>(0);
-    max_index = std::max_element(output, output + out_tensor->bytes) - output;
+    const size_t num_classes = out_tensor->bytes / batch_size;
+    const uint8_t* output =
+        interpreter_->typed_output_tensor<uint8_t>(0) + batch_index * num_classes;
+    max_index = std::max_element(output, output + num_classes) - output;
     // For uint8 output, we need to apply zero point amd scale.
     max_prob = (output[max_index] - out_tensor->params.zero_point) * out_tensor->params.scale;
   } else if (out_tensor->type == kTfLiteFloat32) {
-    const float* output = interpreter_->typed_output_tensor<float>(0);
-    max_index = std::max_element(output, output + out_tensor->bytes / sizeof(float)) - output;
+    const size_t num_classes = out_tensor->bytes / sizeof(float) / batch_size;
+    const float* output = interpreter_->typed_output_tensor<float>(0) + batch_index * num_classes;
+    max_index = std::max_element(output, output + num_classes) - output;
     max_prob = output[max_index];
   } else {
     std::cerr << "Tensor " << out_tensor->name
               << " has unsupported output type: " << out_tensor->type << std::endl;
     exit(EXIT_FAILURE);
   }
-  return {labels_[max_index], max_prob};
+  return {labels_->at(max_index), max_prob};
 }
 
-std::vector<DetectionResult> InferenceWrapper::get_detection_results(
+void InferenceWrapper::get_detection_results(
     const uint8_t* input_data, const int input_size, const float threshold,
-    const std::vector<int>& want_ids) {
-  std::vector<std::vector<float>> output_data;
-
-  uint8_t* input = interpreter_->typed_input_tensor<uint8_t>(0);
-  std::memcpy(input, input_data, input_size);
+    const ClassFilter& want_ids, std::vector<DetectionResult>* results) {
+  results->clear();
+  auto start = std::chrono::steady_clock::now();
+  set_input(input_data, input_size);
+  last_timings_.preprocess_ns = elapsed_ns(start);
 
+  start = std::chrono::steady_clock::now();
   CHECK_EQ(interpreter_->Invoke(), kTfLiteOk);
+  last_timings_.invoke_ns = elapsed_ns(start);
+  start = std::chrono::steady_clock::now();
+  release_input();
 
+  if (ssd_decoder_) {
+    ssd_decoder_->decode(
+        get_raw_tensor(interpreter_->tensor(raw_boxes_tensor_)),
+        get_raw_tensor(interpreter_->tensor(raw_scores_tensor_)), threshold, &ssd_detections_);
+    DetectionOutputs outputs;
+    outputs.boxes = ssd_detections_.boxes;
+    outputs.ids = ssd_detections_.ids;
+    outputs.scores = ssd_detections_.scores;
+    outputs.count = ssd_detections_.count;
+    parse_detection_outputs(outputs, *labels_, threshold, want_ids, results);
+    last_timings_.postprocess_ns = elapsed_ns(start);
+    return;
+  }
   const auto& output_indices = interpreter_->outputs();
-  const size_t num_outputs = output_indices.size();
-  output_data.resize(num_outputs);
-  for (size_t i = 0; i < num_outputs; ++i) {
+  CHECK_EQ(output_indices.size(), 4) << "Expected the TFLite SSD postprocess outputs";
+  for (size_t i = 0; i < output_indices.size(); ++i) {
     const auto* out_tensor = interpreter_->tensor(output_indices[i]);
     CHECK_NOTNULL(out_tensor);
-    if (out_tensor->type == kTfLiteFloat32) {
-      // detection model out is float32
-      const size_t num_values = out_tensor->bytes / sizeof(float);
-
-      const float* output = interpreter_->typed_output_tensor<float>(i);
-      const size_t size_of_output_tensor_i = output_shape_[i];
-
-      output_data[i].resize(size_of_output_tensor_i);
-      for (size_t j = 0; j < size_of_output_tensor_i; ++j) {
-        output_data[i][j] = output[j];
-      }
-    } else {
-      LOG(ERROR) << "Unsupported output type: " << out_tensor->type
-                 << "\n Tensor Name: " << out_tensor->name;
+    // detection model out is float32
+    CHECK_EQ(out_tensor->type, kTfLiteFloat32)
+        << "Unsupported output type, Tensor Name: " << out_tensor->name;
+  }
+  DetectionOutputs outputs;
+  outputs.boxes = {interpreter_->typed_output_tensor<float>(0), output_shape_[0]};
+  outputs.ids = {interpreter_->typed_output_tensor<float>(1), output_shape_[1]};
+  outputs.scores = {interpreter_->typed_output_tensor<float>(2), output_shape_[2]};
+  outputs.count = lround(interpreter_->typed_output_tensor<float>(3)[0]);
+  parse_detection_outputs(outputs, *labels_, threshold, want_ids, results);
+  last_timings_.postprocess_ns = elapsed_ns(start);
+}
+
+void InferenceWrapper::use_ssd_decoder(
+    const std::string& anchors_path, const std::vector<float>& class_thresholds) {
+  const tflite::Model& model = *model_->GetModel();
+  SsdDecoderOptions options;
+  options.class_thresholds = class_thresholds;
+  std::vector<Anchor> anchors;
+  int num_classes;
+  const tflite::Operator* postprocess = find_postprocess_op(model);
+  if (postprocess) {
+    // Inputs are the box encodings, the class scores and constant anchors.
+    CHECK_EQ(postprocess->inputs()->size(), 3);
+    raw_boxes_tensor_ = postprocess->inputs()->Get(0);
+    raw_scores_tensor_ = postprocess->inputs()->Get(1);
+    const TfLiteTensor* anchors_tensor = interpreter_->tensor(postprocess->inputs()->Get(2));
+    CHECK_EQ(get_last_dim(anchors_tensor), 4);
+    const RawTensor raw_anchors = get_raw_tensor(anchors_tensor);
+    const auto value = [&](size_t i) {
+      return raw_anchors.quantized
+                 ? raw_anchors.scale * (anchors_tensor->data.uint8[i] - raw_anchors.zero_point)
+                 : anchors_tensor->data.f[i];
+    };
+    anchors.resize(anchors_tensor->bytes / (raw_anchors.quantized ? 4 : 4 * sizeof(float)));
+    for (size_t i = 0; i < anchors.size(); ++i) {
+      anchors[i] = {value(4 * i), value(4 * i + 1), value(4 * i + 2), value(4 * i + 3)};
     }
+    const auto& custom_options = *postprocess->custom_options();
+    const auto op_options =
+        flexbuffers::GetRoot(custom_options.data(), custom_options.size()).AsMap();
+    CHECK(!op_options["use_regular_nms"].AsBool())
+        << "The C++ SSD decoder only does the fast NMS of the postprocess op, use the builtin op";
+    CHECK_LE(op_options["max_classes_per_detection"].AsInt32(), 1)
+        << "The C++ SSD decoder keeps a single class per detection, use the builtin op";
+    num_classes = op_options["num_classes"].AsInt32();
+    options.max_detections = op_options["max_detections"].AsInt32();
+    options.score_threshold = op_options["nms_score_threshold"].AsFloat();
+    options.iou_threshold = op_options["nms_iou_threshold"].AsFloat();
+    options.y_scale = op_options["y_scale"].AsFloat();
+    options.x_scale = op_options["x_scale"].AsFloat();
+    options.h_scale = op_options["h_scale"].AsFloat();
+    options.w_scale = op_options["w_scale"].AsFloat();
+    options.label_offset = get_last_dim(interpreter_->tensor(raw_scores_tensor_)) - num_classes;
+  } else {
+    const auto& output_indices = interpreter_->outputs();
+    CHECK_EQ(output_indices.size(), 2) << "Expected the raw box encodings and class scores outputs";
+    CHECK(!anchors_path.empty()) << "A model without the SSD postprocess op needs its anchors";
+    CHECK(load_anchors(anchors_path, &anchors));
+    raw_boxes_tensor_ = output_indices[0];
+    raw_scores_tensor_ = output_indices[1];
+    num_classes = get_last_dim(interpreter_->tensor(raw_scores_tensor_)) - options.label_offset;
+    // Exports leave the sigmoid in or out, the scores are logits without it.
+    options.logit_scores = !is_logistic_output(model, raw_scores_tensor_);
   }
-  return parse_detection_outputs(output_data, threshold, want_ids);
+  const TfLiteTensor* boxes = interpreter_->tensor(raw_boxes_tensor_);
+  const TfLiteTensor* scores = interpreter_->tensor(raw_scores_tensor_);
+  CHECK_EQ(get_last_dim(boxes), 4) << "Box encodings must be y, x, h, w";
+  const size_t box_values = boxes->bytes / (boxes->type == kTfLiteUInt8 ? 1 : sizeof(float));
+  const size_t score_values = scores->bytes / (scores->type == kTfLiteUInt8 ? 1 : sizeof(float));
+  CHECK_EQ(box_values, 4 * anchors.size()) << "Box encodings don't match the anchors";
+  CHECK_EQ(score_values, (options.label_offset + num_classes) * anchors.size())
+      << "Class scores don't match the anchors";
+  LOG(INFO) << "Decoding " << anchors.size() << " anchors of " << num_classes
+            << " classes in C++, " << (options.logit_scores ? "logit" : "probability")
+            << " scores";
+  ssd_decoder_.reset(new SsdDecoder(std::move(anchors), num_classes, options));
 }
 
-std::vector<DetectionResult> InferenceWrapper::parse_detection_outputs(
-    const std::vector<std::vector<float>>& raw_output, const float threshold,
-    const std::vector<int>& want_ids) {
-  std::vector<DetectionResult> results;
-  int n = lround(raw_output[3][0]);
+void InferenceWrapper::parse_detection_outputs(
+    const DetectionOutputs& outputs, const LabelTable& labels, const float threshold,
+    const ClassFilter& want_ids, std::vector<DetectionResult>* results) {
+  const int n = std::min<int>(outputs.count, outputs.scores.size());
   for (int i = 0; i < n; i++) {
-    if (int id = lround(raw_output[1][i]); std::count(want_ids.begin(), want_ids.end(), id)) {
-      float score = raw_output[2][i];
-      if (score > threshold) {
-        DetectionResult result;
-        result.candidate = labels_.at(id);
-        result.score = score;
-        result.y1 = std::max(static_cast<float>(0.0), raw_output[0][4 * i]);
-        result.x1 = std::max(static_cast<float>(0.0), raw_output[0][4 * i + 1]);
-        result.y2 = std::min(static_cast<float>(1.0), raw_output[0][4 * i + 2]);
-        result.x2 = std::min(static_cast<float>(1.0), raw_output[0][4 * i + 3]);
-        results.push_back(result);
-      }
-    }
+    const float score = outputs.scores[i];
+    if (score <= threshold) continue;
+    const int id = lround(outputs.ids[i]);
+    if (!want_ids.contains(id)) continue;
+    DetectionResult result;
+    result.id = id;
+    result.candidate = labels.at(id);
+    result.score = score;
+    result.y1 = std::max(0.0f, outputs.boxes[4 * i]);
+    result.x1 = std::max(0.0f, outputs.boxes[4 * i + 1]);
+    result.y2 = std::min(1.0f, outputs.boxes[4 * i + 2]);
+    result.x2 = std::min(1.0f, outputs.boxes[4 * i + 3]);
+    results->push_back(result);
   }
-  return results;
 }
 
 }  // namespace coral
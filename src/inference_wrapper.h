@@ -17,70 +17,201 @@
 #ifndef MANUFACTURING_DEMO_INFERENCE_WRAPPER_H_
 #define MANUFACTURING_DEMO_INFERENCE_WRAPPER_H_
 
-#include <map>
+#include <atomic>
+#include <cstdlib>
+#include <functional>
 #include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
 #include "glog/logging.h"
 #include "image_utils.h"
+#include "inference_backend.h"
+#include "label_table.h"
+#include "ssd_decoder.h"
 #include "tensorflow/lite/interpreter.h"
 #include "tensorflow/lite/model.h"
-#include "tflite/public/edgetpu.h"
 
 namespace coral {
 
-// Represents a Detection Result.
+// Alignment a frame needs to be bound directly as an input tensor.
+constexpr size_t kInputAlignment = 64;
+
+// Represents a Detection Result. `candidate` points into the label table of
+// the InferenceWrapper that produced it.
 struct DetectionResult {
-  std::string candidate;
+  int id;
+  absl::string_view candidate;
   float score, x1, y1, x2, y2;
 };
 
-// Represents a Classification Result.
+// Represents a Classification Result. `candidate` points into the label
+// table of the InferenceWrapper that produced it.
 struct ClassificationResult {
-  std::string candidate;
+  absl::string_view candidate;
   float score;
 };
 
+// Views over the output tensors of a model with the TFLite SSD postprocess op.
+struct DetectionOutputs {
+  // [count, 4] boxes as ymin, xmin, ymax, xmax.
+  absl::Span<const float> boxes;
+  absl::Span<const float> ids;
+  absl::Span<const float> scores;
+  int count;
+};
+
+// Time the last inference of an InferenceWrapper spent in each step.
+struct InferenceTimings {
+  // Setting or copying the input, cropping and resizing for batches.
+  int64_t preprocess_ns = 0;
+  int64_t invoke_ns = 0;
+  // Reading the results out of the output tensors.
+  int64_t postprocess_ns = 0;
+};
+
 // A tflite::Interpreter wrapper class with extra features to parses
 // Dectection models with ssd head.
 class InferenceWrapper {
 public:
   ~InferenceWrapper() = default;
-  // Constructor for InferenceWrapper.
-  InferenceWrapper(const std::string& model_path, const std::string& label_path);
+  // Constructor for InferenceWrapper. The interpreter runs on the backend
+  // described by `backend_options`.
+  InferenceWrapper(
+      const std::string& model_path, const std::string& label_path,
+      const BackendOptions& backend_options = {});
+  // Constructor for InferenceWrapper sharing an already loaded model and
+  // labels with other wrappers.
+  InferenceWrapper(
+      std::shared_ptr<const tflite::FlatBufferModel> model,
+      std::shared_ptr<const LabelTable> labels, const BackendOptions& backend_options = {});
+  // Maps a model from `model_path`, exits on failure.
+  static std::shared_ptr<const tflite::FlatBufferModel> load_model(const std::string& model_path);
+  // Dimensions of a single image of the first input of `model`, read from the
+  // model itself so they are known before any interpreter is built.
+  static ImageDims get_input_dims(const tflite::FlatBufferModel& model);
+  // Loads labels from `label_path`, exits on failure.
+  static std::shared_ptr<const LabelTable> load_labels(const std::string& label_path);
   // InferenceWrapper is neither copyable nor movable.
   InferenceWrapper(const InferenceWrapper&) = delete;
   InferenceWrapper& operator=(const InferenceWrapper&) = delete;
 
   // Runs inference using given `interpreter` and get classification results
   ClassificationResult get_classification_result(const uint8_t* input_data, const int input_size);
-  // Runs inference using given `interpreter` and get detection results.
+  // Runs inference on the input already written through mutable_input() and
+  // get classification results.
+  ClassificationResult get_classification_result();
+  // Crops and classifies every `crops` region of `frame`, packing up to
+  // get_max_batch_size() crops into each invoke. Writes one result per crop,
+  // in order, into `results`.
+  void get_classification_results(
+      const uint8_t* frame, const ImageDims& frame_dims, absl::Span<const BoundingBox> crops,
+      std::vector<ClassificationResult>* results);
+  // Classifies images already resized to the model input, packed back to back
+  // in `inputs`, as get_classification_results() above does for crops. Lets
+  // the crop and resize run ahead on another thread.
+  void get_classification_results(
+      absl::Span<const uint8_t> inputs, std::vector<ClassificationResult>* results);
+  // Sets the largest batch the input is resized to on backends that allow it.
+  void set_max_batch_size(int batch_size);
+  // Get the number of crops packed into a single invoke.
+  int get_max_batch_size() const;
+  // Runs inference using given `interpreter` and writes detection results
+  // into `results`, reusing its storage so the steady state doesn't allocate.
   // want_ids contains the ids of the object that we want to filter.
   // 0 == person
   // 52 == apple
-  std::vector<DetectionResult> get_detection_results(
+  void get_detection_results(
       const uint8_t* input_data, const int input_size, const float threshold,
-      const std::vector<int>& want_ids = {0, 52});
-  // Helper function to parse ssd outputs into detection objects.
-  std::vector<DetectionResult> parse_detection_outputs(
-      const std::vector<std::vector<float>>& raw_output, const float threshold,
-      const std::vector<int>& want_ids);
+      const ClassFilter& want_ids, std::vector<DetectionResult>* results);
+  // Reads detections with an SsdDecoder from the raw box encodings and class
+  // scores instead of the outputs of the TFLite SSD postprocess op. On a model
+  // with the op its inputs, anchors and options are used, which gives the
+  // same detections as the op unless `class_thresholds` are set. Any other
+  // model must end in the box encodings and class scores outputs, in that
+  // order, with its anchors in `anchors_path`. Exits on a model it can't read.
+  void use_ssd_decoder(const std::string& anchors_path, const std::vector<float>& class_thresholds);
+  // Helper function to parse ssd outputs into detection objects, read in
+  // place from the output tensors and appended to `results`. Candidates are
+  // looked up in `labels`.
+  static void parse_detection_outputs(
+      const DetectionOutputs& outputs, const LabelTable& labels, const float threshold,
+      const ClassFilter& want_ids, std::vector<DetectionResult>* results);
+  // Sets the model input to `input_data`. When the buffer is aligned to
+  // kInputAlignment and exactly matches the tensor size it is bound as the
+  // tensor memory without a copy, otherwise it is copied. A bound
+  // `input_data` must stay valid until release_input(). Returns true for the
+  // zero-copy path.
+  bool set_input(const uint8_t* input_data, const size_t input_size);
+  // Moves an input bound by set_input() back to the staging buffer, so no
+  // later invoke reads the caller's frame once it is released.
+  void release_input();
+  // Returns writable input tensor memory owned by this wrapper.
+  uint8_t* mutable_input();
+  // Number of inputs that were bound without a copy.
+  uint64_t get_zero_copy_inputs() const { return zero_copy_inputs_; }
+  // Number of inputs that had to be copied.
+  uint64_t get_copied_inputs() const { return copied_inputs_; }
   // Get the input size of the model.
   size_t get_input_size() { return input_size_; }
+  // Get the number of bytes of a single input image.
+  size_t get_input_image_bytes() const { return input_image_bytes_; }
   // Get the interpreter
   std::unique_ptr<tflite::Interpreter>& get_interpreter() { return interpreter_; }
+  // Get the backend the interpreter runs on.
+  BackendType get_backend_type() const { return backend_->type(); }
+  // Steps of the last get_*_result(s) call, only safe to read from the
+  // thread that made it.
+  const InferenceTimings& get_last_timings() const { return last_timings_; }
+  // Runs `runs` invokes on the current input and returns the mean latency in ms.
+  double measure_invoke_latency(int runs);
 
 private:
   InferenceWrapper() = default;
-  std::unique_ptr<tflite::FlatBufferModel> model_;
-  std::map<int, std::string> labels_;
+  // Resizes the batch dimension of the input, a no-op if it already matches.
+  // An input bound through set_input() is replaced by the staging buffer.
+  void resize_batch(int batch_size);
+  // Binds the staging buffer as the input tensor, growing it to the tensor
+  // size first if needed.
+  void bind_staging_input();
+  // Classifies `count` images in batches, `fill` writes image `index` into the
+  // input tensor at `slot`.
+  void classify_batches(
+      int count, const std::function<void(int index, uint8_t* slot)>& fill,
+      std::vector<ClassificationResult>* results);
+  // Reads the top class of `batch_index` out of a batch of `batch_size`.
+  ClassificationResult parse_classification_output(int batch_index, int batch_size) const;
+
+  std::shared_ptr<const tflite::FlatBufferModel> model_;
+  std::shared_ptr<const LabelTable> labels_;
   std::vector<size_t> input_shape_;
   std::vector<size_t> output_shape_;
-  std::shared_ptr<edgetpu::EdgeTpuContext> tpu_context_;
+  // Declared before interpreter_ so it outlives it.
+  std::unique_ptr<InferenceBackend> backend_;
   std::unique_ptr<tflite::Interpreter> interpreter_;
   size_t input_size_;
+  size_t input_image_bytes_;
+  // Batch dimension the model was built with, and the current one.
+  int model_batch_size_;
+  int batch_size_;
+  int max_batch_size_ = 1;
+  // Memory currently bound to the input tensor through a custom allocation,
+  // nullptr while the tensor still lives in the interpreter arena.
+  const uint8_t* bound_input_ = nullptr;
+  // Owned input memory, used for copies once the arena has been replaced.
+  std::unique_ptr<uint8_t, decltype(&std::free)> staging_input_{nullptr, &std::free};
+  size_t staging_bytes_ = 0;
+  std::atomic<uint64_t> zero_copy_inputs_{0};
+  std::atomic<uint64_t> copied_inputs_{0};
+  InferenceTimings last_timings_;
+  // Set by use_ssd_decoder(), with the tensors it reads and its detections.
+  std::unique_ptr<SsdDecoder> ssd_decoder_;
+  int raw_boxes_tensor_ = -1;
+  int raw_scores_tensor_ = -1;
+  SsdDetections ssd_detections_;
 };
 
 }  // namespace coral
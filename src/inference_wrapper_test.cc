@@ -0,0 +1,135 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "inference_wrapper.h"
+#include "label_table.h"
+
+namespace {
+
+// Every allocation made through the global operator new, by any thread.
+std::atomic<int64_t> allocations{0};
+
+void* counted_new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  void* p = std::malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+}  // namespace
+
+void* operator new(size_t size) { return counted_new(size); }
+void* operator new[](size_t size) { return counted_new(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+
+namespace coral {
+namespace {
+
+constexpr int kMaxDetections = 100;
+
+// Raw outputs of the SSD postprocess op, `count` detections of classes 0 to
+// 2 with random boxes, some reaching outside the frame, and scores.
+struct SyntheticOutputs {
+  std::vector<float> boxes, ids, scores;
+  int count;
+
+  SyntheticOutputs(int count, std::mt19937* rng)
+      : boxes(4 * kMaxDetections), ids(kMaxDetections), scores(kMaxDetections), count(count) {
+    std::uniform_real_distribution<float> coordinate(-0.1f, 1.1f);
+    std::uniform_real_distribution<float> score(0.0f, 1.0f);
+    std::uniform_int_distribution<int> id(0, 2);
+    for (int i = 0; i < count; ++i) {
+      for (int j = 0; j < 4; ++j) boxes[4 * i + j] = coordinate(*rng);
+      ids[i] = id(*rng);
+      scores[i] = score(*rng);
+    }
+  }
+
+  DetectionOutputs get() const { return {boxes, ids, scores, count}; }
+};
+
+class ParseDetectionOutputsTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    const std::string path = ::testing::TempDir() + "/labels.txt";
+    std::ofstream(path) << "0 person\n1 bicycle\n2 car\n";
+    labels_.load(path);
+  }
+
+  LabelTable labels_;
+};
+
+TEST_F(ParseDetectionOutputsTest, KeepsWantedClassesAboveThreshold) {
+  std::mt19937 rng(1);
+  const SyntheticOutputs outputs(kMaxDetections, &rng);
+  const ClassFilter want_ids{0, 2};
+  std::vector<DetectionResult> results;
+  InferenceWrapper::parse_detection_outputs(outputs.get(), labels_, 0.5f, want_ids, &results);
+
+  size_t expected = 0;
+  for (int i = 0; i < outputs.count; ++i) {
+    if (outputs.scores[i] > 0.5f && outputs.ids[i] != 1) ++expected;
+  }
+  ASSERT_EQ(results.size(), expected);
+  for (const auto& result : results) {
+    EXPECT_GT(result.score, 0.5f);
+    EXPECT_NE(result.id, 1);
+    EXPECT_EQ(result.candidate, labels_.at(result.id));
+    EXPECT_GE(result.x1, 0.0f);
+    EXPECT_GE(result.y1, 0.0f);
+    EXPECT_LE(result.x2, 1.0f);
+    EXPECT_LE(result.y2, 1.0f);
+  }
+}
+
+TEST_F(ParseDetectionOutputsTest, SteadyStateDoesNotAllocate) {
+  std::mt19937 rng(2);
+  std::vector<SyntheticOutputs> frames;
+  for (int i = 0; i < 50; ++i) {
+    frames.emplace_back(std::uniform_int_distribution<int>(0, kMaxDetections)(rng), &rng);
+  }
+  frames.emplace_back(kMaxDetections, &rng);
+  const ClassFilter want_ids{0, 1, 2};
+  std::vector<DetectionResult> results;
+  // Grows the buffer to the most detections a frame can have.
+  InferenceWrapper::parse_detection_outputs(
+      frames.back().get(), labels_, 0.0f, want_ids, &results);
+
+  const int64_t before = allocations.load();
+  size_t parsed = 0;
+  for (int run = 0; run < 10; ++run) {
+    for (const auto& frame : frames) {
+      results.clear();
+      InferenceWrapper::parse_detection_outputs(frame.get(), labels_, 0.3f, want_ids, &results);
+      parsed += results.size();
+    }
+  }
+  EXPECT_EQ(allocations.load() - before, 0);
+  EXPECT_GT(parsed, 0);
+}
+
+}  // namespace
+}  // namespace coral
@@ -14,12 +14,16 @@
 
 #include "keepout_shape.h"
 
+#include <algorithm>
 #include <iostream>
 
 #include "absl/flags/flag.h"
 #include "absl/flags/parse.h"
 #include "absl/strings/str_format.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/str_split.h"
 #include "absl/strings/substitute.h"
+#include "glog/logging.h"
 
 ABSL_FLAG(
     bool, safety_check_whole_box, false,
@@ -57,6 +61,16 @@ bool Line::intersects_line(const Line& l) const {
   if (dir4 == 0 && l.contains_point(end_)) return true;
   return false;
 }
+bool Line::crosses_ray(const Point& p, int max_x) const {
+  const Point& low = begin_.y_ < end_.y_ ? begin_ : end_;
+  const Point& high = begin_.y_ < end_.y_ ? end_ : begin_;
+  if (p.y_ < low.y_ || p.y_ >= high.y_) return false;
+  // The line meets row p.y_ at x = num / den, den > 0.
+  const int64_t num = static_cast<int64_t>(low.x_) * (high.y_ - low.y_) +
+                      static_cast<int64_t>(p.y_ - low.y_) * (high.x_ - low.x_);
+  const int64_t den = high.y_ - low.y_;
+  return num >= static_cast<int64_t>(p.x_) * den && num <= static_cast<int64_t>(max_x) * den;
+}
 const std::string Line::info() const {
   return "((" + std::to_string(begin_.x_) + "," + std::to_string(begin_.y_) + "),("
          + std::to_string(end_.x_) + "," + std::to_string(end_.y_) + "))";
@@ -68,17 +82,134 @@ Polygon::Polygon(std::vector<Point>& polygon_points) {
     lines_.emplace_back(polygon_points[i], polygon_points[i + 1]);
 }
 
-Box::Box(int x1, int y1, int x2, int y2) {
-  points_.emplace_back(x1, y1);
-  points_.emplace_back(x1, y2);
-  points_.emplace_back(x2, y1);
-  points_.emplace_back(x2, y2);
-  lines_.emplace_back(points_[0], points_[1]);
-  lines_.emplace_back(points_[1], points_[2]);
-  lines_.emplace_back(points_[2], points_[3]);
-  lines_.emplace_back(points_[3], points_[0]);
-  bottom_y_ = std::max(y1, y2);
+namespace {
+
+// Side in pixels of the grid cells indexing keepout zones.
+constexpr int kZoneCellSize = 64;
+
+// Floor of num / den for den > 0.
+int64_t floor_div(int64_t num, int64_t den) {
+  return num >= 0 ? num / den : -((-num + den - 1) / den);
+}
+
+}  // namespace
+
+KeepoutMask::KeepoutMask(
+    const std::vector<Line>& lines, uint32_t max_width, uint32_t max_height, bool whole_box)
+    : whole_box_(whole_box) {
+  if (lines.empty()) return;
+  int min_y = lines[0].begin_.y_, max_y = min_y, max_x = lines[0].begin_.x_;
+  for (const auto& l : lines) {
+    min_y = std::min({min_y, l.begin_.y_, l.end_.y_});
+    max_y = std::max({max_y, l.begin_.y_, l.end_.y_});
+    max_x = std::max({max_x, l.begin_.x_, l.end_.x_});
+  }
+  // Rows outside the polygon never cross it, neither do columns right of it.
+  y0_ = std::max(min_y, 0);
+  height_ = std::min<int64_t>(max_y, max_height) - y0_ + 1;
+  width_ = std::min<int64_t>(max_x, max_width) + 1;
+  if (height_ <= 0 || width_ <= 0) return;
+
+  // Rows are first classified over every column, the mask then only keeps
+  // the columns from the leftmost inside point.
+  const int columns = width_;
+  std::vector<uint8_t> inside(static_cast<size_t>(height_) * columns);
+  // crossings[x]: polygon lines the ray from x to max_width meets, as a
+  // histogram of the rightmost column each line still counts for.
+  std::vector<int> crossings(columns);
+  int min_x = columns;
+  for (int row = 0; row < height_; ++row) {
+    const int64_t y = y0_ + row;
+    uint8_t* inside_row = &inside[static_cast<size_t>(row) * columns];
+    std::fill(crossings.begin(), crossings.end(), 0);
+    for (const auto& l : lines) {
+      const Point& a = l.begin_;
+      const Point& b = l.end_;
+      if (y < std::min(a.y_, b.y_) || y > std::max(a.y_, b.y_)) continue;
+      if (a.y_ == b.y_) {
+        // Collinear with the ray, every point of it is on the boundary.
+        const int64_t lo = std::max<int64_t>(std::min(a.x_, b.x_), 0);
+        const int64_t hi = std::min<int64_t>(std::max(a.x_, b.x_), columns - 1);
+        for (int64_t x = lo; x <= hi; ++x) inside_row[x] = 1;
+        continue;
+      }
+      // Crosses the row once, at x = num / den.
+      int64_t num = static_cast<int64_t>(a.x_) * (b.y_ - a.y_) + (y - a.y_) * (b.x_ - a.x_);
+      int64_t den = b.y_ - a.y_;
+      if (den < 0) {
+        num = -num;
+        den = -den;
+      }
+      const int64_t last = floor_div(num, den);  // Rightmost ray start it counts for.
+      if (num % den == 0 && last >= 0 && last < columns) inside_row[last] = 1;
+      // Same half-open rule as Line::crosses_ray().
+      if (y == std::max(a.y_, b.y_) || num > static_cast<int64_t>(max_width) * den) continue;
+      if (last >= 0) crossings[std::min<int64_t>(last, columns - 1)]++;
+    }
+    // Suffix sums turn the histogram into the crossing count of each start.
+    int count = 0;
+    for (int x = columns - 1; x >= 0; --x) {
+      count += crossings[x];
+      inside_row[x] |= count % 2;
+      if (inside_row[x]) min_x = std::min(min_x, x);
+    }
+  }
+  if (min_x == columns) return;
+
+  x0_ = min_x;
+  width_ = columns - x0_;
+  sums_.assign(static_cast<size_t>(height_ + 1) * (width_ + 1), 0);
+  for (int row = 0; row < height_; ++row) {
+    const uint8_t* inside_row = &inside[static_cast<size_t>(row) * columns + x0_];
+    uint32_t* sum_row = &sums_[static_cast<size_t>(row + 1) * (width_ + 1)];
+    const uint32_t* prev_row = sum_row - (width_ + 1);
+    uint32_t row_sum = 0;
+    for (int x = 0; x < width_; ++x) {
+      row_sum += inside_row[x];
+      sum_row[x + 1] = prev_row[x + 1] + row_sum;
+    }
+  }
+}
+
+uint32_t KeepoutMask::count(int x1, int y1, int x2, int y2) const {
+  if (sums_.empty()) return 0;
+  x1 = std::max(x1 - x0_, 0);
+  y1 = std::max(y1 - y0_, 0);
+  x2 = std::min(x2 - x0_, width_ - 1);
+  y2 = std::min(y2 - y0_, height_ - 1);
+  if (x2 < x1 || y2 < y1) return 0;
+  const size_t stride = width_ + 1;
+  return sums_[(y2 + 1) * stride + x2 + 1] - sums_[y1 * stride + x2 + 1] -
+         sums_[(y2 + 1) * stride + x1] + sums_[y1 * stride + x1];
+}
+
+void Polygon::rasterize(uint32_t max_width, uint32_t max_height) {
+  mask_ = KeepoutMask(lines_, max_width, max_height, absl::GetFlag(FLAGS_safety_check_whole_box));
+}
+
+Box::Box(int x1, int y1, int x2, int y2)
+    : points_{{{x1, y1}, {x1, y2}, {x2, y1}, {x2, y2}}},
+      lines_{{{points_[0], points_[1]},
+              {points_[1], points_[3]},
+              {points_[3], points_[2]},
+              {points_[2], points_[0]}}},
+      x1_(std::min(x1, x2)),
+      y1_(std::min(y1, y2)),
+      x2_(std::max(x1, x2)),
+      y2_(std::max(y1, y2)) {}
+
+bool Box::collided_with_mask(const Polygon& p, const uint32_t max_width) const {
+  const auto& mask = p.get_mask();
+  if (!mask.valid()) return collided_with_polygon(p, max_width);
+  if (mask.whole_box()) return mask.count(x1_, y1_, x2_, y2_) > 0;
+  return mask.count(x1_, y2_, x2_, y2_) > 0;
+}
+
+const std::string Box::info() const {
+  return "((" + std::to_string(x1_) + "," + std::to_string(y1_) + "),(" + std::to_string(x2_) + ","
+         + std::to_string(y2_) + "))";
 }
+
 const bool Box::intersects_line(const Line& l) const {
   for (const auto& line : lines_) {
     if (line.intersects_line(l)) {
@@ -88,25 +219,26 @@ const bool Box::intersects_line(const Line& l) const {
   return false;
 }
 const bool Box::collided_with_polygon(const Polygon& p, const uint32_t max_width) const {
+  const bool whole_box = absl::GetFlag(FLAGS_safety_check_whole_box);
+  const int bottom_y = y2_;
   const auto& polygon_lines = p.get_lines();
   for (const auto& p : points_) {
     // If not checking the whole box, ignore points that aren't on the
     // bottom of the box.
-    if (!absl::GetFlag(FLAGS_safety_check_whole_box) && p.y_ != bottom_y_) {
+    if (!whole_box && p.y_ != bottom_y) {
       continue;
     }
     size_t intersect_time{0};
     // We create a horizontal line from this point to max image width, if
     // it interects the lines in the polygon even time, it is not inside
     // the polygon. If it is odd, it is inside the polygon.
-    Line extreme{p, {max_width, p.y_}};
     for (const auto& l : polygon_lines) {
       // If p is on any of the lines, it is a collision.
       if (l.contains_point(p)) {
         return true;
       }
-      // If this line in the polygon intersects the extreme line.
-      if (l.intersects_line(extreme)) {
+      // If this line in the polygon crosses the line from p to max width.
+      if (l.crosses_ray(p, max_width)) {
         intersect_time++;
       }
     }
@@ -118,8 +250,7 @@ const bool Box::collided_with_polygon(const Polygon& p, const uint32_t max_width
   for (const auto& box_line : lines_) {
     // If not checking the whole box, skip all lines that don't have the y
     // coordinate equal to the bottom of the box.
-    if (!absl::GetFlag(FLAGS_safety_check_whole_box)
-        && (box_line.begin_.y_ != bottom_y_ || box_line.end_.y_ != bottom_y_)) {
+    if (!whole_box && (box_line.begin_.y_ != bottom_y || box_line.end_.y_ != bottom_y)) {
       continue;
     }
     for (const auto& polygon_line : p.get_lines()) {
@@ -128,9 +259,98 @@ const bool Box::collided_with_polygon(const Polygon& p, const uint32_t max_width
       }
     }
   }
+  // A polygon inside the box neither holds a corner nor crosses an edge.
+  if (whole_box) {
+    for (const auto& l : polygon_lines) {
+      const Point& v = l.begin_;
+      if (v.x_ >= x1_ && v.x_ <= x2_ && v.y_ >= y1_ && v.y_ <= y2_) return true;
+    }
+  }
   return false;
 }
 
+void collide_boxes(
+    const Polygon& p, const std::vector<Box>& boxes, const uint32_t max_width,
+    std::vector<bool>* collided) {
+  collided->resize(boxes.size());
+  for (size_t i = 0; i < boxes.size(); ++i) {
+    (*collided)[i] = boxes[i].collided_with_mask(p, max_width);
+  }
+}
+
+void KeepoutZoneSet::add_zone(const std::string& name, int severity, std::vector<Point> points) {
+  CHECK(!points.empty()) << "Zone " << name << " has no points";
+  Polygon polygon(points);
+  zones_.push_back({name, severity, std::move(points), std::move(polygon)});
+}
+
+KeepoutZoneSet::Range KeepoutZoneSet::cells_of(int x1, int y1, int x2, int y2) const {
+  return {
+      std::max(x1 / kZoneCellSize, 0), std::max(y1 / kZoneCellSize, 0),
+      std::min(x2 / kZoneCellSize, cells_x_ - 1), std::min(y2 / kZoneCellSize, cells_y_ - 1)};
+}
+
+void KeepoutZoneSet::rasterize(uint32_t max_width, uint32_t max_height) {
+  max_width_ = max_width;
+  whole_box_ = absl::GetFlag(FLAGS_safety_check_whole_box);
+  cells_x_ = max_width / kZoneCellSize + 1;
+  cells_y_ = max_height / kZoneCellSize + 1;
+  zone_bounds_.clear();
+  zone_cells_.clear();
+  std::vector<std::vector<int>> cells(cells_x_ * cells_y_);
+  for (size_t id = 0; id < zones_.size(); ++id) {
+    auto& polygon = zones_[id].polygon;
+    polygon.rasterize(max_width, max_height);
+    const auto& mask = polygon.get_mask();
+    // Zones entirely off screen are never hit.
+    zone_bounds_.push_back(
+        mask.valid() ? Range{mask.left(), mask.top(), mask.right(), mask.bottom()}
+                     : Range{0, 0, -1, -1});
+    const auto& bounds = zone_bounds_.back();
+    zone_cells_.push_back(
+        mask.valid() ? cells_of(bounds.x1, bounds.y1, bounds.x2, bounds.y2) : bounds);
+    const auto& range = zone_cells_.back();
+    for (int cy = range.y1; cy <= range.y2; ++cy) {
+      for (int cx = range.x1; cx <= range.x2; ++cx) cells[cy * cells_x_ + cx].push_back(id);
+    }
+  }
+  cell_offsets_.assign(1, 0);
+  cell_zones_.clear();
+  for (const auto& cell : cells) {
+    cell_zones_.insert(cell_zones_.end(), cell.begin(), cell.end());
+    cell_offsets_.push_back(cell_zones_.size());
+  }
+}
+
+void KeepoutZoneSet::collide(const std::vector<Box>& boxes, std::vector<ZoneHit>* hits) const {
+  for (size_t i = 0; i < boxes.size(); ++i) {
+    const Box& box = boxes[i];
+    // Only the bottom edge counts unless checking the whole box.
+    const int top = whole_box_ ? box.top() : box.bottom();
+    const Range query = cells_of(box.left(), top, box.right(), box.bottom());
+    for (int cy = query.y1; cy <= query.y2; ++cy) {
+      for (int cx = query.x1; cx <= query.x2; ++cx) {
+        const int cell = cy * cells_x_ + cx;
+        for (int k = cell_offsets_[cell]; k < cell_offsets_[cell + 1]; ++k) {
+          const int zone = cell_zones_[k];
+          // A zone spanning several cells is only tested in the first one it
+          // shares with the box.
+          const auto& range = zone_cells_[zone];
+          if (cx != std::max(range.x1, query.x1) || cy != std::max(range.y1, query.y1)) continue;
+          const auto& bounds = zone_bounds_[zone];
+          if (bounds.x1 > box.right() || bounds.x2 < box.left() || bounds.y1 > box.bottom() ||
+              bounds.y2 < top) {
+            continue;
+          }
+          if (box.collided_with_mask(zones_[zone].polygon, max_width_)) {
+            hits->push_back({static_cast<int>(i), zone});
+          }
+        }
+      }
+    }
+  }
+}
+
 Polygon parse_keepout_polygon(const std::string& file_path) {
   std::ifstream f{file_path};
   std::vector<Point> points;
@@ -156,4 +376,47 @@ Polygon parse_keepout_polygon(const std::string& file_path) {
   return {};
 }
 
+KeepoutZoneSet parse_keepout_zones(const std::string& file_path) {
+  KeepoutZoneSet zones;
+  std::ifstream f{file_path};
+  if (!f.is_open()) return zones;
+  std::string header;
+  std::getline(f, header);
+  const bool legacy = std::vector<std::string>(absl::StrSplit(header, ',')).size() == 2;
+  std::string name = legacy ? "keepout" : "";
+  int severity = 2;
+  std::vector<Point> points;
+  for (std::string line; std::getline(f, line);) {
+    const std::vector<absl::string_view> fields =
+        absl::StrSplit(line, ',', absl::SkipWhitespace());
+    if (fields.empty()) continue;
+    int x, y;
+    if (legacy) {
+      if (fields.size() != 2 || !absl::SimpleAtoi(fields[0], &x) ||
+          !absl::SimpleAtoi(fields[1], &y)) {
+        LOG(WARNING) << "Skipping malformed keepout row: " << line;
+        continue;
+      }
+    } else {
+      int row_severity;
+      if (fields.size() != 4 || !absl::SimpleAtoi(fields[1], &row_severity) ||
+          !absl::SimpleAtoi(fields[2], &x) || !absl::SimpleAtoi(fields[3], &y)) {
+        LOG(WARNING) << "Skipping malformed keepout row: " << line;
+        continue;
+      }
+      const auto zone_name = absl::StripAsciiWhitespace(fields[0]);
+      if (zone_name != name) {
+        // Rows of the next zone begin.
+        if (!points.empty()) zones.add_zone(name, severity, std::move(points));
+        points.clear();
+        name = std::string(zone_name);
+        severity = row_severity;
+      }
+    }
+    points.emplace_back(x, y);
+  }
+  if (!points.empty()) zones.add_zone(name, severity, std::move(points));
+  return zones;
+}
+
 }  // namespace coral
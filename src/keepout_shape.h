@@ -19,6 +19,8 @@
 
 #include <math.h>
 
+#include <array>
+#include <cstdint>
 #include <fstream>
 #include <iostream>
 #include <string>
@@ -52,11 +54,52 @@ struct Line {
   bool contains_point(const Point& p) const;
   // Checks whether if this line intersects the line l.
   bool intersects_line(const Line& l) const;
+  // Checks whether this line crosses the horizontal ray from p to max_x, for
+  // ray casting. Lines count for the rows from their lower end up to but not
+  // including their upper end, so a ray through a vertex meets exactly one of
+  // its lines, or both or none where the polygon turns back, and horizontal
+  // lines never count.
+  bool crosses_ray(const Point& p, int max_x) const;
   const std::string info() const;
   Point begin_, end_;
   double length_;
 };
 
+// Lattice points inside or on the boundary of a polygon, precomputed for one
+// output resolution so collision tests become table lookups. Inside matches
+// the ray casting of Box::collided_with_polygon() point for point.
+class KeepoutMask {
+public:
+  KeepoutMask() = default;
+  // Rasterizes the polygon made of `lines` for boxes within `max_width` by
+  // `max_height`. `whole_box` selects the box test, see Box::collided_with_mask().
+  KeepoutMask(
+      const std::vector<Line>& lines, uint32_t max_width, uint32_t max_height, bool whole_box);
+  // True once built for a non-empty polygon.
+  bool valid() const { return !sums_.empty(); }
+  bool whole_box() const { return whole_box_; }
+  // Return true if the point (x, y) is inside or on the polygon.
+  bool contains(int x, int y) const { return count(x, y, x, y) > 0; }
+  // Return the number of lattice points in the polygon between (x1, y1) and
+  // (x2, y2), both included.
+  uint32_t count(int x1, int y1, int x2, int y2) const;
+  // Return the area the mask covers, which holds every inside point.
+  int left() const { return x0_; }
+  int top() const { return y0_; }
+  int right() const { return x0_ + width_ - 1; }
+  int bottom() const { return y0_ + height_ - 1; }
+
+private:
+  // Summed-area table of the inside points, (height_ + 1) x (width_ + 1),
+  // covering columns [x0_, x0_ + width_) and rows [y0_, y0_ + height_).
+  std::vector<uint32_t> sums_;
+  int x0_ = 0;
+  int y0_ = 0;
+  int width_ = 0;
+  int height_ = 0;
+  bool whole_box_ = false;
+};
+
 class Polygon {
 public:
   Polygon() {}
@@ -68,29 +111,110 @@ public:
   const std::string& get_svg_str() const { return svg_str_; };
   // Set svg string.
   void set_svg_str(const std::string& svg) { svg_str_ = svg; };
+  // Precomputes the mask used by Box::collided_with_mask() for boxes within
+  // `max_width` by `max_height`.
+  void rasterize(uint32_t max_width, uint32_t max_height);
+  // Return the mask built by rasterize().
+  const KeepoutMask& get_mask() const { return mask_; }
 
 private:
   std::vector<Line> lines_;
   std::string svg_str_{"None"};
+  KeepoutMask mask_;
 };
 
 class Box {
 public:
   Box(const int x1, const int y1, const int x2, const int y2);
-  // Return true if this box collided with the polygon p.
+  // Return true if this box collided with the polygon p. Geometric reference
+  // for collided_with_mask(), testing the same edge or box against the exact
+  // polygon, so it also reports the slivers of polygon between pixels.
   const bool collided_with_polygon(const Polygon& p, const uint32_t max_width) const;
+  // Return true if the polygon overlaps the bottom edge of this box, or the
+  // whole box with --safety_check_whole_box. Constant time once the polygon
+  // has been rasterized, falls back to collided_with_polygon() before.
+  bool collided_with_mask(const Polygon& p, const uint32_t max_width) const;
   // Return true if this box collided with the line l.
   const bool intersects_line(const Line& l) const;
   const std::string info() const;
+  // Return the edges of this box.
+  int left() const { return x1_; }
+  int top() const { return y1_; }
+  int right() const { return x2_; }
+  int bottom() const { return y2_; }
 
 private:
-  std::vector<Point> points_;
-  std::vector<Line> lines_;
-  int bottom_y_;
+  std::array<Point, 4> points_;
+  std::array<Line, 4> lines_;
+  int x1_, y1_, x2_, y2_;
+};
+
+// Tests every box of a frame against the polygon in one call, writes whether
+// boxes[i] collided into (*collided)[i].
+void collide_boxes(
+    const Polygon& p, const std::vector<Box>& boxes, const uint32_t max_width,
+    std::vector<bool>* collided);
+
+// A named keepout region. Severity 1 is a warning, 2 and above a violation.
+struct KeepoutZone {
+  std::string name;
+  int severity;
+  // Vertices of the outline, in order.
+  std::vector<Point> points;
+  Polygon polygon;
+};
+
+// A zone a box of a batch collided with.
+struct ZoneHit {
+  int box;
+  int zone;
+};
+
+// Every keepout zone of a camera. A uniform grid over the output indexes the
+// zones by bounding box, so a box is only tested against the zones sharing a
+// cell with it and the cost per box stays flat as zones are added.
+class KeepoutZoneSet {
+public:
+  // Adds a zone, ids are assigned in order from 0.
+  void add_zone(const std::string& name, int severity, std::vector<Point> points);
+  // Rasterizes every zone and builds the grid for boxes within `max_width`
+  // by `max_height`. Must be called before collide().
+  void rasterize(uint32_t max_width, uint32_t max_height);
+  bool empty() const { return zones_.empty(); }
+  int size() const { return zones_.size(); }
+  const KeepoutZone& get_zone(int id) const { return zones_[id]; }
+  // Appends a ZoneHit for every zone each of `boxes` collided with, ordered
+  // by box. Same collision test as Box::collided_with_mask().
+  void collide(const std::vector<Box>& boxes, std::vector<ZoneHit>* hits) const;
+
+private:
+  // Inclusive range of pixels or grid cells.
+  struct Range {
+    int x1, y1, x2, y2;
+  };
+  Range cells_of(int x1, int y1, int x2, int y2) const;
+
+  std::vector<KeepoutZone> zones_;
+  // Mask bounds and grid cells of every zone, kept apart from the zones so
+  // rejecting candidates doesn't touch their masks.
+  std::vector<Range> zone_bounds_;
+  std::vector<Range> zone_cells_;
+  // Zone ids of every cell, cell c owns [cell_offsets_[c], cell_offsets_[c + 1]).
+  std::vector<int> cell_offsets_;
+  std::vector<int> cell_zones_;
+  int cells_x_ = 0;
+  int cells_y_ = 0;
+  uint32_t max_width_ = 0;
+  bool whole_box_ = false;
 };
 
 Polygon parse_keepout_polygon(const std::string& file_path);
 
+// Parses zones from a CSV file. Rows are "zone,severity,x,y", the rows of a
+// zone list its points in order. A file with an "x,y" header is read as a
+// single zone of severity 2.
+KeepoutZoneSet parse_keepout_zones(const std::string& file_path);
+
 }  // namespace coral
 
 #endif  // MANUFACTURING_DEMO_SHAPE_H_
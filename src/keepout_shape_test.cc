@@ -0,0 +1,175 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "keepout_shape.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "absl/flags/declare.h"
+#include "absl/flags/flag.h"
+#include "gtest/gtest.h"
+
+ABSL_DECLARE_FLAG(bool, safety_check_whole_box);
+
+namespace coral {
+namespace {
+
+constexpr int kWidth = 160;
+constexpr int kHeight = 120;
+
+// A star shaped polygon of 3 to 10 vertices within the frame, so it never
+// crosses itself.
+std::vector<Point> random_polygon(std::mt19937* rng) {
+  std::uniform_int_distribution<int> vertices(3, 10);
+  std::uniform_real_distribution<double> angle(0, 2 * M_PI);
+  std::uniform_real_distribution<double> radius(2, 60);
+  std::uniform_int_distribution<int> cx(0, kWidth), cy(0, kHeight);
+  const int n = vertices(*rng);
+  const int x = cx(*rng), y = cy(*rng);
+  std::vector<double> angles(n);
+  for (auto& a : angles) a = angle(*rng);
+  std::sort(angles.begin(), angles.end());
+  std::vector<Point> points;
+  for (double a : angles) {
+    const double r = radius(*rng);
+    points.emplace_back(
+        std::min(std::max(static_cast<int>(std::lround(x + r * std::cos(a))), 0), kWidth),
+        std::min(std::max(static_cast<int>(std::lround(y + r * std::sin(a))), 0), kHeight));
+  }
+  return points;
+}
+
+Box random_box(std::mt19937* rng) {
+  std::uniform_int_distribution<int> x(0, kWidth), y(0, kHeight);
+  const int x1 = x(*rng), x2 = x(*rng), y1 = y(*rng), y2 = y(*rng);
+  return Box(std::min(x1, x2), std::min(y1, y2), std::max(x1, x2), std::max(y1, y2));
+}
+
+// Whether any pixel of the area `box` is tested on lies in `polygon`, by the
+// geometric test of single points.
+bool has_pixel_inside(const Box& box, const Polygon& polygon, bool whole_box) {
+  for (int y = whole_box ? box.top() : box.bottom(); y <= box.bottom(); ++y) {
+    for (int x = box.left(); x <= box.right(); ++x) {
+      if (Box(x, y, x, y).collided_with_polygon(polygon, kWidth)) return true;
+    }
+  }
+  return false;
+}
+
+// Collides `boxes` with `points` through the mask, collide_boxes() and a
+// KeepoutZoneSet, which must all agree, and checks the geometric reference
+// against them. Returns the boxes only the reference reports.
+int expect_same_answers(
+    const std::vector<Point>& points, const std::vector<Box>& boxes, bool whole_box) {
+  absl::SetFlag(&FLAGS_safety_check_whole_box, whole_box);
+  std::vector<Point> vertices = points;
+  Polygon polygon(vertices);
+  polygon.rasterize(kWidth, kHeight);
+  KeepoutZoneSet zones;
+  zones.add_zone("zone", 2, points);
+  zones.rasterize(kWidth, kHeight);
+
+  std::vector<bool> batch;
+  collide_boxes(polygon, boxes, kWidth, &batch);
+  std::vector<ZoneHit> hits;
+  zones.collide(boxes, &hits);
+  std::vector<bool> zone_hit(boxes.size());
+  for (const auto& hit : hits) zone_hit[hit.box] = true;
+
+  int slivers = 0;
+  for (size_t i = 0; i < boxes.size(); ++i) {
+    const Box& box = boxes[i];
+    const bool mask = box.collided_with_mask(polygon, kWidth);
+    const bool geometric = box.collided_with_polygon(polygon, kWidth);
+    EXPECT_EQ(batch[i], mask) << box.info();
+    EXPECT_EQ(zone_hit[i], mask) << box.info();
+    if (mask == geometric) continue;
+    // The mask only holds pixels, so it may miss a sliver of polygon
+    // between them, but never reports a box the reference doesn't.
+    EXPECT_TRUE(geometric) << box.info();
+    EXPECT_FALSE(has_pixel_inside(box, polygon, whole_box)) << box.info();
+    ++slivers;
+  }
+  return slivers;
+}
+
+TEST(KeepoutShapeTest, MaskMatchesGeometryOnRandomBoxes) {
+  std::mt19937 rng(1);
+  for (bool whole_box : {false, true}) {
+    int tested = 0, slivers = 0;
+    for (int run = 0; run < 200; ++run) {
+      const auto points = random_polygon(&rng);
+      std::vector<Box> boxes;
+      for (int i = 0; i < 100; ++i) boxes.push_back(random_box(&rng));
+      slivers += expect_same_answers(points, boxes, whole_box);
+      tested += boxes.size();
+    }
+    EXPECT_LT(slivers, tested / 100) << "whole_box " << whole_box;
+  }
+}
+
+TEST(KeepoutShapeTest, MaskMatchesGeometryOnPoints) {
+  std::mt19937 rng(2);
+  std::uniform_int_distribution<int> x(0, kWidth), y(0, kHeight);
+  for (bool whole_box : {false, true}) {
+    for (int run = 0; run < 100; ++run) {
+      std::vector<Box> boxes;
+      for (int i = 0; i < 100; ++i) {
+        const int px = x(rng), py = y(rng);
+        boxes.emplace_back(px, py, px, py);
+      }
+      EXPECT_EQ(expect_same_answers(random_polygon(&rng), boxes, whole_box), 0);
+    }
+  }
+}
+
+TEST(KeepoutShapeTest, BoxesOnTheEdges) {
+  // A square and a diamond, whose edges are diagonal.
+  const std::vector<Point> square{{40, 40}, {80, 40}, {80, 80}, {40, 80}};
+  const std::vector<Point> diamond{{80, 10}, {120, 50}, {80, 90}, {40, 50}};
+  std::vector<Box> boxes{
+      // Bottom on the top edge, on a corner, and one row above.
+      {50, 20, 60, 40}, {30, 20, 40, 40}, {50, 20, 60, 39},
+      // Right side on the left edge, the bottom corner on it or beside it.
+      {20, 50, 40, 60}, {20, 50, 39, 60},
+      // Bottom across the whole polygon with both its corners outside.
+      {10, 20, 150, 60},
+      // Around the whole polygon, the bottom below it.
+      {10, 10, 150, 110},
+      // Corners on a diagonal edge of the diamond, and just off it.
+      {100, 20, 110, 30}, {101, 20, 110, 30}, {60, 70, 70, 90}, {50, 60, 55, 65},
+  };
+  for (bool whole_box : {false, true}) {
+    EXPECT_EQ(expect_same_answers(square, boxes, whole_box), 0);
+    EXPECT_EQ(expect_same_answers(diamond, boxes, whole_box), 0);
+  }
+
+  absl::SetFlag(&FLAGS_safety_check_whole_box, false);
+  std::vector<Point> vertices = square;
+  Polygon polygon(vertices);
+  polygon.rasterize(kWidth, kHeight);
+  EXPECT_TRUE(Box(50, 20, 60, 40).collided_with_mask(polygon, kWidth));
+  EXPECT_FALSE(Box(50, 20, 60, 39).collided_with_mask(polygon, kWidth));
+  EXPECT_TRUE(Box(20, 50, 40, 60).collided_with_mask(polygon, kWidth));
+  EXPECT_TRUE(Box(10, 20, 150, 60).collided_with_polygon(polygon, kWidth));
+  EXPECT_FALSE(Box(10, 10, 150, 110).collided_with_polygon(polygon, kWidth));
+  absl::SetFlag(&FLAGS_safety_check_whole_box, true);
+  EXPECT_TRUE(Box(10, 10, 150, 110).collided_with_polygon(polygon, kWidth));
+}
+
+}  // namespace
+}  // namespace coral
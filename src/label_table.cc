@@ -0,0 +1,66 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "label_table.h"
+
+#include <fstream>
+#include <iterator>
+#include <utility>
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/numbers.h"
+#include "glog/logging.h"
+
+namespace coral {
+
+void LabelTable::load(const std::string& label_path) {
+  std::ifstream label_file(label_path, std::ios::binary);
+  if (!label_file.good()) {
+    LOG(ERROR) << "Unable to open file " << label_path;
+    exit(EXIT_FAILURE);
+  }
+  const std::string contents(
+      (std::istreambuf_iterator<char>(label_file)), std::istreambuf_iterator<char>());
+  // Offsets are collected first, views are only safe once storage_ stops growing.
+  std::vector<std::pair<size_t, size_t>> spans;
+  storage_.clear();
+  storage_.reserve(contents.size());
+  absl::string_view rest = contents;
+  while (!rest.empty()) {
+    const size_t end = rest.find('\n');
+    absl::string_view line = rest.substr(0, end);
+    rest.remove_prefix(end == absl::string_view::npos ? rest.size() : end + 1);
+    // Lines are "<id> <label>", anything without a leading id is skipped.
+    absl::string_view trimmed = absl::StripLeadingAsciiWhitespace(line);
+    size_t digits = 0;
+    while (digits < trimmed.size() && absl::ascii_isdigit(trimmed[digits])) ++digits;
+    int id;
+    if (digits == 0 || !absl::SimpleAtoi(trimmed.substr(0, digits), &id)) continue;
+    // Trim the id and the spaces after it to get the label.
+    if (trimmed.size() == line.size() && digits < line.size() && line[digits] == ' ') {
+      line.remove_prefix(digits);
+      while (!line.empty() && line.front() == ' ') line.remove_prefix(1);
+    }
+    if (spans.size() <= static_cast<size_t>(id)) spans.resize(id + 1);
+    spans[id] = {storage_.size(), line.size()};
+    storage_.append(line.data(), line.size());
+  }
+  labels_.clear();
+  labels_.reserve(spans.size());
+  for (const auto& span : spans) {
+    labels_.emplace_back(storage_.data() + span.first, span.second);
+  }
+}
+
+}  // namespace coral
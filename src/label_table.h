@@ -0,0 +1,78 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MANUFACTURING_DEMO_LABEL_TABLE_H_
+#define MANUFACTURING_DEMO_LABEL_TABLE_H_
+
+#include <bitset>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+namespace coral {
+
+// Upper bound (exclusive) on the class ids a ClassFilter can hold.
+constexpr int kMaxClassId = 1024;
+
+// Interned label strings indexed by class id. Every label lives in a single
+// buffer, so lookups hand out views instead of copying strings.
+class LabelTable {
+public:
+  LabelTable() = default;
+  // LabelTable is neither copyable nor movable, views point into it.
+  LabelTable(const LabelTable&) = delete;
+  LabelTable& operator=(const LabelTable&) = delete;
+
+  // Reads a "<id> <label>" per line file, exits on failure.
+  void load(const std::string& label_path);
+  // Returns the label for `id`, or an empty view for unknown ids. The view
+  // stays valid for the lifetime of the table.
+  absl::string_view at(int id) const {
+    return id >= 0 && id < static_cast<int>(labels_.size()) ? labels_[id] : absl::string_view();
+  }
+  // Number of ids, including gaps.
+  size_t size() const { return labels_.size(); }
+
+private:
+  std::string storage_;
+  std::vector<absl::string_view> labels_;
+};
+
+// A precomputed set of class ids for filtering detections.
+class ClassFilter {
+public:
+  ClassFilter() = default;
+  ClassFilter(std::initializer_list<int> ids) {
+    for (int id : ids) add(id);
+  }
+  explicit ClassFilter(const std::vector<int>& ids) {
+    for (int id : ids) add(id);
+  }
+
+  void add(int id) {
+    if (id >= 0 && id < kMaxClassId) ids_.set(id);
+  }
+  bool contains(int id) const { return id >= 0 && id < kMaxClassId && ids_.test(id); }
+
+private:
+  std::bitset<kMaxClassId> ids_;
+};
+
+}  // namespace coral
+
+#endif  // MANUFACTURING_DEMO_LABEL_TABLE_H_
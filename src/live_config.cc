@@ -0,0 +1,404 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "live_config.h"
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <set>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/str_split.h"
+#include "glog/logging.h"
+
+namespace coral {
+
+namespace {
+
+// How long the watcher waits for an event or a connection before checking
+// whether it was stopped.
+constexpr int kPollIntervalMs = 200;
+// Longest command line read.
+constexpr size_t kMaxCommandBytes = 4096;
+// Changes that complete a file: written and closed, or renamed into place.
+constexpr uint32_t kWatchedEvents = IN_CLOSE_WRITE | IN_MOVED_TO;
+
+// Splits `path` into its directory, "." for none, and file name.
+void split_path(const std::string& path, std::string* directory, std::string* name) {
+  const size_t slash = path.rfind('/');
+  if (slash == std::string::npos) {
+    *directory = ".";
+    *name = path;
+  } else {
+    *directory = slash == 0 ? "/" : path.substr(0, slash);
+    *name = path.substr(slash + 1);
+  }
+}
+
+// `path` as built from an inotify event, so both compare equal.
+std::string event_path(const std::string& path) {
+  std::string directory, name;
+  split_path(path, &directory, &name);
+  return absl::StrCat(directory, directory == "/" ? "" : "/", name);
+}
+
+void write_all(int fd, const std::string& data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    const ssize_t n = write(fd, data.data() + written, data.size() - written);
+    if (n <= 0) return;
+    written += n;
+  }
+}
+
+}  // namespace
+
+LiveConfig::LiveConfig(
+    const std::vector<StreamConfig>& configs, const std::vector<std::vector<int>>& class_ids,
+    const LiveConfigOptions& options)
+    : options_(options) {
+  CHECK_EQ(configs.size(), class_ids.size());
+  absl::MutexLock l(&lock_);
+  configs_ = configs;
+  for (size_t i = 0; i < configs.size(); ++i) {
+    const auto& config = configs[i];
+    std::shared_ptr<StreamSettings> settings(new StreamSettings);
+    settings->threshold = config.threshold;
+    settings->class_ids = class_ids[i];
+    settings->want_ids = ClassFilter(class_ids[i]);
+    const bool safety = config.task == StreamTask::kWorkerSafety;
+    settings->keepout_zones = load_keepout(safety ? config.keepout_path : "");
+    if (!settings->keepout_zones) {
+      LOG(ERROR) << config.name << ": unable to read " << config.keepout_path;
+      settings->keepout_zones = load_keepout("");
+    } else if (!config.keepout_path.empty()) {
+      LOG(INFO) << config.name << ": loaded " << settings->keepout_zones->size()
+                << " keepout zones";
+    }
+    settings_.emplace_back(new Snapshot<StreamSettings>(std::move(settings)));
+  }
+}
+
+std::vector<std::string> LiveConfig::get_watched_paths() const {
+  absl::MutexLock l(&lock_);
+  std::vector<std::string> paths;
+  if (!options_.streams_config_path.empty()) paths.push_back(options_.streams_config_path);
+  for (const auto& config : configs_) {
+    if (config.task == StreamTask::kWorkerSafety && !config.keepout_path.empty()) {
+      paths.push_back(config.keepout_path);
+    }
+  }
+  return paths;
+}
+
+void LiveConfig::reload_file(const std::string& path) {
+  const std::string changed = event_path(path);
+  absl::MutexLock l(&lock_);
+  if (!options_.streams_config_path.empty() &&
+      event_path(options_.streams_config_path) == changed) {
+    reload_streams(/*all_keepouts=*/false);
+    return;
+  }
+  for (size_t i = 0; i < configs_.size(); ++i) {
+    const auto& config = configs_[i];
+    if (config.task == StreamTask::kWorkerSafety && !config.keepout_path.empty() &&
+        event_path(config.keepout_path) == changed) {
+      reload_keepout(i, config.keepout_path);
+    }
+  }
+}
+
+std::string LiveConfig::handle_command(const std::string& command) {
+  const std::vector<std::string> words =
+      absl::StrSplit(command, absl::ByAnyChar(" \t\r"), absl::SkipEmpty());
+  if (words.empty()) return "error: empty command";
+  absl::MutexLock l(&lock_);
+  const std::string& verb = words[0];
+  if (verb == "show" && words.size() == 1) {
+    std::vector<std::string> lines;
+    for (size_t i = 0; i < configs_.size(); ++i) {
+      const auto settings = settings_[i]->get();
+      lines.push_back(absl::StrCat(
+          configs_[i].name, " threshold=", settings->threshold,
+          " classes=", absl::StrJoin(settings->class_ids, ","),
+          " zones=", settings->keepout_zones->size(), " keepout=", configs_[i].keepout_path));
+    }
+    return absl::StrJoin(lines, "\n");
+  }
+  if (verb == "reload" && words.size() == 1) {
+    if (!options_.streams_config_path.empty()) {
+      return reload_streams(/*all_keepouts=*/true)
+                 ? "ok"
+                 : absl::StrCat("error: unable to read ", options_.streams_config_path);
+    }
+    bool loaded = true;
+    for (size_t i = 0; i < configs_.size(); ++i) {
+      if (configs_[i].task != StreamTask::kWorkerSafety) continue;
+      loaded &= reload_keepout(i, configs_[i].keepout_path);
+    }
+    return loaded ? "ok" : "error: unable to read every keepout file";
+  }
+  if (words.size() < 2) return absl::StrCat("error: unknown command ", command);
+  const int stream = find_stream(words[1]);
+  if (stream < 0) return absl::StrCat("error: unknown stream ", words[1]);
+  if (verb == "threshold" && words.size() == 3) {
+    float threshold;
+    if (!absl::SimpleAtof(words[2], &threshold) || threshold < 0 || threshold > 1) {
+      return absl::StrCat("error: invalid threshold ", words[2]);
+    }
+    configs_[stream].threshold = threshold;
+    update(stream, [threshold](StreamSettings* settings) { settings->threshold = threshold; });
+    LOG(INFO) << words[1] << ": threshold set to " << threshold;
+    return "ok";
+  }
+  if (verb == "classes" && words.size() == 3) {
+    std::vector<int> ids;
+    for (absl::string_view field : absl::StrSplit(words[2], ',')) {
+      int id;
+      if (!absl::SimpleAtoi(field, &id) || id < 0 || id >= kMaxClassId) {
+        return absl::StrCat("error: invalid class id ", field);
+      }
+      ids.push_back(id);
+    }
+    update(stream, [&ids](StreamSettings* settings) {
+      settings->class_ids = ids;
+      settings->want_ids = ClassFilter(ids);
+    });
+    LOG(INFO) << words[1] << ": classes set to " << words[2];
+    return "ok";
+  }
+  if (verb == "keepout" && (words.size() == 2 || words.size() == 3)) {
+    if (configs_[stream].task != StreamTask::kWorkerSafety) {
+      return absl::StrCat("error: ", words[1], " is not a worker safety stream");
+    }
+    const std::string path = words.size() == 3 ? words[2] : configs_[stream].keepout_path;
+    if (!reload_keepout(stream, path)) return absl::StrCat("error: unable to read ", path);
+    configs_[stream].keepout_path = path;
+    return "ok";
+  }
+  return absl::StrCat("error: unknown command ", command);
+}
+
+std::shared_ptr<const KeepoutZoneSet> LiveConfig::load_keepout(const std::string& path) const {
+  std::shared_ptr<KeepoutZoneSet> zones(new KeepoutZoneSet);
+  if (!path.empty()) {
+    // parse_keepout_zones() reads a missing file as no zones, which a file
+    // half way through being replaced mustn't turn into.
+    if (!std::ifstream(path).is_open()) return nullptr;
+    *zones = parse_keepout_zones(path);
+  }
+  zones->rasterize(options_.width, options_.height);
+  return zones;
+}
+
+void LiveConfig::update(int stream, const std::function<void(StreamSettings*)>& change) {
+  std::shared_ptr<StreamSettings> settings(new StreamSettings(*settings_[stream]->get()));
+  change(settings.get());
+  settings_[stream]->publish(std::move(settings));
+}
+
+bool LiveConfig::reload_keepout(int stream, const std::string& path) {
+  // Zones are loaded and rasterized before anything is published, the
+  // stream keeps checking the previous ones meanwhile.
+  auto zones = load_keepout(path);
+  if (!zones) {
+    LOG(ERROR) << configs_[stream].name << ": unable to read " << path
+               << ", keeping the current keepout zones";
+    return false;
+  }
+  LOG(INFO) << configs_[stream].name << ": reloaded " << zones->size() << " keepout zones";
+  update(stream, [&zones](StreamSettings* settings) { settings->keepout_zones = zones; });
+  return true;
+}
+
+bool LiveConfig::reload_streams(bool all_keepouts) {
+  std::vector<StreamConfig> configs;
+  if (!parse_stream_configs(options_.streams_config_path, &configs)) {
+    LOG(ERROR) << "Unable to reload " << options_.streams_config_path
+               << ", keeping the current settings";
+    return false;
+  }
+  std::set<std::string> listed;
+  for (const auto& config : configs) {
+    listed.insert(config.name);
+    const int stream = find_stream(config.name);
+    if (stream < 0) {
+      LOG(WARNING) << "Adding stream " << config.name << " needs a restart";
+      continue;
+    }
+    auto& current = configs_[stream];
+    if (config.task != current.task || config.input != current.input) {
+      LOG(WARNING) << "Changing the task or input of " << config.name << " needs a restart";
+    }
+    if (config.threshold != current.threshold) {
+      LOG(INFO) << config.name << ": threshold set to " << config.threshold;
+      current.threshold = config.threshold;
+      const float threshold = config.threshold;
+      update(stream, [threshold](StreamSettings* settings) { settings->threshold = threshold; });
+    }
+    if (current.task == StreamTask::kWorkerSafety &&
+        (all_keepouts || config.keepout_path != current.keepout_path) &&
+        reload_keepout(stream, config.keepout_path)) {
+      current.keepout_path = config.keepout_path;
+    }
+  }
+  for (const auto& config : configs_) {
+    if (!listed.count(config.name)) {
+      LOG(WARNING) << "Removing stream " << config.name << " needs a restart";
+    }
+  }
+  return true;
+}
+
+int LiveConfig::find_stream(const std::string& name) const {
+  for (size_t i = 0; i < configs_.size(); ++i) {
+    if (configs_[i].name == name) return i;
+  }
+  return -1;
+}
+
+ConfigWatcher::ConfigWatcher(LiveConfig* config, const ConfigWatcherOptions& options)
+    : config_(config), options_(options) {
+  if (options_.watch_files) {
+    inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd_ < 0) {
+      LOG(ERROR) << "Unable to watch the config files: " << strerror(errno);
+    } else {
+      update_watches();
+    }
+  }
+  if (!options_.control_socket.empty()) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    CHECK_LT(options_.control_socket.size(), sizeof(address.sun_path))
+        << "Control socket path too long";
+    strncpy(address.sun_path, options_.control_socket.c_str(), sizeof(address.sun_path) - 1);
+    listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    CHECK_GE(listen_fd_, 0) << "Unable to create the control socket";
+    // A socket left behind by a previous run would fail the bind.
+    unlink(options_.control_socket.c_str());
+    if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(listen_fd_, /*backlog=*/4) != 0) {
+      LOG(ERROR) << "Unable to listen on " << options_.control_socket << ": " << strerror(errno);
+      close(listen_fd_);
+      listen_fd_ = -1;
+    } else {
+      // Only the user running the demo may reconfigure it.
+      chmod(options_.control_socket.c_str(), S_IRUSR | S_IWUSR);
+      LOG(INFO) << "Taking control commands on " << options_.control_socket;
+    }
+  }
+  if (inotify_fd_ >= 0 || listen_fd_ >= 0) thread_ = std::thread(&ConfigWatcher::run, this);
+}
+
+ConfigWatcher::~ConfigWatcher() {
+  stopped_ = true;
+  if (thread_.joinable()) thread_.join();
+  if (inotify_fd_ >= 0) close(inotify_fd_);
+  if (listen_fd_ >= 0) {
+    close(listen_fd_);
+    unlink(options_.control_socket.c_str());
+  }
+}
+
+void ConfigWatcher::run() {
+  while (!stopped_) {
+    pollfd fds[2] = {{inotify_fd_, POLLIN, 0}, {listen_fd_, POLLIN, 0}};
+    // Negative descriptors are ignored by poll().
+    if (poll(fds, 2, kPollIntervalMs) <= 0) continue;
+    if (fds[0].revents & POLLIN) read_events();
+    if (fds[1].revents & POLLIN) {
+      const int client = accept(listen_fd_, nullptr, nullptr);
+      if (client >= 0) {
+        serve(client);
+        close(client);
+      }
+    }
+  }
+}
+
+void ConfigWatcher::update_watches() {
+  if (inotify_fd_ < 0) return;
+  for (const auto& path : config_->get_watched_paths()) {
+    std::string directory, name;
+    split_path(path, &directory, &name);
+    // Watching a directory again returns the descriptor it already has.
+    const int wd = inotify_add_watch(inotify_fd_, directory.c_str(), kWatchedEvents);
+    if (wd < 0) {
+      LOG(ERROR) << "Unable to watch " << directory << ": " << strerror(errno);
+    } else if (directories_.emplace(wd, directory).second) {
+      LOG(INFO) << "Watching " << directory << " for config changes";
+    }
+  }
+}
+
+void ConfigWatcher::read_events() {
+  // Every event queued is read before reloading, so a file changed several
+  // times in a row is reloaded once.
+  std::set<std::string> changed;
+  alignas(inotify_event) char buffer[4096];
+  for (;;) {
+    const ssize_t n = read(inotify_fd_, buffer, sizeof(buffer));
+    if (n <= 0) break;
+    for (ssize_t offset = 0; offset < n;) {
+      const auto* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+      offset += sizeof(inotify_event) + event->len;
+      const auto directory = directories_.find(event->wd);
+      if (event->len == 0 || directory == directories_.end()) continue;
+      changed.insert(event_path(absl::StrCat(directory->second, "/", event->name)));
+    }
+  }
+  if (changed.empty()) return;
+  std::set<std::string> watched;
+  for (const auto& path : config_->get_watched_paths()) watched.insert(event_path(path));
+  for (const auto& path : changed) {
+    if (watched.count(path)) config_->reload_file(path);
+  }
+  // The streams config may have pointed a stream at another keepout file.
+  update_watches();
+}
+
+void ConfigWatcher::serve(int client) {
+  // Commands are lines, a client sends them and waits for the replies.
+  std::string request;
+  char buffer[512];
+  while (request.find('\n') == std::string::npos && request.size() < kMaxCommandBytes) {
+    pollfd fd{client, POLLIN, 0};
+    if (poll(&fd, 1, kPollIntervalMs) <= 0) break;
+    const ssize_t n = read(client, buffer, sizeof(buffer));
+    if (n <= 0) break;
+    request.append(buffer, n);
+  }
+  std::string response;
+  for (absl::string_view line : absl::StrSplit(request, '\n', absl::SkipWhitespace())) {
+    const std::string command(line);
+    LOG(INFO) << "Control command: " << command;
+    absl::StrAppend(&response, config_->handle_command(command), "\n");
+  }
+  write_all(client, response);
+  // A keepout command may have pointed a stream at another file.
+  update_watches();
+}
+
+}  // namespace coral
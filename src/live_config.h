@@ -0,0 +1,213 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MANUFACTURING_DEMO_LIVE_CONFIG_H_
+#define MANUFACTURING_DEMO_LIVE_CONFIG_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "keepout_shape.h"
+#include "label_table.h"
+#include "stream_config.h"
+
+namespace coral {
+
+// A value the streams read on every frame and that is replaced whole while
+// they run, read-copy-update style: a published value is never modified, a
+// change publishes a modified copy. Readers keep the value they last read
+// and only check a version number per frame, the lock is taken on the first
+// frame after a change. A replaced value is freed once the last reader
+// holding it moved on.
+template <typename T>
+class Snapshot {
+public:
+  explicit Snapshot(std::shared_ptr<const T> value) : value_(std::move(value)) {}
+  Snapshot(const Snapshot&) = delete;
+  Snapshot& operator=(const Snapshot&) = delete;
+
+  // Replaces the value, readers see it on their next update().
+  void publish(std::shared_ptr<const T> value) LOCKS_EXCLUDED(lock_) {
+    absl::MutexLock l(&lock_);
+    value_ = std::move(value);
+    version_.store(version_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+  // Returns the current value, for writers and for readers off the hot path.
+  std::shared_ptr<const T> get() const LOCKS_EXCLUDED(lock_) {
+    absl::MutexLock l(&lock_);
+    return value_;
+  }
+
+  // Reads the snapshot from one thread at a time, such as a stream worker.
+  class Reader {
+  public:
+    explicit Reader(const Snapshot* snapshot) : snapshot_(snapshot) {}
+
+    // Picks up the value published last. Returns true on the first call and
+    // whenever the value changed since the previous call. A single atomic
+    // load when it didn't.
+    bool update() {
+      if (value_ && snapshot_->version_.load(std::memory_order_acquire) == version_) {
+        return false;
+      }
+      absl::MutexLock l(&snapshot_->lock_);
+      version_ = snapshot_->version_.load(std::memory_order_relaxed);
+      value_ = snapshot_->value_;
+      return true;
+    }
+    // The value read by the last update().
+    const T& get() const { return *value_; }
+    // Shares the value past the next update(), such as with the later stages
+    // of a frame.
+    const std::shared_ptr<const T>& share() const { return value_; }
+
+  private:
+    const Snapshot* snapshot_;
+    uint64_t version_ = 0;
+    std::shared_ptr<const T> value_;
+  };
+
+private:
+  mutable absl::Mutex lock_;
+  std::shared_ptr<const T> value_ GUARDED_BY(lock_);
+  // Bumped with every publish(), under the lock.
+  std::atomic<uint64_t> version_{0};
+};
+
+// Settings of a stream that can change while it runs.
+struct StreamSettings {
+  // Minimum score of a result shown.
+  float threshold = 0;
+  // Classes detected, and the filter built from them.
+  std::vector<int> class_ids;
+  ClassFilter want_ids;
+  // Keepout zones of a worker safety stream, rasterized for the output size.
+  // Snapshots share them until they are reloaded.
+  std::shared_ptr<const KeepoutZoneSet> keepout_zones;
+};
+
+struct LiveConfigOptions {
+  // File the streams were read from, re-read on a change. Empty when they
+  // come from flags.
+  std::string streams_config_path;
+  // Size of the frames the keepout zones are rasterized for.
+  uint32_t width = 0;
+  uint32_t height = 0;
+};
+
+// The settings of every stream, reloaded from the files they come from or
+// changed by control commands while the streams run. Changes are made to a
+// copy of the settings of a stream, loading and rasterizing keepout zones
+// included, and published when complete. Streams pick them up on their next
+// frame, never waiting for a reload.
+class LiveConfig {
+public:
+  // Loads the keepout zones of `configs`. `class_ids` lists the classes each
+  // stream detects.
+  LiveConfig(
+      const std::vector<StreamConfig>& configs, const std::vector<std::vector<int>>& class_ids,
+      const LiveConfigOptions& options);
+  LiveConfig(const LiveConfig&) = delete;
+  LiveConfig& operator=(const LiveConfig&) = delete;
+
+  int get_num_streams() const { return settings_.size(); }
+  // Settings of `stream`, in the order of the configs.
+  const Snapshot<StreamSettings>& get_settings(int stream) const { return *settings_[stream]; }
+
+  // Returns the files a change to which is reloaded: the streams config and
+  // the keepout zones in use.
+  std::vector<std::string> get_watched_paths() const LOCKS_EXCLUDED(lock_);
+  // Reloads what comes from `path` after it changed. Only the thresholds and
+  // keepout files of the streams config are applied, other changes need a
+  // restart.
+  void reload_file(const std::string& path) LOCKS_EXCLUDED(lock_);
+  // Runs a control command and returns its reply:
+  //   show                         the settings of every stream
+  //   threshold <stream> <score>   sets the threshold of a stream
+  //   classes <stream> <id>,...    sets the classes a stream detects
+  //   keepout <stream> [<path>]    reloads the keepout zones of a stream
+  //   reload                       re-reads every file
+  std::string handle_command(const std::string& command) LOCKS_EXCLUDED(lock_);
+
+private:
+  // Loads and rasterizes the keepout zones in `path`, none if it's empty.
+  // Returns null if the file can't be read.
+  std::shared_ptr<const KeepoutZoneSet> load_keepout(const std::string& path) const;
+  // Publishes a copy of the settings of `stream` modified by `change`.
+  void update(int stream, const std::function<void(StreamSettings*)>& change)
+      EXCLUSIVE_LOCKS_REQUIRED(lock_);
+  // Reloads the keepout zones of `stream` from `path`. Returns false and
+  // keeps the current ones if it can't be read.
+  bool reload_keepout(int stream, const std::string& path) EXCLUSIVE_LOCKS_REQUIRED(lock_);
+  // Re-reads the streams config and applies what changed, every keepout file
+  // too if `all_keepouts`. Returns false if it can't be read.
+  bool reload_streams(bool all_keepouts) EXCLUSIVE_LOCKS_REQUIRED(lock_);
+  // Index of the stream `name`, -1 if there is none.
+  int find_stream(const std::string& name) const EXCLUSIVE_LOCKS_REQUIRED(lock_);
+
+  const LiveConfigOptions options_;
+  // Held by writers, so changes apply one after the other.
+  mutable absl::Mutex lock_;
+  std::vector<StreamConfig> configs_ GUARDED_BY(lock_);
+  std::vector<std::unique_ptr<Snapshot<StreamSettings>>> settings_;
+};
+
+struct ConfigWatcherOptions {
+  // Reloads the files of the config when they change.
+  bool watch_files = true;
+  // Path of a Unix socket taking control commands, one per line, empty for
+  // none.
+  std::string control_socket;
+};
+
+// Watches the files of a LiveConfig with inotify and serves its control
+// socket, from a thread of its own. Directories are watched rather than
+// files, so files replaced by a rename, as editors save them, are seen too.
+class ConfigWatcher {
+public:
+  ConfigWatcher(LiveConfig* config, const ConfigWatcherOptions& options);
+  ~ConfigWatcher();
+  ConfigWatcher(const ConfigWatcher&) = delete;
+  ConfigWatcher& operator=(const ConfigWatcher&) = delete;
+
+private:
+  void run();
+  // Watches the directory of every file the config reads.
+  void update_watches();
+  // Reloads every file changed since the last call.
+  void read_events();
+  void serve(int client);
+
+  LiveConfig* config_;
+  const ConfigWatcherOptions options_;
+  int inotify_fd_ = -1;
+  int listen_fd_ = -1;
+  // Watched directories by watch descriptor.
+  std::map<int, std::string> directories_;
+  std::atomic<bool> stopped_{false};
+  std::thread thread_;
+};
+
+}  // namespace coral
+
+#endif  // MANUFACTURING_DEMO_LIVE_CONFIG_H_
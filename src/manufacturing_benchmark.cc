@@ -0,0 +1,588 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Microbenchmarks of the per-frame hot paths of the demo. Run from the root
+// of the repo so the bundled models and labels are found, with
+// --benchmark_out=<file> --benchmark_out_format=json for results that can be
+// compared between releases.
+
+#include <unistd.h>
+
+#include <cmath>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "absl/flags/declare.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/strings/str_cat.h"
+#include "anonymizer.h"
+#include "benchmark/benchmark.h"
+#include "clip_recorder.h"
+#include "event_log.h"
+#include "image_utils.h"
+#include "inference_wrapper.h"
+#include "keepout_shape.h"
+#include "label_table.h"
+#include "metrics.h"
+#include "overlay.h"
+#include "ssd_decoder.h"
+
+ABSL_DECLARE_FLAG(bool, safety_check_whole_box);
+ABSL_FLAG(
+    std::string, cpu_detection_model, "models/ssdlite_mobiledet_coco_qat_postprocess.tflite",
+    "Path to the CPU detection model timed by BM_DetectionCpu.");
+ABSL_FLAG(
+    std::string, cpu_classifier_model, "models/retraining/classifier.tflite",
+    "Path to the CPU classifier model timed by BM_ClassificationCpu.");
+ABSL_FLAG(
+    std::string, detection_labels, "models/coco_labels.txt",
+    "Path to the detection labels, also timed by BM_LabelTableLoad.");
+ABSL_FLAG(
+    std::string, classifier_labels, "models/classifier_labels.txt",
+    "Path to the classifier labels.");
+ABSL_FLAG(int, num_threads, 0, "CPU threads of the model benchmarks, 0 for every hardware thread.");
+
+namespace coral {
+namespace {
+
+// Output resolution of the worker safety stream.
+constexpr int kWidth = 960;
+constexpr int kHeight = 540;
+// Detections per frame on a busy cell.
+constexpr int kBoxesPerFrame = 10;
+// Fraction of the output covered by keepout zones.
+constexpr float kZoneCoverage = 0.3f;
+
+// Scatters `count` zones over the output, together covering about a third of
+// it like the zones of a real cell, so more zones means smaller zones.
+KeepoutZoneSet make_zones(int count, std::mt19937* rng) {
+  const int side = std::sqrt(kZoneCoverage * kWidth * kHeight / count);
+  std::uniform_int_distribution<int> x(0, kWidth - side), y(0, kHeight - side);
+  std::uniform_int_distribution<int> jitter(0, side / 4);
+  KeepoutZoneSet zones;
+  for (int i = 0; i < count; ++i) {
+    const int x0 = x(*rng), y0 = y(*rng);
+    zones.add_zone(
+        absl::StrCat("zone_", i), 1 + i % 2,
+        {{x0 + jitter(*rng), y0},
+         {x0 + side, y0 + jitter(*rng)},
+         {x0 + side - jitter(*rng), y0 + side},
+         {x0, y0 + side - jitter(*rng)}});
+  }
+  zones.rasterize(kWidth, kHeight);
+  return zones;
+}
+
+// Person sized boxes anywhere in the output.
+std::vector<Box> make_boxes(int count, std::mt19937* rng) {
+  std::uniform_int_distribution<int> x(0, kWidth - 80), y(0, kHeight - 200);
+  std::vector<Box> boxes;
+  for (int i = 0; i < count; ++i) {
+    const int x0 = x(*rng), y0 = y(*rng);
+    boxes.emplace_back(x0, y0, x0 + 80, y0 + 200);
+  }
+  return boxes;
+}
+
+// Args: number of zones, whole box (1) or bottom edge (0) test.
+void BM_CollideZones(benchmark::State& state) {
+  absl::SetFlag(&FLAGS_safety_check_whole_box, state.range(1));
+  std::mt19937 rng(42);
+  const auto zones = make_zones(state.range(0), &rng);
+  const auto boxes = make_boxes(kBoxesPerFrame, &rng);
+  std::vector<ZoneHit> hits;
+  for (auto _ : state) {
+    hits.clear();
+    zones.collide(boxes, &hits);
+    benchmark::DoNotOptimize(hits.data());
+  }
+  state.SetItemsProcessed(state.iterations() * boxes.size());
+}
+BENCHMARK(BM_CollideZones)->ArgsProduct({{1, 50, 500}, {0, 1}});
+
+// The same zones tested one by one against every box, without the grid.
+void BM_CollideZonesLinear(benchmark::State& state) {
+  absl::SetFlag(&FLAGS_safety_check_whole_box, state.range(1));
+  std::mt19937 rng(42);
+  const auto zones = make_zones(state.range(0), &rng);
+  const auto boxes = make_boxes(kBoxesPerFrame, &rng);
+  std::vector<ZoneHit> hits;
+  for (auto _ : state) {
+    hits.clear();
+    for (size_t i = 0; i < boxes.size(); ++i) {
+      for (int zone = 0; zone < zones.size(); ++zone) {
+        if (boxes[i].collided_with_mask(zones.get_zone(zone).polygon, kWidth)) {
+          hits.push_back({static_cast<int>(i), zone});
+        }
+      }
+    }
+    benchmark::DoNotOptimize(hits.data());
+  }
+  state.SetItemsProcessed(state.iterations() * boxes.size());
+}
+BENCHMARK(BM_CollideZonesLinear)->ArgsProduct({{1, 50, 500}, {0, 1}});
+
+// A worker safety scene of `count` labelled boxes, one of them filled.
+OverlayScene make_scene(int count, std::mt19937* rng) {
+  OverlayScene scene;
+  for (const auto& box : make_boxes(count, rng)) {
+    scene.add_box(box.left(), box.top(), 80, 200, kOverlayRed, scene.get_boxes().empty());
+    scene.add_label(box.left(), box.top() - 5, kOverlayRed, "person: ", 0.734375f, " in press");
+  }
+  return scene;
+}
+
+// Keepout zone outlines like the example config.
+std::vector<OverlayPolygon> make_background() {
+  return {{{{585, 390}, {720, 335}, {420, 205}, {305, 235}}, kOverlayRed}};
+}
+
+// Args: number of boxes. Only builds the document, the rsvgoverlay parse and
+// rasterization that follow every update come on top.
+void BM_OverlaySvgMarkup(benchmark::State& state) {
+  std::mt19937 rng(42);
+  const auto scene = make_scene(state.range(0), &rng);
+  std::string background;
+  append_svg(make_background(), 0, 0, &background);
+  std::string document;
+  for (auto _ : state) {
+    document.clear();
+    absl::StrAppend(&document, "<svg>", background);
+    append_svg(scene, 0, 0, &document);
+    document.append("</svg>");
+    benchmark::DoNotOptimize(document.data());
+  }
+}
+BENCHMARK(BM_OverlaySvgMarkup)->Arg(1)->Arg(10)->Arg(50);
+
+// Args: number of boxes. Everything drawn into one frame.
+void BM_OverlayNative(benchmark::State& state) {
+  std::mt19937 rng(42);
+  OverlayOptions options;
+  options.num_streams = 1;
+  options.width = kWidth;
+  options.height = kHeight;
+  options.backgrounds = {make_background()};
+  NativeOverlay overlay(options);
+  overlay.set_scene(0, make_scene(state.range(0), &rng));
+  std::vector<uint8_t> frame(kWidth * kHeight * 4);
+  for (auto _ : state) {
+    overlay.draw(0, frame.data(), kWidth * 4);
+    benchmark::DoNotOptimize(frame.data());
+  }
+}
+BENCHMARK(BM_OverlayNative)->Arg(1)->Arg(10)->Arg(50);
+
+// Args: pixelate (0) or blur (1). Ten workers side by side hidden in a 1080p
+// frame, each about half as tall as it, so over half the frame is rewritten.
+void BM_Anonymize(benchmark::State& state) {
+  constexpr int kFrameWidth = 1920;
+  constexpr int kFrameHeight = 1080;
+  constexpr int kWorkers = 10;
+  AnonymizeOptions options;
+  options.method = state.range(0) ? AnonymizeMethod::kBlur : AnonymizeMethod::kPixelate;
+  options.width = kFrameWidth;
+  options.height = kFrameHeight;
+  Anonymizer anonymizer(1, options);
+  std::vector<BoundingBox> regions;
+  for (int i = 0; i < kWorkers; ++i) {
+    const int x = 40 + i * 185;
+    const int y = 200 + (i % 3) * 120;
+    regions.emplace_back(y, x, y + 480, x + 180);
+  }
+  anonymizer.set_regions(0, regions);
+  std::mt19937 rng(42);
+  std::vector<uint8_t> frame(kFrameWidth * kFrameHeight * 4);
+  for (auto& v : frame) v = rng();
+  for (auto _ : state) {
+    anonymizer.apply(0, frame.data(), kFrameWidth * 4);
+    benchmark::DoNotOptimize(frame.data());
+  }
+  state.SetItemsProcessed(state.iterations() * kWorkers);
+}
+BENCHMARK(BM_Anonymize)->Arg(0)->Arg(1);
+
+// Random RGB pixels of an image of `dims`.
+std::vector<uint8_t> make_image(const ImageDims& dims, std::mt19937* rng) {
+  std::uniform_int_distribution<int> value(0, 255);
+  std::vector<uint8_t> image(dims[0] * dims[1] * dims[2]);
+  for (auto& pixel : image) pixel = value(*rng);
+  return image;
+}
+
+// Args: side of the square crop taken out of a frame.
+void BM_CropImage(benchmark::State& state) {
+  std::mt19937 rng(42);
+  const ImageDims frame_dims{kHeight, kWidth, 3};
+  auto frame = make_image(frame_dims, &rng);
+  const int side = state.range(0);
+  const BoundingBox crop(100, 200, 100 + side, 200 + side);
+  for (auto _ : state) {
+    auto cropped = crop_image(frame.data(), frame_dims, crop);
+    benchmark::DoNotOptimize(cropped.data());
+  }
+}
+BENCHMARK(BM_CropImage)->Arg(64)->Arg(128)->Arg(256);
+
+// Args: side of the square crop resized to the classifier input.
+void BM_ResizeImage(benchmark::State& state) {
+  std::mt19937 rng(42);
+  const ImageDims in_dims{static_cast<int>(state.range(0)), static_cast<int>(state.range(0)), 3};
+  const auto image = make_image(in_dims, &rng);
+  const ImageDims out_dims{224, 224, 3};
+  for (auto _ : state) {
+    auto resized = resize_image(image.data(), in_dims, out_dims);
+    benchmark::DoNotOptimize(resized.data());
+  }
+}
+BENCHMARK(BM_ResizeImage)->Arg(64)->Arg(128)->Arg(256);
+
+// Args: side of the square crop. The single pass the inspection stage uses
+// instead of crop_image() followed by resize_image().
+void BM_CropAndResize(benchmark::State& state) {
+  std::mt19937 rng(42);
+  const ImageDims frame_dims{kHeight, kWidth, 3};
+  const auto frame = make_image(frame_dims, &rng);
+  const int side = state.range(0);
+  const BoundingBox crop(100, 200, 100 + side, 200 + side);
+  const ImageDims out_dims{224, 224, 3};
+  std::vector<uint8_t> out(224 * 224 * 3);
+  for (auto _ : state) {
+    crop_and_resize(frame.data(), frame_dims, 0, crop, out_dims, out.data());
+    benchmark::DoNotOptimize(out.data());
+  }
+}
+BENCHMARK(BM_CropAndResize)->Arg(64)->Arg(128)->Arg(256);
+
+// Size of the frames decoded from a 1080p camera or video.
+constexpr int kSourceWidth = 1920;
+constexpr int kSourceHeight = 1080;
+// Side of the detector input the frames are converted to.
+constexpr int kDetectorSize = 320;
+
+// A 1080p frame of random pixels in `format`, its planes in `storage`.
+YuvImage make_yuv_frame(PixelFormat format, std::vector<uint8_t>* storage, std::mt19937* rng) {
+  YuvImage image{format, YuvMatrix::kBt709, kSourceWidth, kSourceHeight, {}, {}};
+  const int w = kSourceWidth;
+  const int h = kSourceHeight;
+  *storage = make_image({format == PixelFormat::kYuy2 ? 2 * h : 3 * h / 2, w, 1}, rng);
+  uint8_t* data = storage->data();
+  switch (format) {
+    case PixelFormat::kNv12:
+      image.planes[0] = data;
+      image.planes[1] = data + w * h;
+      image.strides[0] = image.strides[1] = w;
+      break;
+    case PixelFormat::kI420:
+      image.planes[0] = data;
+      image.planes[1] = data + w * h;
+      image.planes[2] = data + w * h + w * h / 4;
+      image.strides[0] = w;
+      image.strides[1] = image.strides[2] = w / 2;
+      break;
+    default:
+      image.planes[0] = data;
+      image.strides[0] = 2 * w;
+      break;
+  }
+  return image;
+}
+
+// Args: PixelFormat of a 1080p frame. Converts and resizes it to the detector
+// input in one pass, as the stream workers do with --yuv_ingest.
+void BM_YuvToRgbResize(benchmark::State& state) {
+  std::mt19937 rng(42);
+  std::vector<uint8_t> storage;
+  const auto image = make_yuv_frame(static_cast<PixelFormat>(state.range(0)), &storage, &rng);
+  const ImageDims out_dims{kDetectorSize, kDetectorSize, 3};
+  std::vector<uint8_t> out(kDetectorSize * kDetectorSize * 3);
+  for (auto _ : state) {
+    yuv_to_rgb_resize(image, out_dims, out.data());
+    benchmark::DoNotOptimize(out.data());
+  }
+}
+BENCHMARK(BM_YuvToRgbResize)
+    ->Arg(static_cast<int>(PixelFormat::kNv12))
+    ->Arg(static_cast<int>(PixelFormat::kI420))
+    ->Arg(static_cast<int>(PixelFormat::kYuy2));
+
+// Args: as above. Converts the whole frame to RGB, then resizes it, the work
+// of videoconvert ! videoscale in the pipeline without --yuv_ingest.
+void BM_YuvToRgbThenResize(benchmark::State& state) {
+  std::mt19937 rng(42);
+  std::vector<uint8_t> storage;
+  const auto image = make_yuv_frame(static_cast<PixelFormat>(state.range(0)), &storage, &rng);
+  const ImageDims rgb_dims{kSourceHeight, kSourceWidth, 3};
+  const ImageDims out_dims{kDetectorSize, kDetectorSize, 3};
+  std::vector<uint8_t> rgb(kSourceHeight * kSourceWidth * 3);
+  std::vector<uint8_t> out(kDetectorSize * kDetectorSize * 3);
+  for (auto _ : state) {
+    yuv_to_rgb_resize(image, rgb_dims, rgb.data());
+    resize_image(rgb.data(), rgb_dims, /*in_stride=*/0, out_dims, out.data());
+    benchmark::DoNotOptimize(out.data());
+  }
+}
+BENCHMARK(BM_YuvToRgbThenResize)
+    ->Arg(static_cast<int>(PixelFormat::kNv12))
+    ->Arg(static_cast<int>(PixelFormat::kI420))
+    ->Arg(static_cast<int>(PixelFormat::kYuy2));
+
+// Args: number of raw detections in the output tensors, about a third of
+// them people above the threshold.
+void BM_ParseDetectionOutputs(benchmark::State& state) {
+  LabelTable labels;
+  labels.load(absl::GetFlag(FLAGS_detection_labels));
+  const int count = state.range(0);
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<float> coordinate(0.0f, 1.0f);
+  std::uniform_int_distribution<int> id(0, 2);
+  std::vector<float> boxes(4 * count), ids(count), scores(count);
+  for (int i = 0; i < count; ++i) {
+    for (int j = 0; j < 4; ++j) boxes[4 * i + j] = coordinate(rng);
+    ids[i] = id(rng);
+    scores[i] = coordinate(rng);
+  }
+  const DetectionOutputs outputs{boxes, ids, scores, count};
+  const ClassFilter want_ids{/*person=*/0};
+  std::vector<DetectionResult> results;
+  for (auto _ : state) {
+    results.clear();
+    InferenceWrapper::parse_detection_outputs(outputs, labels, 0.3f, want_ids, &results);
+    benchmark::DoNotOptimize(results.data());
+  }
+  state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_ParseDetectionOutputs)->Arg(0)->Arg(10)->Arg(50)->Arg(100);
+
+// Anchors and classes of the bundled SSD detector, background included.
+constexpr int kSsdAnchors = 1917;
+constexpr int kSsdClasses = 91;
+
+// Args: uint8 (1) or float (0) raw outputs. Scores are low everywhere but
+// around a few objects, each covered by a cluster of overlapping anchors, as
+// on a typical frame.
+void BM_SsdDecode(benchmark::State& state) {
+  const bool quantized = state.range(0);
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  std::vector<Anchor> anchors(kSsdAnchors);
+  for (auto& anchor : anchors) anchor = {unit(rng), unit(rng), 0.1f, 0.1f};
+  std::vector<float> boxes(4 * kSsdAnchors), scores(kSsdAnchors * kSsdClasses);
+  std::normal_distribution<float> offset(0.0f, 0.5f);
+  for (auto& value : boxes) value = offset(rng);
+  for (auto& value : scores) value = 0.05f * unit(rng);
+  std::uniform_int_distribution<int> cluster(0, kSsdAnchors - 8), id(1, kSsdClasses - 1);
+  for (int i = 0; i < kBoxesPerFrame; ++i) {
+    const int first = cluster(rng), object_id = id(rng);
+    for (int j = 0; j < 8; ++j) {
+      anchors[first + j] = anchors[first];
+      scores[(first + j) * kSsdClasses + object_id] = 0.5f + 0.5f * unit(rng);
+    }
+  }
+  SsdDecoder decoder(anchors, kSsdClasses - 1, SsdDecoderOptions());
+  RawTensor raw_boxes{boxes.data()}, raw_scores{scores.data()};
+  std::vector<uint8_t> quantized_boxes, quantized_scores;
+  if (quantized) {
+    for (float value : boxes) {
+      quantized_boxes.push_back(std::min(std::max(value * 50 + 128, 0.0f), 255.0f));
+    }
+    for (float value : scores) quantized_scores.push_back(value * 255);
+    raw_boxes = {quantized_boxes.data(), true, 0.02f, 128};
+    raw_scores = {quantized_scores.data(), true, 1.0f / 255, 0};
+  }
+  SsdDetections detections;
+  for (auto _ : state) {
+    decoder.decode(raw_boxes, raw_scores, 0.3f, &detections);
+    benchmark::DoNotOptimize(detections.boxes.data());
+  }
+  state.SetItemsProcessed(state.iterations() * kSsdAnchors);
+}
+BENCHMARK(BM_SsdDecode)->Arg(0)->Arg(1);
+
+// Args: whole box (1) or bottom edge (0) test. The ray casting reference,
+// without the mask.
+void BM_CollidePolygon(benchmark::State& state) {
+  absl::SetFlag(&FLAGS_safety_check_whole_box, state.range(0));
+  std::vector<Point> points = make_background()[0].points;
+  const Polygon polygon(points);
+  std::mt19937 rng(42);
+  const auto boxes = make_boxes(kBoxesPerFrame, &rng);
+  for (auto _ : state) {
+    for (const auto& box : boxes) {
+      benchmark::DoNotOptimize(box.collided_with_polygon(polygon, kWidth));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * boxes.size());
+}
+BENCHMARK(BM_CollidePolygon)->Arg(0)->Arg(1);
+
+void BM_LabelTableLoad(benchmark::State& state) {
+  const std::string path = absl::GetFlag(FLAGS_detection_labels);
+  for (auto _ : state) {
+    LabelTable labels;
+    labels.load(path);
+    benchmark::DoNotOptimize(labels.size());
+  }
+}
+BENCHMARK(BM_LabelTableLoad);
+
+// One stage latency recorded the way every stage of every frame does, clock
+// reads included.
+void BM_StageLatencyRecord(benchmark::State& state) {
+  MetricsRegistry registry;
+  auto* histogram = registry.get_stage_latency("safety", "invoke");
+  for (auto _ : state) {
+    ScopedLatency latency(histogram);
+  }
+}
+BENCHMARK(BM_StageLatencyRecord)->ThreadRange(1, 4);
+
+// One keepout entry recorded into a mapped event log, as a callback records
+// it, from several streams at once. The log wraps around many times.
+void BM_EventLogRecord(benchmark::State& state) {
+  // Shared by the threads. The file is unlinked at once, the mapping keeps it
+  // until exit.
+  static EventLog* events = [] {
+    char path[] = "/tmp/event_log_benchmark_XXXXXX";
+    const int fd = mkstemp(path);
+    CHECK_GE(fd, 0);
+    close(fd);
+    auto* log = new EventLog;
+    CHECK(log->open(path, /*capacity=*/4096, {"safety", "inspection"}));
+    unlink(path);
+    return log;
+  }();
+  Event event{EventType::kKeepoutEnter, 0, 0, 1, 0.8f, 10, 20, 110, 220, "zone"};
+  for (auto _ : state) {
+    event.frame++;
+    events->record(event);
+  }
+}
+BENCHMARK(BM_EventLogRecord)->ThreadRange(1, 4);
+
+// Encoded frames of a 2 Mbit/s, 30 frames/s stream with a keyframe a second
+// pushed into a clip ring at their pace, the keyframes four times the size of
+// the others. The ring holds 10 s, so every GOP sealed evicts the oldest.
+void BM_ClipBufferPush(benchmark::State& state) {
+  constexpr int kFps = 30;
+  constexpr int64_t kFrameNs = 1000000000 / kFps;
+  constexpr size_t kFrameBytes = 2000000 / 8 / (kFps + 3);
+  const std::vector<uint8_t> frame(4 * kFrameBytes, 0x42);
+  ClipOptions options;
+  ClipBuffer buffer("safety", options, [](Clip) {});
+  int64_t n = 0;
+  for (auto _ : state) {
+    const bool keyframe = n % kFps == 0;
+    buffer.push(
+        frame.data(), keyframe ? 4 * kFrameBytes : kFrameBytes, keyframe, n * kFrameNs,
+        n * kFrameNs, kFrameNs, n * kFrameNs);
+    n++;
+  }
+  state.SetBytesProcessed(n * kFrameBytes);
+  state.counters["ring_bytes"] = buffer.get_bytes();
+}
+BENCHMARK(BM_ClipBufferPush);
+
+// Loads `model_path` on the CPU backend, or returns nullptr and skips the
+// benchmark when the model isn't there. With `ssd_decoder` detections are
+// decoded in C++ instead of by the postprocess op.
+std::unique_ptr<InferenceWrapper> load_cpu_model(
+    benchmark::State& state, const std::string& model_path, const std::string& label_path,
+    bool ssd_decoder = false) {
+  if (!std::ifstream(model_path).good()) {
+    state.SkipWithError(absl::StrCat("Missing model ", model_path).c_str());
+    return nullptr;
+  }
+  BackendOptions options;
+  options.type = BackendType::kCpu;
+  options.num_threads = absl::GetFlag(FLAGS_num_threads);
+  options.skip_detection_postprocess = ssd_decoder;
+  std::unique_ptr<InferenceWrapper> model(new InferenceWrapper(model_path, label_path, options));
+  if (ssd_decoder) model->use_ssd_decoder(/*anchors_path=*/"", /*class_thresholds=*/{});
+  return model;
+}
+
+// Args: detections from the postprocess op (0) or the C++ decoder (1).
+void BM_DetectionCpu(benchmark::State& state) {
+  auto detector = load_cpu_model(
+      state, absl::GetFlag(FLAGS_cpu_detection_model), absl::GetFlag(FLAGS_detection_labels),
+      state.range(0));
+  if (!detector) return;
+  std::mt19937 rng(42);
+  const int size = detector->get_input_size();
+  const auto image = make_image({size, size, 3}, &rng);
+  const ClassFilter want_ids{/*person=*/0};
+  std::vector<DetectionResult> results;
+  for (auto _ : state) {
+    detector->get_detection_results(image.data(), image.size(), 0.3f, want_ids, &results);
+    benchmark::DoNotOptimize(results.data());
+  }
+}
+BENCHMARK(BM_DetectionCpu)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+void BM_ClassificationCpu(benchmark::State& state) {
+  auto classifier = load_cpu_model(
+      state, absl::GetFlag(FLAGS_cpu_classifier_model), absl::GetFlag(FLAGS_classifier_labels));
+  if (!classifier) return;
+  std::mt19937 rng(42);
+  const int size = classifier->get_input_size();
+  const auto image = make_image({size, size, 3}, &rng);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(classifier->get_classification_result(image.data(), image.size()));
+  }
+}
+BENCHMARK(BM_ClassificationCpu)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// Args: number of crops of a frame classified, and the largest batch they are
+// packed into, as --classifier_batch_size of the demo.
+void BM_ClassificationBatchCpu(benchmark::State& state) {
+  auto classifier = load_cpu_model(
+      state, absl::GetFlag(FLAGS_cpu_classifier_model), absl::GetFlag(FLAGS_classifier_labels));
+  if (!classifier) return;
+  classifier->set_max_batch_size(state.range(1));
+  std::mt19937 rng(42);
+  const ImageDims frame_dims{kHeight, kWidth, 3};
+  const auto frame = make_image(frame_dims, &rng);
+  std::uniform_int_distribution<int> y(0, kHeight - 128), x(0, kWidth - 128), side(64, 128);
+  std::vector<BoundingBox> crops;
+  for (int i = 0; i < state.range(0); ++i) {
+    const int ymin = y(rng), xmin = x(rng);
+    crops.emplace_back(ymin, xmin, ymin + side(rng), xmin + side(rng));
+  }
+  std::vector<ClassificationResult> results;
+  for (auto _ : state) {
+    classifier->get_classification_results(frame.data(), frame_dims, crops, &results);
+    benchmark::DoNotOptimize(results.data());
+  }
+  state.SetItemsProcessed(state.iterations() * crops.size());
+}
+BENCHMARK(BM_ClassificationBatchCpu)
+    ->ArgsProduct({{1, 8, 32}, {1, 8, 32}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace coral
+
+int main(int argc, char** argv) {
+  // Benchmark flags are consumed first, the rest are the flags above.
+  benchmark::Initialize(&argc, argv);
+  absl::ParseCommandLine(argc, argv);
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
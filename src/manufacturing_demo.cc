@@ -14,30 +14,51 @@
 
 #include <sys/stat.h>
 
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <memory>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #include "absl/flags/flag.h"
 #include "absl/flags/parse.h"
 #include "absl/strings/str_format.h"
 #include "absl/strings/substitute.h"
+#include "anonymizer.h"
 #include "camera_streamer.h"
+#include "clip_recorder.h"
+#include "event_log.h"
+#include "frame_replay.h"
 #include "glog/logging.h"
 #include "image_utils.h"
+#include "inference_scheduler.h"
 #include "inference_wrapper.h"
 #include "keepout_shape.h"
+#include "live_config.h"
+#include "metrics.h"
+#include "motion_gate.h"
+#include "stage_pipeline.h"
+#include "stream_config.h"
 
+using coral::BackendOptions;
+using coral::BackendType;
 using coral::Box;
 using coral::CameraStreamer;
+using coral::ClassificationResult;
+using coral::DetectionResult;
+using coral::InferenceScheduler;
 using coral::InferenceWrapper;
-using coral::kSvgBox;
-using coral::kSvgText;
+using coral::LatencyHistogram;
+using coral::Overlay;
+using coral::OverlayScene;
 using coral::Point;
-using coral::Polygon;
-using coral::SvgGenerator;
+using coral::StreamConfig;
+using coral::StreamTask;
 
 ABSL_FLAG(
     std::string, detection_model, "models/ssdlite_mobiledet_coco_qat_postprocess_edgetpu.tflite",
@@ -50,250 +71,1277 @@ ABSL_FLAG(
 ABSL_FLAG(
     std::string, classifier_labels, "models/classifier_labels.txt",
     "Path to classification labels file.");
+ABSL_FLAG(
+    std::string, cpu_detection_model, "models/ssdlite_mobiledet_coco_qat_postprocess.tflite",
+    "Path to detection model used when running on the CPU backend.");
+ABSL_FLAG(
+    std::string, cpu_classifier_model, "models/retraining/classifier.tflite",
+    "Path to classification model used when running on the CPU backend.");
+ABSL_FLAG(
+    std::string, detection_postprocess, "builtin",
+    "How detections are read out of the detection model: builtin, from the TFLite SSD "
+    "postprocess op, or cpp, decoding the raw box encodings and class scores in C++. Models "
+    "without the op need cpp.");
+ABSL_FLAG(
+    std::string, detection_anchors, "",
+    "Anchors of a detection model without the SSD postprocess op, a 'ycenter xcenter height "
+    "width' line per anchor. Only read with --detection_postprocess=cpp.");
+ABSL_FLAG(
+    std::string, detection_class_thresholds, "",
+    "Comma separated <id>:<threshold> pairs raising the detection threshold of single classes, "
+    "e.g. 0:0.5. Only used with --detection_postprocess=cpp.");
+ABSL_FLAG(
+    std::string, backend, "auto",
+    "Inference backend: edgetpu, cpu (XNNPACK) or auto to use an Edge TPU when one is attached.");
+ABSL_FLAG(
+    int, num_threads, 0,
+    "Number of threads of each CPU backend interpreter, 0 shares the hardware threads between "
+    "the interpreters of both pools.");
+ABSL_FLAG(
+    int, classifier_batch_size, 8,
+    "Largest number of detected objects classified per invoke on backends that allow resizing "
+    "the batch.");
+ABSL_FLAG(
+    int, detector_pool_size, 1,
+    "Number of detection interpreters shared by every stream. On the CPU backend each gets "
+    "--num_threads threads, with the Edge TPU they are spread over the attached devices.");
+ABSL_FLAG(int, classifier_pool_size, 1, "Number of classification interpreters.");
+ABSL_FLAG(
+    std::string, scheduling, "fair",
+    "How queued inference requests of the streams are ordered: fair (round robin) or priority "
+    "(worker safety streams first).");
+ABSL_FLAG(
+    int, frame_queue_size, 2,
+    "Number of frames each stream queues between capture and inference.");
+ABSL_FLAG(
+    std::string, frame_queue_policy, "drop_oldest",
+    "What a stream does with a new frame when its queue is full: drop_oldest, drop_newest or "
+    "block (back pressure on the pipeline).");
+ABSL_FLAG(
+    int, inspection_pipeline_depth, 4,
+    "Number of visual inspection frames in flight at once. Detect, preprocess, classify and "
+    "render then run on their own threads and overlap across frames. 0 runs them back to back.");
+ABSL_FLAG(
+    int, latency_probe_runs, 10,
+    "Number of invokes per model used to report backend latency at startup, 0 to skip.");
+ABSL_FLAG(
+    std::string, streams_config, "",
+    "If provided, a CSV file listing the streams to run as name,task,input,threshold,keepout "
+    "rows, task being safety or inspection. Otherwise one worker safety and one visual "
+    "inspection stream run from the flags below.");
 ABSL_FLAG(
     std::string, worker_safety_input, "test_data/worker-zone-detection.mp4",
     "Path to video source or file to run worker safety inference.");
 ABSL_FLAG(
     std::string, visual_inspection_input, "test_data/apple.mp4",
     "Path to video source or file to run visual inspection inference.");
+ABSL_FLAG(
+    bool, yuv_ingest, true,
+    "Hand the decoded NV12, I420 or YUY2 frames to the stream workers, which convert and scale "
+    "them to the detector input in one pass, instead of converting them in the pipeline.");
+ABSL_FLAG(
+    bool, letterbox, false,
+    "With --yuv_ingest, keeps the aspect ratio of the frames fed to the detector and fills the "
+    "borders black instead of stretching them.");
 ABSL_FLAG(bool, anonymize, false, "Anonymize detected workers in safety demo.");
-ABSL_FLAG(uint16_t, width, 960, "Width to scale both inputs to.");
-ABSL_FLAG(uint16_t, height, 540, "Height to scale both inputs to.");
+ABSL_FLAG(
+    std::string, anonymize_method, "pixelate",
+    "How --anonymize hides workers: pixelate or blur their regions in the frames of each stream "
+    "before mixing, or fill them with opaque boxes in the overlay.");
+ABSL_FLAG(uint16_t, width, 960, "Width to scale every input to.");
+ABSL_FLAG(uint16_t, height, 540, "Height to scale every input to.");
 ABSL_FLAG(float, worker_threshold, 0.3, "Minimum detection probability required to show bounding box for worker safety.");
 ABSL_FLAG(float, inspection_threshold, 0.7, "Minimum detection probability required to show bounding box for visual inspection.");
+ABSL_FLAG(
+    bool, motion_gate, false,
+    "Skip worker safety detection on frames that barely differ from the last one inferred.");
+ABSL_FLAG(
+    float, motion_threshold, 8.0,
+    "Mean absolute pixel difference of the most changed 16x16 block that counts as motion.");
+ABSL_FLAG(
+    int, motion_max_skip_frames, 30,
+    "Most consecutive worker safety frames the motion gate skips before re-running detection.");
 ABSL_FLAG(
     std::string, keepout_points_path, "config/keepout_points.csv",
-    "If provided, detection boxes will be colored based on if they are "
-    "in the keepout region (red) or not (green).");
+    "If provided, detection boxes will be colored based on if they are in a keepout zone (red for "
+    "severity 2 and above, orange for 1) or not (green). Either an x,y list of one zone's points "
+    "or zone,severity,x,y rows for several zones.");
+ABSL_FLAG(
+    bool, watch_config, true,
+    "Reload the keepout zones files and --streams_config when they change, without restarting. "
+    "Thresholds and keepout files of the streams config apply, other changes need a restart.");
+ABSL_FLAG(
+    std::string, control_socket, "",
+    "If set, path of a Unix socket taking commands that change the settings of the streams "
+    "while they run: show, threshold <stream> <score>, classes <stream> <id>,..., keepout "
+    "<stream> [<path>] and reload.");
+ABSL_FLAG(
+    std::string, overlay, "svg",
+    "How results are drawn over the video: svg renders SVG markup with rsvgoverlay, native draws "
+    "straight into the frames of each stream, none doesn't draw them.");
+ABSL_FLAG(
+    int, overlay_max_fps, 30,
+    "Most SVG overlay updates per second, each one re-parses the whole SVG. 0 for no limit.");
+ABSL_FLAG(
+    std::string, compositor, "gl",
+    "How the streams are tiled in a grid: gl mixes them with glvideomixer, cpu with the "
+    "software compositor, none doesn't mix them and discards the video of each stream.");
+ABSL_FLAG(
+    std::string, video_sink, "display",
+    "Where the mixed video goes: display shows it, fake discards it, anything else is the path of "
+    "a Motion JPEG AVI file to write it to.");
+ABSL_FLAG(
+    std::string, dump_frames, "",
+    "If set, decodes every input once at the detector input size into the raw frame files "
+    "<prefix>_<stream name>.rgb, then exits.");
+ABSL_FLAG(
+    int, dump_camera_frames, 300, "Frames dumped from a /dev/video input by --dump_frames.");
+ABSL_FLAG(
+    std::string, replay_frames, "",
+    "If set, feeds the frames dumped with --dump_frames=<prefix> to the callbacks instead of "
+    "running the video pipeline, then reports the throughput and per-frame latency.");
+ABSL_FLAG(double, replay_fps, 0, "Frames replayed per second and stream, 0 for no limit.");
+ABSL_FLAG(
+    std::string, replay_results, "",
+    "If set, writes the boxes and labels drawn for every replayed frame to this file, which "
+    "doesn't change between runs over the same frames with the same models.");
+ABSL_FLAG(
+    int, metrics_port, 0,
+    "If set, serves per-stage latency histograms and frame counters in the Prometheus text "
+    "format on http://127.0.0.1:<port>/metrics.");
+ABSL_FLAG(
+    std::string, metrics_file, "",
+    "If set, periodically rewrites this file with the metrics, e.g. for the node exporter "
+    "textfile collector.");
+ABSL_FLAG(int, metrics_interval_seconds, 10, "Seconds between rewrites of --metrics_file.");
+ABSL_FLAG(
+    std::string, event_log, "",
+    "If set, records keepout zone entries and exits, inspection rejects and dropped frames "
+    "into this memory mapped file, read back with event_log_reader.");
+ABSL_FLAG(
+    int, event_log_capacity, 262144,
+    "Events the --event_log file holds, 64 bytes each, the newest overwriting the oldest.");
+ABSL_FLAG(
+    std::string, clip_dir, "",
+    "If set, every worker safety stream keeps its last seconds encoded in memory, and the video "
+    "around every keepout zone violation is written to an MP4 file in this directory.");
+ABSL_FLAG(int, clip_pre_roll_seconds, 10, "Seconds of video a clip keeps from before a violation.");
+ABSL_FLAG(
+    int, clip_post_roll_seconds, 10, "Seconds of video a clip keeps after the last violation.");
+ABSL_FLAG(
+    int, clip_ring_mb, 32,
+    "Megabytes of encoded video each stream holds at most for clips, the clip it is taking "
+    "included.");
+ABSL_FLAG(
+    int, clip_pending_mb, 64,
+    "Megabytes of encoded video the clips waiting to be written hold at most, across streams.");
+ABSL_FLAG(
+    std::string, clip_encoder,
+    "x264enc tune=zerolatency speed-preset=ultrafast threads=1 key-int-max=30 bitrate=2000",
+    "GStreamer element encoding the clip branch to H.264, such as v4l2h264enc on boards with a "
+    "hardware encoder. Its keyframe interval sets how finely clips are cut.");
 
 namespace {
 
+// How often the visual inspection stage occupancy is logged.
+constexpr int kStageReportIntervalSeconds = 10;
+// How many worker safety frames pass between motion gate skip ratio logs.
+constexpr int kMotionReportFrames = 300;
+
 // GStreamer definitions
 #define LEAKY_Q " queue max-size-buffers=1 leaky=downstream "
 
-void check_file(const char* file) {
+void check_file(const char* file, const char* hint = "") {
   struct stat buf;
   if (stat(file, &buf) != 0) {
-    LOG(ERROR) << file << " does not exist";
+    LOG(ERROR) << file << " does not exist" << hint;
     exit(EXIT_FAILURE);
   }
 }
+
+// Logs the mean invoke latency of a model so hardware can be sized.
+void report_invoke_latency(const std::string& name, InferenceWrapper& model, int runs) {
+  if (runs <= 0) return;
+  LOG(INFO) << name << " [" << coral::backend_name(model.get_backend_type())
+            << "]: mean invoke latency " << model.measure_invoke_latency(runs) << " ms over "
+            << runs << " runs";
+}
 }  // namespace
 
 namespace callback_helper {
-// Callback function for the manufacturing demo called from the appsink on every new frame
+// Latencies of the stages of a stream callback.
+struct StageMetrics {
+  // Steps of the detector inference.
+  LatencyHistogram* preprocess;
+  LatencyHistogram* invoke;
+  LatencyHistogram* postprocess;
+  LatencyHistogram* keepout;
+  // Cropping and resizing the objects to classify.
+  LatencyHistogram* crop;
+  // Classifying every object of a frame, waiting for a classifier included.
+  LatencyHistogram* classification;
+  LatencyHistogram* overlay;
+  // Told about every inference, to time the first one.
+  coral::StartupTimeline* timeline;
+};
+
+StageMetrics make_stage_metrics(
+    coral::MetricsRegistry* registry, coral::StartupTimeline* timeline,
+    const std::string& stream) {
+  StageMetrics metrics;
+  metrics.timeline = timeline;
+  metrics.preprocess = registry->get_stage_latency(stream, "preprocess");
+  metrics.invoke = registry->get_stage_latency(stream, "invoke");
+  metrics.postprocess = registry->get_stage_latency(stream, "postprocess");
+  metrics.keepout = registry->get_stage_latency(stream, "keepout");
+  metrics.crop = registry->get_stage_latency(stream, "crop");
+  metrics.classification = registry->get_stage_latency(stream, "classification");
+  metrics.overlay = registry->get_stage_latency(stream, "overlay");
+  return metrics;
+}
+
+// Records the steps of the last inference of `interpreter`.
+void record_inference(const StageMetrics& metrics, const InferenceWrapper& interpreter) {
+  const auto& timings = interpreter.get_last_timings();
+  metrics.preprocess->record(timings.preprocess_ns);
+  metrics.invoke->record(timings.invoke_ns);
+  metrics.postprocess->record(timings.postprocess_ns);
+  metrics.timeline->mark_first_inference();
+}
+
+// A worker safety stream, with the buffers its callback keeps from frame to
+// frame.
+struct SafetyStream {
+  std::string name;
+  // Stream id in the schedulers and the overlay.
+  int stream;
+  std::unique_ptr<coral::Snapshot<coral::StreamSettings>::Reader> settings;
+  // Keepout zones drawn under the results, and those they replaced this
+  // frame, if any.
+  std::shared_ptr<const coral::KeepoutZoneSet> drawn_zones;
+  std::shared_ptr<const coral::KeepoutZoneSet> replaced_zones;
+  std::unique_ptr<coral::MotionGate> motion_gate;
+  StageMetrics metrics;
+  coral::EventLog* events;
+  std::vector<DetectionResult> results;
+  std::vector<Box> boxes;
+  std::vector<coral::ZoneHit> hits;
+  // First box in each keepout zone this frame, -1 for none, and whether each
+  // zone held a box the frame before.
+  std::vector<int> zone_boxes;
+  std::vector<bool> zone_occupied;
+  OverlayScene scene;
+  std::string zone_names;
+  // Hides the detected workers in the displayed frames, if set.
+  coral::Anonymizer* anonymizer = nullptr;
+  std::vector<coral::BoundingBox> anon_regions;
+  // Clip of the stream taken around violations, if recorded.
+  coral::ClipRecorder* clips = nullptr;
+  int clip_stream = -1;
+  // Whether the last frame the detector ran on had a violation, still on
+  // screen while the motion gate skips frames.
+  bool violation = false;
+};
+
+// Outlines of keepout zones as drawn under the results, by severity.
+std::vector<coral::OverlayPolygon> keepout_background(const coral::KeepoutZoneSet& zones) {
+  std::vector<coral::OverlayPolygon> polygons;
+  for (int i = 0; i < zones.size(); ++i) {
+    const auto& zone = zones.get_zone(i);
+    polygons.push_back(
+        {zone.points, zone.severity >= 2 ? coral::kOverlayRed : coral::kOverlayOrange});
+  }
+  return polygons;
+}
+
+// Records an entry for every keepout zone of `zones` holding one of the
+// boxes in `hits` since this frame, and an exit for every zone left empty.
+// Events are only recorded on a change, so a frame like the last one costs
+// a pass over the zones.
+void record_zone_events(
+    const coral::KeepoutZoneSet& zones, const std::vector<coral::ZoneHit>& hits, uint64_t seq,
+    SafetyStream* state) {
+  auto& zone_boxes = state->zone_boxes;
+  auto& zone_occupied = state->zone_occupied;
+  zone_boxes.assign(zones.size(), -1);
+  zone_occupied.resize(zones.size(), false);
+  for (const auto& hit : hits) {
+    if (zone_boxes[hit.zone] < 0) zone_boxes[hit.zone] = hit.box;
+  }
+  for (int zone = 0; zone < zones.size(); ++zone) {
+    const int box = zone_boxes[zone];
+    if ((box >= 0) == zone_occupied[zone]) continue;
+    zone_occupied[zone] = box >= 0;
+    coral::Event event;
+    event.type = box >= 0 ? coral::EventType::kKeepoutEnter : coral::EventType::kKeepoutExit;
+    event.stream = state->stream;
+    event.frame = seq;
+    event.id = zone;
+    event.label = zones.get_zone(zone).name;
+    if (box >= 0) {
+      const auto& bounds = state->boxes[box];
+      event.score = state->results[box].score;
+      event.x1 = bounds.left();
+      event.y1 = bounds.top();
+      event.x2 = bounds.right();
+      event.y2 = bounds.bottom();
+    }
+    state->events->record(event);
+  }
+}
+
+// Moves the occupancy of `old_zones`, replaced this frame, over to the zones
+// of `zones` with the same name that `hits` still occupy, so a worker
+// standing in a zone while it is reloaded neither leaves nor enters it.
+// Records an exit from every other occupied zone.
+void hand_over_zones(
+    const coral::KeepoutZoneSet& old_zones, const coral::KeepoutZoneSet& zones,
+    const std::vector<coral::ZoneHit>& hits, uint64_t seq, SafetyStream* state) {
+  std::vector<bool> occupied(zones.size(), false);
+  for (const auto& hit : hits) occupied[hit.zone] = true;
+  std::vector<bool> carried(zones.size(), false);
+  const auto& old_occupied = state->zone_occupied;
+  for (int old = 0; old < old_zones.size(); ++old) {
+    if (old >= static_cast<int>(old_occupied.size()) || !old_occupied[old]) continue;
+    const auto& name = old_zones.get_zone(old).name;
+    bool kept = false;
+    for (int zone = 0; zone < zones.size() && !kept; ++zone) {
+      kept = occupied[zone] && zones.get_zone(zone).name == name;
+      if (kept) carried[zone] = true;
+    }
+    if (kept) continue;
+    coral::Event event;
+    event.type = coral::EventType::kKeepoutExit;
+    event.stream = state->stream;
+    event.frame = seq;
+    event.id = old;
+    event.label = name;
+    state->events->record(event);
+  }
+  state->zone_occupied = std::move(carried);
+}
+
+// Maps detections in a letterboxed frame back onto the picture, as fractions
+// of its size, so they can be drawn over the displayed video.
+void map_to_content(const coral::ContentRect& content, std::vector<DetectionResult>* results) {
+  const float width = content.xmax - content.xmin;
+  const float height = content.ymax - content.ymin;
+  if (width == 1 && height == 1) return;
+  const auto map = [](float v, float min, float size) {
+    return std::min(std::max((v - min) / size, 0.0f), 1.0f);
+  };
+  for (auto& result : *results) {
+    result.x1 = map(result.x1, content.xmin, width);
+    result.x2 = map(result.x2, content.xmin, width);
+    result.y1 = map(result.y1, content.ymin, height);
+    result.y2 = map(result.y2, content.ymin, height);
+  }
+}
+
+// Callback function for the manufacturing demo called from the stream worker on every frame
 void worker_safety_callback(
-    SvgGenerator* svg_gen, const uint8_t* pixels, int pixel_length, InferenceWrapper& detector,
-    int width, int height, float threshold, Polygon& keepout_polygon, bool anon) {
-  static int frame_num = 0;
-  std::string box_list;
-  std::string label_list;
-  const auto results =
-      detector.get_detection_results(pixels, pixel_length, threshold, /*want_ids=*/{0});
-  frame_num++;  // count number of frames processed
-  VLOG(4) << "Frame: " << frame_num << " Candidates: " << results.size();
-
-  std::string svg;
+    Overlay* overlay, const uint8_t* pixels, int pixel_length, uint64_t seq,
+    const coral::ContentRect& content, InferenceScheduler& detector, int width, int height,
+    bool anon, SafetyStream* state) {
+  // Settings changed since the last frame apply from this one on, which
+  // runs the detector whatever the motion.
+  const bool reconfigured = state->settings->update();
+  const auto& settings = state->settings->get();
+  if (settings.keepout_zones != state->drawn_zones) {
+    overlay->set_background(state->stream, keepout_background(*settings.keepout_zones));
+    // Who left the previous zones is only known once the boxes are tested
+    // against the new ones.
+    state->replaced_zones = std::move(state->drawn_zones);
+    state->drawn_zones = settings.keepout_zones;
+  }
+  const auto& metrics = state->metrics;
+  const auto& keepout_zones = *settings.keepout_zones;
+  auto& results = state->results;
+  auto* motion_gate = state->motion_gate.get();
+  if (motion_gate) {
+    if (reconfigured) motion_gate->force_next();
+    const int detector_input_size = detector.get_interpreter(0).get_input_size();
+    const bool moving = motion_gate->should_process(
+        pixels, {detector_input_size, detector_input_size, 3});
+    VLOG(4) << "Motion score: " << motion_gate->get_last_score();
+    // Counted per stream, LOG_EVERY_N would count the frames of every stream.
+    if ((motion_gate->get_processed() + motion_gate->get_skipped()) % kMotionReportFrames == 0) {
+      LOG(INFO) << state->name << ": motion gate skipped " << motion_gate->get_skip_ratio() * 100
+                << "% of frames";
+    }
+    // A static scene keeps the last results, which the overlay already shows,
+    // and the clip of a violation still in it.
+    if (!moving) {
+      if (state->violation && state->clips) state->clips->trigger(state->clip_stream);
+      return;
+    }
+  }
+  detector.run(state->stream, [&](InferenceWrapper& interpreter) {
+    interpreter.get_detection_results(
+        pixels, pixel_length, settings.threshold, settings.want_ids, &results);
+    record_inference(metrics, interpreter);
+  });
+  map_to_content(content, &results);
+  VLOG(4) << "Frame: " << seq << " Candidates: " << results.size()
+          << " Zero-copy inputs: " << detector.get_zero_copy_inputs() << "/"
+          << detector.get_zero_copy_inputs() + detector.get_copied_inputs();
+
+  // Tests every detection against the keepout zones at once.
+  auto& boxes = state->boxes;
+  auto& hits = state->hits;
+  boxes.clear();
   for (const auto& result : results) {
+    boxes.emplace_back(
+        result.x1 * width, result.y1 * height, result.x2 * width, result.y2 * height);
+  }
+  if (state->anonymizer) {
+    auto& regions = state->anon_regions;
+    regions.clear();
+    for (const auto& box : boxes) {
+      regions.emplace_back(box.top(), box.left(), box.bottom(), box.right());
+    }
+    state->anonymizer->set_regions(state->stream, regions);
+  }
+  hits.clear();
+  {
+    coral::ScopedLatency latency(metrics.keepout);
+    keepout_zones.collide(boxes, &hits);
+  }
+  if (state->replaced_zones) {
+    if (state->events->is_open()) {
+      hand_over_zones(*state->replaced_zones, keepout_zones, hits, seq, state);
+    } else {
+      state->zone_occupied.clear();
+    }
+    state->replaced_zones.reset();
+  }
+  if (state->events->is_open()) record_zone_events(keepout_zones, hits, seq, state);
+
+  // The scene keeps its buffers from frame to frame.
+  auto& scene = state->scene;
+  auto& zone_names = state->zone_names;
+  scene.clear();
+  size_t next_hit = 0;
+  bool violation = false;
+  for (size_t i = 0; i < results.size(); ++i) {
+    const auto& result = results[i];
     VLOG(5) << " - score: " << result.score << " x1: " << result.x1 * width
             << " y1: " << result.y1 * height << " x2: " << result.x2 * width
             << " y2: " << result.y2 * height << "\n";
-    std::string box_str;
-    std::string label_str;
-    int w, h;
-    w = (result.x2 - result.x1) * width;
-    h = (result.y2 - result.y1) * height;
-    float opacity = anon ? 1.0 : 0.0;
-    // Checks if this box collided with the keepout.
-    const auto& polygon_svg = keepout_polygon.get_svg_str();
-    if (polygon_svg != "None") {
-      // Check for keepout.
-      Box b{result.x1 * width, result.y1 * height, result.x2 * width, result.y2 * height};
-      if (b.collided_with_polygon(keepout_polygon, width)) {
-        box_str = absl::Substitute(
-            kSvgBox, result.x1 * width, result.y1 * height, w, h, opacity, 255, 0,
-            0);  // Red
-        label_str = absl::Substitute(
-            kSvgText, result.x1 * width, (result.y1 * height) - 5, "red",
-            absl::StrCat(result.candidate, ": ", result.score));
-      } else {
-        box_str = absl::Substitute(
-            kSvgBox, result.x1 * width, result.y1 * height, w, h, opacity, 0, 255,
-            0);  // Green
-        label_str = absl::Substitute(
-            kSvgText, result.x1 * width, (result.y1 * height) - 5, "lightgreen",
-            absl::StrCat(result.candidate, ": ", result.score));
-      }
+    // Hits are ordered by box, the box takes the color of its worst zone.
+    int severity = 0;
+    zone_names.clear();
+    for (; next_hit < hits.size() && hits[next_hit].box == static_cast<int>(i); ++next_hit) {
+      const auto& zone = keepout_zones.get_zone(hits[next_hit].zone);
+      severity = std::max(severity, zone.severity);
+      absl::StrAppend(&zone_names, zone_names.empty() ? " in " : ", ", zone.name);
+    }
+    const int w = (result.x2 - result.x1) * width;
+    const int h = (result.y2 - result.y1) * height;
+    const float x = result.x1 * width;
+    const float y = result.y1 * height;
+    if (severity >= 2) {
+      violation = true;
+      scene.add_box(x, y, w, h, coral::kOverlayRed, anon);
+      scene.add_label(
+          x, y - 5, coral::kOverlayRed, result.candidate, ": ", result.score, zone_names);
+    } else if (severity == 1) {
+      scene.add_box(x, y, w, h, coral::kOverlayOrange, anon);
+      scene.add_label(
+          x, y - 5, coral::kOverlayOrange, result.candidate, ": ", result.score, zone_names);
     } else {
-      // Don't check for keepout.
-      box_str = absl::Substitute(
-          kSvgBox, result.x1 * width, result.y1 * height, w, h, opacity, 0, 255,
-          0);  // Green
-      label_str = absl::Substitute(
-          kSvgText, result.x1 * width, (result.y1 * height) - 5, "lightgreen",
-          absl::StrCat(result.candidate, ": ", result.score));
+      scene.add_box(x, y, w, h, coral::kOverlayGreen, anon);
+      scene.add_label(x, y - 5, coral::kOverlayLightGreen, result.candidate, ": ", result.score);
     }
-    box_list = absl::StrCat(box_list, box_str);
-    label_list = absl::StrCat(label_list, label_str);
   }
-  if (keepout_polygon.get_svg_str() == "None") {
-    svg = absl::StrCat(box_list, label_list);
-  } else {
-    svg = absl::StrCat(keepout_polygon.get_svg_str(), box_list, label_list);
+  // Every frame with a violation pushes the end of its clip out.
+  state->violation = violation;
+  if (violation && state->clips) state->clips->trigger(state->clip_stream);
+  coral::ScopedLatency latency(metrics.overlay);
+  overlay->set_scene(state->stream, scene);
+}
+
+// State of one visual inspection frame on its way through the stages below,
+// reused across frames so the steady state doesn't allocate.
+struct InspectionJob {
+  Overlay* overlay = nullptr;
+  coral::Frame frame;
+  // Settings of the stream when the frame arrived, used by every stage.
+  std::shared_ptr<const coral::StreamSettings> settings;
+  std::vector<DetectionResult> detections;
+  std::vector<coral::BoundingBox> crops;
+  // Crops resized to the classifier input, back to back.
+  std::vector<uint8_t> crop_pixels;
+  std::vector<ClassificationResult> classifications;
+  OverlayScene scene;
+  // When the frame was handed to the stream, see coral::now_ns().
+  int64_t start_ns = 0;
+};
+
+// Rejected objects seen in the last frames, so each is recorded once, on
+// the first frame it is rejected in. Touched by the render stage only.
+class RejectTracker {
+ public:
+  // Returns whether the box x1, y1, x2, y2 rejected in frame `seq` is a new
+  // object, one that overlaps no reject of the last few frames.
+  bool is_new(uint64_t seq, float x1, float y1, float x2, float y2) {
+    rejects_.erase(
+        std::remove_if(
+            rejects_.begin(), rejects_.end(),
+            [seq](const Reject& reject) { return seq - reject.last_seen > kMaxUnseenFrames; }),
+        rejects_.end());
+    for (auto& reject : rejects_) {
+      if (iou(reject, x1, y1, x2, y2) >= kMinOverlap) {
+        reject = {seq, x1, y1, x2, y2};
+        return false;
+      }
+    }
+    rejects_.push_back({seq, x1, y1, x2, y2});
+    return true;
   }
-  VLOG(5) << svg;
-  svg_gen->set_worker_safety_svg(svg.c_str());
+
+ private:
+  // Frames an object may go unrejected, missed by the detector or scored
+  // below the threshold, before it counts as new again.
+  static constexpr uint64_t kMaxUnseenFrames = 5;
+  static constexpr float kMinOverlap = 0.3f;
+
+  struct Reject {
+    uint64_t last_seen;
+    float x1, y1, x2, y2;
+  };
+
+  static float iou(const Reject& a, float x1, float y1, float x2, float y2) {
+    const float w = std::min(a.x2, x2) - std::max(a.x1, x1);
+    const float h = std::min(a.y2, y2) - std::max(a.y1, y1);
+    if (w <= 0 || h <= 0) return 0;
+    const float overlap = w * h;
+    return overlap / ((a.x2 - a.x1) * (a.y2 - a.y1) + (x2 - x1) * (y2 - y1) - overlap);
+  }
+
+  std::vector<Reject> rejects_;
+};
+
+// Settings shared by the visual inspection stages, fixed at startup.
+struct InspectionContext {
+  InferenceScheduler* detector;
+  InferenceScheduler* classifier;
+  // Stream id in the schedulers and the overlay.
+  int stream;
+  int width;
+  int height;
+  const StageMetrics* metrics;
+  coral::EventLog* events;
+  RejectTracker* rejects;
+  // If set, gets the milliseconds from handing over each frame to drawing
+  // its results. Touched by the render stage only.
+  std::vector<double>* latencies_ms;
+};
+
+// Detect stage: finds the objects to inspect in the frame.
+void inspection_detect(const InspectionContext& context, InspectionJob* job) {
+  context.detector->run(context.stream, [&](InferenceWrapper& interpreter) {
+    interpreter.get_detection_results(
+        job->frame.data(), job->frame.size(), job->settings->threshold, job->settings->want_ids,
+        &job->detections);
+    record_inference(*context.metrics, interpreter);
+  });
 }
 
-// Callback function for the visual inspection demo called from the appsink on every new frame
-void visual_inspection_callback(
-    SvgGenerator* svg_gen, uint8_t* pixels, int pixel_length, InferenceWrapper& detector,
-    InferenceWrapper& classifier, int width, int height, float threshold) {
-  static int frame_num = 0;
-  std::string box_list;
-  std::string label_list;
-  const auto results =
-      detector.get_detection_results(pixels, pixel_length, threshold, /*want_id*/ {52});
-  frame_num++;  // count number of frames processed
-  VLOG(4) << "Frame: " << frame_num << " Candidates: " << results.size();
-
-  std::string svg;
-  for (const auto& result : results) {
+// Preprocess stage: crops every detected object and resizes it to the
+// classifier input, then lets go of the frame.
+void inspection_preprocess(const InspectionContext& context, InspectionJob* job) {
+  coral::ScopedLatency latency(context.metrics->crop);
+  const int detector_input_size = context.detector->get_interpreter(0).get_input_size();
+  const coral::ImageDims image_dim{detector_input_size, detector_input_size, 3};
+  auto& classifier = context.classifier->get_interpreter(0);
+  const int crop_size = classifier.get_input_size();
+  const coral::ImageDims crop_dim{crop_size, crop_size, 3};
+  const size_t crop_bytes = classifier.get_input_image_bytes();
+  job->crops.clear();
+  for (const auto& result : job->detections) {
+    job->crops.emplace_back(
+        result.y1 * image_dim[0], result.x1 * image_dim[0], result.y2 * image_dim[1],
+        result.x2 * image_dim[1]);
+  }
+  job->crop_pixels.resize(job->crops.size() * crop_bytes);
+  for (size_t i = 0; i < job->crops.size(); ++i) {
+    uint8_t* crop = job->crop_pixels.data() + i * crop_bytes;
+    if (!coral::crop_and_resize(
+            job->frame.data(), image_dim, /*in_stride=*/0, job->crops[i], crop_dim, crop)) {
+      // Empty crops still take their slot so results stay index aligned.
+      std::memset(crop, 0, crop_bytes);
+    }
+  }
+  // Crops were taken in frame coordinates, the rest only draws the results.
+  map_to_content(job->frame.get_content(), &job->detections);
+  // The pixels aren't needed past this point, return the buffer upstream.
+  job->frame = coral::Frame();
+}
+
+// Classify stage: classifies every detected object at once, in as few
+// invokes as the classifier allows.
+void inspection_classify(const InspectionContext& context, InspectionJob* job) {
+  coral::ScopedLatency latency(context.metrics->classification);
+  context.classifier->run(context.stream, [&](InferenceWrapper& interpreter) {
+    interpreter.get_classification_results(job->crop_pixels, &job->classifications);
+  });
+}
+
+// Render stage: draws the verdicts into the overlay.
+void inspection_render(const InspectionContext& context, uint64_t seq, InspectionJob* job) {
+  const int width = context.width;
+  const int height = context.height;
+  const auto& results = job->detections;
+  VLOG(4) << "Frame: " << seq << " Candidates: " << results.size();
+  // The scene keeps its buffers from frame to frame.
+  auto& scene = job->scene;
+  scene.clear();
+  for (size_t i = 0; i < results.size(); ++i) {
+    const auto& result = results[i];
     VLOG(5) << " x1: " << result.x1 * width << " y1: " << result.y1 * height
             << " x2: " << result.x2 * width << " y2: " << result.y2 * height << "\n";
-    std::string box_str;
-    std::string label_str;
-    int w = (result.x2 - result.x1) * width;
-    int h = (result.y2 - result.y1) * height;
-
-    const auto detector_input_size = detector.get_input_size();
-    const coral::ImageDims image_dim{detector_input_size, detector_input_size, 3};
-    const coral::BoundingBox crop_area{
-        result.y1 * image_dim[0], result.x1 * image_dim[0], result.y2 * image_dim[1],
-        result.x2 * image_dim[1]};
-    const auto& cropped_image = coral::crop_image(pixels, image_dim, crop_area);
-
-    const coral::ImageDims in_dim{crop_area.height, crop_area.width, 3};
-    const coral::ImageDims out_dim{classifier.get_input_size(), classifier.get_input_size(), 3};
-    const auto& resized_image = coral::resize_image(cropped_image.data(), in_dim, out_dim);
-
-    const auto classification =
-        classifier.get_classification_result(resized_image.data(), resized_image.size());
-    if (classification.score > threshold) {
-      VLOG(4) << classification.candidate << ": " << classification.score;
-      if (classification.candidate == "fresh_apple") {
-        // Fresh Apple.
-        box_str = absl::Substitute(
-            kSvgBox, result.x1 * width + width, result.y1 * height, w, h, 0.0, 0, 255,
-            0);  // Green
-        label_str = absl::Substitute(
-            kSvgText, result.x1 * width + width, (result.y1 * height) - 5, "lightgreen",
-            absl::StrCat(classification.candidate, ": ", classification.score));
-      } else {
-        // Rotten Apple.
-        box_str = absl::Substitute(
-            kSvgBox, result.x1 * width + width, result.y1 * height, w, h, 0.0, 255, 0,
-            0);  // Red
-        label_str = absl::Substitute(
-            kSvgText, result.x1 * width + width, (result.y1 * height) - 5, "red",
-            absl::StrCat(classification.candidate, ": ", classification.score));
+    const auto& classification = job->classifications[i];
+    if (classification.score <= job->settings->threshold) continue;
+    VLOG(4) << classification.candidate << ": " << classification.score;
+    const int w = (result.x2 - result.x1) * width;
+    const int h = (result.y2 - result.y1) * height;
+    const float x = result.x1 * width;
+    const float y = result.y1 * height;
+    if (classification.candidate == "fresh_apple") {
+      // Fresh Apple.
+      scene.add_box(x, y, w, h, coral::kOverlayGreen, false);
+      scene.add_label(
+          x, y - 5, coral::kOverlayLightGreen, classification.candidate, ": ",
+          classification.score);
+    } else {
+      // Rotten Apple, recorded on the first frame it is seen in.
+      scene.add_box(x, y, w, h, coral::kOverlayRed, false);
+      scene.add_label(
+          x, y - 5, coral::kOverlayRed, classification.candidate, ": ", classification.score);
+      if (context.rejects->is_new(seq, x, y, x + w, y + h)) {
+        context.events->record(
+            {coral::EventType::kInspectionReject, context.stream, seq, -1, classification.score,
+             x, y, x + w, y + h, classification.candidate});
       }
     }
-    box_list = absl::StrCat(box_list, box_str);
-    label_list = absl::StrCat(label_list, label_str);
   }
-  svg_gen->set_visual_inspection_svg(absl::StrCat(box_list, label_list).c_str());
+  {
+    coral::ScopedLatency latency(context.metrics->overlay);
+    job->overlay->set_scene(context.stream, scene);
+  }
+  if (context.latencies_ms) {
+    context.latencies_ms->push_back((coral::now_ns() - job->start_ns) / 1e6);
+  }
 }
 
+// Callback function for the visual inspection demo called from the stream
+// worker on every frame, runs all the stages back to back.
+void visual_inspection_callback(const InspectionContext& context, InspectionJob* job) {
+  const uint64_t seq = job->frame.seq();
+  inspection_detect(context, job);
+  inspection_preprocess(context, job);
+  inspection_classify(context, job);
+  inspection_render(context, seq, job);
+}
+
+// A visual inspection stream, running its stages either back to back in the
+// stream worker or overlapped across consecutive frames on a thread per stage.
+struct InspectionStream {
+  InspectionContext context;
+  std::unique_ptr<coral::Snapshot<coral::StreamSettings>::Reader> settings;
+  StageMetrics metrics;
+  RejectTracker rejects;
+  // End to end latencies of a pipelined replay, see InspectionContext.
+  std::vector<double> latencies_ms;
+  InspectionJob serial_job;
+  std::unique_ptr<coral::StagePipeline<InspectionJob>> pipeline;
+};
+
 }  // namespace callback_helper
 
+using callback_helper::InspectionJob;
+using callback_helper::InspectionStream;
+using callback_helper::SafetyStream;
+
 static std::string generate_pipeline_string(
     const std::string input_path, const uint16_t width, const uint16_t height,
-    const size_t detector_input_size, const std::string demo_name) {
+    const size_t detector_input_size, const std::string demo_name, bool native_overlay,
+    bool anonymize, int mixer_pad, bool yuv_ingest, const std::string& clip) {
+  // Workers are hidden in the RGBA frames passing anon_<demo_name>, then the
+  // native overlay draws into those passing overlay_<demo_name>. They then go
+  // to pad `mixer_pad` of the mixer, or are discarded if negative.
+  const std::string display = absl::StrCat(
+      native_overlay || anonymize ? "video/x-raw,format=RGBA ! " : "",
+      anonymize ? absl::StrFormat("identity name=anon_%s ! ", demo_name) : "",
+      native_overlay ? absl::StrFormat("identity name=overlay_%s ! ", demo_name) : "",
+      mixer_pad >= 0 ? absl::StrFormat("m.sink_%d", mixer_pad) : "fakesink sync=false");
+  const bool camera = absl::StrContains(input_path, "/dev/video");
+  // With YUV ingest the appsink takes the frames as decoded, videoconvert
+  // passing them through untouched unless they come in another format, and
+  // the stream worker converts and scales them in one go. Otherwise the
+  // pipeline scales them to the detector input and converts them to RGB.
+  const std::string inference =
+      yuv_ingest
+          ? absl::StrFormat(
+                "videoconvert ! video/x-raw,format={NV12,I420,YUY2} ! appsink name=appsink_%s",
+                demo_name)
+          : absl::StrFormat(
+                "videoscale ! video/x-raw,width=%d,height=%d ! videoconvert ! "
+                "video/x-raw,format=RGB ! appsink name=appsink_%s",
+                detector_input_size, detector_input_size, demo_name);
   std::string pipeline;
-  if (absl::StrContains(input_path, "/dev/video")) {
+  if (camera) {
     pipeline = absl::StrFormat(
         "v4l2src device=%s !"
         "video/x-raw,framerate=30/1,width=%d,height=%d ! " LEAKY_Q
         " ! tee name=t_%s "
         "t_%s. !" LEAKY_Q
-        " ! videoconvert ! m. \n"
-        "t_%s. !" LEAKY_Q
-        " ! videoscale ! video/x-raw,width=%d,height=%d ! "
-        "videoconvert ! video/x-raw,format=RGB ! appsink name=appsink_%s\n",
-        input_path, width, height, demo_name, demo_name, demo_name, detector_input_size,
-        detector_input_size, demo_name);
+        " ! videoconvert ! %s \n"
+        "t_%s. !" LEAKY_Q " ! %s\n",
+        input_path, width, height, demo_name, demo_name, display, demo_name, inference);
   } else {
-    // Assuming that input is a video.
+    // Assuming that input is a video. The display branch scales before its
+    // only conversion, so it converts frames of the display size.
     pipeline = absl::StrFormat(
         "filesrc location=%s ! decodebin ! tee name=t_%s "
-        "t_%s. ! queue ! videoconvert ! videoscale ! video/x-raw,width=%d,height=%d ! "
-        "videoconvert ! m.\n"
-        "t_%s. ! queue ! videoconvert ! videoscale ! "
-        "video/x-raw,width=%d,height=%d,format=RGB ! appsink name=appsink_%s\n",
-        input_path, demo_name, demo_name, width, height, demo_name, detector_input_size,
-        detector_input_size, demo_name);
+        "t_%s. ! queue ! videoscale ! video/x-raw,width=%d,height=%d ! videoconvert ! %s\n"
+        "t_%s. ! queue ! %s\n",
+        input_path, demo_name, demo_name, width, height, display, demo_name, inference);
+  }
+  // The clip branch drops frames rather than hold up the others when the
+  // encoder falls behind.
+  if (!clip.empty()) {
+    absl::StrAppendFormat(
+        &pipeline, "t_%s. ! queue max-size-buffers=8 leaky=downstream ! %s\n", demo_name, clip);
   }
   return pipeline;
 }
 
+// Encodes frames of the display size into H.264 access units for the appsink
+// of ClipRecorder. Each keyframe carries the stream headers, so clips can
+// start at any of them. With `anonymize`, workers are hidden in the RGBA
+// frames passing anon_clip_<demo_name> before they are encoded.
+static std::string generate_clip_string(
+    const uint16_t width, const uint16_t height, const std::string& encoder,
+    const std::string& demo_name, bool anonymize) {
+  const std::string anon = anonymize ? absl::StrFormat(
+                                           "video/x-raw,format=RGBA,width=%d,height=%d ! "
+                                           "identity name=anon_clip_%s ! videoconvert ! ",
+                                           width, height, demo_name)
+                                     : "";
+  return absl::StrFormat(
+      "videoscale ! videoconvert ! %svideo/x-raw,format=I420,width=%d,height=%d ! %s ! "
+      "h264parse config-interval=-1 ! video/x-h264,stream-format=byte-stream,alignment=au ! "
+      "appsink name=clip_%s sync=false",
+      anon, width, height, encoder, demo_name);
+}
+
+// Begins the pipeline with the mixer "m" tiling the streams as laid out by
+// `overlay_options`, then the SVG overlay if any, then the sink. Empty when
+// nothing is mixed.
+static std::string generate_output_string(
+    const std::string& compositor, const std::string& video_sink,
+    const coral::OverlayOptions& overlay_options) {
+  if (compositor == "none") return "";
+  const std::string mixer = compositor == "gl" ? "glvideomixer" : "compositor";
+  std::string sink;
+  if (video_sink == "display") {
+    sink = "autovideosink name=overlaysink sync=false";
+  } else if (video_sink == "fake") {
+    sink = "fakesink sync=false";
+  } else {
+    sink = absl::StrFormat("jpegenc ! avimux ! filesink location=%s sync=false", video_sink);
+  }
+  std::string pads;
+  for (int i = 0; i < overlay_options.num_streams; ++i) {
+    int x, y;
+    coral::get_stream_origin(overlay_options, i, &x, &y);
+    absl::StrAppendFormat(&pads, " sink_%d::xpos=%d sink_%d::ypos=%d", i, x, i, y);
+  }
+  return absl::StrFormat(
+      "%s name=m%s ! %svideoconvert ! %s \n", mixer, pads,
+      overlay_options.type == coral::OverlayType::kSvg ? "rsvgoverlay name=rsvg ! " : "", sink);
+}
+
+// Path of the frame dump of the stream `demo_name` under `prefix`.
+static std::string frame_dump_path(const std::string& prefix, const std::string& demo_name) {
+  return absl::StrCat(prefix, "_", demo_name, ".rgb");
+}
+
+// Decodes an input straight to an appsink at the detector input size, the
+// frames its callback would get.
+static std::string generate_dump_pipeline_string(
+    const std::string& input_path, const size_t detector_input_size,
+    const std::string& demo_name, int camera_frames) {
+  const std::string source =
+      absl::StrContains(input_path, "/dev/video")
+          ? absl::StrFormat("v4l2src device=%s num-buffers=%d", input_path, camera_frames)
+          : absl::StrFormat("filesrc location=%s ! decodebin", input_path);
+  return absl::StrFormat(
+      "%s ! videoconvert ! videoscale ! video/x-raw,width=%d,height=%d,format=RGB ! "
+      "appsink name=appsink_%s\n",
+      source, detector_input_size, detector_input_size, demo_name);
+}
+
 int main(int argc, char* argv[]) {
+  coral::StartupTimeline timeline;
   google::InitGoogleLogging(argv[0]);
   absl::ParseCommandLine(argc, argv);
 
-  std::string detection_model_path = absl::GetFlag(FLAGS_detection_model);
+  BackendOptions backend_options;
+  if (!coral::parse_backend_type(absl::GetFlag(FLAGS_backend), &backend_options.type)) {
+    LOG(ERROR) << "Unknown backend " << absl::GetFlag(FLAGS_backend);
+    exit(EXIT_FAILURE);
+  }
+  // Resolve once so both models agree on the hardware and model files.
+  backend_options.type = coral::resolve_backend_type(backend_options.type);
+  backend_options.num_threads = absl::GetFlag(FLAGS_num_threads);
+  const bool use_cpu = backend_options.type == BackendType::kCpu;
+  LOG(INFO) << "Using " << coral::backend_name(backend_options.type) << " backend";
+
+  std::string detection_model_path =
+      use_cpu ? absl::GetFlag(FLAGS_cpu_detection_model) : absl::GetFlag(FLAGS_detection_model);
   std::string detection_label_path = absl::GetFlag(FLAGS_detection_labels);
-  std::string classifier_model_path = absl::GetFlag(FLAGS_classifier_model);
+  std::string classifier_model_path =
+      use_cpu ? absl::GetFlag(FLAGS_cpu_classifier_model) : absl::GetFlag(FLAGS_classifier_model);
   std::string classifier_label_path = absl::GetFlag(FLAGS_classifier_labels);
   const uint16_t width = absl::GetFlag(FLAGS_width);
   const uint16_t height = absl::GetFlag(FLAGS_height);
-  const float worker_threshold = absl::GetFlag(FLAGS_worker_threshold);
-  const float inspection_threshold = absl::GetFlag(FLAGS_inspection_threshold);
-  const bool anon = absl::GetFlag(FLAGS_anonymize);
+  coral::AnonymizeMethod anonymize_method;
+  if (!coral::parse_anonymize_method(
+          absl::GetFlag(FLAGS_anonymize_method), &anonymize_method)) {
+    LOG(ERROR) << "Unknown anonymize method " << absl::GetFlag(FLAGS_anonymize_method);
+    exit(EXIT_FAILURE);
+  }
+  // Only filled boxes are drawn by the overlay, the other methods work on
+  // the frames.
+  const bool anonymize = absl::GetFlag(FLAGS_anonymize);
+  const bool anon = anonymize && anonymize_method == coral::AnonymizeMethod::kFill;
+  const bool anonymize_frames = anonymize && !anon;
 
-  check_file(detection_model_path.c_str());
+  // The CPU detection model isn't in the repo, only its Edge TPU build.
+  check_file(
+      detection_model_path.c_str(),
+      use_cpu ? ", run `make models` to download the default CPU detection model" : "");
   check_file(detection_label_path.c_str());
   check_file(classifier_label_path.c_str());
   check_file(classifier_model_path.c_str());
 
-  coral::CameraStreamer streamer;
-  const auto safety_input_path = absl::GetFlag(FLAGS_worker_safety_input);
-  const auto visual_inspection_path = absl::GetFlag(FLAGS_visual_inspection_input);
+  // Every stream, in display order.
+  std::vector<StreamConfig> stream_configs;
+  const std::string streams_config_path = absl::GetFlag(FLAGS_streams_config);
+  if (!streams_config_path.empty()) {
+    if (!coral::parse_stream_configs(streams_config_path, &stream_configs)) exit(EXIT_FAILURE);
+  } else {
+    stream_configs.push_back(
+        {"safety", StreamTask::kWorkerSafety, absl::GetFlag(FLAGS_worker_safety_input),
+         absl::GetFlag(FLAGS_worker_threshold), absl::GetFlag(FLAGS_keepout_points_path)});
+    stream_configs.push_back(
+        {"inspection", StreamTask::kVisualInspection,
+         absl::GetFlag(FLAGS_visual_inspection_input), absl::GetFlag(FLAGS_inspection_threshold),
+         ""});
+  }
+  if (stream_configs.empty()) {
+    LOG(ERROR) << "No streams listed in " << streams_config_path;
+    exit(EXIT_FAILURE);
+  }
+  const int num_streams = stream_configs.size();
+  for (const auto& config : stream_configs) {
+    LOG(INFO) << "Stream " << config.name << ": " << coral::stream_task_name(config.task)
+              << " on " << config.input;
+  }
 
-  InferenceWrapper detector(detection_model_path, detection_label_path);
-  size_t detector_input_size = detector.get_input_size();
+  const int frame_queue_size = absl::GetFlag(FLAGS_frame_queue_size);
+  CHECK_GT(frame_queue_size, 0);
+  coral::FrameQueueOptions queue_options;
+  queue_options.capacity = frame_queue_size;
+  if (!coral::parse_drop_policy(absl::GetFlag(FLAGS_frame_queue_policy), &queue_options.policy)) {
+    LOG(ERROR) << "Unknown frame queue policy " << absl::GetFlag(FLAGS_frame_queue_policy);
+    exit(EXIT_FAILURE);
+  }
+  coral::OverlayOptions overlay_options;
+  if (!coral::parse_overlay_type(absl::GetFlag(FLAGS_overlay), &overlay_options.type)) {
+    LOG(ERROR) << "Unknown overlay " << absl::GetFlag(FLAGS_overlay);
+    exit(EXIT_FAILURE);
+  }
+  const bool native_overlay = overlay_options.type == coral::OverlayType::kNative;
+  const std::string compositor = absl::GetFlag(FLAGS_compositor);
+  if (compositor != "gl" && compositor != "cpu" && compositor != "none") {
+    LOG(ERROR) << "Unknown compositor " << compositor;
+    exit(EXIT_FAILURE);
+  }
+  const bool mixed = compositor != "none";
+  const std::string video_sink = absl::GetFlag(FLAGS_video_sink);
+  if (!mixed && video_sink != "fake") {
+    LOG(ERROR) << "Without a compositor the video can only go to --video_sink=fake";
+    exit(EXIT_FAILURE);
+  }
+  if (!mixed && overlay_options.type == coral::OverlayType::kSvg) {
+    LOG(ERROR) << "The SVG overlay is drawn over the mixed video and needs a compositor";
+    exit(EXIT_FAILURE);
+  }
+  overlay_options.num_streams = num_streams;
+  overlay_options.columns = coral::get_grid_columns(num_streams);
+  overlay_options.width = width;
+  overlay_options.height = height;
+  overlay_options.max_updates_per_second = absl::GetFlag(FLAGS_overlay_max_fps);
+  // Thresholds, classes and keepout zones can change while the streams run,
+  // each stream reads them from a snapshot once per frame.
+  std::vector<std::vector<int>> class_ids;
+  for (const auto& config : stream_configs) {
+    class_ids.push_back(
+        config.task == StreamTask::kWorkerSafety ? std::vector<int>{/*person=*/0}
+                                                 : std::vector<int>{/*apple=*/52});
+  }
+  coral::LiveConfigOptions live_config_options;
+  live_config_options.streams_config_path = streams_config_path;
+  live_config_options.width = width;
+  live_config_options.height = height;
+  coral::LiveConfig live_config(stream_configs, class_ids, live_config_options);
+  // The zones are drawn under every frame of their worker safety stream, and
+  // only drawn again when they are reloaded.
+  overlay_options.backgrounds.resize(num_streams);
+  for (int i = 0; i < num_streams; ++i) {
+    const auto zones = live_config.get_settings(i).get()->keepout_zones;
+    overlay_options.backgrounds[i] = callback_helper::keepout_background(*zones);
+  }
+  coral::MetricsRegistry metrics;
+  coral::MetricsExporterOptions exporter_options;
+  exporter_options.port = absl::GetFlag(FLAGS_metrics_port);
+  exporter_options.path = absl::GetFlag(FLAGS_metrics_file);
+  exporter_options.interval_seconds = absl::GetFlag(FLAGS_metrics_interval_seconds);
+  coral::MetricsExporter metrics_exporter(&metrics, exporter_options);
+  coral::EventLog events;
+  const std::string event_log_path = absl::GetFlag(FLAGS_event_log);
+  if (!event_log_path.empty()) {
+    std::vector<std::string> stream_names;
+    for (const auto& config : stream_configs) stream_names.push_back(config.name);
+    CHECK_GT(absl::GetFlag(FLAGS_event_log_capacity), 0);
+    if (!events.open(event_log_path, absl::GetFlag(FLAGS_event_log_capacity), stream_names)) {
+      exit(EXIT_FAILURE);
+    }
+  }
 
-  // Begins pipeline with a mixer for combining both streams.
-  std::string pipeline = absl::StrFormat(
-      "glvideomixer name=m sink_0::xpos=0 "
-      "sink_1::xpos=%d ! rsvgoverlay name=rsvg ! videoconvert ! autovideosink name=overlaysink sync=false \n",
-      width);
+  coral::SchedulerOptions detector_options;
+  coral::SchedulerOptions classifier_options;
+  if (!coral::parse_scheduling_policy(absl::GetFlag(FLAGS_scheduling), &detector_options.policy)) {
+    LOG(ERROR) << "Unknown scheduling policy " << absl::GetFlag(FLAGS_scheduling);
+    exit(EXIT_FAILURE);
+  }
+  classifier_options.policy = detector_options.policy;
+  detector_options.pool_size = absl::GetFlag(FLAGS_detector_pool_size);
+  classifier_options.pool_size = absl::GetFlag(FLAGS_classifier_pool_size);
+  if (use_cpu && backend_options.num_threads == 0) {
+    // Every interpreter of both pools may invoke at once, sharing the cores
+    // between them keeps their threads from contending for the same ones.
+    backend_options.num_threads = coral::cpu_threads_per_interpreter(
+        detector_options.pool_size + classifier_options.pool_size);
+    LOG(INFO) << "CPU interpreters use " << backend_options.num_threads << " threads each";
+  }
 
-  // Begins pipelines with Worker Safety.
-  pipeline += generate_pipeline_string(
-      safety_input_path, width, height, detector_input_size, coral::kWorkerSafety);
+  coral::DetectionPostprocess detection_postprocess;
+  if (!coral::parse_detection_postprocess(
+          absl::GetFlag(FLAGS_detection_postprocess), &detection_postprocess)) {
+    LOG(ERROR) << "Unknown detection postprocess " << absl::GetFlag(FLAGS_detection_postprocess);
+    exit(EXIT_FAILURE);
+  }
+  std::vector<float> class_thresholds;
+  if (!coral::parse_class_thresholds(
+          absl::GetFlag(FLAGS_detection_class_thresholds), &class_thresholds)) {
+    exit(EXIT_FAILURE);
+  }
+  const bool cpp_postprocess = detection_postprocess == coral::DetectionPostprocess::kCpp;
+  BackendOptions detector_backend_options = backend_options;
+  // The decoder reads the inputs of the postprocess op, running the op too
+  // would be wasted.
+  detector_backend_options.skip_detection_postprocess = cpp_postprocess;
+  detector_options.name = "Detector";
+  classifier_options.name = "Classifier";
+  // Models are mapped rather than read, so the detector input is known from
+  // its model long before an interpreter is built.
+  const auto detection_model = InferenceWrapper::load_model(detection_model_path);
+  const coral::ImageDims detector_dims = InferenceWrapper::get_input_dims(*detection_model);
+  const size_t detector_input_size = detector_dims[1];
+  timeline.mark("detection model mapped");
+  const bool yuv_ingest = absl::GetFlag(FLAGS_yuv_ingest);
+  coral::IngestOptions ingest_options;
+  ingest_options.convert = yuv_ingest;
+  ingest_options.dims = detector_dims;
+  ingest_options.letterbox = absl::GetFlag(FLAGS_letterbox);
+  coral::CameraStreamer streamer(queue_options, overlay_options, &metrics, ingest_options);
+  streamer.set_event_log(&events);
 
-  // Next, adds in the Visual Inspection.
-  pipeline += generate_pipeline_string(
-      visual_inspection_path, width, height, detector_input_size, coral::kVisualInspection);
+  const std::string dump_prefix = absl::GetFlag(FLAGS_dump_frames);
+  if (!dump_prefix.empty()) {
+    const int camera_frames = absl::GetFlag(FLAGS_dump_camera_frames);
+    std::vector<std::pair<std::string, std::string>> sinks;
+    std::string dump_pipeline;
+    for (const auto& config : stream_configs) {
+      dump_pipeline += generate_dump_pipeline_string(
+          config.input, detector_input_size, config.name, camera_frames);
+      sinks.emplace_back(
+          absl::StrCat("appsink_", config.name), frame_dump_path(dump_prefix, config.name));
+    }
+    VLOG(2) << "Dump pipeline: " << dump_pipeline;
+    exit(coral::dump_frames(dump_pipeline, sinks, detector_dims) ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
+
+  // Worker safety streams keep their latest video encoded, each violation
+  // writing out a clip. Replays have no video to keep.
+  std::unique_ptr<coral::ClipRecorder> clip_recorder;
+  std::vector<int> clip_streams(num_streams, -1);
+  const std::string clip_dir = absl::GetFlag(FLAGS_clip_dir);
+  if (!clip_dir.empty() && absl::GetFlag(FLAGS_replay_frames).empty()) {
+    std::vector<std::string> clip_names;
+    for (int i = 0; i < num_streams; ++i) {
+      if (stream_configs[i].task != StreamTask::kWorkerSafety) continue;
+      clip_streams[i] = clip_names.size();
+      clip_names.push_back(stream_configs[i].name);
+    }
+    coral::ClipOptions clip_options;
+    clip_options.directory = clip_dir;
+    clip_options.pre_roll_seconds = absl::GetFlag(FLAGS_clip_pre_roll_seconds);
+    clip_options.post_roll_seconds = absl::GetFlag(FLAGS_clip_post_roll_seconds);
+    CHECK_GT(absl::GetFlag(FLAGS_clip_ring_mb), 0);
+    clip_options.max_ring_bytes = static_cast<size_t>(absl::GetFlag(FLAGS_clip_ring_mb)) << 20;
+    CHECK_GT(absl::GetFlag(FLAGS_clip_pending_mb), 0);
+    clip_options.max_pending_bytes = static_cast<size_t>(absl::GetFlag(FLAGS_clip_pending_mb))
+                                     << 20;
+    clip_recorder.reset(new coral::ClipRecorder(clip_names, clip_options));
+    streamer.set_clip_recorder(clip_recorder.get());
+  }
+  // Clips never show the workers either. The overlay doesn't draw into them,
+  // so they are pixelated when the display has filled boxes.
+  std::unique_ptr<coral::Anonymizer> anonymizer;
+  if (anonymize_frames || (anonymize && clip_recorder)) {
+    coral::AnonymizeOptions anonymize_options;
+    anonymize_options.method =
+        anonymize_frames ? anonymize_method : coral::AnonymizeMethod::kPixelate;
+    anonymize_options.width = width;
+    anonymize_options.height = height;
+    anonymizer.reset(new coral::Anonymizer(num_streams, anonymize_options));
+    streamer.set_anonymizer(anonymizer.get());
+  }
+
+  // Both pools are built, warmed up and probed on threads of their own while
+  // the pipeline is parsed, so startup takes as long as the slowest of them.
+  const int latency_probe_runs = absl::GetFlag(FLAGS_latency_probe_runs);
+  std::unique_ptr<InferenceScheduler> detector_pool, classifier_pool;
+  std::thread detector_builder([&] {
+    detector_pool.reset(new InferenceScheduler(
+        detection_model, InferenceWrapper::load_labels(detection_label_path),
+        detector_backend_options, detector_options));
+    timeline.mark("detector ready");
+    report_invoke_latency("Detector", detector_pool->get_interpreter(0), latency_probe_runs);
+  });
+  std::thread classifier_builder([&] {
+    classifier_pool.reset(new InferenceScheduler(
+        classifier_model_path, classifier_label_path, backend_options, classifier_options));
+    timeline.mark("classifier ready");
+    report_invoke_latency("Classifier", classifier_pool->get_interpreter(0), latency_probe_runs);
+  });
+
+  // Begins pipeline with a mixer tiling the streams in a grid. The native
+  // overlay is drawn into each stream before, the SVG one after mixing.
+  std::string pipeline = generate_output_string(compositor, video_sink, overlay_options);
+
+  // Next, adds in every stream, each feeding the mixer pad of its tile.
+  for (int i = 0; i < num_streams; ++i) {
+    const bool safety = stream_configs[i].task == StreamTask::kWorkerSafety;
+    const std::string clip =
+        clip_streams[i] < 0 ? "" : generate_clip_string(
+                                       width, height, absl::GetFlag(FLAGS_clip_encoder),
+                                       stream_configs[i].name, anonymizer && safety);
+    pipeline += generate_pipeline_string(
+        stream_configs[i].input, width, height, detector_input_size, stream_configs[i].name,
+        native_overlay, anonymize_frames && safety, mixed ? i : -1, yuv_ingest, clip);
+  }
 
   const gchar* kPipeline = pipeline.c_str();
   VLOG(2) << "Pipeline: " << pipeline.c_str();
+  const std::string replay_prefix = absl::GetFlag(FLAGS_replay_frames);
+  if (replay_prefix.empty()) {
+    streamer.parse_pipeline(kPipeline);
+    timeline.mark("pipeline parsed");
+  }
+  detector_builder.join();
+  classifier_builder.join();
+  InferenceScheduler& detector = *detector_pool;
+  InferenceScheduler& classifier = *classifier_pool;
 
   LOG(INFO) << "Starting Manufacturing Demo\n";
-  InferenceWrapper classifier(classifier_model_path, classifier_label_path);
-  auto keepout_polygon = coral::parse_keepout_polygon(absl::GetFlag(FLAGS_keepout_points_path));
-  streamer.run_pipeline(
-      /*pipeline_string=*/kPipeline,
-      /*safety_callback_data=*/
-      {/*svg_gen=*/nullptr, /*cb=*/
-       [&](SvgGenerator* svg_gen, uint8_t* pixels, int pixel_length) {
-         callback_helper::worker_safety_callback(
-             svg_gen, pixels, pixel_length, detector, width, height, worker_threshold, keepout_polygon, anon);
-       }},
-      /*inspection_callback_data=*/
-      {/*svg_gen=*/nullptr, /*cb=*/[&](SvgGenerator* svg_gen, uint8_t* pixels, int pixel_length) {
-         callback_helper::visual_inspection_callback(
-             svg_gen, pixels, pixel_length, detector, classifier, width, height, inspection_threshold);
-       }});
+  if (cpp_postprocess) {
+    for (int i = 0; i < detector.get_pool_size(); ++i) {
+      detector.get_interpreter(i).use_ssd_decoder(
+          absl::GetFlag(FLAGS_detection_anchors), class_thresholds);
+    }
+  }
+  // Every stream shares the pools. Worker safety outranks visual inspection
+  // under the priority policy. Scheduler stream ids follow the stream order,
+  // as overlay stream ids do, in both schedulers.
+  for (int i = 0; i < num_streams; ++i) {
+    const bool safety = stream_configs[i].task == StreamTask::kWorkerSafety;
+    CHECK_EQ(detector.add_stream(stream_configs[i].name, /*priority=*/safety ? 1 : 0), i);
+    CHECK_EQ(classifier.add_stream(stream_configs[i].name, /*priority=*/safety ? 1 : 0), i);
+  }
+  for (int i = 0; i < classifier.get_pool_size(); ++i) {
+    classifier.get_interpreter(i).set_max_batch_size(absl::GetFlag(FLAGS_classifier_batch_size));
+  }
+  coral::MotionGateOptions motion_options;
+  motion_options.threshold = absl::GetFlag(FLAGS_motion_threshold);
+  motion_options.max_skip_frames = absl::GetFlag(FLAGS_motion_max_skip_frames);
+  const int inspection_depth = absl::GetFlag(FLAGS_inspection_pipeline_depth);
+  // State of the streams of each task, and the callback of every stream in
+  // stream order.
+  std::vector<std::unique_ptr<SafetyStream>> safety_streams;
+  std::vector<std::unique_ptr<InspectionStream>> inspection_streams;
+  std::vector<std::function<void(Overlay*, coral::Frame)>> callbacks;
+  // Finish the frames a stream handed to threads of its own, before the
+  // overlay goes.
+  std::vector<std::function<void()>> stop_callbacks(num_streams);
+  for (int i = 0; i < num_streams; ++i) {
+    const auto& config = stream_configs[i];
+    if (config.task == StreamTask::kWorkerSafety) {
+      safety_streams.emplace_back(new SafetyStream);
+      SafetyStream* state = safety_streams.back().get();
+      state->name = config.name;
+      state->stream = i;
+      state->settings.reset(
+          new coral::Snapshot<coral::StreamSettings>::Reader(&live_config.get_settings(i)));
+      // The overlay starts out with the zones loaded at startup.
+      state->drawn_zones = live_config.get_settings(i).get()->keepout_zones;
+      if (absl::GetFlag(FLAGS_motion_gate)) {
+        state->motion_gate.reset(new coral::MotionGate(motion_options));
+      }
+      state->metrics = callback_helper::make_stage_metrics(&metrics, &timeline, config.name);
+      state->events = &events;
+      state->clips = clip_recorder.get();
+      state->anonymizer = anonymizer.get();
+      state->clip_stream = clip_streams[i];
+      callbacks.push_back([&, state](Overlay* overlay, coral::Frame frame) {
+        callback_helper::worker_safety_callback(
+            overlay, frame.data(), frame.size(), frame.seq(), frame.get_content(), detector,
+            width, height, anon, state);
+      });
+      continue;
+    }
+    inspection_streams.emplace_back(new InspectionStream);
+    InspectionStream* state = inspection_streams.back().get();
+    state->metrics = callback_helper::make_stage_metrics(&metrics, &timeline, config.name);
+    // A replay only times handing each frame to a pipeline, the render stage
+    // times the rest.
+    const bool time_jobs = !replay_prefix.empty() && inspection_depth > 0;
+    state->context = {
+        &detector, &classifier, i, width, height, &state->metrics, &events, &state->rejects,
+        time_jobs ? &state->latencies_ms : nullptr};
+    state->settings.reset(
+        new coral::Snapshot<coral::StreamSettings>::Reader(&live_config.get_settings(i)));
+    if (inspection_depth > 0) {
+      state->pipeline.reset(new coral::StagePipeline<InspectionJob>(
+          inspection_depth, kStageReportIntervalSeconds, config.name));
+      const auto& context = state->context;
+      state->pipeline->add_stage("detect", [&context](uint64_t, InspectionJob* job) {
+        callback_helper::inspection_detect(context, job);
+      });
+      state->pipeline->add_stage("preprocess", [&context](uint64_t, InspectionJob* job) {
+        callback_helper::inspection_preprocess(context, job);
+      });
+      state->pipeline->add_stage("classify", [&context](uint64_t, InspectionJob* job) {
+        callback_helper::inspection_classify(context, job);
+      });
+      state->pipeline->add_stage("render", [&context](uint64_t seq, InspectionJob* job) {
+        callback_helper::inspection_render(context, seq, job);
+      });
+      state->pipeline->start();
+    }
+    stop_callbacks[i] = [state, name = config.name] {
+      if (!state->pipeline) return;
+      state->pipeline->stop();
+      auto& latencies = state->latencies_ms;
+      if (latencies.empty()) return;
+      std::sort(latencies.begin(), latencies.end());
+      LOG(INFO) << name << ": end to end latency p50 " << coral::percentile(latencies, 0.50)
+                << " ms, p95 " << coral::percentile(latencies, 0.95) << " ms, p99 "
+                << coral::percentile(latencies, 0.99) << " ms";
+    };
+    callbacks.push_back([state](Overlay* overlay, coral::Frame frame) {
+      const int64_t start_ns = coral::now_ns();
+      auto* job = state->pipeline ? state->pipeline->acquire() : &state->serial_job;
+      if (!job) return;
+      job->overlay = overlay;
+      job->frame = std::move(frame);
+      job->start_ns = start_ns;
+      // Frames already in flight finish with the settings they started with.
+      state->settings->update();
+      job->settings = state->settings->share();
+      if (state->pipeline) {
+        state->pipeline->submit(job);
+      } else {
+        callback_helper::visual_inspection_callback(state->context, job);
+      }
+    });
+  }
+  // Changes are published from a thread of its own, the streams pick them up
+  // on their next frame.
+  coral::ConfigWatcherOptions watcher_options;
+  watcher_options.watch_files = absl::GetFlag(FLAGS_watch_config);
+  watcher_options.control_socket = absl::GetFlag(FLAGS_control_socket);
+  coral::ConfigWatcher config_watcher(&live_config, watcher_options);
+  std::unique_ptr<coral::SceneRecorder> recorder;
+  if (!replay_prefix.empty()) {
+    // Each stream replays its dump on a thread of its own, as it would run
+    // on its stream worker, without decoding or display. The overlay outlives
+    // the threads, which stop their stream before they exit.
+    coral::NullOverlay null_overlay;
+    Overlay* overlay = &null_overlay;
+    if (!absl::GetFlag(FLAGS_replay_results).empty()) {
+      recorder.reset(new coral::SceneRecorder(num_streams));
+      overlay = recorder.get();
+    }
+    coral::ReplayOptions replay_options;
+    replay_options.fps = absl::GetFlag(FLAGS_replay_fps);
+    std::vector<std::thread> replays;
+    timeline.mark("replay started");
+    for (int i = 0; i < num_streams; ++i) {
+      replays.emplace_back([&, i] {
+        const std::string& name = stream_configs[i].name;
+        coral::FrameDump dump;
+        const auto path = frame_dump_path(replay_prefix, name);
+        CHECK(dump.open(path));
+        CHECK(dump.get_dims() == detector_dims)
+            << path << " wasn't dumped at the detector input size " << detector_input_size;
+        const auto stats = coral::replay_frames(dump, replay_options, [&](coral::Frame frame) {
+          callbacks[i](overlay, std::move(frame));
+        });
+        // A pipelined stream is only handed the frames by its callback, its
+        // end to end latency is logged once stopped.
+        LOG(INFO) << name << ": replayed " << stats.frames << " frames at "
+                  << stats.frames / stats.seconds << " frames/s, callback latency p50 "
+                  << stats.p50_ms << " ms, p95 " << stats.p95_ms << " ms, p99 " << stats.p99_ms
+                  << " ms";
+        if (stop_callbacks[i]) stop_callbacks[i]();
+      });
+    }
+    for (auto& replay : replays) replay.join();
+  } else {
+    std::vector<CameraStreamer::CallbackData> callback_data;
+    for (int i = 0; i < num_streams; ++i) {
+      callback_data.push_back(
+          {stream_configs[i].name, /*overlay=*/nullptr, callbacks[i], stop_callbacks[i]});
+    }
+    streamer.set_on_playing([&timeline] { timeline.mark("pipeline playing"); });
+    streamer.run_pipeline(std::move(callback_data));
+  }
+  if (recorder) {
+    const auto results_path = absl::GetFlag(FLAGS_replay_results);
+    if (!recorder->write(results_path)) LOG(ERROR) << "Unable to write " << results_path;
+  }
+  for (const auto& stream : safety_streams) {
+    if (!stream->motion_gate) continue;
+    LOG(INFO) << stream->name << ": motion gate skipped " << stream->motion_gate->get_skipped()
+              << " frames, processed " << stream->motion_gate->get_processed();
+  }
+  LOG(INFO) << "Detector inputs: " << detector.get_zero_copy_inputs() << " zero-copy, "
+            << detector.get_copied_inputs() << " copied";
 }
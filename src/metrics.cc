@@ -0,0 +1,234 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "metrics.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "glog/logging.h"
+
+namespace coral {
+
+namespace {
+
+// How long the exporter waits for a connection before checking whether it
+// was stopped or the file is due.
+constexpr int kPollIntervalMs = 200;
+// Largest request read, the request line is all that matters.
+constexpr size_t kMaxRequestBytes = 4096;
+
+// Joins `labels` and `extra` into a Prometheus label set, "{}" excluded when
+// both are empty.
+std::string label_set(const std::string& labels, const std::string& extra = "") {
+  if (labels.empty() && extra.empty()) return "";
+  return absl::StrCat("{", labels, labels.empty() || extra.empty() ? "" : ",", extra, "}");
+}
+
+void write_all(int fd, const std::string& data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    const ssize_t n = write(fd, data.data() + written, data.size() - written);
+    if (n <= 0) return;
+    written += n;
+  }
+}
+
+}  // namespace
+
+Counter* MetricsRegistry::get_counter(
+    const std::string& name, const std::string& help, const std::string& labels) {
+  absl::MutexLock l(&lock_);
+  auto& family = families_[name];
+  family.help = help;
+  CHECK(family.histograms.empty()) << name << " is already a histogram";
+  auto& counter = family.counters[labels];
+  if (!counter) counter.reset(new Counter);
+  return counter.get();
+}
+
+LatencyHistogram* MetricsRegistry::get_histogram(
+    const std::string& name, const std::string& help, const std::string& labels) {
+  absl::MutexLock l(&lock_);
+  auto& family = families_[name];
+  family.help = help;
+  CHECK(family.counters.empty()) << name << " is already a counter";
+  auto& histogram = family.histograms[labels];
+  if (!histogram) histogram.reset(new LatencyHistogram);
+  return histogram.get();
+}
+
+LatencyHistogram* MetricsRegistry::get_stage_latency(
+    const std::string& stream, const std::string& stage) {
+  return get_histogram(
+      "coral_stage_latency_seconds", "Time a frame spends in each stage of a stream.",
+      absl::StrFormat("stream=\"%s\",stage=\"%s\"", stream, stage));
+}
+
+void MetricsRegistry::write_text(std::string* text) const {
+  absl::MutexLock l(&lock_);
+  for (const auto& entry : families_) {
+    const std::string& name = entry.first;
+    const Family& family = entry.second;
+    absl::StrAppend(
+        text, "# HELP ", name, " ", family.help, "\n# TYPE ", name,
+        family.counters.empty() ? " histogram\n" : " counter\n");
+    for (const auto& counter : family.counters) {
+      absl::StrAppend(text, name, label_set(counter.first), " ", counter.second->value(), "\n");
+    }
+    for (const auto& series : family.histograms) {
+      const auto& histogram = *series.second;
+      // Buckets are cumulative in the exposition format.
+      uint64_t count = 0;
+      for (int i = 0; i < LatencyHistogram::kBuckets; ++i) {
+        count += histogram.get_count(i);
+        absl::StrAppendFormat(
+            text, "%s_bucket%s %d\n", name,
+            label_set(
+                series.first,
+                absl::StrFormat("le=\"%g\"", LatencyHistogram::get_upper_bound(i))),
+            count);
+      }
+      count += histogram.get_count(LatencyHistogram::kBuckets);
+      absl::StrAppend(
+          text, name, "_bucket", label_set(series.first, "le=\"+Inf\""), " ", count, "\n");
+      absl::StrAppend(
+          text, name, "_sum", label_set(series.first), " ", histogram.get_sum_ns() * 1e-9, "\n");
+      absl::StrAppend(text, name, "_count", label_set(series.first), " ", count, "\n");
+    }
+  }
+}
+
+void StartupTimeline::mark(const std::string& event) {
+  const int64_t elapsed_ns = now_ns() - start_ns_;
+  absl::MutexLock l(&lock_);
+  events_.emplace_back(event, elapsed_ns);
+}
+
+void StartupTimeline::log() const {
+  std::string text = "Startup timeline:";
+  absl::MutexLock l(&lock_);
+  for (const auto& event : events_) {
+    absl::StrAppendFormat(&text, "\n  %8.1f ms  %s", event.second * 1e-6, event.first);
+  }
+  LOG(INFO) << text;
+}
+
+MetricsExporter::MetricsExporter(
+    const MetricsRegistry* registry, const MetricsExporterOptions& options)
+    : registry_(registry), options_(options) {
+  if (options_.port > 0) {
+    listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    CHECK_GE(listen_fd_, 0) << "Unable to create the metrics socket";
+    const int reuse = 1;
+    setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(options_.port);
+    if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(listen_fd_, /*backlog=*/4) != 0) {
+      LOG(ERROR) << "Unable to serve metrics on port " << options_.port << ": "
+                 << strerror(errno);
+      close(listen_fd_);
+      listen_fd_ = -1;
+    } else {
+      LOG(INFO) << "Serving metrics on http://127.0.0.1:" << options_.port << "/metrics";
+    }
+  }
+  if (listen_fd_ >= 0 || !options_.path.empty()) {
+    thread_ = std::thread(&MetricsExporter::run, this);
+  }
+}
+
+MetricsExporter::~MetricsExporter() {
+  stopped_ = true;
+  if (thread_.joinable()) thread_.join();
+  if (listen_fd_ >= 0) close(listen_fd_);
+  if (!options_.path.empty()) write_file();
+}
+
+void MetricsExporter::run() {
+  const auto interval = std::chrono::seconds(std::max(options_.interval_seconds, 1));
+  auto next_write = std::chrono::steady_clock::now() + interval;
+  while (!stopped_) {
+    if (listen_fd_ >= 0) {
+      pollfd fd{listen_fd_, POLLIN, 0};
+      if (poll(&fd, 1, kPollIntervalMs) > 0 && (fd.revents & POLLIN)) {
+        const int client = accept(listen_fd_, nullptr, nullptr);
+        if (client >= 0) {
+          serve(client);
+          close(client);
+        }
+      }
+    } else {
+      std::this_thread::sleep_for(std::chrono::milliseconds(kPollIntervalMs));
+    }
+    if (!options_.path.empty() && std::chrono::steady_clock::now() >= next_write) {
+      write_file();
+      next_write += interval;
+    }
+  }
+}
+
+void MetricsExporter::serve(int client) const {
+  // A scraper sends its request line first, a slow client only delays the
+  // next scrape.
+  pollfd fd{client, POLLIN, 0};
+  if (poll(&fd, 1, kPollIntervalMs) <= 0) return;
+  char request[kMaxRequestBytes];
+  const ssize_t n = read(client, request, sizeof(request) - 1);
+  if (n <= 0) return;
+  request[n] = '\0';
+  std::string response;
+  if (absl::StartsWith(request, "GET /metrics ") || absl::StartsWith(request, "GET / ")) {
+    std::string body;
+    registry_->write_text(&body);
+    absl::StrAppend(
+        &response,
+        "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: ",
+        body.size(), "\r\n\r\n", body);
+  } else {
+    response = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+  }
+  write_all(client, response);
+}
+
+void MetricsExporter::write_file() const {
+  std::string text;
+  registry_->write_text(&text);
+  // Readers only ever see a complete file.
+  const std::string temp_path = options_.path + ".tmp";
+  FILE* file = fopen(temp_path.c_str(), "w");
+  if (!file) {
+    LOG(ERROR) << "Unable to write metrics to " << temp_path;
+    return;
+  }
+  const bool written = fwrite(text.data(), 1, text.size(), file) == text.size();
+  if (fclose(file) != 0 || !written || rename(temp_path.c_str(), options_.path.c_str()) != 0) {
+    LOG(ERROR) << "Unable to write metrics to " << options_.path;
+  }
+}
+
+}  // namespace coral
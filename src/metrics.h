@@ -0,0 +1,201 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MANUFACTURING_DEMO_METRICS_H_
+#define MANUFACTURING_DEMO_METRICS_H_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+
+namespace coral {
+
+// Monotonic time in nanoseconds, for latencies.
+inline int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// A count that only goes up, such as frames processed. Updates are a single
+// relaxed atomic add.
+class Counter {
+public:
+  void add(uint64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+  uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<uint64_t> value_{0};
+};
+
+// Latencies counted into power of two buckets from 16 us to about 8 s, plus
+// one for anything slower. Recording is two relaxed atomic adds and a bucket
+// found with a bit scan, so it can stay on for every frame.
+class LatencyHistogram {
+public:
+  static constexpr int kBuckets = 20;
+  // Upper bound of the first bucket is 2^kFirstBucketLog2 microseconds.
+  static constexpr int kFirstBucketLog2 = 4;
+
+  void record(int64_t latency_ns) {
+    if (latency_ns < 0) return;
+    const uint64_t us = latency_ns / 1000;
+    // Smallest k with us <= 2^k.
+    const int log2 = us <= 1 ? 0 : 64 - __builtin_clzll(us - 1);
+    const int bucket = std::min(std::max(log2 - kFirstBucketLog2, 0), kBuckets);
+    buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+    sum_ns_.fetch_add(latency_ns, std::memory_order_relaxed);
+  }
+  // Upper bound of `bucket` in seconds.
+  static double get_upper_bound(int bucket) {
+    return static_cast<double>(uint64_t{1} << (bucket + kFirstBucketLog2)) * 1e-6;
+  }
+  // Count of `bucket`, kBuckets being the overflow bucket.
+  uint64_t get_count(int bucket) const {
+    return buckets_[bucket].load(std::memory_order_relaxed);
+  }
+  uint64_t get_sum_ns() const { return sum_ns_.load(std::memory_order_relaxed); }
+
+private:
+  std::array<std::atomic<uint64_t>, kBuckets + 1> buckets_{};
+  std::atomic<uint64_t> sum_ns_{0};
+};
+
+// Records the time from construction to destruction into a histogram, if any.
+class ScopedLatency {
+public:
+  explicit ScopedLatency(LatencyHistogram* histogram)
+      : histogram_(histogram), start_ns_(histogram ? now_ns() : 0) {}
+  ~ScopedLatency() {
+    if (histogram_) histogram_->record(now_ns() - start_ns_);
+  }
+  ScopedLatency(const ScopedLatency&) = delete;
+  ScopedLatency& operator=(const ScopedLatency&) = delete;
+
+private:
+  LatencyHistogram* histogram_;
+  int64_t start_ns_;
+};
+
+// Names every metric and writes them all in the Prometheus text format.
+// Metrics are made once at startup, the registry lock is never taken while
+// recording.
+class MetricsRegistry {
+public:
+  MetricsRegistry() = default;
+  MetricsRegistry(const MetricsRegistry&) = delete;
+  MetricsRegistry& operator=(const MetricsRegistry&) = delete;
+
+  // Returns the counter `name` with `labels`, such as `stream="safety"`,
+  // made on first use. It lives as long as the registry.
+  Counter* get_counter(
+      const std::string& name, const std::string& help, const std::string& labels)
+      LOCKS_EXCLUDED(lock_);
+  // Returns the histogram `name` with `labels`, as get_counter() does.
+  LatencyHistogram* get_histogram(
+      const std::string& name, const std::string& help, const std::string& labels)
+      LOCKS_EXCLUDED(lock_);
+  // Latency of `stage` in `stream`, the histograms every stage reports to.
+  LatencyHistogram* get_stage_latency(const std::string& stream, const std::string& stage);
+  // Appends every metric to `text`.
+  void write_text(std::string* text) const LOCKS_EXCLUDED(lock_);
+
+private:
+  struct Family {
+    std::string help;
+    // Keyed by labels, each family has a single type.
+    std::map<std::string, std::unique_ptr<Counter>> counters;
+    std::map<std::string, std::unique_ptr<LatencyHistogram>> histograms;
+  };
+
+  mutable absl::Mutex lock_;
+  std::map<std::string, Family> families_ GUARDED_BY(lock_);
+};
+
+// Times the steps from the start of main() to the first inference, so the
+// time a restart costs can be tracked. Marks can be made from any thread.
+class StartupTimeline {
+public:
+  StartupTimeline() : start_ns_(now_ns()) {}
+  StartupTimeline(const StartupTimeline&) = delete;
+  StartupTimeline& operator=(const StartupTimeline&) = delete;
+
+  // Records `event` as done now.
+  void mark(const std::string& event) LOCKS_EXCLUDED(lock_);
+  // Marks the first inference and logs the timeline on the first call. Later
+  // calls are a single relaxed load, so every inference can make it.
+  void mark_first_inference() {
+    if (first_inference_.load(std::memory_order_relaxed)) return;
+    if (first_inference_.exchange(true)) return;
+    mark("first inference");
+    log();
+  }
+  // Logs every event so far with its time since the start.
+  void log() const LOCKS_EXCLUDED(lock_);
+
+private:
+  const int64_t start_ns_;
+  std::atomic<bool> first_inference_{false};
+  mutable absl::Mutex lock_;
+  std::vector<std::pair<std::string, int64_t>> events_ GUARDED_BY(lock_);
+};
+
+struct MetricsExporterOptions {
+  // Port of the HTTP endpoint serving /metrics on the loopback interface, 0
+  // for none.
+  int port = 0;
+  // File rewritten with every metric, for the node exporter textfile
+  // collector. Empty for none.
+  std::string path;
+  // Seconds between rewrites of `path`.
+  int interval_seconds = 10;
+};
+
+// Serves and writes the metrics of a registry from a thread of its own, so
+// scraping never blocks the streams.
+class MetricsExporter {
+public:
+  MetricsExporter(const MetricsRegistry* registry, const MetricsExporterOptions& options);
+  // Stops the thread and writes the file a last time.
+  ~MetricsExporter();
+  MetricsExporter(const MetricsExporter&) = delete;
+  MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+private:
+  void run();
+  void serve(int client) const;
+  void write_file() const;
+
+  const MetricsRegistry* registry_;
+  const MetricsExporterOptions options_;
+  int listen_fd_ = -1;
+  std::atomic<bool> stopped_{false};
+  std::thread thread_;
+};
+
+}  // namespace coral
+
+#endif  // MANUFACTURING_DEMO_METRICS_H_
@@ -0,0 +1,85 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "motion_gate.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "glog/logging.h"
+
+namespace coral {
+
+bool MotionGate::should_process(const uint8_t* frame, const ImageDims& dims) {
+  const size_t frame_bytes = static_cast<size_t>(dims[0]) * dims[1] * dims[2];
+  bool process;
+  if (dims != reference_dims_) {
+    // First frame, or the stream changed resolution.
+    reference_dims_ = dims;
+    reference_.resize(frame_bytes);
+    last_score_ = 0;
+    process = true;
+  } else {
+    last_score_ = block_score(frame, dims);
+    process = force_next_ || last_score_ >= options_.threshold ||
+              frames_since_processed_ >= options_.max_skip_frames;
+  }
+  force_next_ = false;
+  if (!process) {
+    frames_since_processed_++;
+    skipped_++;
+    return false;
+  }
+  std::memcpy(reference_.data(), frame, frame_bytes);
+  frames_since_processed_ = 0;
+  processed_++;
+  return true;
+}
+
+double MotionGate::get_skip_ratio() const {
+  const uint64_t skipped = skipped_;
+  const uint64_t total = skipped + processed_;
+  return total > 0 ? static_cast<double>(skipped) / total : 0;
+}
+
+float MotionGate::block_score(const uint8_t* frame, const ImageDims& dims) {
+  const int block = std::max(options_.block_size, 1);
+  const int row_bytes = dims[1] * dims[2];
+  const int block_bytes = block * dims[2];
+  const int blocks_x = (dims[1] + block - 1) / block;
+  const int blocks_y = (dims[0] + block - 1) / block;
+  block_sums_.assign(blocks_x, 0);
+  float max_score = 0;
+  for (int by = 0; by < blocks_y; ++by) {
+    const int y_end = std::min((by + 1) * block, dims[0]);
+    std::fill(block_sums_.begin(), block_sums_.end(), 0);
+    for (int y = by * block; y < y_end; ++y) {
+      const size_t offset = static_cast<size_t>(y) * row_bytes;
+      for (int bx = 0; bx < blocks_x; ++bx) {
+        const int x = bx * block_bytes;
+        block_sums_[bx] += sum_abs_diff(
+            frame + offset + x, reference_.data() + offset + x,
+            std::min(block_bytes, row_bytes - x));
+      }
+    }
+    const int rows = y_end - by * block;
+    for (int bx = 0; bx < blocks_x; ++bx) {
+      const int columns = std::min(block_bytes, row_bytes - bx * block_bytes);
+      max_score = std::max(max_score, static_cast<float>(block_sums_[bx]) / (rows * columns));
+    }
+  }
+  return max_score;
+}
+
+}  // namespace coral
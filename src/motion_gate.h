@@ -0,0 +1,80 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MANUFACTURING_DEMO_MOTION_GATE_H_
+#define MANUFACTURING_DEMO_MOTION_GATE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "image_utils.h"
+
+namespace coral {
+
+struct MotionGateOptions {
+  // Mean absolute difference per channel value, over the most changed block,
+  // above which a frame counts as moving.
+  float threshold = 8.0f;
+  // Most consecutive frames skipped before one is processed anyway, so a
+  // worker standing still is re-verified.
+  int max_skip_frames = 30;
+  // Side in pixels of the square blocks the difference is measured over.
+  int block_size = 16;
+};
+
+// Decides whether a frame differs enough from the last processed one to be
+// worth running inference on. The score is the block SAD (sum of absolute
+// differences) against the frame of the last inference, so slow drift adds
+// up rather than hiding between consecutive frames, and a small moving
+// object isn't averaged away by a static background.
+class MotionGate {
+public:
+  explicit MotionGate(const MotionGateOptions& options) : options_(options) {}
+  MotionGate(const MotionGate&) = delete;
+  MotionGate& operator=(const MotionGate&) = delete;
+
+  // Returns true if inference should run on `frame`, which then becomes the
+  // reference the next frames are compared against. Not thread safe, a gate
+  // serves one stream.
+  bool should_process(const uint8_t* frame, const ImageDims& dims);
+  // Makes the next should_process() return true whatever the motion, such
+  // as once the settings the results depend on changed.
+  void force_next() { force_next_ = true; }
+  // Mean absolute difference of the most changed block of the last frame.
+  float get_last_score() const { return last_score_; }
+  uint64_t get_processed() const { return processed_; }
+  uint64_t get_skipped() const { return skipped_; }
+  // Fraction of the frames skipped so far.
+  double get_skip_ratio() const;
+
+private:
+  float block_score(const uint8_t* frame, const ImageDims& dims);
+
+  const MotionGateOptions options_;
+  ImageDims reference_dims_{0, 0, 0};
+  std::vector<uint8_t> reference_;
+  std::vector<uint32_t> block_sums_;
+  int frames_since_processed_ = 0;
+  bool force_next_ = false;
+  float last_score_ = 0;
+  std::atomic<uint64_t> processed_{0};
+  std::atomic<uint64_t> skipped_{0};
+};
+
+}  // namespace coral
+
+#endif  // MANUFACTURING_DEMO_MOTION_GATE_H_
@@ -0,0 +1,317 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "overlay.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include "absl/strings/substitute.h"
+#include "glog/logging.h"
+
+namespace coral {
+namespace {
+
+constexpr char kSvgBox[] =
+    "<rect x=\"$0\" y=\"$1\" width=\"$2\" height=\"$3\" "
+    "fill-opacity=\"$4\" "
+    "style=\"stroke-width:5;stroke:rgb($5,$6,$7);\"/>";
+constexpr char kSvgTextBegin[] =
+    "<text x=\"$0\" y=\"$1\" font-size=\"large\" fill=\"rgb($2,$3,$4)\">";
+constexpr char kSvgTextEnd[] = "</text>";
+constexpr char kSvgPolygonBegin[] = "<polygon points=\"";
+constexpr char kSvgPolygonEnd[] = "\" style=\"fill:none;stroke:rgb($0,$1,$2);stroke-width:5\" /> ";
+
+// Width in pixels of box and polygon outlines, the same as the SVG strokes.
+constexpr int kStrokeWidth = 5;
+// Glyphs are 5x7 cells, each drawn as kGlyphScale x kGlyphScale pixels.
+constexpr int kGlyphColumns = 5;
+constexpr int kGlyphRows = 7;
+constexpr int kGlyphScale = 2;
+constexpr int kGlyphWidth = kGlyphColumns * kGlyphScale;
+constexpr int kGlyphHeight = kGlyphRows * kGlyphScale;
+// Horizontal distance between the starts of consecutive glyphs.
+constexpr int kGlyphAdvance = kGlyphWidth + kGlyphScale;
+constexpr char kFirstGlyph = ' ';
+constexpr char kLastGlyph = '~';
+
+// Printable ASCII in a 5x7 font, a byte per column from left to right with
+// the top row in the lowest bit.
+constexpr uint8_t kFont[kLastGlyph - kFirstGlyph + 1][kGlyphColumns] = {
+    {0x00, 0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x5F, 0x00, 0x00},  //  !
+    {0x00, 0x07, 0x00, 0x07, 0x00}, {0x14, 0x7F, 0x14, 0x7F, 0x14},  // "#
+    {0x24, 0x2A, 0x7F, 0x2A, 0x12}, {0x23, 0x13, 0x08, 0x64, 0x62},  // $%
+    {0x36, 0x49, 0x55, 0x22, 0x50}, {0x00, 0x05, 0x03, 0x00, 0x00},  // &'
+    {0x00, 0x1C, 0x22, 0x41, 0x00}, {0x00, 0x41, 0x22, 0x1C, 0x00},  // ()
+    {0x14, 0x08, 0x3E, 0x08, 0x14}, {0x08, 0x08, 0x3E, 0x08, 0x08},  // *+
+    {0x00, 0x50, 0x30, 0x00, 0x00}, {0x08, 0x08, 0x08, 0x08, 0x08},  // ,-
+    {0x00, 0x60, 0x60, 0x00, 0x00}, {0x20, 0x10, 0x08, 0x04, 0x02},  // ./
+    {0x3E, 0x51, 0x49, 0x45, 0x3E}, {0x00, 0x42, 0x7F, 0x40, 0x00},  // 01
+    {0x42, 0x61, 0x51, 0x49, 0x46}, {0x21, 0x41, 0x45, 0x4B, 0x31},  // 23
+    {0x18, 0x14, 0x12, 0x7F, 0x10}, {0x27, 0x45, 0x45, 0x45, 0x39},  // 45
+    {0x3C, 0x4A, 0x49, 0x49, 0x30}, {0x01, 0x71, 0x09, 0x05, 0x03},  // 67
+    {0x36, 0x49, 0x49, 0x49, 0x36}, {0x06, 0x49, 0x49, 0x29, 0x1E},  // 89
+    {0x00, 0x36, 0x36, 0x00, 0x00}, {0x00, 0x56, 0x36, 0x00, 0x00},  // :;
+    {0x08, 0x14, 0x22, 0x41, 0x00}, {0x14, 0x14, 0x14, 0x14, 0x14},  // <=
+    {0x00, 0x41, 0x22, 0x14, 0x08}, {0x02, 0x01, 0x51, 0x09, 0x06},  // >?
+    {0x32, 0x49, 0x79, 0x41, 0x3E}, {0x7E, 0x11, 0x11, 0x11, 0x7E},  // @A
+    {0x7F, 0x49, 0x49, 0x49, 0x36}, {0x3E, 0x41, 0x41, 0x41, 0x22},  // BC
+    {0x7F, 0x41, 0x41, 0x22, 0x1C}, {0x7F, 0x49, 0x49, 0x49, 0x41},  // DE
+    {0x7F, 0x09, 0x09, 0x01, 0x01}, {0x3E, 0x41, 0x41, 0x51, 0x32},  // FG
+    {0x7F, 0x08, 0x08, 0x08, 0x7F}, {0x00, 0x41, 0x7F, 0x41, 0x00},  // HI
+    {0x20, 0x40, 0x41, 0x3F, 0x01}, {0x7F, 0x08, 0x14, 0x22, 0x41},  // JK
+    {0x7F, 0x40, 0x40, 0x40, 0x40}, {0x7F, 0x02, 0x04, 0x02, 0x7F},  // LM
+    {0x7F, 0x04, 0x08, 0x10, 0x7F}, {0x3E, 0x41, 0x41, 0x41, 0x3E},  // NO
+    {0x7F, 0x09, 0x09, 0x09, 0x06}, {0x3E, 0x41, 0x51, 0x21, 0x5E},  // PQ
+    {0x7F, 0x09, 0x19, 0x29, 0x46}, {0x46, 0x49, 0x49, 0x49, 0x31},  // RS
+    {0x01, 0x01, 0x7F, 0x01, 0x01}, {0x3F, 0x40, 0x40, 0x40, 0x3F},  // TU
+    {0x1F, 0x20, 0x40, 0x20, 0x1F}, {0x7F, 0x20, 0x18, 0x20, 0x7F},  // VW
+    {0x63, 0x14, 0x08, 0x14, 0x63}, {0x03, 0x04, 0x78, 0x04, 0x03},  // XY
+    {0x61, 0x51, 0x49, 0x45, 0x43}, {0x00, 0x7F, 0x41, 0x41, 0x00},  // Z[
+    {0x02, 0x04, 0x08, 0x10, 0x20}, {0x00, 0x41, 0x41, 0x7F, 0x00},  // \]
+    {0x04, 0x02, 0x01, 0x02, 0x04}, {0x40, 0x40, 0x40, 0x40, 0x40},  // ^_
+    {0x00, 0x01, 0x02, 0x04, 0x00}, {0x20, 0x54, 0x54, 0x54, 0x78},  // `a
+    {0x7F, 0x48, 0x44, 0x44, 0x38}, {0x38, 0x44, 0x44, 0x44, 0x20},  // bc
+    {0x38, 0x44, 0x44, 0x48, 0x7F}, {0x38, 0x54, 0x54, 0x54, 0x18},  // de
+    {0x08, 0x7E, 0x09, 0x01, 0x02}, {0x08, 0x54, 0x54, 0x54, 0x3C},  // fg
+    {0x7F, 0x08, 0x04, 0x04, 0x78}, {0x00, 0x44, 0x7D, 0x40, 0x00},  // hi
+    {0x20, 0x40, 0x44, 0x3D, 0x00}, {0x00, 0x7F, 0x10, 0x28, 0x44},  // jk
+    {0x00, 0x41, 0x7F, 0x40, 0x00}, {0x7C, 0x04, 0x18, 0x04, 0x78},  // lm
+    {0x7C, 0x08, 0x04, 0x04, 0x78}, {0x38, 0x44, 0x44, 0x44, 0x38},  // no
+    {0x7C, 0x14, 0x14, 0x14, 0x08}, {0x08, 0x14, 0x14, 0x18, 0x7C},  // pq
+    {0x7C, 0x08, 0x04, 0x04, 0x08}, {0x48, 0x54, 0x54, 0x54, 0x20},  // rs
+    {0x04, 0x3F, 0x44, 0x40, 0x20}, {0x3C, 0x40, 0x40, 0x20, 0x7C},  // tu
+    {0x1C, 0x20, 0x40, 0x20, 0x1C}, {0x3C, 0x40, 0x30, 0x40, 0x3C},  // vw
+    {0x44, 0x28, 0x10, 0x28, 0x44}, {0x0C, 0x50, 0x50, 0x50, 0x3C},  // xy
+    {0x44, 0x64, 0x54, 0x4C, 0x44}, {0x00, 0x08, 0x36, 0x41, 0x00},  // z{
+    {0x00, 0x00, 0x7F, 0x00, 0x00}, {0x00, 0x41, 0x36, 0x08, 0x00},  // |}
+    {0x08, 0x04, 0x08, 0x10, 0x08},                                  // ~
+};
+
+// Writes `count` pixels of `color` from `pixel` on, which must be 4 byte
+// aligned like the rows of every RGBA frame.
+inline void fill_pixels(uint8_t* pixel, int count, OverlayColor color) {
+  const uint8_t rgba[4] = {color.r, color.g, color.b, 255};
+  uint32_t value;
+  std::memcpy(&value, rgba, sizeof(value));
+  std::fill_n(reinterpret_cast<uint32_t*>(pixel), count, value);
+}
+
+}  // namespace
+
+bool operator==(const OverlayColor& a, const OverlayColor& b) {
+  return a.r == b.r && a.g == b.g && a.b == b.b;
+}
+
+bool operator==(const OverlayBox& a, const OverlayBox& b) {
+  return a.x == b.x && a.y == b.y && a.w == b.w && a.h == b.h && a.color == b.color &&
+         a.filled == b.filled;
+}
+
+bool operator==(const OverlayLabel& a, const OverlayLabel& b) {
+  return a.x == b.x && a.y == b.y && a.color == b.color && a.text == b.text;
+}
+
+bool operator==(const OverlayScene& a, const OverlayScene& b) {
+  return a.get_boxes() == b.get_boxes() && a.get_labels() == b.get_labels();
+}
+
+void append_svg(const OverlayScene& scene, int x_offset, int y_offset, std::string* svg) {
+  for (const auto& box : scene.get_boxes()) {
+    absl::SubstituteAndAppend(
+        svg, kSvgBox, box.x + x_offset, box.y + y_offset, box.w, box.h, box.filled ? 1.0 : 0.0,
+        box.color.r, box.color.g, box.color.b);
+  }
+  for (const auto& label : scene.get_labels()) {
+    absl::SubstituteAndAppend(
+        svg, kSvgTextBegin, label.x + x_offset, label.y + y_offset, label.color.r, label.color.g,
+        label.color.b);
+    absl::StrAppend(svg, label.text, kSvgTextEnd);
+  }
+}
+
+void append_svg(
+    const std::vector<OverlayPolygon>& polygons, int x_offset, int y_offset, std::string* svg) {
+  for (const auto& polygon : polygons) {
+    svg->append(kSvgPolygonBegin);
+    for (const auto& point : polygon.points) {
+      absl::StrAppend(svg, point.x_ + x_offset, ",", point.y_ + y_offset, " ");
+    }
+    absl::SubstituteAndAppend(
+        svg, kSvgPolygonEnd, polygon.color.r, polygon.color.g, polygon.color.b);
+  }
+}
+
+bool parse_overlay_type(const std::string& name, OverlayType* type) {
+  if (name == "svg") {
+    *type = OverlayType::kSvg;
+  } else if (name == "native") {
+    *type = OverlayType::kNative;
+  } else if (name == "none") {
+    *type = OverlayType::kNone;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void get_stream_origin(const OverlayOptions& options, int stream, int* x, int* y) {
+  const int columns = options.columns > 0 ? options.columns : std::max(options.num_streams, 1);
+  *x = stream % columns * options.width;
+  *y = stream / columns * options.height;
+}
+
+NativeOverlay::NativeOverlay(const OverlayOptions& options)
+    : width_(options.width), height_(options.height) {
+  CHECK_GT(width_, 0);
+  CHECK_GT(height_, 0);
+  // Glyphs are scaled up and split into horizontal spans once here rather
+  // than on every label.
+  for (const auto& columns : kFont) {
+    glyph_offsets_.push_back(atlas_.size());
+    for (int y = 0; y < kGlyphHeight; ++y) {
+      for (int x = 0; x < kGlyphColumns;) {
+        if (!((columns[x] >> (y / kGlyphScale)) & 1)) {
+          ++x;
+          continue;
+        }
+        int end = x + 1;
+        while (end < kGlyphColumns && ((columns[end] >> (y / kGlyphScale)) & 1)) ++end;
+        atlas_.push_back({y, x * kGlyphScale, (end - x) * kGlyphScale});
+        x = end;
+      }
+    }
+  }
+  glyph_offsets_.push_back(atlas_.size());
+
+  // Outlines are traced into runs up front, and again only when a background
+  // is replaced.
+  for (int stream = 0; stream < options.num_streams; ++stream) {
+    streams_.emplace_back(new StreamState);
+    if (stream >= static_cast<int>(options.backgrounds.size())) continue;
+    auto& state = *streams_.back();
+    absl::MutexLock l(&state.lock);
+    trace_background(options.backgrounds[stream], &state.background);
+  }
+}
+
+void NativeOverlay::trace_background(
+    const std::vector<OverlayPolygon>& polygons, std::vector<Run>* runs) const {
+  // Pixels hold the index of the last polygon drawn over them, plus one.
+  std::vector<int> owner(static_cast<size_t>(width_) * height_);
+  for (size_t i = 0; i < polygons.size(); ++i) {
+    const auto& points = polygons[i].points;
+    for (size_t j = 0; j < points.size(); ++j) {
+      const Point& a = points[j];
+      const Point& b = points[(j + 1) % points.size()];
+      // Stamps a stroke sized square at every step along the edge.
+      const int steps = std::max({std::abs(b.x_ - a.x_), std::abs(b.y_ - a.y_), 1});
+      for (int step = 0; step <= steps; ++step) {
+        const int cx = a.x_ + (b.x_ - a.x_) * step / steps;
+        const int cy = a.y_ + (b.y_ - a.y_) * step / steps;
+        for (int y = std::max(cy - kStrokeWidth / 2, 0);
+             y <= std::min(cy + kStrokeWidth / 2, height_ - 1); ++y) {
+          for (int x = std::max(cx - kStrokeWidth / 2, 0);
+               x <= std::min(cx + kStrokeWidth / 2, width_ - 1); ++x) {
+            owner[y * width_ + x] = i + 1;
+          }
+        }
+      }
+    }
+  }
+  runs->clear();
+  for (int y = 0; y < height_; ++y) {
+    const int* row = &owner[y * width_];
+    for (int x = 0; x < width_;) {
+      int end = x + 1;
+      while (end < width_ && row[end] == row[x]) ++end;
+      if (row[x]) runs->push_back({x, y, end - x, polygons[row[x] - 1].color});
+      x = end;
+    }
+  }
+}
+
+void NativeOverlay::set_background(int stream, const std::vector<OverlayPolygon>& polygons) {
+  // Outlines are traced into runs before the lock is taken, so the frames
+  // drawn meanwhile only wait for the swap.
+  std::vector<Run> runs;
+  trace_background(polygons, &runs);
+  auto& state = *streams_[stream];
+  absl::MutexLock l(&state.lock);
+  state.background.swap(runs);
+}
+
+void NativeOverlay::set_scene(int stream, const OverlayScene& scene) {
+  auto& state = *streams_[stream];
+  absl::MutexLock l(&state.lock);
+  // Assigning keeps the buffers of the previous scene.
+  state.scene = scene;
+}
+
+void NativeOverlay::draw(int stream, uint8_t* rgba, int stride) {
+  auto& state = *streams_[stream];
+  absl::MutexLock l(&state.lock);
+  for (const auto& run : state.background) {
+    fill_pixels(rgba + run.y * stride + run.x * 4, run.length, run.color);
+  }
+  constexpr int half = kStrokeWidth / 2;
+  for (const auto& box : state.scene.get_boxes()) {
+    const int x = std::lround(box.x);
+    const int y = std::lround(box.y);
+    if (box.filled) fill_rect(x, y, box.w, box.h, {0, 0, 0}, rgba, stride);
+    // Strokes are centered on the edges, like SVG draws them.
+    fill_rect(x - half, y - half, box.w + kStrokeWidth, kStrokeWidth, box.color, rgba, stride);
+    fill_rect(
+        x - half, y + box.h - half, box.w + kStrokeWidth, kStrokeWidth, box.color, rgba, stride);
+    fill_rect(
+        x - half, y + half + 1, kStrokeWidth, box.h - kStrokeWidth, box.color, rgba, stride);
+    fill_rect(
+        x + box.w - half, y + half + 1, kStrokeWidth, box.h - kStrokeWidth, box.color, rgba,
+        stride);
+  }
+  for (const auto& label : state.scene.get_labels()) {
+    draw_text(
+        std::lround(label.x), std::lround(label.y), label.text, label.color, rgba, stride);
+  }
+}
+
+void NativeOverlay::fill_rect(
+    int x, int y, int w, int h, OverlayColor color, uint8_t* rgba, int stride) const {
+  const int x1 = std::max(x, 0);
+  const int y1 = std::max(y, 0);
+  const int x2 = std::min(x + w, width_);
+  const int y2 = std::min(y + h, height_);
+  if (x2 <= x1) return;
+  for (int row = y1; row < y2; ++row) fill_pixels(rgba + row * stride + x1 * 4, x2 - x1, color);
+}
+
+void NativeOverlay::draw_text(
+    int x, int y, const std::string& text, OverlayColor color, uint8_t* rgba, int stride) const {
+  // The baseline is the bottom of the glyph cells.
+  const int top = y - kGlyphHeight;
+  for (char c : text) {
+    if (x >= width_) break;
+    if (c < kFirstGlyph || c > kLastGlyph) c = '?';
+    const int glyph = c - kFirstGlyph;
+    for (int i = glyph_offsets_[glyph]; i < glyph_offsets_[glyph + 1]; ++i) {
+      const auto& span = atlas_[i];
+      fill_rect(x + span.x, top + span.y, span.length, 1, color, rgba, stride);
+    }
+    x += kGlyphAdvance;
+  }
+}
+
+}  // namespace coral
@@ -0,0 +1,217 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MANUFACTURING_DEMO_OVERLAY_H_
+#define MANUFACTURING_DEMO_OVERLAY_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
+#include "keepout_shape.h"
+
+namespace coral {
+
+struct OverlayColor {
+  uint8_t r, g, b;
+};
+bool operator==(const OverlayColor& a, const OverlayColor& b);
+
+constexpr OverlayColor kOverlayRed{255, 0, 0};
+constexpr OverlayColor kOverlayOrange{255, 165, 0};
+constexpr OverlayColor kOverlayGreen{0, 255, 0};
+constexpr OverlayColor kOverlayLightGreen{144, 238, 144};
+
+// A box outline, optionally filled black to hide what is inside.
+struct OverlayBox {
+  float x, y;
+  int w, h;
+  OverlayColor color;
+  bool filled;
+};
+bool operator==(const OverlayBox& a, const OverlayBox& b);
+
+// A line of text whose baseline starts at (x, y).
+struct OverlayLabel {
+  float x, y;
+  OverlayColor color;
+  std::string text;
+};
+bool operator==(const OverlayLabel& a, const OverlayLabel& b);
+
+// A closed polygon outline.
+struct OverlayPolygon {
+  std::vector<Point> points;
+  OverlayColor color;
+};
+
+// What a stream draws over one of its frames, in the coordinates of the
+// stream. Labels are drawn on top of every box. Clearing keeps every buffer,
+// label strings included, so building a scene each frame doesn't allocate in
+// the steady state.
+class OverlayScene {
+public:
+  void clear() {
+    boxes_.clear();
+    label_count_ = 0;
+  }
+  void add_box(float x, float y, int w, int h, OverlayColor color, bool filled) {
+    boxes_.push_back({x, y, w, h, color, filled});
+  }
+  // The label text is the concatenation of `text`.
+  template <typename... Text>
+  void add_label(float x, float y, OverlayColor color, const Text&... text) {
+    if (label_count_ == labels_.size()) labels_.emplace_back();
+    OverlayLabel& label = labels_[label_count_++];
+    label.x = x;
+    label.y = y;
+    label.color = color;
+    label.text.clear();
+    absl::StrAppend(&label.text, text...);
+  }
+  const std::vector<OverlayBox>& get_boxes() const { return boxes_; }
+  absl::Span<const OverlayLabel> get_labels() const { return {labels_.data(), label_count_}; }
+
+private:
+  std::vector<OverlayBox> boxes_;
+  // Only the first label_count_ labels are in use.
+  std::vector<OverlayLabel> labels_;
+  size_t label_count_ = 0;
+};
+bool operator==(const OverlayScene& a, const OverlayScene& b);
+inline bool operator!=(const OverlayScene& a, const OverlayScene& b) { return !(a == b); }
+
+// Appends the SVG markup of `scene`, shifted by (`x_offset`, `y_offset`).
+void append_svg(const OverlayScene& scene, int x_offset, int y_offset, std::string* svg);
+// Appends the SVG markup of `polygons`, shifted by (`x_offset`, `y_offset`).
+void append_svg(
+    const std::vector<OverlayPolygon>& polygons, int x_offset, int y_offset, std::string* svg);
+
+// How the results are drawn over the video.
+enum class OverlayType {
+  // SVG markup rendered by rsvgoverlay after the streams are mixed.
+  kSvg,
+  // Drawn straight into the frames of each stream before mixing.
+  kNative,
+  // Not drawn at all, such as when nothing is displayed.
+  kNone,
+};
+
+// Parses "svg", "native" or "none" into `type`. Returns false on an unknown name.
+bool parse_overlay_type(const std::string& name, OverlayType* type);
+
+struct OverlayOptions {
+  OverlayType type = OverlayType::kSvg;
+  // Number of streams drawing over the video.
+  int num_streams = 0;
+  // Size of the frames of every stream on the display.
+  int width = 0;
+  int height = 0;
+  // Streams are tiled `columns` to a row in stream order, see
+  // get_stream_origin(). 0 puts them all side by side.
+  int columns = 0;
+  // Polygons drawn under the results of each stream, indexed by stream,
+  // such as the keepout zones, until Overlay::set_background() replaces them.
+  // Streams past the end have none.
+  std::vector<std::vector<OverlayPolygon>> backgrounds;
+  // SVG only. Most overlay updates per second, 0 for no limit. A change
+  // arriving sooner is held back until the interval has passed.
+  int max_updates_per_second = 0;
+  // SVG only. Seconds between logs of the updates saved, 0 disables them.
+  int report_interval_seconds = 10;
+};
+
+// Top left corner of `stream` on the display.
+void get_stream_origin(const OverlayOptions& options, int stream, int* x, int* y);
+
+// Where the streams send the scene to draw over their video.
+class Overlay {
+public:
+  virtual ~Overlay() = default;
+  // Replaces what `stream` draws, until its next scene. Thread safe.
+  virtual void set_scene(int stream, const OverlayScene& scene) = 0;
+  // Replaces the polygons drawn under every scene of `stream`, such as its
+  // keepout zones after they were reloaded. Thread safe, but far slower than
+  // set_scene(), so only called on a change.
+  virtual void set_background(int stream, const std::vector<OverlayPolygon>& polygons) {}
+};
+
+// Drops every scene.
+class NullOverlay : public Overlay {
+public:
+  void set_scene(int stream, const OverlayScene& scene) override {}
+};
+
+// Draws scenes straight into RGBA frames, without going through SVG. Text
+// is stamped from a glyph atlas rasterized once, the backgrounds are turned
+// into pixel runs whenever they are set. Each stream has a lock of its own,
+// taken while its scene is replaced or drawn, so streams never wait on one
+// another.
+class NativeOverlay : public Overlay {
+public:
+  explicit NativeOverlay(const OverlayOptions& options);
+  NativeOverlay(const NativeOverlay&) = delete;
+  NativeOverlay& operator=(const NativeOverlay&) = delete;
+
+  void set_scene(int stream, const OverlayScene& scene) override;
+  void set_background(int stream, const std::vector<OverlayPolygon>& polygons) override;
+  // Draws the background and the current scene of `stream` into a frame of
+  // the configured size, `stride` bytes apart from row to row.
+  void draw(int stream, uint8_t* rgba, int stride);
+  int get_width() const { return width_; }
+  int get_height() const { return height_; }
+
+private:
+  // `length` pixels of one color from (x, y) rightwards.
+  struct Run {
+    int x, y;
+    int length;
+    OverlayColor color;
+  };
+  // Inked pixels of one glyph row, from (x, y) of the glyph cell rightwards.
+  struct GlyphSpan {
+    int y, x;
+    int length;
+  };
+  struct StreamState {
+    absl::Mutex lock;
+    OverlayScene scene GUARDED_BY(lock);
+    std::vector<Run> background GUARDED_BY(lock);
+  };
+
+  // Traces the outlines of `polygons` into `runs`.
+  void trace_background(const std::vector<OverlayPolygon>& polygons, std::vector<Run>* runs) const;
+
+  void fill_rect(int x, int y, int w, int h, OverlayColor color, uint8_t* rgba, int stride) const;
+  void draw_text(
+      int x, int y, const std::string& text, OverlayColor color, uint8_t* rgba, int stride) const;
+
+  const int width_;
+  const int height_;
+  std::vector<std::unique_ptr<StreamState>> streams_;
+  // Spans of every glyph back to back, glyph g owning
+  // [glyph_offsets_[g], glyph_offsets_[g + 1]).
+  std::vector<GlyphSpan> atlas_;
+  std::vector<int> glyph_offsets_;
+};
+
+}  // namespace coral
+
+#endif  // MANUFACTURING_DEMO_OVERLAY_H_
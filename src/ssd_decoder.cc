@@ -0,0 +1,354 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ssd_decoder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+#include "glog/logging.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace coral {
+
+namespace {
+
+// Arrays of kept boxes: ymin, xmin, ymax, xmax and area.
+constexpr int kKeptArrays = 5;
+// Highest class id parse_class_thresholds() accepts.
+constexpr int kMaxThresholdId = 1 << 16;
+
+// Largest of the `n` values at `row`.
+int row_max(const uint8_t* row, int n) {
+  int i = 0;
+  int best = 0;
+#if defined(__SSE2__)
+  if (n >= 16) {
+    __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row));
+    for (i = 16; i + 16 <= n; i += 16) {
+      m = _mm_max_epu8(m, _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i)));
+    }
+    m = _mm_max_epu8(m, _mm_srli_si128(m, 8));
+    m = _mm_max_epu8(m, _mm_srli_si128(m, 4));
+    m = _mm_max_epu8(m, _mm_srli_si128(m, 2));
+    m = _mm_max_epu8(m, _mm_srli_si128(m, 1));
+    best = _mm_cvtsi128_si32(m) & 0xff;
+  }
+#elif defined(__aarch64__)
+  if (n >= 16) {
+    uint8x16_t m = vld1q_u8(row);
+    for (i = 16; i + 16 <= n; i += 16) m = vmaxq_u8(m, vld1q_u8(row + i));
+    best = vmaxvq_u8(m);
+  }
+#endif
+  for (; i < n; ++i) best = std::max<int>(best, row[i]);
+  return best;
+}
+
+float row_max(const float* row, int n) {
+  int i = 0;
+  float best = -std::numeric_limits<float>::infinity();
+#if defined(__SSE2__)
+  if (n >= 4) {
+    __m128 m = _mm_loadu_ps(row);
+    for (i = 4; i + 4 <= n; i += 4) m = _mm_max_ps(m, _mm_loadu_ps(row + i));
+    m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+    m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+    best = _mm_cvtss_f32(m);
+  }
+#elif defined(__aarch64__)
+  if (n >= 4) {
+    float32x4_t m = vld1q_f32(row);
+    for (i = 4; i + 4 <= n; i += 4) m = vmaxq_f32(m, vld1q_f32(row + i));
+    best = vmaxvq_f32(m);
+  }
+#endif
+  for (; i < n; ++i) best = std::max(best, row[i]);
+  return best;
+}
+
+float dequantize(uint8_t value, const RawTensor& tensor) {
+  return tensor.scale * (static_cast<int>(value) - tensor.zero_point);
+}
+
+float dequantize(float value, const RawTensor& tensor) { return value; }
+
+// Lowest raw score that can reach `threshold` once converted. Logits get a
+// little slack as the exact test runs after the sigmoid.
+float to_raw_domain(float threshold, bool logit) {
+  if (!logit) return threshold;
+  if (threshold <= 0.0f) return -std::numeric_limits<float>::infinity();
+  if (threshold >= 1.0f) return std::numeric_limits<float>::infinity();
+  return std::log(threshold / (1.0f - threshold)) - 1e-4f;
+}
+
+float raw_bound(float threshold, const RawTensor& tensor, bool logit, const float*) {
+  return to_raw_domain(threshold, logit);
+}
+
+// Smallest quantized value reaching `threshold`, 256 if there is none.
+int raw_bound(float threshold, const RawTensor& tensor, bool logit, const uint8_t*) {
+  const float bound = to_raw_domain(threshold, logit);
+  int q = 0;
+  while (q < 256 && dequantize(static_cast<uint8_t>(q), tensor) < bound) ++q;
+  return q;
+}
+
+// Whether the box at `y0, x0, y1, x1` with `area` overlaps any of the `count`
+// boxes in `kept` by more than `threshold`, computed as the TFLite op does.
+bool overlaps_kept(
+    const float* kept, int stride, int count, float y0, float x0, float y1, float x1, float area,
+    float threshold) {
+  const float* kept_y0 = kept;
+  const float* kept_x0 = kept + stride;
+  const float* kept_y1 = kept + 2 * stride;
+  const float* kept_x1 = kept + 3 * stride;
+  const float* kept_area = kept + 4 * stride;
+  int i = 0;
+#if defined(__SSE2__)
+  const __m128 cy0 = _mm_set1_ps(y0), cx0 = _mm_set1_ps(x0);
+  const __m128 cy1 = _mm_set1_ps(y1), cx1 = _mm_set1_ps(x1);
+  const __m128 carea = _mm_set1_ps(area), limit = _mm_set1_ps(threshold);
+  const __m128 zero = _mm_setzero_ps();
+  // Arrays are padded with empty boxes, which never overlap.
+  for (; i < count; i += 4) {
+    const __m128 h = _mm_max_ps(
+        _mm_sub_ps(
+            _mm_min_ps(_mm_loadu_ps(kept_y1 + i), cy1), _mm_max_ps(_mm_loadu_ps(kept_y0 + i), cy0)),
+        zero);
+    const __m128 w = _mm_max_ps(
+        _mm_sub_ps(
+            _mm_min_ps(_mm_loadu_ps(kept_x1 + i), cx1), _mm_max_ps(_mm_loadu_ps(kept_x0 + i), cx0)),
+        zero);
+    const __m128 intersection = _mm_mul_ps(h, w);
+    const __m128 areas = _mm_loadu_ps(kept_area + i);
+    const __m128 iou =
+        _mm_div_ps(intersection, _mm_sub_ps(_mm_add_ps(areas, carea), intersection));
+    if (_mm_movemask_ps(_mm_and_ps(_mm_cmpgt_ps(iou, limit), _mm_cmpgt_ps(areas, zero)))) {
+      return true;
+    }
+  }
+  return false;
+#elif defined(__aarch64__)
+  const float32x4_t cy0 = vdupq_n_f32(y0), cx0 = vdupq_n_f32(x0);
+  const float32x4_t cy1 = vdupq_n_f32(y1), cx1 = vdupq_n_f32(x1);
+  const float32x4_t carea = vdupq_n_f32(area), limit = vdupq_n_f32(threshold);
+  const float32x4_t zero = vdupq_n_f32(0.0f);
+  for (; i < count; i += 4) {
+    const float32x4_t h = vmaxq_f32(
+        vsubq_f32(vminq_f32(vld1q_f32(kept_y1 + i), cy1), vmaxq_f32(vld1q_f32(kept_y0 + i), cy0)),
+        zero);
+    const float32x4_t w = vmaxq_f32(
+        vsubq_f32(vminq_f32(vld1q_f32(kept_x1 + i), cx1), vmaxq_f32(vld1q_f32(kept_x0 + i), cx0)),
+        zero);
+    const float32x4_t intersection = vmulq_f32(h, w);
+    const float32x4_t areas = vld1q_f32(kept_area + i);
+    const float32x4_t iou =
+        vdivq_f32(intersection, vsubq_f32(vaddq_f32(areas, carea), intersection));
+    if (vmaxvq_u32(vandq_u32(vcgtq_f32(iou, limit), vcgtq_f32(areas, zero)))) return true;
+  }
+  return false;
+#else
+  for (; i < count; ++i) {
+    if (kept_area[i] <= 0.0f) continue;
+    const float h = std::max(std::min(kept_y1[i], y1) - std::max(kept_y0[i], y0), 0.0f);
+    const float w = std::max(std::min(kept_x1[i], x1) - std::max(kept_x0[i], x0), 0.0f);
+    const float intersection = h * w;
+    if (intersection / (kept_area[i] + area - intersection) > threshold) return true;
+  }
+  return false;
+#endif
+}
+
+}  // namespace
+
+bool parse_detection_postprocess(const std::string& name, DetectionPostprocess* type) {
+  if (name == "builtin") {
+    *type = DetectionPostprocess::kBuiltin;
+  } else if (name == "cpp") {
+    *type = DetectionPostprocess::kCpp;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool load_anchors(const std::string& path, std::vector<Anchor>* anchors) {
+  std::ifstream file(path);
+  if (!file) {
+    LOG(ERROR) << "Unable to open anchors " << path;
+    return false;
+  }
+  anchors->clear();
+  std::string line;
+  for (int line_number = 1; std::getline(file, line); ++line_number) {
+    std::vector<absl::string_view> values =
+        absl::StrSplit(line, absl::ByAnyChar(" ,\t"), absl::SkipEmpty());
+    if (values.empty() || values[0][0] == '#') continue;
+    Anchor anchor;
+    if (values.size() != 4 || !absl::SimpleAtof(values[0], &anchor.y) ||
+        !absl::SimpleAtof(values[1], &anchor.x) || !absl::SimpleAtof(values[2], &anchor.h) ||
+        !absl::SimpleAtof(values[3], &anchor.w)) {
+      LOG(ERROR) << path << ":" << line_number << ": expected ycenter xcenter height width";
+      return false;
+    }
+    anchors->push_back(anchor);
+  }
+  return true;
+}
+
+bool parse_class_thresholds(const std::string& spec, std::vector<float>* thresholds) {
+  thresholds->clear();
+  for (absl::string_view entry : absl::StrSplit(spec, ',', absl::SkipWhitespace())) {
+    std::vector<absl::string_view> fields = absl::StrSplit(entry, ':');
+    int id;
+    float threshold;
+    if (fields.size() != 2 || !absl::SimpleAtoi(fields[0], &id) ||
+        !absl::SimpleAtof(fields[1], &threshold) || id < 0 || id >= kMaxThresholdId) {
+      LOG(ERROR) << "Malformed class threshold '" << entry << "', expected <id>:<threshold>";
+      return false;
+    }
+    if (id >= static_cast<int>(thresholds->size())) thresholds->resize(id + 1, 0.0f);
+    (*thresholds)[id] = threshold;
+  }
+  return true;
+}
+
+SsdDecoder::SsdDecoder(
+    std::vector<Anchor> anchors, int num_classes, const SsdDecoderOptions& options)
+    : anchors_(std::move(anchors)),
+      num_classes_(num_classes),
+      options_(options),
+      kept_stride_((options.max_detections + 3) / 4 * 4) {
+  CHECK(!anchors_.empty()) << "An SSD decoder needs anchors";
+  CHECK_GT(num_classes_, 0);
+  CHECK_GE(options_.label_offset, 0);
+  CHECK_GT(options_.max_detections, 0);
+  kept_.reset(new float[kKeptArrays * kept_stride_]());
+}
+
+void SsdDecoder::decode(
+    const RawTensor& boxes, const RawTensor& scores, float min_score,
+    SsdDetections* detections) {
+  candidates_.clear();
+  if (scores.quantized) {
+    find_candidates(static_cast<const uint8_t*>(scores.data), scores, min_score);
+  } else {
+    find_candidates(static_cast<const float*>(scores.data), scores, min_score);
+  }
+  suppress(boxes, detections);
+}
+
+template <typename T>
+void SsdDecoder::find_candidates(const T* scores, const RawTensor& tensor, float min_score) {
+  const int stride = options_.label_offset + num_classes_;
+  const float threshold = std::max(options_.score_threshold, min_score);
+  // Every class threshold is at least `threshold`, so an anchor whose top
+  // score misses it has nothing to offer.
+  const auto bound = raw_bound(threshold, tensor, options_.logit_scores, scores);
+  const int num_anchors = anchors_.size();
+  for (int anchor = 0; anchor < num_anchors; ++anchor) {
+    const T* row = scores + anchor * stride + options_.label_offset;
+    if (row_max(row, num_classes_) < bound) continue;
+    // The first of equal scores wins, as in the TFLite op.
+    int id = 0;
+    for (int c = 1; c < num_classes_; ++c) {
+      if (row[c] > row[id]) id = c;
+    }
+    float score = dequantize(row[id], tensor);
+    if (options_.logit_scores) score = 1.0f / (1.0f + std::exp(-score));
+    float class_threshold = threshold;
+    if (id < static_cast<int>(options_.class_thresholds.size())) {
+      class_threshold = std::max(class_threshold, options_.class_thresholds[id]);
+    }
+    if (score < class_threshold) continue;
+    candidates_.push_back({score, anchor, id});
+  }
+}
+
+void SsdDecoder::suppress(const RawTensor& boxes, SsdDetections* detections) {
+  detections->boxes.clear();
+  detections->ids.clear();
+  detections->scores.clear();
+  detections->count = 0;
+  float* kept = kept_.get();
+  // Unused slots are empty boxes, which the IoU test skips.
+  std::fill(kept + 4 * kept_stride_, kept + 5 * kept_stride_, 0.0f);
+
+  // A max heap on score, ties going to the lower anchor like the stable sort
+  // of the TFLite op. Building it is linear and only the candidates the NMS
+  // looks at are ever popped.
+  const auto worse = [](const Candidate& a, const Candidate& b) {
+    return a.score < b.score || (a.score == b.score && a.anchor > b.anchor);
+  };
+  std::make_heap(candidates_.begin(), candidates_.end(), worse);
+  auto heap_end = candidates_.end();
+  int count = 0;
+  while (heap_end != candidates_.begin() && count < options_.max_detections) {
+    std::pop_heap(candidates_.begin(), heap_end, worse);
+    --heap_end;
+    const Candidate& candidate = *heap_end;
+
+    // Decoded in the precision of the TFLite op so the boxes come out equal.
+    const Anchor& anchor = anchors_[candidate.anchor];
+    float encoding[4];
+    if (boxes.quantized) {
+      const uint8_t* row = static_cast<const uint8_t*>(boxes.data) + 4 * candidate.anchor;
+      for (int i = 0; i < 4; ++i) encoding[i] = dequantize(row[i], boxes);
+    } else {
+      std::memcpy(
+          encoding, static_cast<const float*>(boxes.data) + 4 * candidate.anchor,
+          sizeof(encoding));
+    }
+    const float y_center = static_cast<float>(
+        static_cast<double>(encoding[0]) / options_.y_scale * anchor.h + anchor.y);
+    const float x_center = static_cast<float>(
+        static_cast<double>(encoding[1]) / options_.x_scale * anchor.w + anchor.x);
+    const float half_h = static_cast<float>(
+        0.5 * std::exp(static_cast<double>(encoding[2]) / options_.h_scale) * anchor.h);
+    const float half_w = static_cast<float>(
+        0.5 * std::exp(static_cast<double>(encoding[3]) / options_.w_scale) * anchor.w);
+    const float y0 = y_center - half_h, x0 = x_center - half_w;
+    const float y1 = y_center + half_h, x1 = x_center + half_w;
+    const float area = (y1 - y0) * (x1 - x0);
+
+    // Degenerate boxes have no overlap with anything and are always kept.
+    if (area > 0.0f &&
+        overlaps_kept(kept, kept_stride_, count, y0, x0, y1, x1, area, options_.iou_threshold)) {
+      continue;
+    }
+    kept[count] = y0;
+    kept[kept_stride_ + count] = x0;
+    kept[2 * kept_stride_ + count] = y1;
+    kept[3 * kept_stride_ + count] = x1;
+    kept[4 * kept_stride_ + count] = area;
+    ++count;
+    detections->boxes.insert(detections->boxes.end(), {y0, x0, y1, x1});
+    detections->ids.push_back(candidate.id);
+    detections->scores.push_back(candidate.score);
+  }
+  detections->count = count;
+}
+
+}  // namespace coral
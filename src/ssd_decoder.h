@@ -0,0 +1,150 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MANUFACTURING_DEMO_SSD_DECODER_H_
+#define MANUFACTURING_DEMO_SSD_DECODER_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace coral {
+
+// Where the detections of an SSD model are read from.
+enum class DetectionPostprocess {
+  // The outputs of the TFLite SSD postprocess op ending the model.
+  kBuiltin,
+  // An SsdDecoder over the raw box encodings and class scores.
+  kCpp,
+};
+
+// Parses "builtin" or "cpp" into `type`. Returns false on an unknown name.
+bool parse_detection_postprocess(const std::string& name, DetectionPostprocess* type);
+
+// Custom op name of the TFLite SSD postprocess op.
+constexpr char kSsdPostprocessOp[] = "TFLite_Detection_PostProcess";
+
+// An anchor box in center-size form, relative to the model input.
+struct Anchor {
+  float y, x, h, w;
+};
+
+// Reads anchors from a text file of "ycenter xcenter height width" lines,
+// spaces or commas between the values. Returns false if it can't be read or
+// a line is malformed.
+bool load_anchors(const std::string& path, std::vector<Anchor>* anchors);
+
+// Parses "<id>:<threshold>,..." into per-class thresholds indexed by class
+// id, 0 for classes not listed. Returns false on a malformed entry.
+bool parse_class_thresholds(const std::string& spec, std::vector<float>* thresholds);
+
+// Decoding parameters, the defaults being those of the TF object detection
+// API export with the postprocess op.
+struct SsdDecoderOptions {
+  // The box encodings are offsets divided by these scales.
+  float y_scale = 10.0f;
+  float x_scale = 10.0f;
+  float h_scale = 5.0f;
+  float w_scale = 5.0f;
+  // Candidates overlapping an already kept box by more than this are dropped.
+  float iou_threshold = 0.6f;
+  // Candidates scoring less than this never reach the NMS.
+  float score_threshold = 1e-8f;
+  int max_detections = 10;
+  // Columns of the class scores before the first class, usually a single
+  // background column.
+  int label_offset = 1;
+  // The scores are logits, a sigmoid turns them into probabilities.
+  bool logit_scores = false;
+  // Minimum score of each class id on top of the score threshold, for classes
+  // that need more confidence than others. Boxes below the threshold of their
+  // class are dropped before the NMS, so unlike boxes below the global
+  // threshold they no longer suppress overlapping boxes of other classes.
+  std::vector<float> class_thresholds;
+};
+
+// A view over a raw output tensor, float or uint8 quantized as
+// scale * (value - zero_point).
+struct RawTensor {
+  const void* data = nullptr;
+  bool quantized = false;
+  float scale = 1.0f;
+  int zero_point = 0;
+};
+
+// Detections in the layout of the TFLite SSD postprocess op outputs: boxes
+// as ymin, xmin, ymax, xmax, by decreasing score.
+struct SsdDetections {
+  std::vector<float> boxes;
+  std::vector<float> ids;
+  std::vector<float> scores;
+  int count = 0;
+};
+
+// Turns the raw box encodings and class scores of an SSD model into
+// detections, the way the TFLite SSD postprocess op does with
+// use_regular_nms off and one class per detection: each anchor takes its top
+// class and the NMS runs over every class at once.
+//
+// Anchors whose top score misses the threshold are rejected with a SIMD max
+// over their scores, compared in the quantized or logit domain so nothing is
+// converted. Only the survivors are decoded, and they are served best first
+// from a heap, so no sort runs and the NMS stops after max_detections boxes.
+// The IoU of a candidate against every kept box is computed four at a time.
+class SsdDecoder {
+public:
+  SsdDecoder(std::vector<Anchor> anchors, int num_classes, const SsdDecoderOptions& options);
+  SsdDecoder(const SsdDecoder&) = delete;
+  SsdDecoder& operator=(const SsdDecoder&) = delete;
+
+  // Decodes `boxes`, [anchors, 4] as y, x, h, w encodings, and `scores`,
+  // [anchors, label_offset + classes], into `detections`. Detections scoring
+  // less than `min_score` are left out, which gives the same detections as
+  // filtering them afterwards unless class thresholds are set.
+  void decode(
+      const RawTensor& boxes, const RawTensor& scores, float min_score,
+      SsdDetections* detections);
+
+  int get_num_anchors() const { return anchors_.size(); }
+  int get_num_classes() const { return num_classes_; }
+  const SsdDecoderOptions& get_options() const { return options_; }
+
+private:
+  struct Candidate {
+    float score;
+    int anchor;
+    int id;
+  };
+
+  // Appends every anchor whose top class passes its threshold to candidates_.
+  template <typename T>
+  void find_candidates(const T* scores, const RawTensor& tensor, float min_score);
+  // Keeps the best candidates not overlapping a better one.
+  void suppress(const RawTensor& boxes, SsdDetections* detections);
+
+  const std::vector<Anchor> anchors_;
+  const int num_classes_;
+  const SsdDecoderOptions options_;
+  std::vector<Candidate> candidates_;
+  // Kept boxes, one array per coordinate padded to a multiple of four.
+  std::unique_ptr<float[]> kept_;
+  int kept_stride_;
+};
+
+}  // namespace coral
+
+#endif  // MANUFACTURING_DEMO_SSD_DECODER_H_
@@ -0,0 +1,298 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ssd_decoder.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "flatbuffers/flexbuffers.h"
+#include "gtest/gtest.h"
+#include "inference_wrapper.h"
+#include "tensorflow/lite/interpreter.h"
+#include "tensorflow/lite/kernels/register.h"
+
+namespace coral {
+namespace {
+
+// Raw SSD outputs of `anchors` anchors, float or uint8 quantized, as the
+// model would hand them to the postprocess op.
+struct RawOutputs {
+  std::vector<float> float_boxes, float_scores;
+  std::vector<uint8_t> quantized_boxes, quantized_scores;
+  RawTensor boxes, scores;
+};
+
+// Anchors bunched around a few centers, so many of their boxes overlap and
+// the NMS has work to do.
+std::vector<Anchor> random_anchors(int count, std::mt19937* rng) {
+  std::uniform_int_distribution<int> center(1, 4);
+  std::uniform_real_distribution<float> jitter(-0.05f, 0.05f);
+  std::uniform_real_distribution<float> size(0.05f, 0.5f);
+  std::vector<Anchor> anchors(count);
+  for (auto& anchor : anchors) {
+    anchor = {center(*rng) / 5.0f + jitter(*rng), center(*rng) / 5.0f + jitter(*rng), size(*rng),
+              size(*rng)};
+  }
+  return anchors;
+}
+
+// Float outputs, random enough that no two scores are equal.
+RawOutputs random_float_outputs(int anchors, int stride, std::mt19937* rng) {
+  std::uniform_real_distribution<float> encoding(-2.0f, 2.0f);
+  std::uniform_real_distribution<float> score(0.0f, 1.0f);
+  RawOutputs outputs;
+  outputs.float_boxes.resize(4 * anchors);
+  for (auto& value : outputs.float_boxes) value = encoding(*rng);
+  outputs.float_scores.resize(stride * anchors);
+  for (auto& value : outputs.float_scores) value = score(*rng);
+  outputs.boxes.data = outputs.float_boxes.data();
+  outputs.scores.data = outputs.float_scores.data();
+  return outputs;
+}
+
+// Quantized outputs. The top scores of the anchors are all different and
+// above the other classes of their anchor, the order of equal scores being
+// up to the sort the op was built with. Takes at most 200 anchors.
+RawOutputs random_quantized_outputs(int anchors, int stride, std::mt19937* rng) {
+  std::uniform_int_distribution<int> value(0, 255);
+  RawOutputs outputs;
+  outputs.quantized_boxes.resize(4 * anchors);
+  for (auto& box : outputs.quantized_boxes) box = value(*rng);
+  std::vector<int> tops(anchors);
+  std::iota(tops.begin(), tops.end(), 256 - anchors);
+  std::shuffle(tops.begin(), tops.end(), *rng);
+  std::uniform_int_distribution<int> top_class(1, stride - 1);
+  outputs.quantized_scores.resize(stride * anchors);
+  for (int i = 0; i < anchors; ++i) {
+    uint8_t* row = outputs.quantized_scores.data() + i * stride;
+    std::uniform_int_distribution<int> below_top(0, tops[i] - 1);
+    for (int c = 0; c < stride; ++c) row[c] = below_top(*rng);
+    row[top_class(*rng)] = tops[i];
+  }
+  outputs.boxes = {outputs.quantized_boxes.data(), true, 0.05f, 128};
+  outputs.scores = {outputs.quantized_scores.data(), true, 1.0f / 255, 0};
+  return outputs;
+}
+
+// Runs the TFLite SSD postprocess op alone over `outputs`.
+SsdDetections run_postprocess_op(
+    const std::vector<Anchor>& anchors, int num_classes, const SsdDecoderOptions& options,
+    const RawOutputs& outputs) {
+  const int n = anchors.size();
+  const int stride = options.label_offset + num_classes;
+  std::unique_ptr<tflite::Interpreter> interpreter(new tflite::Interpreter);
+  int base_index = 0;
+  interpreter->AddTensors(7, &base_index);
+  interpreter->SetInputs({0, 1, 2});
+  interpreter->SetOutputs({3, 4, 5, 6});
+  const bool quantized = outputs.scores.quantized;
+  const TfLiteType type = quantized ? kTfLiteUInt8 : kTfLiteFloat32;
+  interpreter->SetTensorParametersReadWrite(
+      0, type, "box_encodings", {1, n, 4}, {outputs.boxes.scale, outputs.boxes.zero_point});
+  interpreter->SetTensorParametersReadWrite(
+      1, type, "class_predictions", {1, n, stride},
+      {outputs.scores.scale, outputs.scores.zero_point});
+  interpreter->SetTensorParametersReadWrite(2, kTfLiteFloat32, "anchors", {n, 4}, {});
+  const int max = options.max_detections;
+  interpreter->SetTensorParametersReadWrite(3, kTfLiteFloat32, "boxes", {1, max, 4}, {});
+  interpreter->SetTensorParametersReadWrite(4, kTfLiteFloat32, "classes", {1, max}, {});
+  interpreter->SetTensorParametersReadWrite(5, kTfLiteFloat32, "scores", {1, max}, {});
+  interpreter->SetTensorParametersReadWrite(6, kTfLiteFloat32, "count", {1}, {});
+
+  flexbuffers::Builder fbb;
+  fbb.Map([&] {
+    fbb.Int("max_detections", max);
+    fbb.Int("max_classes_per_detection", 1);
+    fbb.Bool("use_regular_nms", false);
+    fbb.Float("nms_score_threshold", options.score_threshold);
+    fbb.Float("nms_iou_threshold", options.iou_threshold);
+    fbb.Int("num_classes", num_classes);
+    fbb.Float("y_scale", options.y_scale);
+    fbb.Float("x_scale", options.x_scale);
+    fbb.Float("h_scale", options.h_scale);
+    fbb.Float("w_scale", options.w_scale);
+  });
+  fbb.Finish();
+  const std::vector<uint8_t>& op_options = fbb.GetBuffer();
+  tflite::ops::builtin::BuiltinOpResolver resolver;
+  const TfLiteRegistration* op = resolver.FindOp(kSsdPostprocessOp, 1);
+  EXPECT_NE(op, nullptr);
+  interpreter->AddNodeWithParameters(
+      {0, 1, 2}, {3, 4, 5, 6}, reinterpret_cast<const char*>(op_options.data()),
+      op_options.size(), nullptr, op, nullptr);
+  EXPECT_EQ(interpreter->AllocateTensors(), kTfLiteOk);
+
+  if (quantized) {
+    std::copy(
+        outputs.quantized_boxes.begin(), outputs.quantized_boxes.end(),
+        interpreter->typed_tensor<uint8_t>(0));
+    std::copy(
+        outputs.quantized_scores.begin(), outputs.quantized_scores.end(),
+        interpreter->typed_tensor<uint8_t>(1));
+  } else {
+    std::copy(
+        outputs.float_boxes.begin(), outputs.float_boxes.end(),
+        interpreter->typed_tensor<float>(0));
+    std::copy(
+        outputs.float_scores.begin(), outputs.float_scores.end(),
+        interpreter->typed_tensor<float>(1));
+  }
+  float* op_anchors = interpreter->typed_tensor<float>(2);
+  for (int i = 0; i < n; ++i) {
+    op_anchors[4 * i] = anchors[i].y;
+    op_anchors[4 * i + 1] = anchors[i].x;
+    op_anchors[4 * i + 2] = anchors[i].h;
+    op_anchors[4 * i + 3] = anchors[i].w;
+  }
+  EXPECT_EQ(interpreter->Invoke(), kTfLiteOk);
+
+  SsdDetections detections;
+  detections.count = static_cast<int>(interpreter->typed_tensor<float>(6)[0]);
+  const float* boxes = interpreter->typed_tensor<float>(3);
+  detections.boxes.assign(boxes, boxes + 4 * detections.count);
+  const float* ids = interpreter->typed_tensor<float>(4);
+  detections.ids.assign(ids, ids + detections.count);
+  const float* scores = interpreter->typed_tensor<float>(5);
+  detections.scores.assign(scores, scores + detections.count);
+  return detections;
+}
+
+// Leaves out the detections of `detections` scoring less than `min_score`.
+SsdDetections keep_above(const SsdDetections& detections, float min_score) {
+  SsdDetections kept;
+  for (int i = 0; i < detections.count; ++i) {
+    if (detections.scores[i] < min_score) continue;
+    kept.boxes.insert(
+        kept.boxes.end(), detections.boxes.begin() + 4 * i, detections.boxes.begin() + 4 * i + 4);
+    kept.ids.push_back(detections.ids[i]);
+    kept.scores.push_back(detections.scores[i]);
+    ++kept.count;
+  }
+  return kept;
+}
+
+void expect_same_detections(const SsdDetections& actual, const SsdDetections& expected) {
+  ASSERT_EQ(actual.count, expected.count);
+  for (int i = 0; i < expected.count; ++i) {
+    EXPECT_EQ(actual.ids[i], expected.ids[i]) << "detection " << i;
+    EXPECT_FLOAT_EQ(actual.scores[i], expected.scores[i]) << "detection " << i;
+    for (int j = 0; j < 4; ++j) {
+      EXPECT_NEAR(actual.boxes[4 * i + j], expected.boxes[4 * i + j], 1e-5f)
+          << "detection " << i << " coordinate " << j;
+    }
+  }
+}
+
+struct DecoderCase {
+  int anchors;
+  int num_classes;
+  bool quantized;
+};
+
+class SsdDecoderTest : public ::testing::TestWithParam<DecoderCase> {};
+
+TEST_P(SsdDecoderTest, MatchesPostprocessOp) {
+  const DecoderCase& param = GetParam();
+  std::mt19937 rng(param.anchors * 100 + param.num_classes);
+  SsdDecoderOptions options;
+  options.score_threshold = 0.3f;
+  options.iou_threshold = 0.5f;
+  options.max_detections = 20;
+  const int stride = options.label_offset + param.num_classes;
+  int detected = 0;
+  for (int run = 0; run < 20; ++run) {
+    const auto anchors = random_anchors(param.anchors, &rng);
+    const RawOutputs outputs = param.quantized
+                                   ? random_quantized_outputs(param.anchors, stride, &rng)
+                                   : random_float_outputs(param.anchors, stride, &rng);
+    const SsdDetections expected = run_postprocess_op(anchors, param.num_classes, options, outputs);
+    SsdDecoder decoder(anchors, param.num_classes, options);
+    SsdDetections actual;
+    decoder.decode(outputs.boxes, outputs.scores, /*min_score=*/0.0f, &actual);
+    expect_same_detections(actual, expected);
+    detected += expected.count;
+
+    // A higher score is the same as filtering the detections afterwards.
+    decoder.decode(outputs.boxes, outputs.scores, /*min_score=*/0.8f, &actual);
+    expect_same_detections(actual, keep_above(expected, 0.8f));
+  }
+  EXPECT_GT(detected, 0);
+}
+
+// Class counts below, at and past the SIMD widths of the score max.
+INSTANTIATE_TEST_SUITE_P(
+    RandomOutputs, SsdDecoderTest,
+    ::testing::Values(
+        DecoderCase{500, 3, false}, DecoderCase{500, 4, false}, DecoderCase{500, 90, false},
+        DecoderCase{200, 3, true}, DecoderCase{200, 16, true}, DecoderCase{200, 90, true}));
+
+// The op and the decoder over the model `make models` downloads, when it is
+// there: make test points MODELS_DIR at it.
+TEST(SsdDecoderModelTest, MatchesPostprocessOpOnModel) {
+  const char* models_dir = std::getenv("MODELS_DIR");
+  const std::string model_path =
+      std::string(models_dir ? models_dir : "models") +
+      "/ssdlite_mobiledet_coco_qat_postprocess.tflite";
+  const std::string label_path =
+      std::string(models_dir ? models_dir : "models") + "/coco_labels.txt";
+  if (!std::ifstream(model_path).good()) GTEST_SKIP() << "Missing model " << model_path;
+
+  BackendOptions options;
+  options.type = BackendType::kCpu;
+  InferenceWrapper builtin(model_path, label_path, options);
+  options.skip_detection_postprocess = true;
+  InferenceWrapper cpp(model_path, label_path, options);
+  cpp.use_ssd_decoder(/*anchors_path=*/"", /*class_thresholds=*/{});
+
+  ClassFilter want_ids;
+  for (int id = 0; id < kMaxClassId; ++id) want_ids.add(id);
+  std::mt19937 rng(1);
+  const int size = builtin.get_input_size();
+  std::vector<uint8_t> image(size * size * 3);
+  std::vector<DetectionResult> expected, actual;
+  // Equal scores may come out in either order.
+  const auto by_score = [](const DetectionResult& a, const DetectionResult& b) {
+    return std::tie(b.score, a.id, a.y1, a.x1) < std::tie(a.score, b.id, b.y1, b.x1);
+  };
+  for (int run = 0; run < 10; ++run) {
+    // Noise, and smooth gradients the detector finds more in.
+    for (size_t i = 0; i < image.size(); ++i) {
+      image[i] = run % 2 ? rng() % 256 : (i / 3 % size + i / 3 / size * run) % 256;
+    }
+    builtin.get_detection_results(image.data(), image.size(), 0.0f, want_ids, &expected);
+    cpp.get_detection_results(image.data(), image.size(), 0.0f, want_ids, &actual);
+    std::sort(expected.begin(), expected.end(), by_score);
+    std::sort(actual.begin(), actual.end(), by_score);
+    ASSERT_EQ(actual.size(), expected.size()) << "image " << run;
+    for (size_t i = 0; i < expected.size(); ++i) {
+      EXPECT_EQ(actual[i].id, expected[i].id) << "image " << run << " detection " << i;
+      EXPECT_FLOAT_EQ(actual[i].score, expected[i].score);
+      EXPECT_NEAR(actual[i].x1, expected[i].x1, 1e-5f);
+      EXPECT_NEAR(actual[i].y1, expected[i].y1, 1e-5f);
+      EXPECT_NEAR(actual[i].x2, expected[i].x2, 1e-5f);
+      EXPECT_NEAR(actual[i].y2, expected[i].y2, 1e-5f);
+    }
+  }
+}
+
+}  // namespace
+}  // namespace coral
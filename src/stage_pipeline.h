@@ -0,0 +1,200 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MANUFACTURING_DEMO_STAGE_PIPELINE_H_
+#define MANUFACTURING_DEMO_STAGE_PIPELINE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/strings/str_format.h"
+#include "frame_ring.h"
+#include "glog/logging.h"
+
+namespace coral {
+
+// Runs a fixed sequence of stages over jobs, each stage on a thread of its
+// own, so consecutive jobs overlap: while stage 2 works on job N, stage 1
+// already works on job N+1. Steady state throughput is then bounded by the
+// slowest stage rather than by the sum of all of them.
+//
+// A pool of `depth` jobs is allocated up front and recycled, acquire() blocks
+// while all of them are in flight, which bounds latency and memory and pushes
+// back on the producer. Stages are joined by bounded rings that preserve the
+// submission order.
+template <typename Job>
+class StagePipeline {
+public:
+  // Processes the job numbered `seq`.
+  using Stage = std::function<void(uint64_t seq, Job* job)>;
+
+  // Logs an occupancy report every `report_interval_seconds`, 0 disables it,
+  // prefixed with `name` if set.
+  StagePipeline(int depth, int report_interval_seconds, const std::string& name = "")
+      : free_(depth),
+        name_(name),
+        report_interval_(std::chrono::seconds(report_interval_seconds)) {
+    CHECK_GT(depth, 0);
+    for (int i = 0; i < depth; ++i) {
+      jobs_.emplace_back(new Job);
+      CHECK(free_.try_push(jobs_.back().get()));
+    }
+  }
+  ~StagePipeline() { stop(); }
+  StagePipeline(const StagePipeline&) = delete;
+  StagePipeline& operator=(const StagePipeline&) = delete;
+
+  // Appends a stage, only before start().
+  void add_stage(const std::string& name, Stage stage) {
+    CHECK(!started_);
+    stages_.emplace_back(new StageState);
+    stages_.back()->name = name;
+    stages_.back()->stage = std::move(stage);
+    stages_.back()->input.reset(new FrameRing<Item>(jobs_.size()));
+  }
+
+  // Starts one thread per stage.
+  void start() {
+    CHECK(!stages_.empty());
+    CHECK(!started_);
+    started_ = true;
+    window_start_ = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < stages_.size(); ++i) {
+      stages_[i]->thread = std::thread(&StagePipeline::run_stage, this, i);
+    }
+  }
+
+  // Returns a free job, blocking while every job is in flight. Returns
+  // nullptr once stopped.
+  Job* acquire() {
+    Job* job;
+    return free_.pop(&job) ? job : nullptr;
+  }
+
+  // Queues an acquired job for the first stage.
+  void submit(Job* job) {
+    if (!stages_.front()->input->push({next_seq_++, job})) release(job);
+  }
+
+  // Finishes the queued jobs, stops every stage and logs a last report.
+  void stop() {
+    if (!started_ || stopped_) return;
+    stopped_ = true;
+    // Closing each ring only after its producer stage exited lets queued jobs
+    // drain through the remaining stages.
+    for (auto& state : stages_) {
+      state->input->close();
+      state->thread.join();
+    }
+    free_.close();
+    log_report();
+  }
+
+  // Fraction of the time since the last report each stage spent working,
+  // and the throughput of the last stage. Resets the window.
+  std::string occupancy_report() {
+    const auto now = std::chrono::steady_clock::now();
+    const double window = std::chrono::duration<double>(now - window_start_).count();
+    window_start_ = now;
+    std::string report;
+    double max_occupancy = -1;
+    const std::string* bottleneck = nullptr;
+    for (auto& state : stages_) {
+      const int64_t busy_ns = state->busy_ns.load();
+      const double occupancy =
+          window > 0 ? (busy_ns - state->reported_busy_ns) * 1e-9 / window : 0;
+      state->reported_busy_ns = busy_ns;
+      absl::StrAppendFormat(&report, "%s %.0f%%, ", state->name, occupancy * 100);
+      if (occupancy > max_occupancy) {
+        max_occupancy = occupancy;
+        bottleneck = &state->name;
+      }
+    }
+    const uint64_t done = stages_.back()->processed.load();
+    absl::StrAppendFormat(
+        &report, "%.1f jobs/s, bottleneck %s", window > 0 ? (done - reported_done_) / window : 0,
+        *bottleneck);
+    reported_done_ = done;
+    return report;
+  }
+
+private:
+  struct Item {
+    uint64_t seq;
+    Job* job;
+  };
+  struct StageState {
+    std::string name;
+    Stage stage;
+    std::unique_ptr<FrameRing<Item>> input;
+    std::thread thread;
+    std::atomic<int64_t> busy_ns{0};
+    std::atomic<uint64_t> processed{0};
+    // Only touched by the thread building reports.
+    int64_t reported_busy_ns = 0;
+  };
+
+  void run_stage(size_t index) {
+    StageState& state = *stages_[index];
+    const bool last = index + 1 == stages_.size();
+    Item item;
+    while (state.input->pop(&item)) {
+      const auto start = std::chrono::steady_clock::now();
+      state.stage(item.seq, item.job);
+      const auto end = std::chrono::steady_clock::now();
+      state.busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+      state.processed++;
+      if (!last) {
+        if (!stages_[index + 1]->input->push(item)) release(item.job);
+        continue;
+      }
+      release(item.job);
+      if (report_interval_.count() > 0 && end - window_start_ >= report_interval_) {
+        log_report();
+      }
+    }
+  }
+
+  void release(Job* job) { CHECK(free_.try_push(job)); }
+
+  void log_report() {
+    LOG(INFO) << name_ << (name_.empty() ? "" : ": ") << "Stage occupancy: "
+              << occupancy_report();
+  }
+
+  std::vector<std::unique_ptr<Job>> jobs_;
+  FrameRing<Job*> free_;
+  std::vector<std::unique_ptr<StageState>> stages_;
+  // Only touched by the producer.
+  uint64_t next_seq_ = 0;
+  bool started_ = false;
+  bool stopped_ = false;
+  const std::string name_;
+  const std::chrono::seconds report_interval_;
+  // Owned by the last stage thread while running, by stop() afterwards.
+  std::chrono::steady_clock::time_point window_start_;
+  uint64_t reported_done_ = 0;
+};
+
+}  // namespace coral
+
+#endif  // MANUFACTURING_DEMO_STAGE_PIPELINE_H_
@@ -0,0 +1,100 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "stream_config.h"
+
+#include <fstream>
+#include <set>
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+#include "glog/logging.h"
+
+namespace coral {
+
+namespace {
+
+// Names end up in GStreamer element names and metric labels.
+bool is_valid_name(const std::string& name) {
+  if (name.empty()) return false;
+  for (char c : name) {
+    if (!absl::ascii_isalnum(c) && c != '_') return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+bool parse_stream_task(const std::string& name, StreamTask* task) {
+  if (name == "safety") {
+    *task = StreamTask::kWorkerSafety;
+  } else if (name == "inspection") {
+    *task = StreamTask::kVisualInspection;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+const char* stream_task_name(StreamTask task) {
+  switch (task) {
+    case StreamTask::kWorkerSafety:
+      return "safety";
+    case StreamTask::kVisualInspection:
+      return "inspection";
+  }
+  return "unknown";
+}
+
+bool parse_stream_configs(const std::string& file_path, std::vector<StreamConfig>* configs) {
+  std::ifstream f{file_path};
+  if (!f.is_open()) {
+    LOG(ERROR) << "Unable to open stream config " << file_path;
+    return false;
+  }
+  configs->clear();
+  std::set<std::string> names;
+  std::string header;
+  std::getline(f, header);
+  for (std::string line; std::getline(f, line);) {
+    std::vector<std::string> fields = absl::StrSplit(line, ',');
+    for (auto& field : fields) absl::StripAsciiWhitespace(&field);
+    if (fields.size() == 1 && fields[0].empty()) continue;
+    StreamConfig config;
+    if (fields.size() < 4 || fields.size() > 5 || !is_valid_name(fields[0]) ||
+        !parse_stream_task(fields[1], &config.task) || fields[2].empty() ||
+        !absl::SimpleAtof(fields[3], &config.threshold)) {
+      LOG(ERROR) << "Malformed stream row in " << file_path << ": " << line;
+      return false;
+    }
+    config.name = fields[0];
+    config.input = fields[2];
+    if (fields.size() == 5) config.keepout_path = fields[4];
+    if (!names.insert(config.name).second) {
+      LOG(ERROR) << "Stream " << config.name << " is listed twice in " << file_path;
+      return false;
+    }
+    configs->push_back(std::move(config));
+  }
+  return true;
+}
+
+int get_grid_columns(int num_streams) {
+  int columns = 1;
+  while (columns * columns < num_streams) ++columns;
+  return columns;
+}
+
+}  // namespace coral
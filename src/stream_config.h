@@ -0,0 +1,63 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MANUFACTURING_DEMO_STREAM_CONFIG_H_
+#define MANUFACTURING_DEMO_STREAM_CONFIG_H_
+
+#include <string>
+#include <vector>
+
+namespace coral {
+
+// What a stream does with its frames.
+enum class StreamTask {
+  // Detects people and checks them against keepout zones.
+  kWorkerSafety,
+  // Detects apples and classifies them as fresh or rotten.
+  kVisualInspection,
+};
+
+// Parses "safety" or "inspection" into `task`. Returns false on an unknown name.
+bool parse_stream_task(const std::string& name, StreamTask* task);
+const char* stream_task_name(StreamTask task);
+
+// One camera or video and how its frames are processed.
+struct StreamConfig {
+  // Names the appsink, metrics and frame dump of the stream. Letters, digits
+  // and underscores only, unique among the streams.
+  std::string name;
+  StreamTask task;
+  // Video file or /dev/video device.
+  std::string input;
+  // Minimum score of a result shown.
+  float threshold;
+  // CSV file of the keepout zones of a worker safety stream, empty for none.
+  std::string keepout_path;
+};
+
+// Parses streams from a CSV file with a "name,task,input,threshold,keepout"
+// header, one row per stream in display order. The keepout column may be
+// left empty or out. Returns false on a missing file, a malformed row or a
+// repeated name.
+bool parse_stream_configs(const std::string& file_path, std::vector<StreamConfig>* configs);
+
+// Columns of the most square grid fitting `num_streams` tiles, never fewer
+// columns than rows.
+int get_grid_columns(int num_streams);
+
+}  // namespace coral
+
+#endif  // MANUFACTURING_DEMO_STREAM_CONFIG_H_
@@ -14,53 +14,176 @@
  * limitations under the License.
  */
 
+#ifndef MANUFACTURING_DEMO_SVG_GENERATOR_H_
+#define MANUFACTURING_DEMO_SVG_GENERATOR_H_
+
 #include <glib.h>
+#include <gst/gst.h>
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
 
-#include "absl/strings/substitute.h"
+#include "absl/strings/str_cat.h"
 #include "absl/synchronization/mutex.h"
+#include "glog/logging.h"
+#include "overlay.h"
 
 namespace coral {
 
-constexpr char* kSvgHeader = "<svg>";
-constexpr char* kSvgFooter = "</svg>";
-constexpr char* kSvgBox =
-    "<rect x=\"$0\" y=\"$1\" width=\"$2\" height=\"$3\" "
-    "fill-opacity=\"$4\" "
-    "style=\"stroke-width:5;stroke:rgb($5,$6,$7);\"/>";
-constexpr char* kSvgText = "<text x=\"$0\" y=\"$1\" font-size=\"large\" fill=\"$2\">$3</text>";
+constexpr char kSvgHeader[] = "<svg>";
+constexpr char kSvgFooter[] = "</svg>";
+// Bytes reserved for the markup of a stream, enough for a few dozen boxes.
+constexpr size_t kSvgReserveBytes = 8192;
 
-class SvgGenerator {
+// Draws the scenes of every stream as one SVG document, rendered by the
+// rsvgoverlay element after the streams are mixed. Every update makes librsvg
+// parse the whole document again, so scenes identical to what is shown are
+// dropped and updates are throttled to the display rate. A change held back
+// is sent by the next call after its deadline, or by a timer on the default
+// main context if none comes, so the generator must be destroyed while that
+// context isn't being iterated.
+class SvgGenerator : public Overlay {
 public:
-  SvgGenerator(GstElement* svg) : rsvg_(svg){};
-  virtual ~SvgGenerator() = default;
+  SvgGenerator(GstElement* svg, const OverlayOptions& options)
+      : rsvg_(svg),
+        options_(options),
+        scenes_(options.num_streams),
+        min_update_interval_(
+            options.max_updates_per_second > 0
+                ? std::chrono::steady_clock::duration(std::chrono::seconds(1)) /
+                      options.max_updates_per_second
+                : std::chrono::steady_clock::duration::zero()),
+        report_interval_(std::chrono::seconds(options.report_interval_seconds)) {
+    absl::MutexLock l(&lock_);
+    backgrounds_.resize(options.num_streams);
+    size_t background_bytes = 0;
+    for (size_t i = 0; i < options.backgrounds.size() && i < backgrounds_.size(); ++i) {
+      int x, y;
+      get_stream_origin(options_, i, &x, &y);
+      append_svg(options.backgrounds[i], x, y, &backgrounds_[i]);
+      background_bytes += backgrounds_[i].size();
+    }
+    document_.reserve(background_bytes + scenes_.size() * kSvgReserveBytes);
+  }
+  ~SvgGenerator() override {
+    absl::MutexLock l(&lock_);
+    if (flush_source_ != 0) g_source_remove(flush_source_);
+    LOG(INFO) << "Overlay: " << updates_ << " updates for " << submitted_
+              << " scenes submitted";
+  }
   SvgGenerator(const SvgGenerator&) = delete;
   SvgGenerator& operator=(const SvgGenerator&) = delete;
 
-  void set_worker_safety_svg(const std::string svg) LOCKS_EXCLUDED(lock_) {
+  void set_scene(int stream, const OverlayScene& scene) LOCKS_EXCLUDED(lock_) override {
     absl::MutexLock l(&lock_);
-    worker_safety_svg_ = svg;
-    update_svg();
+    submitted_++;
+    if (scene != scenes_[stream]) {
+      // Assigning keeps the buffers of the previous scene.
+      scenes_[stream] = scene;
+      dirty_ = true;
+    }
+    maybe_update();
   }
-  void set_visual_inspection_svg(const std::string svg) LOCKS_EXCLUDED(lock_) {
+
+  void set_background(int stream, const std::vector<OverlayPolygon>& polygons)
+      LOCKS_EXCLUDED(lock_) override {
+    int x, y;
+    get_stream_origin(options_, stream, &x, &y);
+    std::string background;
+    append_svg(polygons, x, y, &background);
     absl::MutexLock l(&lock_);
-    visual_inspection_svg_ = svg;
-    update_svg();
+    if (background == backgrounds_[stream]) return;
+    backgrounds_[stream].swap(background);
+    dirty_ = true;
+    maybe_update();
   }
 
 private:
+  // Sends the document if it changed and the last update is old enough,
+  // otherwise makes sure a timer sends it once it is.
+  void maybe_update() EXCLUSIVE_LOCKS_REQUIRED(lock_) {
+    const auto now = std::chrono::steady_clock::now();
+    if (dirty_) {
+      const auto deadline = last_update_ + min_update_interval_;
+      if (now >= deadline) {
+        update_svg();
+        last_update_ = now;
+        dirty_ = false;
+      } else if (flush_source_ == 0) {
+        // Rounded up, a timer firing early would only schedule another.
+        const auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now) +
+                           std::chrono::milliseconds(1);
+        flush_source_ = g_timeout_add(delay.count(), on_flush_timer, this);
+      }
+    }
+    if (report_interval_.count() > 0 && now - window_start_ >= report_interval_) {
+      log_report(now);
+    }
+  }
+
+  // Sends a change held back while no scene arrived to send it.
+  static gboolean on_flush_timer(gpointer data) {
+    auto generator = reinterpret_cast<SvgGenerator*>(data);
+    absl::MutexLock l(&generator->lock_);
+    generator->flush_source_ = 0;
+    generator->maybe_update();
+    return G_SOURCE_REMOVE;
+  }
+
   void update_svg() EXCLUSIVE_LOCKS_REQUIRED(lock_) {
-    g_object_set(
-        G_OBJECT(rsvg_), "data",
-        absl::StrCat(kSvgHeader, worker_safety_svg_, visual_inspection_svg_, kSvgFooter).c_str(),
-        NULL);
+    document_.clear();
+    document_.append(kSvgHeader);
+    for (const auto& background : backgrounds_) document_.append(background);
+    for (size_t i = 0; i < scenes_.size(); ++i) {
+      int x, y;
+      get_stream_origin(options_, i, &x, &y);
+      append_svg(scenes_[i], x, y, &document_);
+    }
+    document_.append(kSvgFooter);
+    g_object_set(G_OBJECT(rsvg_), "data", document_.c_str(), NULL);
+    updates_++;
+  }
+
+  void log_report(std::chrono::steady_clock::time_point now) EXCLUSIVE_LOCKS_REQUIRED(lock_) {
+    const double window = std::chrono::duration<double>(now - window_start_).count();
+    const uint64_t submitted = submitted_ - reported_submitted_;
+    const uint64_t updates = updates_ - reported_updates_;
+    LOG(INFO) << "Overlay: " << updates / window << " reparses/s for " << submitted / window
+              << " scenes/s, "
+              << (submitted > 0 ? 100.0 * (submitted - updates) / submitted : 0.0)
+              << "% saved";
+    window_start_ = now;
+    reported_submitted_ = submitted_;
+    reported_updates_ = updates_;
   }
 
-  std::string worker_safety_svg_ GUARDED_BY(lock_) = "";
-  std::string visual_inspection_svg_ GUARDED_BY(lock_) = "";
   GstElement* rsvg_ GUARDED_BY(lock_);
+  // Only the layout of the streams is read past construction.
+  const OverlayOptions options_;
+  // Markup of the background of each stream, rendered when it is set.
+  std::vector<std::string> backgrounds_ GUARDED_BY(lock_);
+  std::vector<OverlayScene> scenes_ GUARDED_BY(lock_);
+  const std::chrono::steady_clock::duration min_update_interval_;
+  const std::chrono::seconds report_interval_;
+  // The whole overlay, rebuilt in place for each update.
+  std::string document_ GUARDED_BY(lock_);
+  bool dirty_ GUARDED_BY(lock_) = false;
+  // Timer sending a held back change, 0 when none is pending.
+  guint flush_source_ GUARDED_BY(lock_) = 0;
+  std::chrono::steady_clock::time_point last_update_ GUARDED_BY(lock_);
+  std::chrono::steady_clock::time_point window_start_ GUARDED_BY(lock_) =
+      std::chrono::steady_clock::now();
+  uint64_t submitted_ GUARDED_BY(lock_) = 0;
+  uint64_t updates_ GUARDED_BY(lock_) = 0;
+  uint64_t reported_submitted_ GUARDED_BY(lock_) = 0;
+  uint64_t reported_updates_ GUARDED_BY(lock_) = 0;
   // A mutex is needed to ensure the competing threads don't update the strings
   // before the SVG has been set in the overlay.
   absl::Mutex lock_;
 };
 
 }  // namespace coral
+
+#endif  // MANUFACTURING_DEMO_SVG_GENERATOR_H_
@@ -0,0 +1,146 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "svg_generator.h"
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+// Documents set on every FakeRsvg, in order.
+std::vector<std::string> documents;
+
+// Stands in for rsvgoverlay, only records the documents it is given.
+struct FakeRsvg {
+  GstElement parent;
+};
+
+struct FakeRsvgClass {
+  GstElementClass parent_class;
+};
+
+G_DEFINE_TYPE(FakeRsvg, fake_rsvg, GST_TYPE_ELEMENT)
+
+void fake_rsvg_set_property(GObject*, guint, const GValue* value, GParamSpec*) {
+  documents.emplace_back(g_value_get_string(value));
+}
+
+void fake_rsvg_class_init(FakeRsvgClass* klass) {
+  GObjectClass* object_class = G_OBJECT_CLASS(klass);
+  object_class->set_property = fake_rsvg_set_property;
+  g_object_class_install_property(
+      object_class, 1,
+      g_param_spec_string("data", "Data", "SVG document", nullptr, G_PARAM_WRITABLE));
+}
+
+void fake_rsvg_init(FakeRsvg*) {}
+
+}  // namespace
+
+namespace coral {
+namespace {
+
+constexpr int kUpdatesPerSecond = 10;
+constexpr auto kUpdateInterval = std::chrono::milliseconds(1000 / kUpdatesPerSecond);
+
+class SvgGeneratorTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    gst_init(nullptr, nullptr);
+    documents.clear();
+    rsvg_ = GST_ELEMENT(g_object_new(fake_rsvg_get_type(), nullptr));
+    OverlayOptions options;
+    options.num_streams = 1;
+    options.width = 640;
+    options.height = 480;
+    options.max_updates_per_second = kUpdatesPerSecond;
+    options.report_interval_seconds = 0;
+    generator_.reset(new SvgGenerator(rsvg_, options));
+    first_.add_box(10, 10, 20, 20, kOverlayGreen, false);
+    second_.add_box(30, 30, 20, 20, kOverlayRed, false);
+  }
+
+  void TearDown() override {
+    generator_.reset();
+    gst_object_unref(rsvg_);
+  }
+
+  // Runs the sources of the default main context for `duration`.
+  static void iterate_for(std::chrono::steady_clock::duration duration) {
+    const auto end = std::chrono::steady_clock::now() + duration;
+    while (std::chrono::steady_clock::now() < end) {
+      while (g_main_context_iteration(nullptr, FALSE)) {
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  GstElement* rsvg_;
+  std::unique_ptr<SvgGenerator> generator_;
+  OverlayScene first_, second_;
+};
+
+TEST_F(SvgGeneratorTest, HeldBackSceneIsSentOnceUpdatesStop) {
+  generator_->set_scene(0, first_);
+  const auto sent = std::chrono::steady_clock::now();
+  ASSERT_EQ(documents.size(), 1u);
+  generator_->set_scene(0, second_);
+  EXPECT_EQ(documents.size(), 1u);
+
+  // Nothing else is submitted, the timer sends it after the interval.
+  while (documents.size() < 2 && std::chrono::steady_clock::now() - sent < 10 * kUpdateInterval) {
+    iterate_for(std::chrono::milliseconds(1));
+  }
+  ASSERT_EQ(documents.size(), 2u);
+  EXPECT_GE(std::chrono::steady_clock::now() - sent, kUpdateInterval - kUpdateInterval / 10);
+  EXPECT_NE(documents[1], documents[0]);
+}
+
+TEST_F(SvgGeneratorTest, HeldBackSceneIsSentByTheNextCallAfterTheInterval) {
+  generator_->set_scene(0, first_);
+  generator_->set_scene(0, second_);
+  ASSERT_EQ(documents.size(), 1u);
+  std::this_thread::sleep_for(2 * kUpdateInterval);
+  // An unchanged scene still sends the change held back.
+  generator_->set_scene(0, second_);
+  ASSERT_EQ(documents.size(), 2u);
+
+  // The timer then has nothing left to send.
+  iterate_for(2 * kUpdateInterval);
+  EXPECT_EQ(documents.size(), 2u);
+}
+
+TEST_F(SvgGeneratorTest, UnchangedScenesAreNotSent) {
+  generator_->set_scene(0, first_);
+  generator_->set_scene(0, first_);
+  iterate_for(2 * kUpdateInterval);
+  EXPECT_EQ(documents.size(), 1u);
+}
+
+TEST_F(SvgGeneratorTest, DestroyingCancelsTheTimer) {
+  generator_->set_scene(0, first_);
+  generator_->set_scene(0, second_);
+  generator_.reset();
+  iterate_for(2 * kUpdateInterval);
+  EXPECT_EQ(documents.size(), 1u);
+}
+
+}  // namespace
+}  // namespace coral